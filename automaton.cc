@@ -0,0 +1,576 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "automaton.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+
+// Builds the automaton for a regular expression by Thompson's
+// construction: each part of the expression becomes a fragment, a
+// start state and a list of dangling transitions, and fragments are
+// joined by patching the dangling transitions of one to the start of
+// the next.
+class RegexpCompiler {
+ public:
+  RegexpCompiler(const string& regexp, RegexpAutomaton* automaton)
+      : automaton_(automaton),
+        p_(regexp.data()),
+        end_(regexp.data() + regexp.size()),
+        ok_(true) {}
+
+  bool Compile() {
+    // Anchors at the very ends are recorded rather than compiled:
+    // full matches are anchored anyway.
+    if (p_ < end_ && *p_ == '^') {
+      ++p_;
+      automaton_->anchored_start_ = true;
+    }
+    if (p_ < end_ && end_[-1] == '$' && !IsEscaped(end_ - 1)) {
+      --end_;
+      automaton_->anchored_end_ = true;
+    }
+
+    Fragment fragment = ParseAlternation();
+    if (!ok_ || p_ != end_)
+      return false;
+    int accept = NewState(RegexpAutomaton::ACCEPT);
+    Patch(fragment, accept);
+    automaton_->start_ = fragment.start;
+    return ok_;
+  }
+
+ private:
+  typedef RegexpAutomaton::State State;
+
+  // Automata larger than this are not worth simulating; the
+  // expression is probably a large repetition count.
+  static const int kMaxStates = 1000;
+
+  // A dangling transition: the out (0) or out1 (1) of a state.
+  typedef pair<int, int> Dangling;
+
+  struct Fragment {
+    int start;
+    vector<Dangling> outs;
+  };
+
+  State& state(int i) {
+    return automaton_->states_[i];
+  }
+
+  int NewState(RegexpAutomaton::StateType type) {
+    if (automaton_->states_.size() >= kMaxStates) {
+      ok_ = false;
+      return 0;
+    }
+    State state;
+    state.type = type;
+    state.out = -1;
+    state.out1 = -1;
+    memset(state.chars, 0, sizeof(state.chars));
+    automaton_->states_.push_back(state);
+    return automaton_->states_.size() - 1;
+  }
+
+  // Points the dangling transitions of FRAGMENT to TARGET.
+  void Patch(const Fragment& fragment, int target) {
+    if (!ok_)
+      return;
+    for (vector<Dangling>::const_iterator i = fragment.outs.begin();
+         i != fragment.outs.end(); ++i) {
+      if (i->second == 0)
+        state(i->first).out = target;
+      else
+        state(i->first).out1 = target;
+    }
+  }
+
+  // Returns a fragment matching the empty string.
+  Fragment Empty() {
+    Fragment fragment;
+    fragment.start = NewState(RegexpAutomaton::EMPTY);
+    fragment.outs.push_back(Dangling(fragment.start, 0));
+    return fragment;
+  }
+
+  Fragment Concatenate(const Fragment& a, const Fragment& b) {
+    Patch(a, b.start);
+    Fragment fragment;
+    fragment.start = a.start;
+    fragment.outs = b.outs;
+    return fragment;
+  }
+
+  // Returns a SPLIT state to FRAGMENT and a dangling transition.
+  int Split(const Fragment& fragment) {
+    int split = NewState(RegexpAutomaton::SPLIT);
+    if (ok_)
+      state(split).out = fragment.start;
+    return split;
+  }
+
+  Fragment Star(const Fragment& a) {
+    Fragment fragment;
+    fragment.start = Split(a);
+    Patch(a, fragment.start);
+    fragment.outs.push_back(Dangling(fragment.start, 1));
+    return fragment;
+  }
+
+  Fragment Plus(const Fragment& a) {
+    int split = Split(a);
+    Patch(a, split);
+    Fragment fragment;
+    fragment.start = a.start;
+    fragment.outs.push_back(Dangling(split, 1));
+    return fragment;
+  }
+
+  Fragment Quest(const Fragment& a) {
+    Fragment fragment;
+    fragment.start = Split(a);
+    fragment.outs = a.outs;
+    fragment.outs.push_back(Dangling(fragment.start, 1));
+    return fragment;
+  }
+
+  // alternation: concatenation ('|' concatenation)*
+  Fragment ParseAlternation() {
+    Fragment fragment = ParseConcatenation();
+    while (ok_ && p_ < end_ && *p_ == '|') {
+      ++p_;
+      Fragment other = ParseConcatenation();
+      int split = Split(fragment);
+      if (!ok_)
+        break;
+      state(split).out1 = other.start;
+      fragment.start = split;
+      fragment.outs.insert(fragment.outs.end(),
+                           other.outs.begin(), other.outs.end());
+    }
+    return fragment;
+  }
+
+  // concatenation: piece*
+  Fragment ParseConcatenation() {
+    Fragment fragment = Empty();
+    while (ok_ && p_ < end_ && *p_ != '|' && *p_ != ')')
+      fragment = Concatenate(fragment, ParsePiece());
+    return fragment;
+  }
+
+  // piece: atom ('*' | '+' | '?' | '{' m [',' [n]] '}')*
+  Fragment ParsePiece() {
+    const char* atom = p_;
+    Fragment fragment = ParseAtom();
+    const char* atom_end = p_;
+    while (ok_ && p_ < end_) {
+      if (*p_ == '*') {
+        fragment = Star(fragment);
+      } else if (*p_ == '+') {
+        fragment = Plus(fragment);
+      } else if (*p_ == '?') {
+        fragment = Quest(fragment);
+      } else if (*p_ == '{' && p_ == atom_end) {
+        ++p_;
+        int min = ParseNumber();
+        int max = min;
+        if (ok_ && p_ < end_ && *p_ == ',') {
+          ++p_;
+          max = (p_ < end_ && isdigit(static_cast<unsigned char>(*p_)))
+              ? ParseNumber() : -1;
+        }
+        if (!ok_ || p_ == end_ || *p_ != '}' || (max != -1 && max < min)) {
+          ok_ = false;
+          break;
+        }
+        const char* after = p_;
+        fragment = Repeat(fragment, atom, min, max);
+        p_ = after;
+      } else {
+        break;
+      }
+      ++p_;
+    }
+    return fragment;
+  }
+
+  // Returns a fragment matching between MIN and MAX (or, if MAX is -1,
+  // any number above MIN) copies of ATOM, whose first copy is FIRST.
+  // Further copies are made by parsing the atom again.
+  Fragment Repeat(const Fragment& first, const char* atom, int min, int max) {
+    Fragment fragment = Empty();
+    int copies = max == -1 ? min + 1 : max;
+    for (int i = 0; i < copies && ok_; ++i) {
+      Fragment copy = first;
+      if (i > 0) {
+        p_ = atom;
+        copy = ParseAtom();
+      }
+      if (i < min)
+        fragment = Concatenate(fragment, copy);
+      else if (max == -1)
+        fragment = Concatenate(fragment, Star(copy));
+      else
+        fragment = Concatenate(fragment, Quest(copy));
+    }
+    return fragment;
+  }
+
+  Fragment ParseAtom() {
+    Fragment fragment;
+    char c = *p_++;
+    bool escaped = false;
+    switch (c) {
+      case '(':
+        fragment = ParseAlternation();
+        if (!ok_ || p_ == end_ || *p_ != ')') {
+          ok_ = false;
+          return fragment;
+        }
+        ++p_;
+        return fragment;
+      case '\\':
+        // An escaped letter or digit is a GNU extension such as \w, or
+        // a back-reference, and so are the word anchors \< \> \` \'.
+        if (p_ == end_ || isalnum(static_cast<unsigned char>(*p_)) ||
+            strchr("<>`'", *p_) != NULL) {
+          ok_ = false;
+          return fragment;
+        }
+        c = *p_++;
+        escaped = true;
+        break;
+      case '^':
+      case '$':
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        ok_ = false;
+        return fragment;
+      default:
+        break;
+    }
+
+    fragment.start = NewState(RegexpAutomaton::CHARS);
+    fragment.outs.push_back(Dangling(fragment.start, 0));
+    if (!ok_)
+      return fragment;
+    uint32* chars = state(fragment.start).chars;
+    if (c == '[' && !escaped) {
+      ParseBracketExpression(chars);
+    } else if (c == '.' && !escaped) {
+      for (int i = 1; i < 256; ++i)
+        AddChar(i, chars);
+    } else {
+      AddChar(static_cast<unsigned char>(c), chars);
+    }
+    return fragment;
+  }
+
+  // Reads a bracket expression, whose '[' has been read, into CHARS.
+  void ParseBracketExpression(uint32* chars) {
+    bool negate = false;
+    if (p_ < end_ && *p_ == '^') {
+      negate = true;
+      ++p_;
+    }
+    for (bool first = true; ; first = false) {
+      if (p_ == end_) {
+        ok_ = false;
+        return;
+      }
+      unsigned char c = *p_;
+      if (c == ']' && !first) {
+        ++p_;
+        break;
+      }
+      if (c == '[' && p_ + 1 < end_ && p_[1] == ':') {
+        ParseClass(chars);
+        if (!ok_)
+          return;
+        continue;
+      }
+      if (IsCollatingElement(p_)) {
+        ok_ = false;
+        return;
+      }
+      ++p_;
+      if (p_ + 1 < end_ && *p_ == '-' && p_[1] != ']') {
+        if (IsCollatingElement(p_ + 1)) {
+          ok_ = false;
+          return;
+        }
+        unsigned char last = p_[1];
+        p_ += 2;
+        if (last < c) {
+          ok_ = false;
+          return;
+        }
+        for (int i = c; i <= last; ++i)
+          AddChar(i, chars);
+      } else {
+        AddChar(c, chars);
+      }
+    }
+
+    if (negate) {
+      for (int i = 0; i < 256 / 32; ++i)
+        chars[i] = ~chars[i];
+      chars[0] &= ~1U;
+    }
+  }
+
+  // Reads a [:class:] into CHARS.
+  void ParseClass(uint32* chars) {
+    const char* name = p_ + 2;
+    const char* name_end = name;
+    while (name_end + 1 < end_ && !(name_end[0] == ':' && name_end[1] == ']'))
+      ++name_end;
+    if (name_end + 1 >= end_) {
+      ok_ = false;
+      return;
+    }
+    p_ = name_end + 2;
+
+    static const struct {
+      const char* name;
+      int (*predicate)(int);
+    } kClasses[] = {
+      { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+      { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+      { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+      { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    string class_name(name, name_end - name);
+    for (size_t i = 0; i < sizeof(kClasses) / sizeof(kClasses[0]); ++i) {
+      if (class_name == kClasses[i].name) {
+        for (int c = 1; c < 256; ++c) {
+          if (kClasses[i].predicate(c))
+            AddChar(c, chars);
+        }
+        return;
+      }
+    }
+    ok_ = false;
+  }
+
+  // Returns true if P starts an equivalence class or a collating
+  // symbol, which aren't supported.
+  bool IsCollatingElement(const char* p) const {
+    return p + 1 < end_ && p[0] == '[' && (p[1] == '=' || p[1] == '.');
+  }
+
+  // Reads a repetition count, or clears ok_ if there is none.
+  int ParseNumber() {
+    if (p_ == end_ || !isdigit(static_cast<unsigned char>(*p_))) {
+      ok_ = false;
+      return 0;
+    }
+    int value = 0;
+    while (p_ < end_ && isdigit(static_cast<unsigned char>(*p_))) {
+      value = value * 10 + (*p_++ - '0');
+      if (value > kMaxStates)
+        ok_ = false;
+    }
+    return value;
+  }
+
+  // Returns true if the character at P is escaped by a backslash.
+  bool IsEscaped(const char* p) const {
+    int backslashes = 0;
+    while (p - backslashes > p_ && p[-backslashes - 1] == '\\')
+      ++backslashes;
+    return backslashes % 2 == 1;
+  }
+
+  static void AddChar(int c, uint32* chars) {
+    chars[c / 32] |= 1U << (c % 32);
+  }
+
+  RegexpAutomaton* automaton_;
+  const char* p_;
+  const char* end_;
+  // Cleared when the expression is malformed or unsupported.
+  bool ok_;
+};
+
+RegexpAutomaton* RegexpAutomaton::Compile(const string& regexp) {
+  RegexpAutomaton* automaton = new RegexpAutomaton();
+  RegexpCompiler compiler(regexp, automaton);
+  if (!compiler.Compile()) {
+    delete automaton;
+    return NULL;
+  }
+  return automaton;
+}
+
+void RegexpAutomaton::Start(StateSet* states) const {
+  states->clear();
+  vector<bool> visited(states_.size());
+  AddState(start_, &visited, states);
+  sort(states->begin(), states->end());
+}
+
+void RegexpAutomaton::Step(const StateSet& from, unsigned char c,
+                           StateSet* to) const {
+  to->clear();
+  vector<bool> visited(states_.size());
+  for (StateSet::const_iterator i = from.begin(); i != from.end(); ++i) {
+    const State& state = states_[*i];
+    if (state.type == CHARS && (state.chars[c / 32] & (1U << (c % 32))))
+      AddState(state.out, &visited, to);
+  }
+  sort(to->begin(), to->end());
+}
+
+bool RegexpAutomaton::IsMatch(const StateSet& states) const {
+  for (StateSet::const_iterator i = states.begin(); i != states.end(); ++i) {
+    if (states_[*i].type == ACCEPT)
+      return true;
+  }
+  return false;
+}
+
+bool RegexpAutomaton::FullMatch(const char* str) const {
+  StateSet states, next;
+  Start(&states);
+  for (const char* p = str; *p != '\0' && !states.empty(); ++p) {
+    Step(states, *p, &next);
+    states.swap(next);
+  }
+  return IsMatch(states);
+}
+
+void RegexpAutomaton::AddState(int state, vector<bool>* visited,
+                               StateSet* states) const {
+  if ((*visited)[state])
+    return;
+  (*visited)[state] = true;
+  const State& s = states_[state];
+  switch (s.type) {
+    case CHARS:
+    case ACCEPT:
+      states->push_back(state);
+      break;
+    case SPLIT:
+      AddState(s.out, visited, states);
+      AddState(s.out1, visited, states);
+      break;
+    case EMPTY:
+      AddState(s.out, visited, states);
+      break;
+  }
+}
+
+// ***** RegexpDFA
+
+const int RegexpDFA::kMaxStates;
+const int RegexpDFA::kUnknown;
+
+RegexpDFA::RegexpDFA(const RegexpAutomaton* automaton, bool search)
+    : automaton_(automaton),
+      unanchored_start_(search && !automaton->anchored_start()),
+      unanchored_end_(search && !automaton->anchored_end()) {
+  automaton_->Start(&start_);
+  start_state_ = StateFor(start_);
+
+  for (int c = 0; c < 256; ++c)
+    leaves_start_[c] = true;
+  if (unanchored_start_ && outcomes_[start_state_] == CONTINUE) {
+    // A search stays in the initial state until it reads a character
+    // that may start a match.
+    for (int c = 1; c < 256; ++c)
+      leaves_start_[c] = Next(start_state_, c) != start_state_;
+  }
+}
+
+bool RegexpDFA::Match(const char* str) {
+  int state = start_state_;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(str);
+  while (true) {
+    if (outcomes_[state] != CONTINUE)
+      return outcomes_[state] == MATCHED;
+    if (state == start_state_) {
+      while (!leaves_start_[*p])
+        ++p;
+    }
+    if (*p == '\0')
+      break;
+    int next = next_[256 * state + *p];
+    state = next != kUnknown ? next : Next(state, *p);
+    ++p;
+  }
+  return accepting_[state];
+}
+
+int RegexpDFA::StateFor(const RegexpAutomaton::StateSet& states) {
+  map<RegexpAutomaton::StateSet, int>::const_iterator i = ids_.find(states);
+  if (i != ids_.end())
+    return i->second;
+
+  int id = states_.size();
+  states_.push_back(states);
+  accepting_.push_back(automaton_->IsMatch(states));
+  if (unanchored_end_ && accepting_.back())
+    outcomes_.push_back(MATCHED);
+  else if (states.empty())
+    outcomes_.push_back(FAILED);
+  else
+    outcomes_.push_back(CONTINUE);
+  next_.resize(next_.size() + 256, kUnknown);
+  ids_.insert(make_pair(states, id));
+  return id;
+}
+
+int RegexpDFA::Next(int state, unsigned char c) {
+  int next = next_[256 * state + c];
+  if (next != kUnknown)
+    return next;
+
+  RegexpAutomaton::StateSet states;
+  automaton_->Step(states_[state], c, &states);
+  if (unanchored_start_) {
+    // A match may also start at the next character.
+    RegexpAutomaton::StateSet merged;
+    set_union(states.begin(), states.end(), start_.begin(), start_.end(),
+              back_inserter(merged));
+    states.swap(merged);
+  }
+
+  if (states_.size() >= kMaxStates) {
+    Flush();
+    return StateFor(states);
+  }
+  next = StateFor(states);
+  next_[256 * state + c] = next;
+  return next;
+}
+
+void RegexpDFA::Flush() {
+  states_.clear();
+  accepting_.clear();
+  outcomes_.clear();
+  next_.clear();
+  ids_.clear();
+  start_state_ = StateFor(start_);
+}
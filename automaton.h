@@ -0,0 +1,190 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// RegexpAutomaton is a nondeterministic finite automaton compiled
+// from a POSIX extended regular expression, which can be run one
+// character at a time. It is used to match the regular expression
+// against the whole of each tag while walking the sorted tag index:
+// tags sharing a prefix share the states reached after it, and once
+// no state is left, every tag with that prefix can be skipped at
+// once.
+//
+// Only the common subset of the syntax is supported: literals,
+// '.', bracket expressions, grouping, alternation and the *, +, ?
+// and {m,n} operators, with '^' and '$' only at the very start and
+// end. Compile returns NULL for anything else (back-references, GNU
+// escapes such as \w, anchors elsewhere), and callers fall back to
+// the POSIX implementation in regexp.h.
+//
+// RegexpDFA runs a RegexpAutomaton as a deterministic automaton,
+// whose states are built from sets of states of the RegexpAutomaton as
+// they are first reached, and cached. Matching a string then costs
+// one table lookup per character.
+//
+// Sample usage:
+//
+// RegexpAutomaton* automaton = RegexpAutomaton::Compile("Get[A-Z].*");
+// if (automaton != NULL) {
+//   RegexpAutomaton::StateSet states, next;
+//   automaton->Start(&states);
+//   for (const char* p = str; *p != '\0' && !states.empty(); ++p) {
+//     automaton->Step(states, *p, &next);
+//     states.swap(next);
+//   }
+//   if (automaton->IsMatch(states)) ...
+// }
+
+#ifndef TOOLS_TAGS_AUTOMATON_H__
+#define TOOLS_TAGS_AUTOMATON_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tagsutil.h"
+
+class RegexpAutomaton {
+ public:
+  // The states the automaton may be in, in increasing order. Only
+  // states which consume a character, or accept, are included.
+  typedef vector<int> StateSet;
+
+  // Returns a new automaton accepting exactly the strings which
+  // REGEXP matches in full, or NULL if REGEXP is malformed or uses
+  // syntax which isn't supported.
+  static RegexpAutomaton* Compile(const string& regexp);
+
+  // Stores the initial states in STATES.
+  void Start(StateSet* states) const;
+
+  // Stores in TO the states reached from FROM by reading C. TO is
+  // empty if no string starting this way can match.
+  void Step(const StateSet& from, unsigned char c, StateSet* to) const;
+
+  // Returns true if STATES includes the accepting state.
+  bool IsMatch(const StateSet& states) const;
+
+  // Returns true if the automaton accepts STR.
+  bool FullMatch(const char* str) const;
+
+  // Returns the number of states.
+  int size() const {
+    return states_.size();
+  }
+
+  // Return true if the regular expression started with '^' or ended
+  // with '$'. Full matches don't depend on these, but searches do.
+  bool anchored_start() const {
+    return anchored_start_;
+  }
+  bool anchored_end() const {
+    return anchored_end_;
+  }
+
+ private:
+  friend class RegexpCompiler;
+
+  enum StateType {
+    CHARS,    // Reads a character in chars, then goes to out
+    SPLIT,    // Goes to both out and out1 without reading anything
+    EMPTY,    // Goes to out without reading anything
+    ACCEPT    // Accepts
+  };
+
+  struct State {
+    StateType type;
+    int out;
+    int out1;
+    // The characters read by a CHARS state, one bit each.
+    uint32 chars[256 / 32];
+  };
+
+  RegexpAutomaton()
+      : start_(0), anchored_start_(false), anchored_end_(false) {}
+
+  // Adds STATE, and the states reachable from it without reading
+  // anything, to STATES, which has no duplicates. VISITED marks the
+  // states already considered.
+  void AddState(int state, vector<bool>* visited, StateSet* states) const;
+
+  vector<State> states_;
+  int start_;
+  bool anchored_start_;
+  bool anchored_end_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RegexpAutomaton);
+};
+
+// Not thread-safe: the cache of states is built while matching.
+class RegexpDFA {
+ public:
+  // If SEARCH is true, matches strings containing a match of
+  // AUTOMATON, like regexec. Otherwise, only matches the strings which
+  // AUTOMATON accepts as a whole. AUTOMATON must outlive the DFA.
+  RegexpDFA(const RegexpAutomaton* automaton, bool search);
+
+  // Returns true if STR matches.
+  bool Match(const char* str);
+
+ private:
+  // Caches hold at most this many states. A cache that fills up is
+  // flushed, which only happens for unusually complex expressions.
+  static const int kMaxStates = 256;
+  // Marks a transition which hasn't been computed yet.
+  static const int kUnknown = -1;
+
+  // What reaching a state means for Match.
+  enum Outcome {
+    CONTINUE,  // Keep reading
+    MATCHED,   // STR matches whatever comes next
+    FAILED     // STR can't match whatever comes next
+  };
+
+  // Returns the id of the state for STATES, adding it if needed.
+  int StateFor(const RegexpAutomaton::StateSet& states);
+
+  // Returns the state reached from STATE by reading C.
+  int Next(int state, unsigned char c);
+
+  // Empties the cache, leaving only the initial state.
+  void Flush();
+
+  const RegexpAutomaton* automaton_;
+  // Whether a match may start after the first character.
+  bool unanchored_start_;
+  // Whether a match may end before the last character.
+  bool unanchored_end_;
+  RegexpAutomaton::StateSet start_;
+  int start_state_;
+  // For searches, the characters which lead out of the initial state.
+  // Match skips over the others.
+  bool leaves_start_[256];
+
+  // For each state, the automaton states it stands for, whether it
+  // accepts, and what reaching it means.
+  vector<RegexpAutomaton::StateSet> states_;
+  vector<bool> accepting_;
+  vector<unsigned char> outcomes_;
+  // The transitions out of state S are next_[256 * S] onwards.
+  vector<int> next_;
+  map<RegexpAutomaton::StateSet, int> ids_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RegexpDFA);
+};
+
+#endif  // TOOLS_TAGS_AUTOMATON_H__
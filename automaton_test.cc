@@ -0,0 +1,125 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "gtagsunit.h"
+#include "automaton.h"
+
+#include "regexp.h"
+
+namespace {
+
+const char* kRegexps[] = {
+  "abc", "a.c", "a*", "ab+c", "ab?c", "a|b|", "(ab|a)(bc|c)", "(a*)*b",
+  "a{2}", "a{1,3}", "(ab){2,}", "x{0}y", "[a-c]+", "[^a-c]*", "[]a]+",
+  "[a-]+", "[[:upper:]][[:alnum:]_]*", "^Get[A-Z].*$", "Foo.*Bar",
+  "a\\.b", "a\\[b", "a\\*", "\\(x\\)", "()", "a(|b)c", "[[:digit:]]{2,3}",
+};
+
+const char* kStrings[] = {
+  "", "a", "b", "c", "ab", "abc", "abbc", "ac", "aaa", "aaaa", "abab",
+  "ababab", "y", "xy", "ddd", "]a]", "a-", "-", "GetFoo", "Getfoo",
+  "Get", "FooBar", "FooxBar", "Foo_Bar_", "a.b", "a[b", "axb", "a*", "(x)",
+  "12", "1234", "Tags_Reader9",
+};
+
+TEST(RegexpAutomatonTest, AgreesWithRegExp) {
+  for (size_t i = 0; i < sizeof(kRegexps) / sizeof(kRegexps[0]); ++i) {
+    RegexpAutomaton* automaton = RegexpAutomaton::Compile(kRegexps[i]);
+    ASSERT_TRUE(automaton != NULL);
+    RegExp regexp(kRegexps[i]);
+    for (size_t j = 0; j < sizeof(kStrings) / sizeof(kStrings[0]); ++j) {
+      EXPECT_EQ(regexp.FullMatch(kStrings[j]),
+                automaton->FullMatch(kStrings[j]));
+    }
+    delete automaton;
+  }
+}
+
+// Returns true if REGEXP matches a substring of STR, according to
+// regexec.
+bool PosixSearch(const char* regexp, const char* str) {
+  regex_t reg;
+  CHECK_EQ(regcomp(&reg, regexp, REG_EXTENDED | REG_NOSUB), 0);
+  bool match = regexec(&reg, str, 0, NULL, 0) == 0;
+  regfree(&reg);
+  return match;
+}
+
+TEST(RegexpDFATest, AgreesWithRegExp) {
+  const char* anchored[] = { "^ab", "ab$", "^a*$", "^$" };
+  for (size_t i = 0; i < sizeof(kRegexps) / sizeof(kRegexps[0]) + 4; ++i) {
+    const char* re = i < sizeof(kRegexps) / sizeof(kRegexps[0])
+        ? kRegexps[i] : anchored[i - sizeof(kRegexps) / sizeof(kRegexps[0])];
+    RegexpAutomaton* automaton = RegexpAutomaton::Compile(re);
+    ASSERT_TRUE(automaton != NULL);
+    RegexpDFA full(automaton, false);
+    RegexpDFA search(automaton, true);
+    RegExp regexp(re);
+    // Twice, so that the second time runs on cached states.
+    for (int pass = 0; pass < 2; ++pass) {
+      for (size_t j = 0; j < sizeof(kStrings) / sizeof(kStrings[0]); ++j) {
+        EXPECT_EQ(regexp.FullMatch(kStrings[j]), full.Match(kStrings[j]));
+        EXPECT_EQ(PosixSearch(re, kStrings[j]), search.Match(kStrings[j]));
+      }
+    }
+    delete automaton;
+  }
+}
+
+TEST(RegexpDFATest, FlushesLargeCaches) {
+  // Needs a state per distinct suffix of up to 10 characters.
+  RegexpAutomaton* automaton = RegexpAutomaton::Compile("a[ab]{9}");
+  ASSERT_TRUE(automaton != NULL);
+  RegexpDFA search(automaton, true);
+  string str;
+  for (int i = 0; i < 2000; ++i)
+    str.push_back((i * 7919) % 3 ? 'a' : 'b');
+  EXPECT_TRUE(search.Match(str.c_str()));
+  EXPECT_FALSE(search.Match("bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"));
+  EXPECT_TRUE(search.Match("bbbbbbbbbbbbbbbabbbbbbbbbbbbbbbbbbbbbbbb"));
+  EXPECT_FALSE(search.Match("bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbabbbb"));
+  delete automaton;
+}
+
+TEST(RegexpAutomatonTest, Unsupported) {
+  const char* unsupported[] = {
+    "\\w+", "\\<a", "a\\'", "(a)\\1", "a^b", "a$b", "*a", "a{2", "a{3,1}",
+    "(ab", "ab)", "[ab", "[[=a=]]", "[[:nothing:]]", "a{1001}",
+    "(a{100}){100}",
+  };
+  for (size_t i = 0; i < sizeof(unsupported) / sizeof(unsupported[0]); ++i) {
+    RegexpAutomaton* automaton = RegexpAutomaton::Compile(unsupported[i]);
+    EXPECT_TRUE(automaton == NULL);
+    delete automaton;
+  }
+}
+
+TEST(RegexpAutomatonTest, DeadStates) {
+  RegexpAutomaton* automaton = RegexpAutomaton::Compile("Get[A-Z].*");
+  ASSERT_TRUE(automaton != NULL);
+  RegexpAutomaton::StateSet states, next;
+  automaton->Start(&states);
+  automaton->Step(states, 'G', &next);
+  EXPECT_FALSE(next.empty());
+  EXPECT_FALSE(automaton->IsMatch(next));
+  automaton->Step(states, 'S', &next);
+  EXPECT_TRUE(next.empty());
+  delete automaton;
+}
+
+}  // namespace
@@ -0,0 +1,153 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "blockreader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "callback.h"
+
+BlockReader::BlockReader(const string& filename, bool enable_gunzip,
+                         int block_size, int num_blocks)
+    : fd_(-1),
+      gzfile_(NULL),
+      block_size_(block_size),
+      blocks_(num_blocks),
+      free_(num_blocks),
+      // One more slot for the end of file marker.
+      full_(num_blocks + 1),
+      current_(NULL),
+      done_(false),
+      error_(false),
+      stop_(false),
+      thread_(NULL) {
+  CHECK_GE(num_blocks, 2);
+  if (enable_gunzip) {
+    gzfile_ = gzopen(filename.c_str(), "rb");
+    if (gzfile_ != NULL)
+      gzbuffer(gzfile_, block_size);
+  } else {
+    fd_ = open(filename.c_str(), O_RDONLY);
+  }
+  if (gzfile_ == NULL && fd_ == -1) {
+    LOG(WARNING) << "Could not open file " << filename << ": "
+                 << strerror(errno);
+    done_ = true;
+    error_ = true;
+    return;
+  }
+
+  for (int i = 0; i < num_blocks; ++i) {
+    blocks_[i].data = new char[block_size];
+    blocks_[i].length = 0;
+    free_.Put(&blocks_[i]);
+  }
+
+  thread_ = new gtags::ClosureThread(
+      gtags::CallbackFactory::CreatePermanent(
+          this, &BlockReader::ReadBlocks));
+  thread_->SetJoinable(true);
+  thread_->Start();
+}
+
+BlockReader::~BlockReader() {
+  if (thread_ == NULL)
+    return;
+
+  stop_ = true;
+  const char* data;
+  int length;
+  while (Next(&data, &length)) {}
+
+  thread_->Join();
+  delete thread_;
+  for (size_t i = 0; i < blocks_.size(); ++i)
+    delete[] blocks_[i].data;
+  if (gzfile_ != NULL)
+    gzclose(gzfile_);
+  else
+    close(fd_);
+}
+
+bool BlockReader::Next(const char** data, int* length) {
+  if (current_ != NULL) {
+    free_.Put(current_);
+    current_ = NULL;
+  }
+  if (done_)
+    return false;
+
+  current_ = full_.Get();
+  if (current_ == NULL) {
+    done_ = true;
+    return false;
+  }
+  *data = current_->data;
+  *length = current_->length;
+  return true;
+}
+
+void BlockReader::ReadBlocks() {
+  while (!stop_) {
+    Block* block = free_.Get();
+    // Fill the whole block unless the file ends, so that consumers
+    // see few, large blocks.
+    int length = 0;
+    int n = 0;
+    while (length < block_size_ &&
+           (n = Read(block->data + length, block_size_ - length)) > 0)
+      length += n;
+    if (n == -1)
+      error_ = true;
+    if (length == 0) {
+      free_.Put(block);
+      break;
+    }
+    block->length = length;
+    full_.Put(block);
+    // A short block means the file has ended, or can't be read any
+    // further.
+    if (length < block_size_)
+      break;
+  }
+  full_.Put(NULL);
+}
+
+int BlockReader::Read(char* data, int length) {
+  if (gzfile_ != NULL) {
+    int n = gzread(gzfile_, data, length);
+    if (n < 0) {
+      int error;
+      LOG(WARNING) << "Error decompressing input: "
+                   << gzerror(gzfile_, &error);
+      return -1;
+    }
+    return n;
+  }
+
+  int n;
+  do {
+    n = read(fd_, data, length);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1)
+    LOG(WARNING) << "Error reading input: " << strerror(errno);
+  return n;
+}
@@ -0,0 +1,115 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// BlockReader reads a file in large blocks on a thread of its own, so
+// that reading, and decompressing gzipped files with zlib, overlaps
+// with whatever consumes the blocks. The blocks come from a small
+// ring of buffers: the reading thread fills free buffers, and each
+// call to Next hands the previous one back.
+//
+// Sample usage:
+//
+// BlockReader reader("/path/to/file.gz", true);
+// const char* data;
+// int length;
+// while (reader.Next(&data, &length)) {
+//   ...
+// }
+// if (reader.error()) {
+//   ...
+// }
+
+#ifndef TOOLS_TAGS_BLOCKREADER_H__
+#define TOOLS_TAGS_BLOCKREADER_H__
+
+#include <zlib.h>
+#include <string>
+#include <vector>
+
+#include "pcqueue.h"
+#include "tagsutil.h"
+#include "thread.h"
+
+class BlockReader {
+ public:
+  static const int kDefaultBlockSize = 256 << 10;
+  static const int kDefaultNumBlocks = 4;
+
+  // Opens FILENAME, decompressing it if ENABLE_GUNZIP is set, and
+  // starts reading it into NUM_BLOCKS buffers of BLOCK_SIZE bytes. If
+  // the file can't be opened, the reader behaves like an empty file
+  // with error() set.
+  BlockReader(const string& filename, bool enable_gunzip,
+              int block_size = kDefaultBlockSize,
+              int num_blocks = kDefaultNumBlocks);
+
+  // Stops the reading thread and closes the file.
+  ~BlockReader();
+
+  // Sets *DATA and *LENGTH to the next block of the file, which is
+  // never empty and stays valid until the next call. Returns false at
+  // the end of the file, or once the file can't be read any further.
+  bool Next(const char** data, int* length);
+
+  // Returns true if the file couldn't be opened or read, in which case
+  // the blocks returned so far are all there is. Only meaningful once
+  // Next has returned false.
+  bool error() const {
+    return error_;
+  }
+
+ private:
+  struct Block {
+    char* data;
+    int length;
+  };
+
+  // Fills free blocks until the end of the file, or until stop_ is
+  // set. Runs on the reading thread.
+  void ReadBlocks();
+
+  // Reads up to LENGTH bytes into DATA, and returns the number read,
+  // which is 0 only at the end of the file, or -1 on errors.
+  int Read(char* data, int length);
+
+  // Exactly one of these is open.
+  int fd_;
+  gzFile gzfile_;
+  int block_size_;
+
+  vector<Block> blocks_;
+  // Blocks waiting to be filled, and blocks waiting to be consumed.
+  // A NULL in full_ marks the end of the file.
+  gtags::ProducerConsumerQueue<Block*> free_;
+  gtags::ProducerConsumerQueue<Block*> full_;
+  // The block last returned by Next.
+  Block* current_;
+  bool done_;
+  // Set if the file couldn't be opened, or by the reading thread
+  // before it marks the end of the file if it couldn't be read.
+  bool error_;
+  // Set by the destructor to stop the reading thread early.
+  volatile bool stop_;
+
+  // The reading thread, or NULL if the file couldn't be opened.
+  gtags::Thread* thread_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(BlockReader);
+};
+
+#endif  // TOOLS_TAGS_BLOCKREADER_H__
@@ -0,0 +1,104 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtagsunit.h"
+#include "blockreader.h"
+
+#include "tagsoptionparser.h"
+
+namespace {
+
+// Returns the contents of FILENAME, read through a BlockReader with
+// small blocks.
+string ReadAll(const string& filename, bool enable_gunzip) {
+  BlockReader reader(filename, enable_gunzip, 100, 3);
+  string contents;
+  const char* data;
+  int length;
+  while (reader.Next(&data, &length)) {
+    EXPECT_TRUE(length > 0);
+    contents.append(data, length);
+  }
+  // The end of the file stays the end.
+  EXPECT_FALSE(reader.Next(&data, &length));
+  EXPECT_FALSE(reader.error());
+  return contents;
+}
+
+// Writes CONTENTS to FILENAME.
+void WriteFile(const string& filename, const string& contents) {
+  FILE* file = fopen(filename.c_str(), "w");
+  CHECK(file != NULL);
+  fwrite(contents.data(), 1, contents.size(), file);
+  fclose(file);
+}
+
+GTAGS_FIXTURE(BlockReaderTest) {
+ protected:
+  GTAGS_FIXTURE_SETUP(BlockReaderTest) {
+    filename = GET_FLAG(test_tmpdir) + "/test_blockreader";
+    for (int i = 0; i < 1000; ++i)
+      contents.append("(item (line 1) (snippet \"block\"))\n");
+    WriteFile(filename, contents);
+  }
+
+  string filename;
+  string contents;
+};
+
+TEST_F(BlockReaderTest, Plain) {
+  EXPECT_EQ(contents, ReadAll(filename, false));
+}
+
+TEST_F(BlockReaderTest, Gzipped) {
+  string gzip_command = "gzip -f " + filename;
+  system(gzip_command.c_str());
+  EXPECT_EQ(contents, ReadAll(filename + ".gz", true));
+}
+
+TEST_F(BlockReaderTest, Empty) {
+  WriteFile(filename, "");
+  EXPECT_EQ("", ReadAll(filename, false));
+}
+
+TEST_F(BlockReaderTest, Missing) {
+  BlockReader reader(filename + ".missing", false, 100, 3);
+  const char* data;
+  int length;
+  EXPECT_FALSE(reader.Next(&data, &length));
+  EXPECT_TRUE(reader.error());
+
+  BlockReader gzip_reader(filename + ".missing.gz", true, 100, 3);
+  EXPECT_FALSE(gzip_reader.Next(&data, &length));
+  EXPECT_TRUE(gzip_reader.error());
+}
+
+TEST_F(BlockReaderTest, StopsEarly) {
+  // Destroying a reader before it has been read to the end must not
+  // hang.
+  BlockReader reader(filename, false, 10, 2);
+  const char* data;
+  int length;
+  EXPECT_TRUE(reader.Next(&data, &length));
+  EXPECT_EQ(10, length);
+}
+
+}  // namespace
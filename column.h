@@ -0,0 +1,130 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// Column is an array which either owns its elements or is a read-only
+// view of elements stored elsewhere, typically in a memory-mapped
+// snapshot (see snapshot.h). Reads work the same way in both cases.
+// The first call to Mutable on a view copies the elements into memory
+// owned by the Column, so that a table loaded from a snapshot can
+// still be updated.
+
+#ifndef TOOLS_TAGS_COLUMN_H__
+#define TOOLS_TAGS_COLUMN_H__
+
+#include <vector>
+
+#include "tagsutil.h"
+
+template<class T>
+class Column {
+ public:
+  typedef const T* const_iterator;
+
+  Column() : view_(NULL), view_size_(0) { }
+
+  // Makes the column a view of the SIZE elements at DATA, discarding
+  // its previous contents. DATA must remain valid until the column is
+  // cleared or modified.
+  void Attach(const T* data, size_t size) {
+    vector<T>().swap(owned_);
+    view_ = data;
+    view_size_ = size;
+  }
+
+  // Returns true if the column is a view of memory it doesn't own.
+  bool is_view() const {
+    return view_ != NULL;
+  }
+
+  const T* data() const {
+    if (view_ != NULL)
+      return view_;
+    return owned_.empty() ? NULL : &owned_[0];
+  }
+
+  size_t size() const {
+    return view_ != NULL ? view_size_ : owned_.size();
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  // Returns the number of bytes of memory the column owns, which is
+  // none for a view.
+  size_t bytes_owned() const {
+    return owned_.capacity() * sizeof(T);
+  }
+
+  const T& operator[](size_t i) const {
+    return data()[i];
+  }
+
+  const_iterator begin() const {
+    return data();
+  }
+
+  const_iterator end() const {
+    return data() + size();
+  }
+
+  // Returns the elements for modification, first copying them if the
+  // column is a view.
+  vector<T>* Mutable() {
+    if (view_ != NULL) {
+      owned_.assign(view_, view_ + view_size_);
+      view_ = NULL;
+      view_size_ = 0;
+    }
+    return &owned_;
+  }
+
+  // Replaces the elements with those of ELEMENTS, which gets the
+  // previous elements if the column owned them, and is emptied
+  // otherwise.
+  void Swap(vector<T>* elements) {
+    owned_.swap(*elements);
+    if (view_ != NULL) {
+      vector<T>().swap(*elements);
+      view_ = NULL;
+      view_size_ = 0;
+    }
+  }
+
+  // Releases owned memory that isn't used by any element.
+  void Trim() {
+    if (owned_.capacity() > owned_.size())
+      vector<T>(owned_).swap(owned_);
+  }
+
+  // Empties the column and releases its storage.
+  void Clear() {
+    vector<T>().swap(owned_);
+    view_ = NULL;
+    view_size_ = 0;
+  }
+
+ private:
+  vector<T> owned_;
+  const T* view_;
+  size_t view_size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Column);
+};
+
+#endif  // TOOLS_TAGS_COLUMN_H__
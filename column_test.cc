@@ -0,0 +1,58 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include <vector>
+
+#include "gtagsunit.h"
+#include "column.h"
+
+namespace {
+
+TEST(ColumnTest, Owned) {
+  Column<int> column;
+  EXPECT_TRUE(column.empty());
+  EXPECT_FALSE(column.is_view());
+
+  column.Mutable()->push_back(3);
+  column.Mutable()->push_back(4);
+  EXPECT_EQ(2, column.size());
+  EXPECT_EQ(3, column[0]);
+  EXPECT_EQ(4, *(column.end() - 1));
+
+  column.Clear();
+  EXPECT_TRUE(column.empty());
+}
+
+TEST(ColumnTest, CopyOnWrite) {
+  const int data[] = { 1, 2, 3 };
+  Column<int> column;
+  column.Attach(data, 3);
+  EXPECT_TRUE(column.is_view());
+  EXPECT_EQ(data, column.begin());
+  EXPECT_EQ(3, column.size());
+  EXPECT_EQ(2, column[1]);
+
+  (*column.Mutable())[1] = 5;
+  EXPECT_FALSE(column.is_view());
+  EXPECT_EQ(5, column[1]);
+  EXPECT_EQ(3, column[2]);
+  // The viewed memory is never written to.
+  EXPECT_EQ(2, data[1]);
+}
+
+}  // namespace
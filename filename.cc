@@ -25,6 +25,8 @@
 
 #include "filename.h"
 
+#include "strutil.h"
+
 // We store each path as a sequence of char* containing the parent
 // directory names and the file basename-- exactly what you would get
 // if you split the input by "/". By convention (and to make
@@ -48,6 +50,7 @@ Filename::Filename(const Filename& rhs)
   filename_ = filetmp;
   for (int i = 0; i < rhs.subdirs_; ++i, ++filetmp)
     *filetmp = GetString(rhs.filename_[i]);
+  InitializePath();
 }
 
 Filename::~Filename() {
@@ -56,6 +59,9 @@ Filename::~Filename() {
   if (symboltable_ == NULL) {
     for (int i = 0; i < subdirs_; ++i)
       delete[] filename_[i];
+    if (escaped_path_ != path_)
+      delete[] escaped_path_;
+    delete[] path_;
   }
 
   delete[] filename_;
@@ -86,13 +92,11 @@ bool Filename::operator<(const Filename& f) const {
   return this->subdirs_ < f.subdirs_;
 }
 
+// Components never contain a '/', so two paths are equal exactly when
+// their components are.
 bool Filename::operator==(const Filename& rhs) const {
-  if (rhs.subdirs_ != this->subdirs_)
-    return false;
-  for (int i = 0; i < rhs.subdirs_; ++i)
-    if (strcmp(rhs.filename_[i], this->filename_[i]) != 0)
-      return false;
-  return true;
+  return rhs.hash_ == this->hash_ && rhs.length_ == this->length_
+      && memcmp(rhs.path_, this->path_, this->length_) == 0;
 }
 
 bool Filename::operator!=(const Filename& rhs) const {
@@ -120,21 +124,6 @@ int Filename::DistanceTo(const Filename& f) const {
   return f.subdirs_ + this->subdirs_ - 2*common_subdirs - 2;
 }
 
-string Filename::Str() const {
-  string s;
-
-  for (int i = 0; i < subdirs_; ++i) {
-    if (i > 0)
-      s.push_back('/');
-    s.append(filename_[i]);
-  }
-
-  if (s.length() == 0)
-    return ".";
-  else
-    return s;
-}
-
 const char* Filename::Basename() const {
   int index = subdirs_ - 1;
 
@@ -147,6 +136,18 @@ const char* Filename::Basename() const {
     return NULL;
 }
 
+int Filename::bytes_used() const {
+  int bytes = sizeof(*this) + subdirs_ * sizeof(const char*);
+  if (symboltable_ == NULL) {
+    for (int i = 0; i < subdirs_; ++i)
+      bytes += strlen(filename_[i]) + 1;
+    bytes += length_ + 1;
+    if (escaped_path_ != path_)
+      bytes += escaped_length_ + 1;
+  }
+  return bytes;
+}
+
 void Filename::Initialize(const char* file) {
   string file_str(file);
   vector<string> dirs;
@@ -178,4 +179,35 @@ void Filename::Initialize(const char* file) {
     *filetmp = GetString(dirs[i].c_str());
 
   subdirs_ = dirs.size();
+  InitializePath();
+}
+
+void Filename::InitializePath() {
+  string s;
+  for (int i = 0; i < subdirs_; ++i) {
+    if (i > 0)
+      s.push_back('/');
+    s.append(filename_[i]);
+  }
+  if (s.length() == 0)
+    s = ".";
+
+  length_ = s.length();
+  if (symboltable_) {
+    uint32 id = symboltable_->GetId(s.data(), s.length());
+    path_ = symboltable_->Lookup(id);
+    hash_ = symboltable_->HashOf(id);
+  } else {
+    path_ = GetString(s.c_str());
+    hash_ = SymbolTable::Hash(path_, length_);
+  }
+
+  escaped_path_ = path_;
+  escaped_length_ = length_;
+  if (NeedsCEscape(path_, length_)) {
+    string escaped;
+    CEscapeAppend(path_, length_, &escaped);
+    escaped_path_ = GetString(escaped.c_str());
+    escaped_length_ = escaped.length();
+  }
 }
@@ -30,6 +30,11 @@
 // needed strings inside the StringTable. Otherwise, we take
 // responsibility for allocating and deallocating the strings needed
 // for the path.
+//
+// Besides its components, a Filename keeps its normalized path along
+// with the path's length and hash, so that it can be printed, hashed
+// and compared without building a string. It also keeps the path as
+// escaped by CEscape, which is usually the path itself.
 
 #ifndef TOOLS_TAGS_FILENAME_H__
 #define TOOLS_TAGS_FILENAME_H__
@@ -67,7 +72,30 @@ class Filename {
   int DistanceTo(const Filename& f) const;
 
   // Returns a normalized string representation of the path
-  string Str() const;
+  string Str() const {
+    return string(path_, length_);
+  }
+
+  // Returns the same path as Str, which lives as long as the
+  // Filename, its length and its hash (see SymbolTable::Hash).
+  const char* c_str() const {
+    return path_;
+  }
+  int length() const {
+    return length_;
+  }
+  uint32 hash() const {
+    return hash_;
+  }
+
+  // Returns the path escaped by CEscape, as it is quoted in
+  // s-expressions, and its length. Lives as long as the Filename.
+  const char* escaped_c_str() const {
+    return escaped_path_;
+  }
+  int escaped_length() const {
+    return escaped_length_;
+  }
 
   // Returns a string containing the file basename, i.e. the last
   // non-empty component. Returns NULL if the path has no components
@@ -77,10 +105,28 @@ class Filename {
   // Filename object).
   const char* Basename() const;
 
+  // Returns the number of components of the path, and component I,
+  // counting from the first.
+  int num_components() const {
+    return subdirs_;
+  }
+  const char* component(int i) const {
+    return filename_[i];
+  }
+
+  // Returns the number of bytes of memory used by the Filename,
+  // including the strings it allocated itself (its components and
+  // path) but not those stored in its SymbolTable.
+  int bytes_used() const;
+
  private:
   // Initializes the members with the given file path
   void Initialize(const char* file);
 
+  // Sets path_, length_, hash_ and the escaped path from the
+  // components.
+  void InitializePath();
+
   // Allocates a new string or gets it from a SymbolTable, depending
   // on whether we are using a SymbolTable. In either case, returns a
   // string which is streq to STR but not ==.
@@ -101,6 +147,16 @@ class Filename {
   const char* const * filename_;
   // Size of filename array
   int subdirs_;
+
+  // The path as returned by Str, its length and its hash
+  const char* path_;
+  int length_;
+  uint32 hash_;
+
+  // The escaped path and its length. Points to path_ when the path
+  // has nothing to escape.
+  const char* escaped_path_;
+  int escaped_length_;
 };
 
 #endif  // TOOLS_TAGS_FILENAME_H__
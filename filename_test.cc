@@ -19,6 +19,7 @@
 #include "gtagsunit.h"
 #include "filename.h"
 
+#include "strutil.h"
 #include "symboltable.h"
 
 namespace {
@@ -118,6 +119,49 @@ TEST(FilenameTest, EqualityOperator) {
 
   EXPECT_TRUE(f1 != f3);
   EXPECT_TRUE(f2 != f3);
+
+  // Paths which split into the same components differently.
+  Filename f4("a/bc", &table);
+  Filename f5("ab/c", &table);
+  EXPECT_TRUE(f4 != f5);
+}
+
+TEST(FilenameTest, CachedPath) {
+  SymbolTable table;
+  Filename f1("./tools/tags/file.cc", &table);
+  Filename f2("tools/tags/file.cc");
+  Filename f3(f1);
+
+  EXPECT_STREQ("tools/tags/file.cc", f1.c_str());
+  EXPECT_EQ(18, f1.length());
+  EXPECT_STREQ(f1.c_str(), f2.c_str());
+  EXPECT_EQ(f1.length(), f2.length());
+  EXPECT_EQ(f1.hash(), f2.hash());
+  EXPECT_EQ(f1.hash(), f3.hash());
+  EXPECT_EQ(SymbolTable::Hash("tools/tags/file.cc", 18), f1.hash());
+
+  // The path is interned along with the components.
+  EXPECT_EQ(table.Get("tools/tags/file.cc"), f1.c_str());
+
+  Filename f4(".");
+  EXPECT_STREQ(".", f4.c_str());
+  EXPECT_EQ(1, f4.length());
+}
+
+TEST(FilenameTest, EscapedPath) {
+  SymbolTable table;
+  Filename f1("tools/tags/file.cc", &table);
+  // Nothing to escape, so the path itself is used.
+  EXPECT_EQ(f1.c_str(), f1.escaped_c_str());
+  EXPECT_EQ(f1.length(), f1.escaped_length());
+
+  Filename f2("tools/it's \\here\".cc", &table);
+  EXPECT_EQ(CEscape(f2.Str()), string(f2.escaped_c_str(),
+                                      f2.escaped_length()));
+  Filename f3(f2.Str().c_str());
+  EXPECT_STREQ(f2.escaped_c_str(), f3.escaped_c_str());
+  Filename f4(f3);
+  EXPECT_STREQ(f2.escaped_c_str(), f4.escaped_c_str());
 }
 
 TEST(FilenameTest, Basename) {
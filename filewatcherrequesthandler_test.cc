@@ -173,7 +173,7 @@ class MockFileWatcher : public InotifyFileWatcher {
 class MockLocalTagsRequestHandler : public LocalTagsRequestHandler {
  public:
   MockLocalTagsRequestHandler() : LocalTagsRequestHandler(
-      false, false, "google3") {}
+      false, "google3") {}
   virtual ~MockLocalTagsRequestHandler() {}
 
   virtual void UnloadFilesInDir(const string& dirname) {
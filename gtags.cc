@@ -51,15 +51,20 @@
 
 DEFINE_STRING(tags_file, "", "The file containing the tags information.");
 
+DEFINE_STRING(tags_snapshot, "",
+              "A snapshot of the tags file compiled by gtagscompiler. "
+              "It is mapped instead of parsing --tags_file.");
+
 DEFINE_STRING(logsaver_prefix, "alloc/gtags.queries.",
               "The directory in which to save important logs so that "
               "the logsaver can write them to gfs.");
 
 // Enables lookup of tags by file. This may use a significant amount
 // of space.
-DEFINE_BOOL(fileindex, true, "Enable fileindex");
+DEFINE_BOOL(fileindex, true,
+            "Ignored; tags can always be looked up by file");
 
-DEFINE_BOOL(gunzip, false, "Stream input file through gunzip");
+DEFINE_BOOL(gunzip, false, "Decompress input file with zlib");
 
 DEFINE_STRING(corpus_root, "google3",
               "Root of the GTags corpus in Perforce (e.g. google3 or "
@@ -77,9 +82,10 @@ int main(int argc, char **argv) {
   File::Init();
   ParseArgs(argc, argv);
 
-  // tags_file is required in remote mode.
-  if (GET_FLAG(tags_file) == "") {
-    SetUsage("Usage: gtags --tags_file=<tagfile> ...");
+  // tags_file or tags_snapshot is required in remote mode.
+  if (GET_FLAG(tags_file) == "" && GET_FLAG(tags_snapshot) == "") {
+    SetUsage("Usage: gtags --tags_file=<tagfile> ...\n"
+             "       gtags --tags_snapshot=<snapshot> ...");
     ShowUsage(argv[0]);
     // Exit if tags_file is not specified
     return -1;
@@ -87,9 +93,14 @@ int main(int argc, char **argv) {
 
   logger = new StdErrLogger();
 
+  // TagsTable recognizes snapshots by their contents, so the snapshot
+  // is loaded just like a tags file.
+  string tags_file = GET_FLAG(tags_file);
+  if (GET_FLAG(tags_snapshot) != "")
+    tags_file = GET_FLAG(tags_snapshot);
+
   tags_request_handler =
-      new SingleTableTagsRequestHandler(GET_FLAG(tags_file),
-                                        GET_FLAG(fileindex),
+      new SingleTableTagsRequestHandler(tags_file,
                                         GET_FLAG(gunzip),
                                         GET_FLAG(corpus_root));
 
@@ -102,6 +102,10 @@ may contain some or all of the following, in any order:
   (directory-distance) : Files closer to the current file in the
      directory tree will be ranked higher.
   (popularity) : Files referenced by many other files will be ranked
+     higher.
+  (tag-type) : Type definitions will be ranked higher than function
+     definitions, which will be ranked higher than variable definitions.
+  (language) : Tags in the language of the current file will be ranked
      higher.")
 
 (defconst gtags-sleep-time-between-server-polls 0.01)
@@ -1756,8 +1760,7 @@ functionality as seen from each individual caller."
   "Start the GTags mixer daemon."
   (interactive)
   (call-process gtags-mixer-command nil nil nil
-                "--port" (number-to-string gtags-mixer-port)
-                "--fileindex")
+                "--port" (number-to-string gtags-mixer-port))
   (setq gtags-use-gtags-mixer t)
   (memoize-forget 'gtags-find-host-port-pair))
 
@@ -1766,7 +1769,6 @@ functionality as seen from each individual caller."
   (interactive)
   (call-process gtags-mixer-command nil nil nil
                 "--port" (number-to-string gtags-mixer-port)
-                "--fileindex"
 		"--replace")
   (setq gtags-use-gtags-mixer t)
   (memoize-forget 'gtags-find-host-port-pair))
@@ -0,0 +1,51 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// Execution entry point for gtagscompiler, which compiles a TAGS file
+// into a snapshot (see snapshot.h) that gtags can map at startup
+// instead of parsing the TAGS file.
+
+#include "tagsoptionparser.h"
+#include "tagstable.h"
+
+DEFINE_STRING(tags_file, "", "The file containing the tags information.");
+
+DEFINE_BOOL(gunzip, false, "Decompress input file with zlib");
+
+DEFINE_STRING(snapshot_file, "", "The snapshot file to write.");
+
+int main(int argc, char **argv) {
+  ParseArgs(argc, argv);
+
+  if (GET_FLAG(tags_file) == "" || GET_FLAG(snapshot_file) == "") {
+    SetUsage("Usage: gtagscompiler --tags_file=<tagfile> "
+             "--snapshot_file=<snapshot>");
+    ShowUsage(argv[0]);
+    return -1;
+  }
+
+  TagsTable tags_table;
+  if (!tags_table.ReloadTagFile(GET_FLAG(tags_file), GET_FLAG(gunzip)))
+    return 1;
+  if (!tags_table.WriteSnapshot(GET_FLAG(snapshot_file)))
+    return 1;
+
+  LOG(INFO) << "Wrote " << tags_table.size() << " tags to "
+            << GET_FLAG(snapshot_file);
+  return 0;
+}
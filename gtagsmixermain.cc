@@ -45,8 +45,9 @@ DEFINE_BOOL(daemon, true, "Run GTags mixer in daemon mode.");
 DEFINE_STRING(config_file,
               "./gtagsmixer_socket_config",
               "User configuration file");
-DEFINE_BOOL(fileindex, true, "Enable fileindex");
-DEFINE_BOOL(gunzip, false, "Stream input file through gunzip");
+DEFINE_BOOL(fileindex, true,
+            "Ignored; tags can always be looked up by file");
+DEFINE_BOOL(gunzip, false, "Decompress input file with zlib");
 DEFINE_BOOL(enable_local_indexing, false, "Enable local indexing");
 DEFINE_BOOL(replace, false, "Set this flag to replace any existing instance of"
             " gtagsmixer regardless of its version.");
@@ -167,12 +168,10 @@ int main(int argc, char **argv) {
   const DataSourceMap& sources = Settings::instance()->sources();
 
   // Create local GTags server.
-  LocalTagsRequestHandler local_tags_handler(GET_FLAG(fileindex),
-                                             GET_FLAG(gunzip), "");
+  LocalTagsRequestHandler local_tags_handler(GET_FLAG(gunzip), "");
   LocalDataSource local_data_source(&local_tags_handler);
 
-  LocalTagsRequestHandler local_callgraph_handler(GET_FLAG(fileindex),
-                                                  GET_FLAG(gunzip), "");
+  LocalTagsRequestHandler local_callgraph_handler(GET_FLAG(gunzip), "");
   LocalDataSource local_callgraph_source(&local_callgraph_handler);
 
   // Inject local GTags server into sources for all corpuses.
@@ -19,132 +19,96 @@
 #ifndef TOOLS_TAGS_ITERATORS_H__
 #define TOOLS_TAGS_ITERATORS_H__
 
+#include "blockreader.h"
 #include "strutil.h"
 #include "tagsutil.h"
 
-// CharacterIterator specifies an interface for one-way const
-// iteration over a set of characters. It's used as a generic input
-// source for SExpression::ParseSexp. We guarantee that the stream
-// returned by the CharacterIterator contains zero or more non-\0
-// characters, followed by a \0, and IsDone() is true only when the
-// cursor is at \0.
+// Character iterators provide one-way const iteration over a set of
+// characters. They are used as generic input sources for
+// SExpression::ParseSexp. We guarantee that the stream returned by an
+// iterator contains zero or more non-\0 characters, followed by a
+// \0, and IsDone() is true only when the cursor is at \0.
+//
+// Iterators are template arguments rather than subclasses of a
+// common interface, so that the parser's per-character calls are
+// inlined rather than dispatched virtually. Each one provides:
+//
+//   // Dereferences the iterator to a character.
+//   char operator*() const;
+//   // Advances to the next character in the sequence. If IsDone(),
+//   // ++ has undefined effects.
+//   void operator++();
+//   // Returns true if no more characters can be read. IsDone()
+//   // should be synonymous with *char_iter == '\0'.
+//   bool IsDone() const;
 //
 // We provide, below, implementations to iterate through strings and
 // files.
 //
 // Sample usage:
 //
-// for (CharacterIterator* c_iter = new ...; !c_iter->IsDone(); ++c_iter) {
+// for (StringCharacterIterator c_iter(...); !c_iter.IsDone(); ++c_iter) {
 //   char c = *c_iter;
 //   ...
 // }
-class CharacterIterator {
- public:
-  virtual ~CharacterIterator() { }
-
-  // Dereferences the iterator to a character.
-  virtual const char operator*() const = 0;
-  // Advances to the next character in the sequence.
-  virtual void operator++() = 0;
-  // Returns true if no more characters can be read. If IsDone(), ++
-  // has undefined effects. IsDone() should be synonymous with
-  // *char_iter == '\0'.
-  virtual bool IsDone() const = 0;
-
- protected:
-  CharacterIterator() {}
-};
 
 // Simple class to support iterating over the characters of a c-str.
-class StringCharacterIterator : public CharacterIterator {
+class StringCharacterIterator {
  public:
   // Creates a new iterator over the given c-str.
   explicit StringCharacterIterator(const char* str)
-      : CharacterIterator(),
-        cursor_(str) {}
+      : cursor_(str) {}
 
-  virtual const char operator*()  const { return *cursor_; }
-  virtual void operator++() { ++cursor_; }
-  virtual bool IsDone() const { return cursor_ == '\0'; }
+  char operator*() const { return *cursor_; }
+  void operator++() { ++cursor_; }
+  bool IsDone() const { return *cursor_ == '\0'; }
 
  private:
   // Points to the next character to read.
   const char* cursor_;
 };
 
-// Abstract class that iterates over the characters read from a file
-// object. Implementing classes can set the file object to take
-// input from different sources.
-class FileObjectCharacterIterator : public CharacterIterator {
+// Iterates over the characters of a file, optionally gunzipping it.
+// The file is read and decompressed in large blocks on a separate
+// thread by a BlockReader.
+class FileCharacterIterator {
  public:
-  // Closes the file when we're done.
-  virtual ~FileObjectCharacterIterator() { fclose(file_); }
-
-  virtual const char operator*() const {
-    return (current_char_ == EOF) ? '\0' : current_char_;
+  // Creates a new iterator reading from the specified file.
+  explicit FileCharacterIterator(const string& filename,
+                                 bool enable_gunzip = false)
+      : reader_(filename, enable_gunzip),
+        cursor_(NULL),
+        end_(NULL) {
+    LoadNextBlock();
   }
-  virtual void operator++() { LoadNextChar(); }
-  virtual bool IsDone() const { return current_char_ == EOF; }
 
- protected:
-  // Implementing classes should call Init() in their constructors
-  // and pass in the file object to be read.
-  explicit FileObjectCharacterIterator() : CharacterIterator() {}
-
-  void Init(FILE* file) {
-    file_ = file;
-    LoadNextChar();
+  char operator*() const {
+    return (cursor_ == end_) ? '\0' : *cursor_;
   }
-
- private:
-  // Gets the next char from file, checking to see there was not a
-  // read error.
-  inline void LoadNextChar() {
-    current_char_ = fgetc(file_);
-    // Signal when there is a file error
-    CHECK(!(current_char_ == EOF && ferror(file_)));
+  void operator++() {
+    if (++cursor_ == end_)
+      LoadNextBlock();
   }
+  bool IsDone() const { return cursor_ == end_; }
 
-  // FILE object we're reading from
-  FILE* file_;
-  // Always contains the next character to return
-  int current_char_;
-};
-
-// Iterates over the characters of a file.
-class FileCharacterIterator : public FileObjectCharacterIterator {
- public:
-  // Creates a new iterator reading from the specified file.
-  explicit FileCharacterIterator(string filename)
-      : FileObjectCharacterIterator() {
-    FILE * file = fopen(filename.c_str(), "r");
-    CHECK(file != NULL) << "Could not open file " << filename;
-    Init(file);
+ private:
+  // Points the cursor at the next block of the file, or leaves it at
+  // the end if there is none.
+  void LoadNextBlock() {
+    int length;
+    if (reader_.Next(&cursor_, &length))
+      end_ = cursor_ + length;
+    else
+      cursor_ = end_ = NULL;
   }
 
-  virtual ~FileCharacterIterator() { }
-};
-
-// gunzips a file stream and reads the characters
-class GzippedFileCharacterIterator : public FileObjectCharacterIterator {
- public:
-  // Creates a new iterator reading from the specified file.
-  explicit GzippedFileCharacterIterator(string filename)
-      : FileObjectCharacterIterator() {
-    //Check file existance
-    FILE * file = fopen(filename.c_str(), "r");
-    CHECK(file != NULL);
-    fclose(file);
-
-    // Pipe in the output from "gunzip -c FILENAME".
-    string cmd;
-    cmd.append("gunzip -c ");
-    cmd.append(filename.c_str());
-
-    Init(popen(cmd.c_str(), "r"));
-  }
+  BlockReader reader_;
+  // Points to the next character to read, in the current block which
+  // ends at end_.
+  const char* cursor_;
+  const char* end_;
 
-  virtual ~GzippedFileCharacterIterator() { }
+  DISALLOW_EVIL_CONSTRUCTORS(FileCharacterIterator);
 };
 
 // Moves *psexp so that it points to the first non-whitespace
@@ -172,12 +136,8 @@ class FileReader {
 
   // Creates new reader reading from the specified file, optionally
   // enabling a gunzip filter on the input.
-  FileReader(string filename, bool enable_gunzip) {
-    if (enable_gunzip)
-      pchar_iter = new GzippedFileCharacterIterator(filename);
-    else
-      pchar_iter = new FileCharacterIterator(filename);
-  }
+  FileReader(string filename, bool enable_gunzip)
+      : pchar_iter(new FileCharacterIterator(filename, enable_gunzip)) {}
 
   // Deletes the underlying iterator when we're done.
   ~FileReader() { delete pchar_iter; }
@@ -196,7 +156,7 @@ class FileReader {
  private:
   // This is the underlying iterator used to get all the characters in
   // the file.
-  CharacterIterator* pchar_iter;
+  FileCharacterIterator* pchar_iter;
 };
 
 #endif  // TOOLS_TAGS_ITERATORS_H__
@@ -16,7 +16,7 @@
 //
 // Author: nigdsouza@google.com (Nigel D'souza)
 //
-// A lightweight mutex wrapper for pthreads.
+// Lightweight mutex and reader-writer lock wrappers for pthreads.
 
 #ifndef TOOLS_TAGS_MUTEX_H__
 #define TOOLS_TAGS_MUTEX_H__
@@ -55,6 +55,55 @@ class MutexLock {
   DISALLOW_EVIL_CONSTRUCTORS(MutexLock);
 };
 
+// A reader-writer lock: any number of readers may hold it at once,
+// or a single writer. Waiting writers keep new readers out, so a
+// steady stream of readers can't hold off a writer forever.
+class RWMutex {
+ public:
+  RWMutex() {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(
+        &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&rwlock_, &attr);
+    pthread_rwlockattr_destroy(&attr);
+  }
+  ~RWMutex() { pthread_rwlock_destroy(&rwlock_); }
+  inline void ReaderLock() { pthread_rwlock_rdlock(&rwlock_); }
+  inline void ReaderUnlock() { pthread_rwlock_unlock(&rwlock_); }
+  inline void WriterLock() { pthread_rwlock_wrlock(&rwlock_); }
+  inline void WriterUnlock() { pthread_rwlock_unlock(&rwlock_); }
+  inline bool TryReaderLock() {
+    return pthread_rwlock_tryrdlock(&rwlock_) == 0;
+  }
+  inline bool TryWriterLock() {
+    return pthread_rwlock_trywrlock(&rwlock_) == 0;
+  }
+ private:
+  pthread_rwlock_t rwlock_;
+  DISALLOW_EVIL_CONSTRUCTORS(RWMutex);
+};
+
+class ReaderMutexLock {
+ public:
+  explicit ReaderMutexLock(RWMutex *mu) : mu_(mu) { mu_->ReaderLock(); }
+  ~ReaderMutexLock() { mu_->ReaderUnlock(); }
+ private:
+  RWMutex * const mu_;
+  DISALLOW_EVIL_CONSTRUCTORS(ReaderMutexLock);
+};
+
+class WriterMutexLock {
+ public:
+  explicit WriterMutexLock(RWMutex *mu) : mu_(mu) { mu_->WriterLock(); }
+  ~WriterMutexLock() { mu_->WriterUnlock(); }
+ private:
+  RWMutex * const mu_;
+  DISALLOW_EVIL_CONSTRUCTORS(WriterMutexLock);
+};
+
 }  // namespace gtags
 
 #endif  // TOOLS_TAGS_MUTEX_H__
@@ -61,6 +61,33 @@ TEST(MutexTest, UnlockTest) {
   }
 }
 
+TEST(RWMutexTest, ReadersShareTest) {
+  gtags::RWMutex m;
+  EXPECT_TRUE(m.TryReaderLock());
+  EXPECT_TRUE(m.TryReaderLock());
+  EXPECT_FALSE(m.TryWriterLock());
+  m.ReaderUnlock();
+  EXPECT_FALSE(m.TryWriterLock());
+  m.ReaderUnlock();
+  EXPECT_TRUE(m.TryWriterLock());
+  m.WriterUnlock();
+}
+
+TEST(RWMutexTest, WriterExcludesTest) {
+  gtags::RWMutex m;
+  {
+    gtags::WriterMutexLock lock(&m);
+    EXPECT_FALSE(m.TryReaderLock());
+    EXPECT_FALSE(m.TryWriterLock());
+  }
+  {
+    gtags::ReaderMutexLock lock(&m);
+    EXPECT_FALSE(m.TryWriterLock());
+  }
+  EXPECT_TRUE(m.TryWriterLock());
+  m.WriterUnlock();
+}
+
 class IncrementThread : public gtags::Thread {
  public:
   IncrementThread(int *x, int count, gtags::Mutex *m) :
@@ -0,0 +1,73 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "parallelreader.h"
+
+#include "strutil.h"
+
+const char* SExpressionSplitter::Split(const char* begin, const char* end,
+                                       int min_length) {
+  for (const char* p = begin; p < end; ++p) {
+    char c = *p;
+    if (escaped_) {
+      escaped_ = false;
+      continue;
+    }
+    switch (state_) {
+      case IN_STRING:
+      case IN_BARS:
+        if (c == '\\')
+          escaped_ = true;
+        else if (c == (state_ == IN_STRING ? '"' : '|'))
+          state_ = BETWEEN_TOKENS;
+        break;
+      case IN_TOKEN:
+        if (c == '\\') {
+          escaped_ = true;
+          break;
+        }
+        if (!ascii_isspace(c) && c != ')')
+          break;
+        state_ = BETWEEN_TOKENS;
+        // The character that ends a token is read as if it came
+        // between tokens.
+      case BETWEEN_TOKENS:
+        if (c == '(') {
+          ++depth_;
+        } else if (c == ')') {
+          // A stray ')' is left for the parser to complain about.
+          if (depth_ > 0)
+            --depth_;
+        } else if (c == '"') {
+          state_ = IN_STRING;
+        } else if (c == '|') {
+          state_ = IN_BARS;
+        } else if (c == '\\') {
+          state_ = IN_TOKEN;
+          escaped_ = true;
+        } else if (!ascii_isspace(c)) {
+          state_ = IN_TOKEN;
+        }
+        break;
+    }
+
+    if (state_ == BETWEEN_TOKENS && depth_ == 0 && p + 1 - begin >= min_length)
+      return p + 1;
+  }
+  return NULL;
+}
@@ -0,0 +1,232 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// ParallelReader reads a file of s-expressions and parses its
+// top-level s-expressions on a pool of threads.
+//
+// A reader thread takes the file in large blocks from a BlockReader,
+// which reads and decompresses it on a thread of its own, and cuts
+// it into batches of complete top-level s-expressions. It only has
+// to track nesting, strings and escapes to find the boundaries,
+// which is much cheaper than parsing. Worker threads parse the batches, and
+// NextBatch hands them back in file order, so callers see the file
+// exactly as if it had been parsed sequentially.
+//
+// What a batch is parsed into is up to the caller. BATCH must have a
+// default constructor, a string member named text which holds the
+// input, and a method void Parse() which is run on a worker thread.
+//
+// Sample usage:
+//
+// struct SExpressionBatch {
+//   void Parse() { ... parse text into sexps ... }
+//   string text;
+//   vector<SExpression*> sexps;
+// };
+//
+// ParallelReader<SExpressionBatch> reader("/path/to/file", false, 8);
+// while (SExpressionBatch* batch = reader.NextBatch()) {
+//   ...
+// }
+
+#ifndef TOOLS_TAGS_PARALLELREADER_H__
+#define TOOLS_TAGS_PARALLELREADER_H__
+
+#include <string>
+#include <vector>
+
+#include "blockreader.h"
+#include "callback.h"
+#include "pcqueue.h"
+#include "semaphore.h"
+#include "tagsutil.h"
+#include "thread.h"
+
+// Finds the boundaries between top-level s-expressions in a stream
+// of text that arrives in arbitrary pieces.
+class SExpressionSplitter {
+ public:
+  SExpressionSplitter()
+      : state_(BETWEEN_TOKENS), escaped_(false), depth_(0) {}
+
+  // Scans the text from BEGIN to END and returns a pointer just past
+  // the first boundary between top-level s-expressions that is at
+  // least MIN_LENGTH characters after BEGIN. Returns NULL if there is
+  // no such boundary before END; the next call then continues the
+  // scan where this one left off.
+  const char* Split(const char* begin, const char* end, int min_length);
+
+ private:
+  // Lexical state of the scan, which only needs to be precise enough
+  // to tell when we are between two top-level s-expressions.
+  enum State { BETWEEN_TOKENS, IN_TOKEN, IN_STRING, IN_BARS };
+
+  State state_;
+  bool escaped_;
+  int depth_;
+};
+
+template<class Batch>
+class ParallelReader {
+ public:
+  // Size of the batches handed to the parsing threads.
+  static const int kDefaultBatchSize = 1 << 20;
+
+  // Creates a new reader reading from FILENAME, optionally gunzipping
+  // it, and parsing on NUM_THREADS threads.
+  // Batches are cut once they hold at least BATCH_SIZE bytes.
+  ParallelReader(const string& filename, bool enable_gunzip,
+                 int num_threads, int batch_size = kDefaultBatchSize)
+      : input_(filename, enable_gunzip),
+        batch_size_(batch_size),
+        ordered_(kBatchesPerThread * num_threads),
+        unparsed_((kBatchesPerThread + 1) * num_threads),
+        current_(NULL),
+        done_(false) {
+    CHECK_GE(num_threads, 1);
+    for (int i = 0; i < num_threads; ++i) {
+      parsers_.push_back(new gtags::ClosureThread(
+          gtags::CallbackFactory::CreatePermanent(
+              this, &ParallelReader::ParseBatches)));
+      parsers_.back()->SetJoinable(true);
+      parsers_.back()->Start();
+    }
+    reader_ = new gtags::ClosureThread(
+        gtags::CallbackFactory::CreatePermanent(
+            this, &ParallelReader::ReadBatches));
+    reader_->SetJoinable(true);
+    reader_->Start();
+  }
+
+  // Waits for all threads to finish, discarding any batches that
+  // were not read.
+  ~ParallelReader() {
+    while (NextBatch() != NULL) {}
+
+    reader_->Join();
+    delete reader_;
+    for (size_t i = 0; i < parsers_.size(); ++i) {
+      parsers_[i]->Join();
+      delete parsers_[i];
+    }
+  }
+
+  // Returns the next parsed batch in file order, or NULL at the end of
+  // the file. The batch is valid until the next call.
+  Batch* NextBatch() {
+    delete current_;
+    current_ = NULL;
+    if (done_)
+      return NULL;
+
+    current_ = ordered_.Get();
+    if (current_ == NULL) {
+      done_ = true;
+      return NULL;
+    }
+    current_->parsed.Lock();
+    return &current_->batch;
+  }
+
+  // Returns true if the file couldn't be opened or read to the end, in
+  // which case the batches returned were all that could be read. Only
+  // meaningful once NextBatch has returned NULL.
+  bool error() const {
+    return input_.error();
+  }
+
+ private:
+  // Number of batches each parsing thread may have in flight. Bounds
+  // the memory used by text that has been read but not consumed.
+  static const int kBatchesPerThread = 2;
+
+  // A batch and the semaphore that the parsing thread unlocks once
+  // it has been parsed.
+  struct PendingBatch {
+    PendingBatch() : parsed(0) {}
+
+    Batch batch;
+    gtags::Semaphore parsed;
+  };
+
+  // Hands PENDING to the consumer and to the parsing threads.
+  void Queue(PendingBatch* pending) {
+    ordered_.Put(pending);
+    unparsed_.Put(pending);
+  }
+
+  // Reads the input and queues batches until the end of the file.
+  // Runs on the reader thread.
+  void ReadBatches() {
+    SExpressionSplitter splitter;
+    PendingBatch* pending = new PendingBatch;
+    const char* start;
+    int length;
+    while (input_.Next(&start, &length)) {
+      const char* end = start + length;
+      const char* boundary;
+      while ((boundary = splitter.Split(
+                  start, end,
+                  batch_size_ - pending->batch.text.size())) != NULL) {
+        pending->batch.text.append(start, boundary - start);
+        start = boundary;
+        Queue(pending);
+        pending = new PendingBatch;
+      }
+      pending->batch.text.append(start, end - start);
+    }
+
+    if (pending->batch.text.empty())
+      delete pending;
+    else
+      Queue(pending);
+
+    ordered_.Put(NULL);
+    for (size_t i = 0; i < parsers_.size(); ++i)
+      unparsed_.Put(NULL);
+  }
+
+  // Parses batches until the reader thread runs out of input. Runs
+  // on the parsing threads.
+  void ParseBatches() {
+    PendingBatch* pending;
+    while ((pending = unparsed_.Get()) != NULL) {
+      pending->batch.Parse();
+      pending->parsed.Unlock();
+    }
+  }
+
+  BlockReader input_;
+  int batch_size_;
+
+  // Batches in file order, for NextBatch. NULL marks the end of input.
+  gtags::ProducerConsumerQueue<PendingBatch*> ordered_;
+  // Batches waiting to be parsed. NULL tells a parser to exit.
+  gtags::ProducerConsumerQueue<PendingBatch*> unparsed_;
+
+  gtags::Thread* reader_;
+  vector<gtags::Thread*> parsers_;
+
+  // The batch last returned by NextBatch.
+  PendingBatch* current_;
+  bool done_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ParallelReader);
+};
+
+#endif  // TOOLS_TAGS_PARALLELREADER_H__
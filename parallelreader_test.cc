@@ -0,0 +1,114 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gtagsunit.h"
+#include "parallelreader.h"
+
+#include "iterators.h"
+#include "sexpression.h"
+#include "tagsoptionparser.h"
+
+namespace {
+
+// A batch that just keeps its text.
+struct TextBatch {
+  void Parse() {}
+
+  string text;
+};
+
+// Returns true if TEXT is all whitespace.
+bool IsBlank(const string& text) {
+  return text.find_first_not_of(" \t\n") == string::npos;
+}
+
+TEST(SExpressionSplitterTest, Split) {
+  const char* text = "(a \"b)\" |c(|) d\\ e (f (g)) ";
+  SExpressionSplitter splitter;
+  const char* end = text + strlen(text);
+
+  const char* boundary = splitter.Split(text, end, 1);
+  EXPECT_EQ(string("(a \"b)\" |c(|)"), string(text, boundary));
+  boundary = splitter.Split(boundary, end, 2);
+  EXPECT_EQ(string(" d\\ e "), string(text + 13, boundary));
+  EXPECT_TRUE(splitter.Split(boundary, end - 3, 1) == NULL);
+  // The scan picks up in the middle of the list.
+  EXPECT_TRUE(splitter.Split(end - 3, end, 1) == end - 1);
+}
+
+// Cuts a batch after every top-level s-expression, so that any
+// mistake in finding the boundaries shows up as a parse difference.
+TEST(ParallelReaderTest, BatchBoundaries) {
+  string filename = GET_FLAG(test_tmpdir) + "/test_parallelreader";
+  FILE* file = fopen(filename.c_str(), "w");
+  CHECK(file != NULL);
+  fputs("(file (path \"a (b\") (x \"\\\") (\"))\n"
+        "|bar ( \\| symbol| \"str)ing\"\n"
+        "(x tok\\ en(with-paren (nested (list)) .dotted-token)\n"
+        "(a . b) 12 -3\n", file);
+  for (int i = 0; i < 1000; ++i)
+    fprintf(file, "(item (line %d) (snippet \"f(%d);\"))\n", i, i);
+  fclose(file);
+
+  int threads[] = { 1, 4 };
+  for (int i = 0; i < 2; ++i) {
+    FileReader<SExpression> expected(filename);
+    ParallelReader<TextBatch> reader(filename, false, threads[i], 1);
+    while (TextBatch* batch = reader.NextBatch()) {
+      if (IsBlank(batch->text))
+        continue;
+      EXPECT_TRUE(!expected.IsDone());
+      SExpression* s1 = expected.GetNext();
+      SExpression* s2 = SExpression::Parse(batch->text.c_str());
+      ASSERT_TRUE(s2 != NULL);
+      EXPECT_EQ(s1->Repr(), s2->Repr());
+      delete s1;
+      delete s2;
+    }
+    EXPECT_TRUE(expected.IsDone());
+  }
+}
+
+// Batches come back in file order and together hold the whole file.
+TEST(ParallelReaderTest, WholeFile) {
+  string expected;
+  FILE* file = fopen((TEST_DATA_DIR + "/test_TAGS").c_str(), "r");
+  CHECK(file != NULL);
+  int c;
+  while ((c = fgetc(file)) != EOF)
+    expected.push_back(c);
+  fclose(file);
+
+  string actual;
+  ParallelReader<TextBatch> reader(TEST_DATA_DIR + "/test_TAGS", false, 3, 64);
+  while (TextBatch* batch = reader.NextBatch())
+    actual.append(batch->text);
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(ParallelReaderTest, StopsEarly) {
+  // Destroying a reader before it has been read to the end must not
+  // hang or leak.
+  ParallelReader<TextBatch> reader(TEST_DATA_DIR + "/test_TAGS", false, 4, 1);
+  EXPECT_TRUE(reader.NextBatch() != NULL);
+}
+
+}  // namespace
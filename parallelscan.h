@@ -0,0 +1,180 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// ParallelScan finds the first matches of a query among a range of
+// positions, such as the entries of a tag index, on several threads.
+//
+// The range is cut into chunks, which the threads take in order. The
+// matches of each chunk are kept apart and concatenated in order at
+// the end, so the result is exactly that of a sequential scan. Once
+// the chunks before some chunk hold MAX_MATCHES matches between them,
+// no later chunk is started.
+//
+// What a match is is up to SCANNER. Each thread constructs its own
+// scanner from the Query passed to the ParallelScan, so scanners may
+// hold state which can't be shared between threads, such as a
+// compiled regexp. SCANNER must look like this:
+//
+// class Scanner {
+//  public:
+//   typedef ... Query;
+//   explicit Scanner(const Query& query);
+//   // Appends to MATCHES up to MAX_MATCHES matches found in positions
+//   // BEGIN to END, in order.
+//   void Scan(uint32 begin, uint32 end, size_t max_matches,
+//             vector<uint32>* matches);
+// };
+//
+// Sample usage:
+//
+// vector<uint32> matches;
+// ParallelScan<Scanner> scan(query, index.size(), 100, 16384);
+// scan.Run(pool, &matches);
+
+#ifndef TOOLS_TAGS_PARALLELSCAN_H__
+#define TOOLS_TAGS_PARALLELSCAN_H__
+
+#include <algorithm>
+#include <vector>
+
+#include "callback.h"
+#include "mutex.h"
+#include "semaphore.h"
+#include "tagsutil.h"
+#include "workerpool.h"
+
+template<class Scanner>
+class ParallelScan {
+ public:
+  // Prepares a scan for QUERY of positions 0 to SIZE, in chunks of
+  // CHUNK_SIZE positions, stopping after MAX_MATCHES matches.
+  ParallelScan(const typename Scanner::Query& query, uint32 size,
+               int max_matches, uint32 chunk_size)
+      : query_(query),
+        size_(size),
+        max_matches_(max_matches),
+        chunk_size_(chunk_size),
+        num_chunks_((size + chunk_size - 1) / chunk_size),
+        chunks_(num_chunks_),
+        next_chunk_(0),
+        stop_chunk_(num_chunks_),
+        complete_chunks_(0),
+        complete_matches_(0),
+        finished_(0) {
+    CHECK_GE(chunk_size, 1);
+  }
+
+  // Scans on the calling thread and on the threads of POOL, which may
+  // be NULL, and stores the matches in MATCHES.
+  void Run(WorkerPool* pool, vector<uint32>* matches) {
+    int helpers = 0;
+    if (pool != NULL)
+      helpers = max(0, min(pool->size(), num_chunks_ - 1));
+    for (int i = 0; i < helpers; ++i) {
+      pool->Add(gtags::CallbackFactory::Create(this, &ParallelScan::Help));
+    }
+    Scan();
+    for (int i = 0; i < helpers; ++i)
+      finished_.Lock();
+
+    matches->clear();
+    int remaining = max_matches_;
+    for (int i = 0; i < num_chunks_ && remaining > 0; ++i) {
+      const vector<uint32>& chunk = chunks_[i].matches;
+      int count = min<int>(chunk.size(), remaining);
+      matches->insert(matches->end(), chunk.begin(), chunk.begin() + count);
+      remaining -= count;
+    }
+  }
+
+ private:
+  struct Chunk {
+    Chunk() : done(false) {}
+
+    bool done;
+    vector<uint32> matches;
+  };
+
+  // Scans chunks until there are none left to scan.
+  void Scan() {
+    Scanner scanner(query_);
+    int chunk;
+    vector<uint32> matches;
+    while ((chunk = NextChunk()) != -1) {
+      uint32 begin = chunk * chunk_size_;
+      uint32 end = min(size_, begin + chunk_size_);
+      matches.clear();
+      scanner.Scan(begin, end, max_matches_, &matches);
+      Finish(chunk, &matches);
+    }
+  }
+
+  // Scans on a thread of the pool, and tells Run when it is done.
+  void Help() {
+    Scan();
+    finished_.Unlock();
+  }
+
+  // Returns the next chunk to scan, or -1 if there are no more.
+  int NextChunk() {
+    gtags::MutexLock lock(&mu_);
+    if (next_chunk_ >= stop_chunk_)
+      return -1;
+    return next_chunk_++;
+  }
+
+  // Stores the MATCHES of CHUNK, and stops the scan once the chunks
+  // before the first unfinished one have enough matches.
+  void Finish(int chunk, vector<uint32>* matches) {
+    gtags::MutexLock lock(&mu_);
+    chunks_[chunk].matches.swap(*matches);
+    chunks_[chunk].done = true;
+    while (complete_matches_ < max_matches_ &&
+           complete_chunks_ < num_chunks_ && chunks_[complete_chunks_].done) {
+      complete_matches_ += chunks_[complete_chunks_].matches.size();
+      ++complete_chunks_;
+    }
+    if (complete_matches_ >= max_matches_)
+      stop_chunk_ = min(stop_chunk_, complete_chunks_);
+  }
+
+  const typename Scanner::Query& query_;
+  uint32 size_;
+  int max_matches_;
+  uint32 chunk_size_;
+  int num_chunks_;
+  vector<Chunk> chunks_;
+
+  // Protects the members below, and the done flags of chunks_.
+  gtags::Mutex mu_;
+  // The next chunk to hand out.
+  int next_chunk_;
+  // No chunk from this one on needs to be scanned.
+  int stop_chunk_;
+  // The first complete_chunks_ chunks are done, and hold
+  // complete_matches_ matches between them.
+  int complete_chunks_;
+  int complete_matches_;
+
+  // Unlocked by each thread of the pool as it finishes.
+  gtags::Semaphore finished_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ParallelScan);
+};
+
+#endif  // TOOLS_TAGS_PARALLELSCAN_H__
@@ -0,0 +1,102 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "gtagsunit.h"
+#include "parallelscan.h"
+
+#include "mutex.h"
+#include "workerpool.h"
+
+namespace {
+
+// Matches the multiples of a number, and counts the positions it
+// looks at.
+class MultipleScanner {
+ public:
+  struct Query {
+    uint32 divisor;
+    gtags::Mutex* mu;
+    int* scanned;
+  };
+
+  explicit MultipleScanner(const Query& query) : query_(query) {}
+
+  void Scan(uint32 begin, uint32 end, size_t max_matches,
+            vector<uint32>* matches) {
+    {
+      gtags::MutexLock lock(query_.mu);
+      *query_.scanned += end - begin;
+    }
+    for (uint32 i = begin; i < end && matches->size() < max_matches; ++i) {
+      if (i % query_.divisor == 0)
+        matches->push_back(i);
+    }
+  }
+
+ private:
+  const Query& query_;
+};
+
+// Returns the first MAX_MATCHES multiples of DIVISOR below SIZE, found
+// with a ParallelScan on POOL, and stores the number of positions
+// scanned in SCANNED.
+vector<uint32> Multiples(WorkerPool* pool, uint32 divisor, uint32 size,
+                         int max_matches, int* scanned) {
+  gtags::Mutex mu;
+  *scanned = 0;
+  MultipleScanner::Query query = { divisor, &mu, scanned };
+  vector<uint32> matches;
+  ParallelScan<MultipleScanner>(query, size, max_matches, 10).Run(pool,
+                                                                  &matches);
+  return matches;
+}
+
+TEST(ParallelScanTest, MatchesInOrder) {
+  WorkerPool pool(3);
+  int scanned;
+  for (int threads = 0; threads < 2; ++threads) {
+    vector<uint32> matches =
+        Multiples(threads ? &pool : NULL, 7, 1000, 1000, &scanned);
+    EXPECT_EQ(1000, scanned);
+    ASSERT_EQ(143, matches.size());
+    for (size_t i = 0; i < matches.size(); ++i)
+      EXPECT_EQ(7 * i, matches[i]);
+  }
+}
+
+TEST(ParallelScanTest, StopsAtMaxMatches) {
+  WorkerPool pool(3);
+  int scanned;
+  vector<uint32> matches = Multiples(&pool, 3, 100000, 50, &scanned);
+  ASSERT_EQ(50, matches.size());
+  EXPECT_EQ(147, matches.back());
+  // Each thread may have started one chunk too many.
+  EXPECT_LE(scanned, 150 + 4 * 10);
+
+  matches = Multiples(NULL, 3, 100000, 50, &scanned);
+  EXPECT_EQ(50, matches.size());
+  EXPECT_EQ(150, scanned);
+}
+
+TEST(ParallelScanTest, Empty) {
+  int scanned;
+  EXPECT_EQ(0, Multiples(NULL, 3, 0, 50, &scanned).size());
+  EXPECT_EQ(0, scanned);
+}
+
+}  // namespace
@@ -53,12 +53,22 @@ class Pollable {
 
   virtual int fd() const { return fd_; }
 
+  // Returns true if HandleWrite should be called when fd_ can be
+  // written to. The PollServer asks before each poll, so a Pollable
+  // with nothing to write can return false rather than have poll
+  // return at once every time.
+  virtual bool WantsWrite() const { return true; }
+
  protected:
   // We provide empty implementations for these handlers because not all
   // Pollables need to read/write.  This allows subclasses to override handlers
   // when needed.
   virtual void HandleRead() {}
   virtual void HandleWrite() {}
+  // Called when poll reports an error on fd_. poll keeps reporting it
+  // until fd_ is unregistered, so Pollables which may see errors
+  // should override this.
+  virtual void HandleError() {}
 
   int fd_;
   PollServer *ps_;
@@ -112,6 +112,9 @@ void PollServer::Loop() {
 }
 
 void PollServer::LoopOnce(int timeout) {
+  for (int i = 0; i < num_fds_; ++i)
+    fds_[i].events = pollables_[i]->WantsWrite() ? POLLIN | POLLOUT : POLLIN;
+
   int result = poll(fds_, num_fds_, timeout);
   if (result == -1) {
     LOG(WARNING) << "Error occurred while polling";
@@ -151,6 +154,11 @@ void PollServer::HandlePollEvents(int num_events) {
       pollables_[i]->HandleWrite();
       had_event = true;
     }
+    // Errors are reported whatever the pollable asked for.
+    if (i < num_fds_ && fds_[i].revents & (POLLERR | POLLNVAL)) {
+      pollables_[i]->HandleError();
+      had_event = true;
+    }
 
     if (had_event)
       --num_events;
@@ -19,6 +19,8 @@
 #include "gtagsunit.h"
 #include "pollserver.h"
 
+#include <unistd.h>
+
 #include "callback.h"
 #include "pollable.h"
 
@@ -100,6 +102,80 @@ TEST(PollServerTest, CapacityTest) {
   }  // guarantee destruction of Pollables before PollServer
 }
 
+// Counts the calls to HandleWrite, which it only wants when
+// wants_write_ is set.
+class WriteCountingPollable : public Pollable {
+ public:
+  WriteCountingPollable(int fd, PollServer *pollserver)
+      : Pollable(fd, pollserver), wants_write_(true), writes_(0) {}
+
+  virtual bool WantsWrite() const { return wants_write_; }
+
+  bool wants_write_;
+  int writes_;
+
+ protected:
+  virtual void HandleWrite() { writes_++; }
+};
+
+TEST(PollServerTest, WantsWriteTest) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  LoopCountingPollServer pollserver(1);
+
+  {
+    // The write end of an empty pipe can always be written to.
+    WriteCountingPollable pollable(fds[1], &pollserver);
+    pollserver.LoopFor(2);
+    EXPECT_EQ(2, pollable.writes_);
+
+    pollable.wants_write_ = false;
+    pollserver.LoopFor(2);
+    EXPECT_EQ(2, pollable.writes_);
+
+    pollable.wants_write_ = true;
+    pollserver.LoopFor(1);
+    EXPECT_EQ(3, pollable.writes_);
+  }  // guarantee destruction of Pollables before PollServer
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Counts the calls to HandleError.
+class ErrorCountingPollable : public Pollable {
+ public:
+  ErrorCountingPollable(int fd, PollServer *pollserver)
+      : Pollable(fd, pollserver), errors_(0) {}
+
+  virtual bool WantsWrite() const { return false; }
+
+  int errors_;
+
+ protected:
+  virtual void HandleError() { errors_++; }
+};
+
+TEST(PollServerTest, HandleErrorTest) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  LoopCountingPollServer pollserver(1);
+
+  {
+    ErrorCountingPollable pollable(fds[1], &pollserver);
+    pollserver.LoopFor(1);
+    EXPECT_EQ(0, pollable.errors_);
+
+    // The write end of a pipe is in error once the read end is closed,
+    // even though nothing is to be written.
+    close(fds[0]);
+    pollserver.LoopFor(2);
+    EXPECT_EQ(2, pollable.errors_);
+  }  // guarantee destruction of Pollables before PollServer
+
+  close(fds[1]);
+}
+
 TEST(PollServerTest, LoopCallbackTest) {
   LoopCountingPollServer pollserver(0);
   CallbackCounter counter;
@@ -0,0 +1,107 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+// Author: stephenchen@google.com (Stephen Chen)
+
+#include "regexp.h"
+
+#include <string.h>
+
+#include "automaton.h"
+
+RegExp::RegExp(const string& re)
+    : pattern_(re), error_(false), automaton_(NULL), partial_(NULL),
+      full_(NULL) {
+  if (regcomp(&reg_, re.c_str(), REG_EXTENDED)) {
+    LOG(WARNING) << "Corrupted regular expression: " << re << "\n";
+    error_ = true;
+    return;
+  }
+  // Only expressions that regcomp accepts are given to the automaton,
+  // which is not as strict.
+  automaton_ = RegexpAutomaton::Compile(re);
+}
+
+RegExp::~RegExp() {
+  delete full_;
+  delete partial_;
+  delete automaton_;
+  if (!error_)
+    regfree(&reg_);
+}
+
+bool RegExp::PartialMatch(const char* str) {
+  if (error_)
+    return false;
+  if (automaton_ != NULL) {
+    if (partial_ == NULL)
+      partial_ = new RegexpDFA(automaton_, true);
+    return partial_->Match(str);
+  }
+  // We don't need the position of the match, so regexec can stop at
+  // the first one it finds.
+  return regexec(&reg_, str, 0, NULL, 0) == 0;
+}
+
+bool RegExp::FullMatch(const char* str) {
+  if (error_)
+    return false;
+  if (automaton_ != NULL) {
+    if (full_ == NULL)
+      full_ = new RegexpDFA(automaton_, false);
+    return full_->Match(str);
+  }
+  // The leftmost-longest match is all of STR if anything is.
+  regmatch_t match;
+  return regexec(&reg_, str, 1, &match, 0) == 0
+      && match.rm_so == 0
+      && match.rm_eo == static_cast<regoff_t>(strlen(str));
+}
+
+// ***** RegExpCache
+
+RegExpCache::RegExpCache(int capacity) : capacity_(capacity) {}
+
+RegExpCache::~RegExpCache() {
+  for (LRUList::iterator i = lru_.begin(); i != lru_.end(); ++i)
+    delete *i;
+}
+
+RegExp* RegExpCache::Acquire(const string& pattern) {
+  {
+    gtags::MutexLock lock(&mu_);
+    IdleMap::iterator idle = idle_.find(pattern);
+    if (idle != idle_.end()) {
+      RegExp* regexp = *idle->second;
+      lru_.erase(idle->second);
+      idle_.erase(idle);
+      return regexp;
+    }
+  }
+  return new RegExp(pattern);
+}
+
+void RegExpCache::Release(RegExp* regexp) {
+  RegExp* evicted = NULL;
+  {
+    gtags::MutexLock lock(&mu_);
+    lru_.push_front(regexp);
+    idle_.insert(make_pair(regexp->pattern(), lru_.begin()));
+    if (lru_.size() > static_cast<size_t>(capacity_)) {
+      evicted = lru_.back();
+      pair<IdleMap::iterator, IdleMap::iterator> range =
+          idle_.equal_range(evicted->pattern());
+      for (IdleMap::iterator i = range.first; i != range.second; ++i) {
+        if (*i->second == evicted) {
+          idle_.erase(i);
+          break;
+        }
+      }
+      lru_.pop_back();
+    }
+  }
+  delete evicted;
+}
+
+int RegExpCache::size() {
+  gtags::MutexLock lock(&mu_);
+  return lru_.size();
+}
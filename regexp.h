@@ -1,66 +1,133 @@
 // Copyright 2007 Google Inc. All Rights Reserved.
 // Author: stephenchen@google.com (Stephen Chen)
+//
+// RegExp matches strings against a POSIX extended regular
+// expression. Expressions that RegexpAutomaton supports (see
+// automaton.h), which are nearly all of those used in queries, are
+// matched with a lazily built DFA; others with regexec. A RegExp is
+// not thread-safe, since the DFA is built while matching.
+//
+// RegExpCache keeps compiled RegExps around for reuse, so that a
+// query for a recently used pattern starts with a warm DFA instead of
+// compiling the pattern again.
 
 #ifndef TOOLS_TAGS_REGEXP_H__
 #define TOOLS_TAGS_REGEXP_H__
 
 #include <regex.h>
+#include <list>
+#include <string>
+#include <ext/hash_map>
+
+#include "mutex.h"
+#include "strutil.h"
 #include "tagsutil.h"
 
+class RegexpAutomaton;
+class RegexpDFA;
+
 class RegExp {
+ public:
+  RegExp(const string& re);
+
+  ~RegExp();
+
+  bool error() const {
+    return error_;
+  }
+
+  const string& pattern() const {
+    return pattern_;
+  }
+
+  // Returns the automaton for the expression, or NULL if it isn't
+  // supported. Unlike the RegExp, the automaton may be shared between
+  // threads.
+  const RegexpAutomaton* automaton() const {
+    return automaton_;
+  }
+
+  // Returns true if any substring of STR matches.
+  bool PartialMatch(const char* str);
+  bool PartialMatch(const string& str) {
+    return PartialMatch(str.c_str());
+  }
+
+  // Returns true if all of STR matches.
+  bool FullMatch(const char* str);
+  bool FullMatch(const string& str) {
+    return FullMatch(str.c_str());
+  }
 
  private:
+  string pattern_;
   regex_t reg_;
   bool error_;
 
+  // The automaton for the expression, or NULL if it isn't supported,
+  // and the DFAs running it for each kind of match, built on first
+  // use.
+  RegexpAutomaton* automaton_;
+  RegexpDFA* partial_;
+  RegexpDFA* full_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RegExp);
+};
+
+// A bounded cache of compiled RegExps which aren't in use, evicting
+// the least recently used. Since a RegExp can't be shared between
+// threads, each user gets one to itself from Acquire and hands it
+// back with Release; a pattern used on several threads at once is
+// compiled once for each. Thread-safe.
+class RegExpCache {
  public:
-  RegExp(const string & re) : error_(false) {
-    if (regcomp(&reg_, re.c_str(), REG_EXTENDED)) {
-      LOG(WARNING) << "Corrupted regular expression: " << re << "\n";
-      error_ = true;
-    }
-  }
+  // Creates a cache keeping up to CAPACITY RegExps.
+  explicit RegExpCache(int capacity);
+  ~RegExpCache();
 
-  ~RegExp() {
-    regfree(&reg_);
-  }
+  // Returns a RegExp for PATTERN, which may have an error, compiling
+  // it if no idle one is cached.
+  RegExp* Acquire(const string& pattern);
 
-  bool error() {
-    return error_;
-  }
+  // Returns REGEXP, which was returned by Acquire, to the cache.
+  void Release(RegExp* regexp);
+
+  // Returns the number of idle RegExps in the cache.
+  int size();
+
+ private:
+  typedef list<RegExp*> LRUList;
+  typedef hash_multimap<string, LRUList::iterator> IdleMap;
 
-  // In PartialMatch and FullMatch:
-  // nsub is the quantity of sub-expressions (parenthesis) in the regular
-  // expression.
-  // pmat is the structure that regexec uses to return the position of the match
-  // regexec returns 0 if there is a match and != 0 if not
-  // pmat[0].rm_eo and pmat[0].rm_so are the end and the beginning of the
-  // regular expression match
-
-  bool PartialMatch(const string & str) {
-    // If any substring of str matches, return true
-    int nsub = reg_.re_nsub+1;
-    regmatch_t *pmat;
-    pmat = (regmatch_t *) malloc(sizeof(regmatch_t)*nsub);
-    bool match = (regexec(&reg_, str.c_str(), nsub, pmat, 0) == 0);
-    free(pmat);
-    return match;
+  int capacity_;
+  gtags::Mutex mu_;
+  // Idle RegExps, most recently released first.
+  LRUList lru_;
+  // The entries of lru_, by pattern.
+  IdleMap idle_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RegExpCache);
+};
+
+// Holds a RegExp from a RegExpCache for the lifetime of the object.
+class CachedRegExp {
+ public:
+  CachedRegExp(RegExpCache* cache, const string& pattern)
+      : cache_(cache), regexp_(cache->Acquire(pattern)) {}
+
+  ~CachedRegExp() {
+    cache_->Release(regexp_);
   }
 
-  bool FullMatch(const string & str) {
-    // If str matches, return true
-    int nsub = reg_.re_nsub+1;
-    regmatch_t *pmat;
-    pmat = (regmatch_t *) malloc(sizeof(regmatch_t)*nsub);
-    // It matches
-    bool match = (regexec(&reg_, str.c_str(), nsub, pmat, 0) == 0);
-    bool ret = false;
-    // From the begginning to the end of str
-    if (match) ret = ((pmat[0].rm_eo - pmat[0].rm_so) == str.size());
-
-    free(pmat);
-    return ret;
+  RegExp* operator->() const {
+    return regexp_;
   }
+
+ private:
+  RegExpCache* cache_;
+  RegExp* regexp_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(CachedRegExp);
 };
 
 #endif  // TOOLS_TAGS_REGEXP_H__
@@ -0,0 +1,66 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+// Author: stephenchen@google.com (Stephen Chen)
+
+#include "gtagsunit.h"
+#include "regexp.h"
+
+namespace {
+
+TEST(RegExpTest, Matches) {
+  // Both an expression the DFA runs and one only regexec supports.
+  const char* patterns[] = { "Tags?Reader", "\\<Tags?Reader" };
+  for (int i = 0; i < 2; ++i) {
+    RegExp regexp(patterns[i]);
+    EXPECT_FALSE(regexp.error());
+    EXPECT_TRUE(regexp.FullMatch("TagsReader"));
+    EXPECT_TRUE(regexp.FullMatch(string("TagReader")));
+    EXPECT_FALSE(regexp.FullMatch("TagsReaders"));
+    EXPECT_TRUE(regexp.PartialMatch("class TagsReader {"));
+    EXPECT_TRUE(regexp.PartialMatch(string("TagReader")));
+    EXPECT_FALSE(regexp.PartialMatch("class TagsWriter {"));
+  }
+  EXPECT_TRUE(RegExp("Tags").automaton() != NULL);
+  EXPECT_TRUE(RegExp("\\<Tags").automaton() == NULL);
+}
+
+TEST(RegExpTest, Error) {
+  RegExp regexp("(unbalanced");
+  EXPECT_TRUE(regexp.error());
+  EXPECT_FALSE(regexp.PartialMatch("(unbalanced"));
+  EXPECT_FALSE(regexp.FullMatch("(unbalanced"));
+}
+
+TEST(RegExpCacheTest, ReusesIdleRegExps) {
+  RegExpCache cache(2);
+  RegExp* foo = cache.Acquire("foo");
+  // A RegExp in use is never handed out twice.
+  RegExp* foo2 = cache.Acquire("foo");
+  EXPECT_TRUE(foo != foo2);
+  cache.Release(foo);
+  cache.Release(foo2);
+  EXPECT_EQ(2, cache.size());
+
+  RegExp* again = cache.Acquire("foo");
+  EXPECT_TRUE(again == foo || again == foo2);
+  EXPECT_EQ("foo", again->pattern());
+  EXPECT_EQ(1, cache.size());
+  cache.Release(again);
+
+  // The least recently released RegExp is evicted.
+  RegExp* bar = cache.Acquire("bar");
+  EXPECT_EQ("bar", bar->pattern());
+  cache.Release(bar);
+  EXPECT_EQ(2, cache.size());
+  RegExp* other = cache.Acquire("foo");
+  EXPECT_TRUE(other == again);
+  cache.Release(other);
+
+  {
+    CachedRegExp cached(&cache, "bar");
+    EXPECT_TRUE(cached->FullMatch("bar"));
+    EXPECT_EQ(1, cache.size());
+  }
+  EXPECT_EQ(2, cache.size());
+}
+
+}  // namespace
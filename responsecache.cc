@@ -0,0 +1,95 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include "responsecache.h"
+
+// Bookkeeping overhead of an entry: the list node, the hash table
+// node and the two string headers.
+static const int64 kEntryOverhead = 64;
+
+ResponseCache::ResponseCache(int64 max_bytes)
+    : max_bytes_(max_bytes), generation_(-1), bytes_used_(0), hits_(0),
+      misses_(0) {}
+
+bool ResponseCache::Lookup(const string& key, int64 generation,
+                           string* response) {
+  gtags::MutexLock lock(&mu_);
+  AdvanceGeneration(generation);
+  EntryMap::iterator entry = entries_.find(key);
+  if (generation != generation_ || entry == entries_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  lru_.splice(lru_.begin(), lru_, entry->second);
+  response->append(entry->second->second);
+  return true;
+}
+
+void ResponseCache::Insert(const string& key, int64 generation,
+                           const string& response) {
+  int64 bytes = EntryBytes(key, response);
+  if (bytes > max_bytes_)
+    return;
+
+  gtags::MutexLock lock(&mu_);
+  if (generation != generation_ || entries_.find(key) != entries_.end())
+    return;
+
+  lru_.push_front(make_pair(key, response));
+  entries_[key] = lru_.begin();
+  bytes_used_ += bytes;
+  while (bytes_used_ > max_bytes_) {
+    const pair<string, string>& evicted = lru_.back();
+    bytes_used_ -= EntryBytes(evicted.first, evicted.second);
+    entries_.erase(evicted.first);
+    lru_.pop_back();
+  }
+}
+
+int64 ResponseCache::hits() {
+  gtags::MutexLock lock(&mu_);
+  return hits_;
+}
+
+int64 ResponseCache::misses() {
+  gtags::MutexLock lock(&mu_);
+  return misses_;
+}
+
+int ResponseCache::size() {
+  gtags::MutexLock lock(&mu_);
+  return lru_.size();
+}
+
+int64 ResponseCache::bytes_used() {
+  gtags::MutexLock lock(&mu_);
+  return bytes_used_;
+}
+
+int64 ResponseCache::EntryBytes(const string& key, const string& response) {
+  return key.size() + response.size() + kEntryOverhead;
+}
+
+void ResponseCache::AdvanceGeneration(int64 generation) {
+  if (generation <= generation_)
+    return;
+  entries_.clear();
+  lru_.clear();
+  bytes_used_ = 0;
+  generation_ = generation;
+}
@@ -0,0 +1,91 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//
+// ResponseCache keeps the rendered responses to recent queries, so
+// that a query which is repeated while the table is unchanged is
+// answered without searching the table or formatting the results
+// again.
+//
+// Responses are stored with the generation of the TagsTable (see
+// TagsTable::generation) they were computed from. Once a lookup
+// comes from a newer generation, every response is stale and the
+// whole cache is dropped. Responses computed at any other generation
+// than the latest looked up are not stored, so a slow query which
+// finishes after an update can't bring the cache back to the old
+// table. Otherwise the least recently used responses are evicted to
+// keep the cache under a size limit.
+
+#ifndef TOOLS_TAGS_RESPONSECACHE_H__
+#define TOOLS_TAGS_RESPONSECACHE_H__
+
+#include <list>
+#include <string>
+#include <ext/hash_map>
+
+#include "mutex.h"
+#include "strutil.h"
+#include "tagsutil.h"
+
+class ResponseCache {
+ public:
+  // Creates a cache holding at most MAX_BYTES of keys and responses.
+  explicit ResponseCache(int64 max_bytes);
+
+  // If the response to KEY computed at generation GENERATION is
+  // cached, appends it to RESPONSE and returns true. Drops the cached
+  // responses if GENERATION is newer than theirs.
+  bool Lookup(const string& key, int64 generation, string* response);
+
+  // Stores RESPONSE as the response to KEY at generation GENERATION,
+  // unless GENERATION isn't the one of the latest lookups.
+  void Insert(const string& key, int64 generation, const string& response);
+
+  // Accessors for server statistics.
+  int64 hits();
+  int64 misses();
+  // Number of cached responses.
+  int size();
+  // Approximate memory used by the cached responses.
+  int64 bytes_used();
+
+ private:
+  typedef list<pair<string, string> > LRUList;
+  typedef hash_map<string, LRUList::iterator> EntryMap;
+
+  // Returns the memory accounted for an entry.
+  static int64 EntryBytes(const string& key, const string& response);
+
+  // Drops every entry if GENERATION is newer than the generation of
+  // the cached responses, and makes it the current one. Requires mu_.
+  void AdvanceGeneration(int64 generation);
+
+  int64 max_bytes_;
+  gtags::Mutex mu_;
+  // Generation of the table the cached responses were computed from.
+  int64 generation_;
+  // (key, response) pairs, most recently used first.
+  LRUList lru_;
+  // The entries of lru_, by key.
+  EntryMap entries_;
+  int64 bytes_used_;
+  int64 hits_;
+  int64 misses_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ResponseCache);
+};
+
+#endif  // TOOLS_TAGS_RESPONSECACHE_H__
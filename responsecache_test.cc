@@ -0,0 +1,87 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include "gtagsunit.h"
+#include "responsecache.h"
+
+namespace {
+
+TEST(ResponseCacheTest, LookupAndInsert) {
+  ResponseCache cache(1 << 20);
+  string response = "(";
+  EXPECT_FALSE(cache.Lookup("foo", 1, &response));
+  cache.Insert("foo", 1, "\"bar\")");
+  EXPECT_TRUE(cache.Lookup("foo", 1, &response));
+  EXPECT_EQ("(\"bar\")", response);
+  EXPECT_FALSE(cache.Lookup("bar", 1, &response));
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(2, cache.misses());
+  EXPECT_EQ(1, cache.size());
+  EXPECT_TRUE(cache.bytes_used() > 0);
+}
+
+TEST(ResponseCacheTest, DropsOtherGenerations) {
+  ResponseCache cache(1 << 20);
+  string response;
+  EXPECT_FALSE(cache.Lookup("foo", 1, &response));
+  cache.Insert("foo", 1, "bar");
+  EXPECT_FALSE(cache.Lookup("foo", 2, &response));
+  EXPECT_EQ(0, cache.size());
+  EXPECT_EQ(0, cache.bytes_used());
+  // Going back doesn't bring stale responses back either.
+  EXPECT_FALSE(cache.Lookup("foo", 1, &response));
+}
+
+// A query which started before an update and finishes after it
+// neither stores its response nor drops the newer ones.
+TEST(ResponseCacheTest, DropsStaleInserts) {
+  ResponseCache cache(1 << 20);
+  string response;
+  EXPECT_FALSE(cache.Lookup("old", 1, &response));
+  EXPECT_FALSE(cache.Lookup("new", 2, &response));
+  cache.Insert("new", 2, "bar");
+  cache.Insert("old", 1, "foo");
+  EXPECT_EQ(1, cache.size());
+  EXPECT_TRUE(cache.Lookup("new", 2, &response));
+  EXPECT_EQ("bar", response);
+  EXPECT_FALSE(cache.Lookup("old", 1, &response));
+  EXPECT_FALSE(cache.Lookup("old", 2, &response));
+  EXPECT_EQ(1, cache.size());
+}
+
+TEST(ResponseCacheTest, EvictsLeastRecentlyUsed) {
+  string big(1000, 'x');
+  ResponseCache cache(2500);
+  string response;
+  EXPECT_FALSE(cache.Lookup("a", 1, &response));
+  cache.Insert("a", 1, big);
+  cache.Insert("b", 1, big);
+  EXPECT_TRUE(cache.Lookup("a", 1, &response));
+  cache.Insert("c", 1, big);
+  EXPECT_EQ(2, cache.size());
+  EXPECT_TRUE(cache.Lookup("a", 1, &response));
+  EXPECT_FALSE(cache.Lookup("b", 1, &response));
+  EXPECT_TRUE(cache.Lookup("c", 1, &response));
+  EXPECT_TRUE(cache.bytes_used() <= 2500);
+
+  // Responses which don't fit at all aren't stored.
+  cache.Insert("d", 1, string(3000, 'x'));
+  EXPECT_FALSE(cache.Lookup("d", 1, &response));
+  EXPECT_EQ(2, cache.size());
+}
+
+}  // namespace
@@ -94,7 +94,8 @@ bool SExpression::TokenIsInteger(const char* str) {
   return IsIntToken(str);
 }
 
-SExpression* SExpression::ParseSexp(CharacterIterator* psexp) {
+template<class CharIterator>
+SExpression* SExpression::ParseSexp(CharIterator* psexp) {
   SkipWhitespace(psexp);
 
   switch (**psexp) {
@@ -106,7 +107,8 @@ SExpression* SExpression::ParseSexp(CharacterIterator* psexp) {
   }
 }
 
-SExpression* SExpression::ParseList(CharacterIterator* psexp) {
+template<class CharIterator>
+SExpression* SExpression::ParseList(CharIterator* psexp) {
   CHECK_EQ('(', **psexp);
   ++(*psexp);
   SkipWhitespace(psexp);
@@ -169,7 +171,8 @@ SExpression* SExpression::ParseList(CharacterIterator* psexp) {
   return answer;
 }
 
-SExpression* SExpression::ParseString(CharacterIterator* psexp) {
+template<class CharIterator>
+SExpression* SExpression::ParseString(CharIterator* psexp) {
   string str_value;
   if (FillWithDelimitedString('"', psexp, &str_value))
     return new SExpressionString(str_value);
@@ -177,7 +180,8 @@ SExpression* SExpression::ParseString(CharacterIterator* psexp) {
     return false;
 }
 
-SExpression* SExpression::ParseSymbolInBars(CharacterIterator* psexp) {
+template<class CharIterator>
+SExpression* SExpression::ParseSymbolInBars(CharIterator* psexp) {
   string symbol_name;
   if (FillWithDelimitedString('|', psexp, &symbol_name))
     return new SExpressionSymbol(symbol_name);
@@ -185,7 +189,8 @@ SExpression* SExpression::ParseSymbolInBars(CharacterIterator* psexp) {
     return false;
 }
 
-SExpression* SExpression::ParseUnquotedToken(CharacterIterator* psexp) {
+template<class CharIterator>
+SExpression* SExpression::ParseUnquotedToken(CharIterator* psexp) {
   string token;
   bool has_escaped_char = false;
 
@@ -215,8 +220,9 @@ SExpression* SExpression::ParseUnquotedToken(CharacterIterator* psexp) {
     return new SExpressionSymbol(token_cstr);
 }
 
+template<class CharIterator>
 bool SExpression::FillWithDelimitedString(char delimiter,
-                                          CharacterIterator* psexp,
+                                          CharIterator* psexp,
                                           string* str) {
   CHECK_EQ(delimiter, **psexp);
   ++(*psexp);
@@ -245,6 +251,10 @@ int SExpression::IntegerValue(const char* str) {
   return value;
 }
 
+// Instantiate the parser for the iterators we read from.
+template SExpression* SExpression::ParseSexp(StringCharacterIterator*);
+template SExpression* SExpression::ParseSexp(FileCharacterIterator*);
+
 // ***** SExpressionPair
 
 void SExpressionPair::WriteRepr(string* str) const {
@@ -177,13 +177,16 @@ class SExpression {
   }
 
   // Returns the first complete SExpression parsed from the text of
-  // the CharacterIterator. Advances the iterator to point to the
-  // first character after the s-exp. Returns NULL if no complete
-  // s-exp is found.
-  static SExpression* ParseSexp(CharacterIterator*);
+  // the character iterator (see iterators.h). Advances the iterator
+  // to point to the first character after the s-exp. Returns NULL if
+  // no complete s-exp is found. Instantiated for
+  // StringCharacterIterator and FileCharacterIterator.
+  template<class CharIterator>
+  static SExpression* ParseSexp(CharIterator*);
 
   // ParseFromCharInterator is required by FileReader template class.
-  static SExpression* ParseFromCharIterator(CharacterIterator* iter) {
+  template<class CharIterator>
+  static SExpression* ParseFromCharIterator(CharIterator* iter) {
     return ParseSexp(iter);
   }
 
@@ -192,20 +195,24 @@ class SExpression {
   friend class FileReader<SExpression>;
 
   // Returns a new SExpression corresponding to the first s-exp of the
-  // given type in the CharacterIterator. Assumes there is no leading
+  // given type in the character iterator. Assumes there is no leading
   // whitespace. Modifies the iterator pointer to point to the first
   // character after the s-exp. If no complete s-exp of the given type
   // is found, we return NULL, and the position of the iterator is
   // unspecified.
 
   // Pairs, lists, and dotted (improper) lists
-  static SExpression* ParseList(CharacterIterator*);
+  template<class CharIterator>
+  static SExpression* ParseList(CharIterator*);
   // Quoted strings like "this"
-  static SExpression* ParseString(CharacterIterator*);
+  template<class CharIterator>
+  static SExpression* ParseString(CharIterator*);
   // Symbols in bar notation like |this one|
-  static SExpression* ParseSymbolInBars(CharacterIterator*);
+  template<class CharIterator>
+  static SExpression* ParseSymbolInBars(CharIterator*);
   // Symbols not in bars, and numeric literals
-  static SExpression* ParseUnquotedToken(CharacterIterator*);
+  template<class CharIterator>
+  static SExpression* ParseUnquotedToken(CharIterator*);
 
   // Finds the string in *psexp bounded by the specified delimiter and
   // appends it to str. Advances the pointer to point to the first
@@ -219,8 +226,9 @@ class SExpression {
   //        puts "quoted" into str
   // e.g. FillWithDelimitedString('|', "|symbol|", str)
   //        puts "symbol" into str
+  template<class CharIterator>
   static bool FillWithDelimitedString(char delimiter,
-                                      CharacterIterator* psexp,
+                                      CharIterator* psexp,
                                       string* str);
 
   // Returns an int corresponding to the string, provided IsInteger is
@@ -400,7 +408,7 @@ class SExpressionString : public SExpression {
   // Prints string with c-style escapes.
   virtual void WriteRepr(string* str) const {
     str->push_back('"');
-    str->append(CEscape(value_));
+    CEscapeAppend(value_.data(), value_.size(), str);
     str->push_back('"');
   }
 
@@ -0,0 +1,187 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+namespace {
+
+const char kSnapshotMagic[8] = { 'G', 'T', 'A', 'G', 'S', 'N', 'A', 'P' };
+const uint32 kSnapshotVersion = 1;
+const uint32 kSnapshotByteOrder = 0x01020304;
+
+const char kPadding[8] = { 0 };
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(const string& filename)
+    : filename_(filename), temp_filename_(filename + ".tmp"),
+      file_(fopen(temp_filename_.c_str(), "wb")), ok_(file_ != NULL),
+      position_(0), current_section_(-1) {
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kSnapshotMagic, sizeof(header_.magic));
+  header_.version = kSnapshotVersion;
+  header_.byte_order = kSnapshotByteOrder;
+  if (!ok_) {
+    LOG(WARNING) << "Unable to create snapshot " << temp_filename_;
+    return;
+  }
+  // Leave room for the header, which is written by Finish once the
+  // section offsets are known.
+  Append(&header_, sizeof(header_));
+  Align();
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (file_ != NULL) {
+    fclose(file_);
+    unlink(temp_filename_.c_str());
+  }
+}
+
+void SnapshotWriter::BeginSection(SnapshotSection section) {
+  EndSection();
+  CHECK_EQ(header_.sections[section].offset, 0)
+    << "Snapshot section " << section << " written twice";
+  current_section_ = section;
+  header_.sections[section].offset = position_;
+}
+
+void SnapshotWriter::Append(const void* data, int64 size) {
+  if (ok_ && size > 0
+      && fwrite(data, 1, size, file_) != static_cast<size_t>(size))
+    ok_ = false;
+  position_ += size;
+}
+
+void SnapshotWriter::Align() {
+  if (position_ % 8 != 0)
+    Append(kPadding, 8 - position_ % 8);
+}
+
+void SnapshotWriter::EndSection() {
+  if (current_section_ < 0)
+    return;
+  header_.sections[current_section_].size
+      = position_ - header_.sections[current_section_].offset;
+  Align();
+  current_section_ = -1;
+}
+
+bool SnapshotWriter::Finish() {
+  EndSection();
+  if (ok_ && fseeko(file_, 0, SEEK_SET) != 0)
+    ok_ = false;
+  if (ok_ && fwrite(&header_, sizeof(header_), 1, file_) != 1)
+    ok_ = false;
+  // The data must be on disk before the rename makes it the snapshot.
+  if (ok_ && (fflush(file_) != 0 || fsync(fileno(file_)) != 0))
+    ok_ = false;
+  if (fclose(file_) != 0)
+    ok_ = false;
+  file_ = NULL;
+  if (ok_ && rename(temp_filename_.c_str(), filename_.c_str()) != 0) {
+    LOG(WARNING) << "Unable to rename " << temp_filename_ << " to "
+                 << filename_;
+    ok_ = false;
+  }
+  if (!ok_)
+    unlink(temp_filename_.c_str());
+  return ok_;
+}
+
+Snapshot::Snapshot() : data_(NULL), size_(0) { }
+
+Snapshot::~Snapshot() {
+  if (data_ != NULL)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+bool Snapshot::IsSnapshot(const string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  char magic[sizeof(kSnapshotMagic)];
+  bool retval = fread(magic, sizeof(magic), 1, file) == 1
+      && memcmp(magic, kSnapshotMagic, sizeof(magic)) == 0;
+  fclose(file);
+  return retval;
+}
+
+bool Snapshot::Open(const string& filename) {
+  CHECK(data_ == NULL) << "Snapshot is already open";
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(WARNING) << "Unable to open snapshot " << filename;
+    return false;
+  }
+  const int64 header_size = sizeof(SnapshotHeader);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < header_size) {
+    LOG(WARNING) << "Snapshot " << filename << " is truncated";
+    close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(WARNING) << "Unable to map snapshot " << filename;
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+
+  const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data_);
+  const char* error = NULL;
+  if (memcmp(header->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0)
+    error = "is not a snapshot";
+  else if (header->byte_order != kSnapshotByteOrder)
+    error = "was written on a machine with a different byte order";
+  else if (header->version != kSnapshotVersion)
+    error = "has an unsupported version";
+  for (int i = 0; error == NULL && i < NUM_SNAPSHOT_SECTIONS; ++i) {
+    if (header->sections[i].offset < header_size
+        || header->sections[i].size < 0
+        || header->sections[i].offset + header->sections[i].size > size_)
+      error = "is truncated or corrupt";
+  }
+  if (error != NULL) {
+    LOG(WARNING) << "Snapshot " << filename << " " << error;
+    munmap(data, size_);
+    data_ = NULL;
+    size_ = 0;
+    return false;
+  }
+  return true;
+}
+
+const char* Snapshot::section(SnapshotSection section) const {
+  const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data_);
+  return data_ + header->sections[section].offset;
+}
+
+int64 Snapshot::section_size(SnapshotSection section) const {
+  const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data_);
+  return header->sections[section].size;
+}
@@ -0,0 +1,178 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// A snapshot is a binary image of a loaded TagsTable, written by
+// gtagscompiler and memory-mapped read-only by gtags so that a server
+// can start serving without parsing the TAGS file. Several servers
+// on one host then share a single copy in the page cache.
+//
+// The file starts with a SnapshotHeader, followed by the sections
+// listed in SnapshotSection. Each section is an array of fixed-size
+// values aligned on an 8-byte boundary. Sections refer to each other
+// only by index or string id, never by address, so the file can be
+// mapped anywhere. Snapshots are only readable on machines with the
+// same byte order as the one that wrote them, and the version must
+// be bumped whenever the layout of any section changes.
+
+#ifndef TOOLS_TAGS_SNAPSHOT_H__
+#define TOOLS_TAGS_SNAPSHOT_H__
+
+#include <stdio.h>
+#include <string>
+
+#include "tagsutil.h"
+
+enum SnapshotSection {
+  // SymbolTable (see symboltable.h)
+  SNAPSHOT_SYMBOL_INFO,          // uint32 number of strings
+  SNAPSHOT_SYMBOL_PAGES,         // string records, page after page
+  SNAPSHOT_SYMBOL_PAGE_OFFSETS,  // int64 offset of each page in the above
+  SNAPSHOT_SYMBOL_PAGE_SIZES,    // uint32 bytes used in each page
+  SNAPSHOT_SYMBOL_TABLE,         // uint32 hash table slots
+
+  // TagsTable (see tagstable.h)
+  SNAPSHOT_TABLE_INFO,           // int64 creation time, uint32 flags
+  SNAPSHOT_TABLE_STRINGS,        // nul-terminated comment, corpus name
+                                 // and names of enabled features
+  SNAPSHOT_FILE_PATHS,           // nul-terminated path of each file id
+  SNAPSHOT_FILE_LOADED,          // unsigned char loaded flag per file id
+  SNAPSHOT_COLUMN_TYPE,
+  SNAPSHOT_COLUMN_CHARNO,
+  SNAPSHOT_COLUMN_LINENO,
+  SNAPSHOT_COLUMN_TAG,
+  SNAPSHOT_COLUMN_LINEREP,
+  SNAPSHOT_COLUMN_FILE,
+  SNAPSHOT_COLUMN_LANGUAGE,
+  SNAPSHOT_DEFINITIONS_INDEX,    // uint32 rows sorted by tag
+  SNAPSHOT_CALLERS_INDEX,        // uint32 rows sorted by tag
+
+  NUM_SNAPSHOT_SECTIONS
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32 version;
+  // kSnapshotByteOrder as written by the producing machine.
+  uint32 byte_order;
+  struct {
+    int64 offset;
+    int64 size;
+  } sections[NUM_SNAPSHOT_SECTIONS];
+};
+
+// Writes a snapshot file section by section. Sections may be written
+// in any order, but each one only once.
+//
+// The snapshot is written to a temporary file next to FILENAME, which
+// Finish renames over FILENAME. Servers which have the old snapshot
+// mapped keep reading the old file rather than one being rewritten
+// under them.
+class SnapshotWriter {
+ public:
+  // Creates FILENAME.tmp, to become FILENAME.
+  explicit SnapshotWriter(const string& filename);
+
+  // Closes and removes the temporary file if Finish wasn't called.
+  ~SnapshotWriter();
+
+  // Returns false if the file could not be created or written.
+  bool ok() const {
+    return ok_;
+  }
+
+  // Starts SECTION. Everything appended until the next BeginSection
+  // or Finish belongs to it.
+  void BeginSection(SnapshotSection section);
+
+  // Appends SIZE bytes at DATA to the current section.
+  void Append(const void* data, int64 size);
+
+  // Appends the COUNT elements at DATA to the current section.
+  template<class T>
+  void AppendArray(const T* data, int64 count) {
+    Append(data, count * sizeof(T));
+  }
+
+  // Pads the current section to a multiple of 8 bytes.
+  void Align();
+
+  // Writes the header, syncs and closes the file, and renames it to
+  // the snapshot's filename. Returns ok().
+  bool Finish();
+
+ private:
+  // Ends the current section, if any.
+  void EndSection();
+
+  string filename_;
+  string temp_filename_;
+  FILE* file_;
+  bool ok_;
+  int64 position_;
+  int current_section_;
+  SnapshotHeader header_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(SnapshotWriter);
+};
+
+// A snapshot file mapped read-only into memory.
+class Snapshot {
+ public:
+  Snapshot();
+
+  // Unmaps the file. Nothing pointing into the snapshot may be used
+  // afterwards.
+  ~Snapshot();
+
+  // Returns true if FILENAME starts with the snapshot magic number,
+  // whatever its version.
+  static bool IsSnapshot(const string& filename);
+
+  // Maps FILENAME. Returns false, logging the reason, if it can't be
+  // mapped or isn't a snapshot of the current version and byte order.
+  bool Open(const string& filename);
+
+  // Returns the size in bytes of the mapped file.
+  int64 size() const {
+    return size_;
+  }
+
+  // Returns the start and size in bytes of SECTION.
+  const char* section(SnapshotSection section) const;
+  int64 section_size(SnapshotSection section) const;
+
+  // Returns SECTION as an array of T, storing its length in COUNT.
+  // Returns NULL, logging why, if SECTION isn't a whole number of T.
+  template<class T>
+  const T* Array(SnapshotSection s, int64* count) const {
+    *count = section_size(s) / sizeof(T);
+    if (section_size(s) % sizeof(T) != 0) {
+      LOG(WARNING) << "Snapshot section " << s << " has a partial element";
+      return NULL;
+    }
+    return reinterpret_cast<const T*>(section(s));
+  }
+
+ private:
+  const char* data_;
+  int64 size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Snapshot);
+};
+
+#endif  // TOOLS_TAGS_SNAPSHOT_H__
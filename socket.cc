@@ -89,7 +89,7 @@ ListenerSocket* ListenerSocket::Create(
     return NULL;
   }
 
-  success = listen(fd, 3);
+  success = listen(fd, SOMAXCONN);
   CHECK_NE(success, -1) << "Listen failed " << ERROR_INFO;
 
   return new ListenerSocket(fd, pollserver, connected_callback);
@@ -100,8 +100,10 @@ void ListenerSocket::HandleRead() {
   socklen_t addrlen = sizeof(addr);
   int accepted_fd = accept(fd_, (struct sockaddr *)&addr, &addrlen);
 
-  if (accepted_fd == -1 && errno != EWOULDBLOCK) {
-    LOG(INFO) << "Unable to accept connection " << ERROR_INFO;
+  if (accepted_fd == -1) {
+    // The connection may have gone away since poll reported it.
+    if (errno != EWOULDBLOCK)
+      LOG(INFO) << "Unable to accept connection " << ERROR_INFO;
     return;
   }
 
@@ -18,7 +18,9 @@
 
 #include "socket_server.h"
 
-#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -26,62 +28,71 @@
 #include <unistd.h>
 #include <string>
 
+#include "callback.h"
+#include "pollserver.h"
+#include "socket.h"
 #include "tagsprofiler.h"
 #include "tagsoptionparser.h"
 #include "tagsrequesthandler.h"
+#include "workerpool.h"
 
 DEFINE_INT32(tags_port, 2222, "port to tags server");
+DEFINE_INT32(query_threads, 0,
+             "Number of threads answering lookups "
+             "(0 means one per processor)");
+DEFINE_INT32(slow_query_threads, 2,
+             "Number of threads answering requests which scan the table "
+             "or load a file, such as regexp and snippet searches");
 
-// Maximum length of a request
-const int kMaxTagLen = 512;
+using gtags::ConnectedSocket;
+using gtags::PollServer;
 
+namespace {
+
+// Returns the number of threads to answer lookups on.
+int QueryThreads() {
+  int num_threads = GET_FLAG(query_threads);
+  if (num_threads <= 0)
+    num_threads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  return num_threads;
+}
+
+// Answers a request that has been read from a connection, which it
+// closes once the response is written.
 class SocketIO : public IOInterface {
  public:
-  SocketIO(int listen_socket) {
-    // a_addr_ is not actually a sockaddr, so we need to measure its size
-    addrlen_ = sizeof(a_addr_);
-    connected_socket_ = accept(listen_socket,
-                              (struct sockaddr *)&a_addr_,
-                              &addrlen_);
-    source_ = inet_ntoa(a_addr_.sin_addr);
+  // Takes over CONNECTED_SOCKET, from which REQUEST was read. REQUEST
+  // must be shorter than kMaxTagLen.
+  SocketIO(int connected_socket, const string& source,
+           const string& request)
+      : connected_socket_(connected_socket), source_(source),
+        request_(request.c_str()) {
+    CHECK(request.size() < kMaxTagLen);
+    memcpy(buf_, request.data(), request.size());
+    buf_[request.size()] = '\0';
+    // The response is written in one go, however long it is.
+    fcntl(connected_socket_, F_SETFL,
+          fcntl(connected_socket_, F_GETFL) & ~O_NONBLOCK);
   }
 
   virtual ~SocketIO() {
-    if (connected_socket_ != -1) {
-      close(connected_socket_);
-    }
+    close(connected_socket_);
   }
 
-  virtual bool Input(char** input) {
-    if (connected_socket_ == -1) {
-      LOG(INFO) << "Connection error" << "\n";
-      return false;
-    }
-
-    int bytesread = recv(connected_socket_, buf_, kMaxTagLen, 0);
-
-    if ( bytesread == -1) {
-      LOG(INFO) << "Error receiving" << "\n";
-      return false;
-    }
-
-    LOG(INFO) << "bytes read: " << bytesread << "\n";
-
-    // strip off \n\r and null terminate the string
-    if (bytesread >= 2 && buf_[bytesread - 1] == '\n'
-        && buf_[bytesread - 2] == '\r') {
-      buf_[bytesread - 2] = '\0';
-    }
+  // The request, to be prepared before it is answered.
+  TagsRequest* request() {
+    return &request_;
+  }
 
+  virtual bool Input(char** input) {
     LOG(INFO) << buf_ << "\n";
     *input = buf_;
-
     return false;
   }
 
-  virtual bool Output(const char * output) {
+  virtual bool Output(const char * output, int length) {
     const char* outbuf = output;
-    int towrite = strlen(output);
+    int towrite = length;
 
     while (towrite > 0) {
       int wrote = write(connected_socket_, outbuf, towrite);
@@ -94,43 +105,158 @@ class SocketIO : public IOInterface {
     return false;
   }
 
-  virtual void Close() {
-    close(connected_socket_);
-    connected_socket_ = -1;
-  }
-
   virtual const char* Source() const {
     return source_.c_str();
   }
 
  private:
-  struct sockaddr_in a_addr_;
-  socklen_t addrlen_;
   int connected_socket_;
   char buf_[kMaxTagLen];
   string source_;
+  TagsRequest request_;
 };
 
-void SocketServer::Loop() {
-  int listen_socket;
-  struct sockaddr_in addr;
+class RequestDispatcher;
 
-  listen_socket = socket(PF_INET, SOCK_STREAM, 0);
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(GET_FLAG(tags_port));
-  addr.sin_addr.s_addr = INADDR_ANY;
+// Reads a request from a new connection, then hands the connection to
+// a RequestDispatcher and deletes itself. Runs on the polling thread.
+class RequestSocket : public ConnectedSocket {
+ public:
+  RequestSocket(int socket_fd, PollServer* ps, RequestDispatcher* dispatcher)
+      : ConnectedSocket(socket_fd, ps), dispatcher_(dispatcher) {
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    if (getpeername(socket_fd, (struct sockaddr *)&addr, &addrlen) == 0)
+      source_ = inet_ntoa(addr.sin_addr);
+  }
 
-  CHECK(bind(listen_socket, (struct sockaddr *)&addr,
-                   static_cast<socklen_t>(sizeof(addr))) != -1);
+  // Nothing is written to the connection until it has been handed
+  // over.
+  virtual bool WantsWrite() const {
+    return false;
+  }
 
-  int server_socket = listen(listen_socket, 3);
-  CHECK(server_socket != -1);
+ protected:
+  virtual void HandleRead();
 
-  LOG(INFO) << "Tags server listening on port " << GET_FLAG(tags_port) << "\n";
+  // As nothing is written, this is only called when the client hangs
+  // up.
+  virtual void HandleWrite() {
+    Drop("Connection hung up");
+  }
+
+  virtual void HandleError() {
+    Drop("Error on connection");
+  }
+
+ private:
+  // Closes the connection, which unregisters it, and deletes this.
+  void Drop(const char* reason) {
+    LOG(INFO) << reason << "\n";
+    delete this;
+  }
 
-  while(true) {
-    SocketIO socket_io(listen_socket);
-    TagsIOProfiler profiler(&socket_io, tags_request_handler_);
+  RequestDispatcher* dispatcher_;
+  string source_;
+};
+
+// Creates a RequestSocket for each connection, and answers the
+// requests they read on its worker threads.
+class RequestDispatcher {
+ public:
+  RequestDispatcher(TagsRequestHandler* handler, int query_threads,
+                    int slow_query_threads)
+      : handler_(handler), queries_(query_threads),
+        slow_queries_(slow_query_threads) {}
+
+  ConnectedSocket* Accept(int socket_fd, PollServer* ps) {
+    return new RequestSocket(socket_fd, ps, this);
+  }
+
+  // Answers the request read into IO, and deletes IO, on a worker
+  // thread. The request is only parsed here, and the worker executes
+  // what was parsed.
+  void Dispatch(SocketIO* io) {
+    handler_->Prepare(io->request());
+    WorkerPool* pool = io->request()->slow() ? &slow_queries_ : &queries_;
+    pool->Add(gtags::CallbackFactory::Create(
+        this, &RequestDispatcher::Answer, io));
+  }
+
+ private:
+  void Answer(SocketIO* io) {
+    TagsIOProfiler profiler(io, handler_, io->request());
     profiler.Execute();
+    delete io;
+  }
+
+  TagsRequestHandler* handler_;
+  WorkerPool queries_;
+  WorkerPool slow_queries_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RequestDispatcher);
+};
+
+void RequestSocket::HandleRead() {
+  char buf[kMaxTagLen];
+  int bytesread;
+  while ((bytesread = recv(fd_, buf, sizeof(buf), 0)) > 0)
+    inbuf_.append(buf, bytesread);
+
+  if (bytesread == -1 && errno != EWOULDBLOCK) {
+    Drop("Error receiving");
+    return;
   }
+
+  // A request is a line; clients end it with \r\n. It is also
+  // complete if the client stops sending, and anything beyond the
+  // maximum length is dropped.
+  string::size_type length = inbuf_.find('\n');
+  if (length == string::npos) {
+    if (bytesread != 0 && inbuf_.size() < kMaxTagLen - 1)
+      return;
+    length = inbuf_.size();
+  }
+  if (length > 0 && inbuf_[length - 1] == '\r')
+    --length;
+  length = min<string::size_type>(length, kMaxTagLen - 1);
+
+  if (length == 0 && bytesread == 0) {
+    Drop("Connection closed without a request");
+    return;
+  }
+
+  LOG(INFO) << "bytes read: " << inbuf_.size() << "\n";
+
+  // The worker closes the connection, so we must no longer.
+  ps_->Unregister(this);
+  int connected_socket = fd_;
+  fd_ = -1;
+  dispatcher_->Dispatch(new SocketIO(connected_socket, source_,
+                                     inbuf_.substr(0, length)));
+  delete this;
+}
+
+}  // namespace
+
+void SocketServer::Loop() {
+  // A client which goes away before its response is written mustn't
+  // take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  RequestDispatcher dispatcher(tags_request_handler_, QueryThreads(),
+                               max(1, GET_FLAG(slow_query_threads)));
+  PollServer ps(16);
+  gtags::ListenerSocket* listener = gtags::ListenerSocket::Create(
+      GET_FLAG(tags_port), &ps,
+      gtags::CallbackFactory::CreatePermanent(
+          &dispatcher, &RequestDispatcher::Accept));
+  CHECK(listener != NULL)
+      << "Unable to listen on port " << GET_FLAG(tags_port);
+
+  LOG(INFO) << "Tags server listening on port " << GET_FLAG(tags_port) << "\n";
+
+  ps.Loop();
+
+  delete listener;
 }
@@ -17,12 +17,23 @@
 // Author: stephenchen@google.com (Stephen Chen)
 //
 // SocketServer is an implementation of TagsServer using sockets
+//
+// A single thread accepts connections and reads their requests with a
+// PollServer, so a client which is slow to send its request holds up
+// no one. Each request is then answered on a worker thread, which
+// writes the response and closes the connection. Requests which may
+// be slow, such as snippet searches and reloads, have workers of their
+// own, so that lookups never wait behind them.
 
 #ifndef TOOLS_TAGS_SOCKET_SERVER_H__
 #define TOOLS_TAGS_SOCKET_SERVER_H__
 
 #include "tagsserver.h"
 
+// Maximum length of a request, including its terminating '\0'. Longer
+// requests are cut short.
+const int kMaxTagLen = 512;
+
 class SocketServer : public TagsServer {
  public:
   SocketServer(TagsRequestHandler * handler) : TagsServer(handler) {}
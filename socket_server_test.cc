@@ -0,0 +1,288 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include "gtagsunit.h"
+#include "socket_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+#include "callback.h"
+#include "mutex.h"
+#include "semaphore.h"
+#include "socket_util.h"
+#include "tags_logger.h"
+#include "tagsoptionparser.h"
+#include "tagsrequesthandler.h"
+#include "thread.h"
+
+DECLARE_INT32(tags_port);
+DECLARE_INT32(query_threads);
+DECLARE_INT32(slow_query_threads);
+
+namespace {
+
+// How long to wait for a response, in milliseconds, when one is
+// expected, and when one is not.
+const int kTimeout = 5000;
+const int kShortTimeout = 200;
+
+// Answers each request with the request in angle brackets. Requests
+// starting with "slow" are slow, and are not answered until they are
+// released.
+class MockTagsRequestHandler : public TagsRequestHandler {
+ public:
+  MockTagsRequestHandler()
+      : executed_(0), slow_started_(0), slow_requests_(0) {}
+
+  virtual string Execute(const char* command,
+                         clock_t* pclock_before_preparing_results,
+                         struct query_profile* log) {
+    if (IsSlow(command)) {
+      Count(&slow_started_);
+      slow_requests_.Lock();
+    }
+    Count(&executed_);
+    *pclock_before_preparing_results = clock();
+    return string("<") + command + ">";
+  }
+
+  virtual void Prepare(TagsRequest* request) const {
+    request->set_class(false, IsSlow(request->command()));
+  }
+
+  // Lets one slow request be answered.
+  void ReleaseSlowRequest() {
+    slow_requests_.Unlock();
+  }
+
+  // The number of requests executed, and of slow requests started.
+  int executed() {
+    gtags::MutexLock lock(&mutex_);
+    return executed_;
+  }
+  int slow_started() {
+    gtags::MutexLock lock(&mutex_);
+    return slow_started_;
+  }
+
+ private:
+  static bool IsSlow(const char* command) {
+    return strncmp(command, "slow", 4) == 0;
+  }
+
+  void Count(int* counter) {
+    gtags::MutexLock lock(&mutex_);
+    ++*counter;
+  }
+
+  gtags::Mutex mutex_;
+  int executed_;
+  int slow_started_;
+  gtags::Semaphore slow_requests_;
+};
+
+// The profiler logs every request it answers.
+class NullLogger : public GtagsLogger {
+ public:
+  virtual void Flush() {}
+  virtual void WriteProfileData(struct query_profile* q, time_t time) {}
+};
+
+NullLogger null_logger;
+
+// The server, which is started by the first test and runs until the
+// tests are done. It has a single thread for lookups and another for
+// slow requests.
+MockTagsRequestHandler* handler = NULL;
+
+// Connects to the server, waiting for it to start listening.
+int Connect() {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(GET_FLAG(tags_port));
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  while (true) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+      return fd;
+    close(fd);
+    usleep(10000);
+  }
+}
+
+void StartServer() {
+  if (handler != NULL)
+    return;
+  GET_FLAG(tags_port) = gtags::FindAvailablePort();
+  GET_FLAG(query_threads) = 1;
+  GET_FLAG(slow_query_threads) = 1;
+
+  handler = new MockTagsRequestHandler;
+  SocketServer* server = new SocketServer(handler);
+  gtags::Thread* thread = new gtags::ClosureThread(
+      gtags::CallbackFactory::CreatePermanent(server, &SocketServer::Loop));
+  thread->Start();
+
+  close(Connect());
+}
+
+void Send(int fd, const string& data) {
+  CHECK_EQ(write(fd, data.data(), data.size()),
+           static_cast<ssize_t>(data.size()));
+}
+
+// Reads from FD until the server closes it, into RESPONSE. Returns
+// false if the server has not closed FD after TIMEOUT milliseconds
+// without data.
+bool ReadResponse(int fd, int timeout, string* response) {
+  char buf[1024];
+  while (true) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout) <= 0)
+      return false;
+    int bytesread = read(fd, buf, sizeof(buf));
+    if (bytesread <= 0)
+      return true;
+    response->append(buf, bytesread);
+  }
+}
+
+// Sends DATA on a connection of its own, and returns the response.
+string Ask(const string& data) {
+  int fd = Connect();
+  Send(fd, data);
+  string response;
+  EXPECT_TRUE(ReadResponse(fd, kTimeout, &response));
+  close(fd);
+  return response;
+}
+
+}  // namespace
+
+GtagsLogger* logger = &null_logger;
+
+TEST(SocketServerTest, Framing) {
+  StartServer();
+  EXPECT_EQ("<ping>", Ask("ping\n"));
+  EXPECT_EQ("<ping>", Ask("ping\r\n"));
+  EXPECT_EQ("<ping>", Ask("ping\nignored\n"));
+  EXPECT_EQ("<>", Ask("\r\n"));
+
+  // A client which stops sending has sent its request.
+  int fd = Connect();
+  Send(fd, "ping");
+  shutdown(fd, SHUT_WR);
+  string response;
+  EXPECT_TRUE(ReadResponse(fd, kTimeout, &response));
+  EXPECT_EQ("<ping>", response);
+  close(fd);
+}
+
+TEST(SocketServerTest, TooLong) {
+  StartServer();
+  const string longest(kMaxTagLen - 1, 'x');
+  EXPECT_EQ("<" + longest + ">", Ask(longest + "\n"));
+
+  // The server doesn't wait for the end of a request that is too long.
+  int fd = Connect();
+  Send(fd, longest + "yz");
+  string response;
+  EXPECT_TRUE(ReadResponse(fd, kTimeout, &response));
+  EXPECT_EQ("<" + longest + ">", response);
+  close(fd);
+}
+
+TEST(SocketServerTest, SplitRequest) {
+  StartServer();
+  int fd = Connect();
+  Send(fd, "pi");
+  string response;
+  EXPECT_FALSE(ReadResponse(fd, kShortTimeout, &response));
+
+  // Others are answered while the request is incomplete.
+  EXPECT_EQ("<other>", Ask("other\n"));
+
+  Send(fd, "ng\r");
+  EXPECT_FALSE(ReadResponse(fd, kShortTimeout, &response));
+  Send(fd, "\n");
+  EXPECT_TRUE(ReadResponse(fd, kTimeout, &response));
+  EXPECT_EQ("<ping>", response);
+  close(fd);
+}
+
+TEST(SocketServerTest, Disconnect) {
+  StartServer();
+  int executed = handler->executed();
+
+  // A client which hangs up before sending anything.
+  close(Connect());
+
+  // A client which resets its connection.
+  int fd = Connect();
+  struct linger linger;
+  linger.l_onoff = 1;
+  linger.l_linger = 0;
+  CHECK_EQ(0, setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)));
+  close(fd);
+
+  usleep(kShortTimeout * 1000);
+  EXPECT_EQ("<ping>", Ask("ping\n"));
+  EXPECT_EQ(executed + 1, handler->executed());
+}
+
+TEST(SocketServerTest, SlowRequests) {
+  StartServer();
+  int slow1 = Connect();
+  Send(slow1, "slow 1\n");
+  while (handler->slow_started() < 1)
+    usleep(1000);
+
+  // Lookups don't wait behind slow requests.
+  EXPECT_EQ("<fast>", Ask("fast\n"));
+
+  // Slow requests wait for the slow request thread, though the lookup
+  // thread is free.
+  int slow2 = Connect();
+  Send(slow2, "slow 2\n");
+  string response;
+  EXPECT_FALSE(ReadResponse(slow2, kShortTimeout, &response));
+  EXPECT_EQ(1, handler->slow_started());
+
+  handler->ReleaseSlowRequest();
+  EXPECT_TRUE(ReadResponse(slow1, kTimeout, &response));
+  EXPECT_EQ("<slow 1>", response);
+
+  handler->ReleaseSlowRequest();
+  response.clear();
+  EXPECT_TRUE(ReadResponse(slow2, kTimeout, &response));
+  EXPECT_EQ("<slow 2>", response);
+
+  close(slow1);
+  close(slow2);
+}
@@ -19,6 +19,7 @@
 #ifndef TOOLS_TAGS_STDERR_LOGGER_H__
 #define TOOLS_TAGS_STDERR_LOGGER_H__
 
+#include "mutex.h"
 #include "queryprofile.h"
 #include "tagsutil.h"
 #include "tags_logger.h"
@@ -30,13 +31,19 @@ class StdErrLogger : public GtagsLogger {
 
   virtual void Flush() { }
 
+  // Requests may be answered on several threads at once, so profiles
+  // are written one at a time to keep them from being interleaved.
   virtual void WriteProfileData(struct query_profile *q, time_t time) {
+    gtags::MutexLock lock(&mu_);
     cerr << "\n" << "PROFILE:" << q->client_ip << "," << q->time_receiving <<
       "," << q->time_searching << "," << q->time_preparing_result << "," <<
       q->time_preparing_result << "," << q->time_sending_result << "," <<
       q->client << "," << q->tag << "," << q->command << "," <<
       q->current_file << "," << q->client_message;
   }
+
+ private:
+  gtags::Mutex mu_;
 };
 
 #endif  // TOOLS_TAGS_STDERR_LOGGER_H__
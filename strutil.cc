@@ -20,37 +20,52 @@
 
 #include <ext/hash_map>
 
+namespace {
+
+// Returns the escape sequence for C, or NULL if it stands for itself.
+inline const char* CEscapeSequence(char c) {
+  switch (c) {
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    case '\"': return "\\\"";
+    case '\'': return "\\\'";
+    case '\\': return "\\\\";
+    default: return NULL;
+  }
+}
+
+}  // namespace
+
 const string & CEscape(const string & src_string) {
   static string buffer;
   buffer.clear();
+  // Like the loop this replaced, stop at the first NUL.
   const char * src = src_string.c_str();
+  CEscapeAppend(src, strlen(src), &buffer);
+  return buffer;
+}
 
-  while(*src) {
-    switch (*src) {
-      case '\n':
-        buffer.append("\\n");
-        break;
-      case '\r':
-        buffer.append("\\r");
-        break;
-      case '\t':
-        buffer.append("\\t");
-        break;
-      case '\"':
-        buffer.append("\\\"");
-        break;
-      case '\'':
-        buffer.append("\\\'");
-        break;
-      case '\\':
-        buffer.append("\\\\");
-        break;
-      default:
-        buffer += *src;
-    }
-    src++;
+void CEscapeAppend(const char* src, int length, string* dest) {
+  const char* run = src;
+  const char* end = src + length;
+  for (const char* p = src; p < end; ++p) {
+    const char* escape = CEscapeSequence(*p);
+    if (escape == NULL)
+      continue;
+    dest->append(run, p - run);
+    dest->append(escape, 2);
+    run = p + 1;
   }
-  return buffer;
+  dest->append(run, end - run);
+}
+
+bool NeedsCEscape(const char* src, int length) {
+  for (const char* end = src + length; src < end; ++src) {
+    if (CEscapeSequence(*src) != NULL)
+      return true;
+  }
+  return false;
 }
 
 // Converts an integer to a string
@@ -74,6 +89,22 @@ string FastItoa(int i) {
   return string(p, local + sizeof(local));
 }
 
+string Int64ToString(long long i) {
+  // Longest is -9223372036854775808.
+  char local[20];
+  char *p = local + sizeof(local);
+  unsigned long long n = i;
+  if (i < 0)
+    n = -n;
+  do {
+    *--p = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  if (i < 0)
+    *--p = '-';
+  return string(p, local + sizeof(local));
+}
+
 size_t __gnu_cxx::hash<string>::operator() (const string& s) const {
   return __gnu_cxx::hash<const char*>()(s.c_str());
 }
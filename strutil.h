@@ -29,11 +29,22 @@ using std::string;
 bool inline ascii_isspace(char c) { return isspace(c); }
 
 string FastItoa(int i);
+// Same for 64-bit integers.
+string Int64ToString(long long i);
 
 // Escape \n, \r, \t, \\, \', \" from src_string.
 // Warning: not thread safe
 const string & CEscape(const string & src_string);
 
+// Appends the first LENGTH characters of SRC to DEST, escaped as by
+// CEscape. Unlike CEscape this does not go through a static buffer,
+// and runs of characters that need no escaping are appended at once.
+void CEscapeAppend(const char* src, int length, string* dest);
+
+// Returns true if CEscape would change the first LENGTH characters
+// of SRC.
+bool NeedsCEscape(const char* src, int length);
+
 inline bool HasPrefixString(const string &str, const string &prefix) {
   return str.compare(0, prefix.length(), prefix) == 0;
 }
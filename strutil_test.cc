@@ -29,6 +29,13 @@ TEST(StrUtilTest, FastItoaTest) {
   EXPECT_EQ("1000", FastItoa(normal_positive));
 }
 
+TEST(StrUtilTest, Int64ToStringTest) {
+  EXPECT_EQ("0", Int64ToString(0));
+  EXPECT_EQ("-547", Int64ToString(-547));
+  EXPECT_EQ("1099511627776", Int64ToString(1LL << 40));
+  EXPECT_EQ("-9223372036854775807", Int64ToString(-9223372036854775807LL));
+}
+
 TEST(StrUtilTest, IsIntToken) {
   const char * too_large = "111111111111";
   const char * zero = "0";
@@ -49,3 +56,20 @@ TEST(StrUtilTest, IsIntToken) {
   EXPECT_FALSE(IsIntToken(letter_end));
   EXPECT_FALSE(IsIntToken(empty_string));
 }
+
+TEST(StrUtilTest, CEscapeAppend) {
+  string buffer = "\n125\r\t\t\"\'\\abc";
+  string result = "prefix ";
+  CEscapeAppend(buffer.data(), buffer.size(), &result);
+  EXPECT_EQ("prefix " + CEscape(buffer), result);
+
+  // Only LENGTH characters are escaped, even if they include a NUL.
+  result.clear();
+  CEscapeAppend("a\0b\"c", 4, &result);
+  EXPECT_EQ(string("a\0b\\\"", 5), result);
+
+  EXPECT_TRUE(NeedsCEscape(buffer.data(), buffer.size()));
+  EXPECT_FALSE(NeedsCEscape("tools/tags/file.cc", 18));
+  EXPECT_FALSE(NeedsCEscape("a\"", 1));
+  EXPECT_FALSE(NeedsCEscape("", 0));
+}
@@ -18,39 +18,242 @@
 
 #include "symboltable.h"
 
-#include <ext/hash_set>
-#include <utility>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
 
-#include "stl_util.h"
+#include "snapshot.h"
+#include "tagsoptionparser.h"
+
+DEFINE_BOOL(symboltable_huge_pages, false,
+            "Ask the kernel to back SymbolTable pages with huge pages");
+
+const int SymbolTable::kOffsetBits;
+const uint32 SymbolTable::kPageSize;
+const uint32 SymbolTable::kOffsetMask;
+const int SymbolTable::kHeaderSize;
+const uint32 SymbolTable::kEmptySlot;
+
+namespace {
+
+// Initial number of slots in the hash table.
+const uint32 kInitialTableSize = 1024;
+
+// FNV-1a parameters.
+const uint32 kFnvOffsetBasis = 2166136261U;
+const uint32 kFnvPrime = 16777619U;
+
+// Maps a new page of SIZE bytes.
+char* AllocatePage(uint32 size) {
+  void* page = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(page != MAP_FAILED) << "Unable to allocate SymbolTable page";
+#ifdef MADV_HUGEPAGE
+  if (GET_FLAG(symboltable_huge_pages))
+    madvise(page, size, MADV_HUGEPAGE);
+#endif
+  return static_cast<char*>(page);
+}
+
+// Logs that the strings of a snapshot can't be attached because of
+// PROBLEM, and returns false.
+bool InvalidSnapshot(const char* problem) {
+  LOG(WARNING) << "Snapshot strings " << problem;
+  return false;
+}
+
+}  // namespace
 
 SymbolTable::SymbolTable()
-    : table_(new hash_set<const char*, hash<const char*>, StrEq>()) { }
+    : pages_(new vector<char*>()),
+      attached_pages_(0),
+      page_sizes_(new vector<uint32>()),
+      page_used_(new vector<uint32>()),
+      table_(new Column<uint32>()),
+      size_(0),
+      bytes_allocated_(0) { }
 
 SymbolTable::~SymbolTable() {
   Clear();
   delete table_;
+  delete page_used_;
+  delete page_sizes_;
+  delete pages_;
 }
 
 void SymbolTable::Clear() {
-  STLDeleteArrayContainer(table_);
+  for (size_t i = attached_pages_; i < pages_->size(); ++i) {
+    munmap((*pages_)[i], (*page_sizes_)[i]);
+  }
+  pages_->clear();
+  attached_pages_ = 0;
+  page_sizes_->clear();
+  page_used_->clear();
+  table_->Clear();
+  size_ = 0;
+  bytes_allocated_ = 0;
+}
+
+int64 SymbolTable::overhead_bytes() const {
+  return table_->bytes_owned() +
+      pages_->capacity() * sizeof(char*) +
+      (page_sizes_->capacity() + page_used_->capacity()) * sizeof(uint32);
+}
+
+uint32 SymbolTable::Hash(const char* str, int length) {
+  uint32 hash = kFnvOffsetBasis;
+  for (int i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(str[i])) * kFnvPrime;
+  }
+  return hash;
+}
+
+uint32 SymbolTable::GetId(const char* str) {
+  // Compute the length and the hash in a single pass.
+  uint32 hash = kFnvOffsetBasis;
+  const char* p = str;
+  for (; *p != '\0'; ++p) {
+    hash = (hash ^ static_cast<unsigned char>(*p)) * kFnvPrime;
+  }
+  return Intern(str, p - str, hash);
+}
+
+uint32 SymbolTable::GetId(const char* str, int length) {
+  return Intern(str, length, Hash(str, length));
+}
+
+uint32 SymbolTable::Intern(const char* str, int length, uint32 hash) {
+  if (static_cast<size_t>(2 * (size_ + 1)) > table_->size())
+    Grow();
+
+  uint32 mask = table_->size() - 1;
+  for (uint32 slot = hash & mask; ; slot = (slot + 1) & mask) {
+    uint32 id = (*table_)[slot];
+    if (id == kEmptySlot) {
+      // If STR isn't already in table, copy and insert it
+      id = Store(str, length, hash);
+      (*table_->Mutable())[slot] = id;
+      return id;
+    }
+    if (HashOf(id) == hash && Length(id) == length
+        && memcmp(Lookup(id), str, length) == 0) {
+      return id;
+    }
+  }
+}
+
+uint32 SymbolTable::Store(const char* str, int length, uint32 hash) {
+  uint32 record_size = (kHeaderSize + length + 1 + 3) & ~3U;
+
+  if (pages_->empty()
+      || page_used_->back() + record_size > page_sizes_->back()) {
+    CHECK(pages_->size() < (1U << (32 - kOffsetBits)))
+      << "SymbolTable is full";
+    uint32 page_size = max(kPageSize, record_size);
+    pages_->push_back(AllocatePage(page_size));
+    page_sizes_->push_back(page_size);
+    page_used_->push_back(0);
+    bytes_allocated_ += page_size;
+  }
+
+  uint32 id = ((pages_->size() - 1) << kOffsetBits) | page_used_->back();
+  char* record = pages_->back() + page_used_->back();
+  uint32* header = reinterpret_cast<uint32*>(record);
+  header[0] = hash;
+  header[1] = length;
+  memcpy(record + kHeaderSize, str, length);
+  record[kHeaderSize + length] = '\0';
+
+  page_used_->back() += record_size;
+  ++size_;
+  return id;
+}
+
+void SymbolTable::Grow() {
+  vector<uint32> old_table;
+  old_table.swap(*table_->Mutable());
+  vector<uint32>* table = table_->Mutable();
+  table->resize(max(kInitialTableSize,
+                    static_cast<uint32>(2 * old_table.size())),
+                kEmptySlot);
+
+  // The hashes are stored with the strings, so rehashing doesn't have
+  // to look at the strings themselves.
+  uint32 mask = table->size() - 1;
+  for (vector<uint32>::const_iterator i = old_table.begin();
+       i != old_table.end(); ++i) {
+    if (*i == kEmptySlot)
+      continue;
+    uint32 slot = HashOf(*i) & mask;
+    while ((*table)[slot] != kEmptySlot)
+      slot = (slot + 1) & mask;
+    (*table)[slot] = *i;
+  }
 }
 
-const char* SymbolTable::Get(const char* str)  {
-  int length = strlen(str);
-  hash_set<const char*, hash<const char*>, StrEq>::const_iterator elt
-    = table_->find(str);
+void SymbolTable::WriteSnapshot(SnapshotWriter* writer) const {
+  uint32 size = size_;
+  writer->BeginSection(SNAPSHOT_SYMBOL_INFO);
+  writer->AppendArray(&size, 1);
+
+  // Pages are written back to back, each one aligned so that its
+  // records stay aligned when mapped.
+  vector<int64> offsets;
+  int64 offset = 0;
+  writer->BeginSection(SNAPSHOT_SYMBOL_PAGES);
+  for (size_t i = 0; i < pages_->size(); ++i) {
+    offsets.push_back(offset);
+    writer->Append((*pages_)[i], (*page_used_)[i]);
+    writer->Align();
+    offset += ((*page_used_)[i] + 7) & ~7;
+  }
+
+  writer->BeginSection(SNAPSHOT_SYMBOL_PAGE_OFFSETS);
+  writer->AppendArray(offsets.empty() ? NULL : &offsets[0], offsets.size());
+  writer->BeginSection(SNAPSHOT_SYMBOL_PAGE_SIZES);
+  writer->AppendArray(page_used_->empty() ? NULL : &(*page_used_)[0],
+                      page_used_->size());
+  writer->BeginSection(SNAPSHOT_SYMBOL_TABLE);
+  writer->AppendArray(table_->data(), table_->size());
+}
+
+bool SymbolTable::AttachSnapshot(const Snapshot& snapshot) {
+  Clear();
+
+  int64 count;
+  const uint32* size = snapshot.Array<uint32>(SNAPSHOT_SYMBOL_INFO, &count);
+  if (size == NULL || count != 1)
+    return InvalidSnapshot("have no count");
+
+  int64 num_pages;
+  const int64* offsets
+      = snapshot.Array<int64>(SNAPSHOT_SYMBOL_PAGE_OFFSETS, &num_pages);
+  const uint32* used = snapshot.Array<uint32>(SNAPSHOT_SYMBOL_PAGE_SIZES,
+                                              &count);
+  if (offsets == NULL || used == NULL || count != num_pages)
+    return InvalidSnapshot("have mismatched page sizes");
+  const char* pages = snapshot.section(SNAPSHOT_SYMBOL_PAGES);
+  int64 pages_size = snapshot.section_size(SNAPSHOT_SYMBOL_PAGES);
+  for (int64 i = 0; i < num_pages; ++i) {
+    if (offsets[i] < 0 || offsets[i] + used[i] > pages_size)
+      return InvalidSnapshot("have a page out of bounds");
+  }
 
-  if (elt == table_->end()) {
-    // If STR isn't already in table, copy and insert it
-    char* str_copy = new char[length + 1];
-    strncpy(str_copy, str, length);
-    str_copy[length] = '\0';
+  // Probing only ends at an empty slot, so the table must have some.
+  const uint32* table = snapshot.Array<uint32>(SNAPSHOT_SYMBOL_TABLE, &count);
+  if (table == NULL || count == 0 || (count & (count - 1)) != 0
+      || 2 * static_cast<int64>(*size) > count)
+    return InvalidSnapshot("have an invalid hash table size");
 
-    pair<hash_set<const char*, hash<const char*>, StrEq>::const_iterator,
-      bool> insert_result = table_->insert(str_copy);
-    CHECK(insert_result.second);
-    return str_copy;
-  } else {
-    return *elt;
+  // Attached pages are marked full, so that Store never writes to
+  // them.
+  for (int64 i = 0; i < num_pages; ++i) {
+    pages_->push_back(const_cast<char*>(pages + offsets[i]));
+    page_sizes_->push_back(used[i]);
+    page_used_->push_back(used[i]);
   }
+  attached_pages_ = num_pages;
+  table_->Attach(table, count);
+  size_ = *size;
+  return true;
 }
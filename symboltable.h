@@ -24,14 +24,27 @@
 // returns a newly allocated string which is equal to the argument. On
 // any subsequent calls with the same argument, the return value is
 // aliased to the string returned the first time.
+//
+// Each unique string is also given a 32-bit id. Use GetId and Lookup
+// to store and retrieve strings by id, which takes half the space of
+// a pointer on 64-bit machines.
+//
+// Strings are stored back to back in large pages, each one preceded
+// by its hash and length, and the id of a string encodes its page and
+// offset. Interning a string therefore costs no allocation beyond
+// the occasional new page, and Clear only has to release the pages.
 
 #ifndef TOOLS_TAGS_SYMBOLTABLE_H__
 #define TOOLS_TAGS_SYMBOLTABLE_H__
 
-#include <ext/hash_set>
+#include <vector>
 
+#include "column.h"
 #include "tagsutil.h"
 
+class Snapshot;
+class SnapshotWriter;
+
 class SymbolTable {
  public:
   SymbolTable();
@@ -45,17 +58,104 @@ class SymbolTable {
   // pointer to it. If STR is not already in the table, then the
   // returned string is newly allocated. Otherwise, it is aliased to a
   // string which was previously created and returned.
-  const char* Get(const char* str);
+  const char* Get(const char* str) {
+    return Lookup(GetId(str));
+  }
+
+  // Adds STR to the table if it's not already present, and returns
+  // its id.
+  uint32 GetId(const char* str);
+
+  // Same as GetId(STR), for a string of known LENGTH. STR need not be
+  // nul-terminated.
+  uint32 GetId(const char* str, int length);
+
+  // Returns the string with id ID, which must have been returned by
+  // GetId since the last Clear.
+  const char* Lookup(uint32 id) const {
+    return Record(id) + kHeaderSize;
+  }
+
+  // Returns the length of the string with id ID.
+  int Length(uint32 id) const {
+    return reinterpret_cast<const uint32*>(Record(id))[1];
+  }
+
+  // Returns the hash of the string with id ID, as computed by Hash.
+  uint32 HashOf(uint32 id) const {
+    return reinterpret_cast<const uint32*>(Record(id))[0];
+  }
+
+  // Returns the number of strings stored.
+  int size() const {
+    return size_;
+  }
+
+  // Returns the number of bytes allocated for pages.
+  int64 bytes_allocated() const {
+    return bytes_allocated_;
+  }
+
+  // Returns the number of bytes used by the hash table of ids and the
+  // page bookkeeping, on top of the pages themselves.
+  int64 overhead_bytes() const;
+
+  // The hash function used for stored strings.
+  static uint32 Hash(const char* str, int length);
+
+  // Writes the strings and the hash table to WRITER.
+  void WriteSnapshot(SnapshotWriter* writer) const;
+
+  // Replaces the contents of the table with the strings stored in
+  // SNAPSHOT, which must stay open until the next Clear. Ids are the
+  // same as in the table that wrote the snapshot. Strings added later
+  // go to new pages, so the snapshot is never written to. Returns
+  // false, logging why and leaving the table empty, if the strings in
+  // SNAPSHOT are inconsistent.
+  bool AttachSnapshot(const Snapshot& snapshot);
 
  private:
-  class StrEq {
-   public:
-    bool operator()(const char* s1, const char* s2) const {
-      return !strcmp(s1, s2);
-    }
-  };
-
-  hash_set<const char*, hash<const char*>, StrEq>* table_;
+  // Each page holds 2^kOffsetBits bytes, enough for one huge page. A
+  // string id is its page number followed by the offset of its record
+  // in the page. Strings too long for a page get a page of their own.
+  static const int kOffsetBits = 21;
+  static const uint32 kPageSize = 1 << kOffsetBits;
+  static const uint32 kOffsetMask = kPageSize - 1;
+  // Each record is the hash and length of the string, followed by the
+  // string itself and its terminating nul, padded to a multiple of 4
+  // bytes.
+  static const int kHeaderSize = 2 * sizeof(uint32);
+  // Marks an empty slot in table_.
+  static const uint32 kEmptySlot = ~0U;
+
+  const char* Record(uint32 id) const {
+    return (*pages_)[id >> kOffsetBits] + (id & kOffsetMask);
+  }
+
+  // Returns the id of STR, of length LENGTH and hash HASH, adding it
+  // to the table if necessary.
+  uint32 Intern(const char* str, int length, uint32 hash);
+
+  // Copies STR into a new record, and returns its id.
+  uint32 Store(const char* str, int length, uint32 hash);
+
+  // Doubles the size of table_, reinserting every id.
+  void Grow();
+
+  // Pages holding the string records. The first attached_pages_ of
+  // them are in a snapshot and are not owned by the table.
+  vector<char*>* pages_;
+  int attached_pages_;
+  // Sizes of the pages, which are larger than kPageSize for long
+  // strings.
+  vector<uint32>* page_sizes_;
+  // Number of bytes used in each page.
+  vector<uint32>* page_used_;
+  // Open-addressed hash table of string ids, with linear probing. Its
+  // size is a power of 2 and it is kept at most half full.
+  Column<uint32>* table_;
+  int size_;
+  int64 bytes_allocated_;
 
   DISALLOW_EVIL_CONSTRUCTORS(SymbolTable);
 };
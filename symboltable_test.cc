@@ -16,9 +16,13 @@
 //
 // Author: psung@google.com (Phil Sung)
 
+#include <vector>
+
 #include "gtagsunit.h"
 #include "symboltable.h"
 
+#include "strutil.h"
+
 namespace {
 
 TEST(SymbolTableTest, Get) {
@@ -46,4 +50,52 @@ TEST(SymbolTableTest, Get) {
   delete t;
 }
 
+TEST(SymbolTableTest, GetId) {
+  SymbolTable t;
+  uint32 id1 = t.GetId("first string");
+  uint32 id2 = t.GetId("second string");
+  EXPECT_NE(id1, id2);
+  EXPECT_EQ(id1, t.GetId(string("first string").c_str()));
+  EXPECT_EQ(2, t.size());
+
+  EXPECT_STREQ("first string", t.Lookup(id1));
+  EXPECT_STREQ("second string", t.Lookup(id2));
+  EXPECT_EQ(t.Get("second string"), t.Lookup(id2));
+
+  t.Clear();
+  EXPECT_EQ(0, t.size());
+  EXPECT_EQ(0, t.GetId("second string"));
+}
+
+TEST(SymbolTableTest, LengthAndHash) {
+  SymbolTable t;
+  uint32 id = t.GetId("some string");
+  EXPECT_EQ(11, t.Length(id));
+  EXPECT_EQ(SymbolTable::Hash("some string", 11), t.HashOf(id));
+
+  // Strings of known length need not be nul-terminated.
+  EXPECT_EQ(id, t.GetId("some string and more", 11));
+  EXPECT_EQ(1, t.size());
+}
+
+TEST(SymbolTableTest, ManyStrings) {
+  SymbolTable t;
+  vector<uint32> ids;
+  for (int i = 0; i < 100000; ++i) {
+    ids.push_back(t.GetId(FastItoa(i).c_str()));
+  }
+  // Strings longer than a page get a page of their own.
+  string long_string(3 << 20, 'x');
+  uint32 long_id = t.GetId(long_string.c_str());
+  EXPECT_EQ(100001, t.size());
+
+  for (int i = 0; i < 100000; ++i) {
+    EXPECT_EQ(ids[i], t.GetId(FastItoa(i).c_str()));
+    EXPECT_EQ(FastItoa(i), t.Lookup(ids[i]));
+  }
+  EXPECT_EQ(long_id, t.GetId(long_string.c_str()));
+  EXPECT_EQ(long_string, t.Lookup(long_id));
+  EXPECT_EQ(100001, t.size());
+}
+
 }  // namespace
@@ -45,13 +45,16 @@ bool TagsIOProfiler::Execute() {
 
   clock_before_searching = clock();
   struct query_profile q;
-  string output =
-    tags_request_handler_->Execute(input,
-                                   &clock_before_preparing_results,
-                                   &q);
+  string output = request_ != NULL
+    ? tags_request_handler_->Execute(*request_,
+                                     &clock_before_preparing_results,
+                                     &q)
+    : tags_request_handler_->Execute(input,
+                                     &clock_before_preparing_results,
+                                     &q);
 
   clock_before_sending_results = clock();
-  io_->Output(output.c_str());
+  io_->Output(output.data(), output.size());
 
   logger->Flush();
   clock_after_sending_results = clock();
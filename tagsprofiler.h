@@ -29,6 +29,7 @@
 
 #include "tagsutil.h"
 
+class TagsRequest;
 class TagsRequestHandler;
 
 // Interface for a class that can do some I/O operations
@@ -39,16 +40,23 @@ class IOInterface {
   // Points in to a null terminated buffer.
   // Return true if there is more data to be read after the call.
   virtual bool Input(char** in) = 0;
-  // Output the null terminated buffer pointed by out.
+  // Output the LENGTH bytes pointed by out.
   // Return true if there is more data to be written after the call.
-  virtual bool Output(const char* out) = 0;
+  virtual bool Output(const char* out, int length) = 0;
 };
 
 // Runs tags request operation with timing measurement included
 class TagsIOProfiler {
  public:
   TagsIOProfiler(IOInterface* io, TagsRequestHandler* tags_request_handler) :
-      io_(io), tags_request_handler_(tags_request_handler) {}
+      io_(io), tags_request_handler_(tags_request_handler), request_(NULL) {}
+
+  // Executes REQUEST, which was prepared from the input IO gives,
+  // instead of the input itself.
+  TagsIOProfiler(IOInterface* io, TagsRequestHandler* tags_request_handler,
+                 const TagsRequest* request) :
+      io_(io), tags_request_handler_(tags_request_handler),
+      request_(request) {}
 
   virtual bool Execute();
 
@@ -61,6 +69,7 @@ class TagsIOProfiler {
 
   IOInterface* io_;
   TagsRequestHandler* tags_request_handler_;
+  const TagsRequest* request_;
 };
 
 #endif  // TOOLS_TAGS_TAGSPROFILER_H__
@@ -0,0 +1,461 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "tagsreader.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "sexpression.h"
+#include "strutil.h"
+
+namespace {
+
+// Number of characters of context shown in error messages.
+const int kContextSize = 40;
+
+}  // namespace
+
+bool TagsReader::Read(const char* text, int length) {
+  p_ = text;
+  end_ = text + length;
+  error_.clear();
+  while (SkipWhitespace())
+    ReadDeclaration();
+  return !failed();
+}
+
+void TagsReader::ReadDeclaration() {
+  const char* start = p_;
+  Expect('(', "Expected a declaration list at the top-level.");
+  if (!SkipWhitespace() || *p_ == ')') {
+    Fail("Expected a non-empty declaration at top-level.");
+    return;
+  }
+  ReadSymbol(&symbol_);
+
+  if (symbol_ == "file") {
+    ReadFile();
+  } else if (symbol_ == "deleted") {
+    // Handle "deleted" entries, which can occur in update files
+    ReadString(&path_);
+    SkipRest();
+    if (failed())
+      return;
+    handler_->Deleted(path_.c_str());
+  } else {
+    // Everything else is a header declaration, which we hand out
+    // whole.
+    SkipRest();
+    if (failed())
+      return;
+    string text(start, p_ - start);
+    SExpression* sexp = SExpression::Parse(text.c_str());
+    if (sexp == NULL) {
+      p_ = start;
+      Fail("Expected a valid s-expression in input file.");
+      return;
+    }
+    handler_->Header(sexp);
+  }
+}
+
+void TagsReader::ReadFile() {
+  bool has_path = false;
+  language_.clear();
+  const char* contents = NULL;
+
+  // The contents may come before the path and language, so find all
+  // the attributes before reading the items.
+  while (!TryClose()) {
+    Expect('(', "Expected attribute-value sets to be lists.");
+    ReadSymbol(&symbol_);
+    if (symbol_ == "path") {
+      ReadString(&path_);
+      has_path = true;
+    } else if (symbol_ == "language") {
+      ReadString(&language_);
+    } else if (symbol_ == "contents") {
+      SkipWhitespace();
+      contents = p_;
+      Skip();
+    } else {
+      LOG(INFO) << "file declaration contained unrecognized attribute name: "
+                << symbol_;
+      Skip();
+    }
+    Expect(')', "Expected attribute-value set to contain only two elements.");
+  }
+
+  if (failed())
+    return;
+
+  // Check that all fields were assigned
+  if (!has_path) {
+    Fail("Expected a file path inside the file declaration.");
+    return;
+  }
+  if (language_.empty()) {
+    Fail("Expected a file language inside the file declaration.");
+    return;
+  }
+  if (contents == NULL) {
+    Fail("Expected a contents list inside the file declaration.");
+    return;
+  }
+
+  handler_->File(path_.c_str(), language_.c_str());
+
+  const char* end = p_;
+  p_ = contents;
+  if (*p_ == '(') {
+    ++p_;
+    while (!TryClose())
+      ReadItem();
+  } else {
+    ReadSymbol(&symbol_);
+    if (!failed() && symbol_ != "nil")
+      Fail("Expected a list of items in contents.");
+  }
+  if (failed())
+    return;
+  p_ = end;
+
+  handler_->EndFile();
+}
+
+void TagsReader::ReadItem() {
+  Expect('(', "Expected an item declaration.");
+  ReadSymbol(&symbol_);
+  if (symbol_ != "item") {
+    Fail("Expected an item declaration.");
+    return;
+  }
+
+  TagsItem item;
+  item.lineno = 0;
+  item.charno = 0;
+  bool has_descriptor = false;
+  // If snippet isn't specified, we report an empty string.
+  snippet_.clear();
+
+  while (!TryClose()) {
+    Expect('(', "Expected attribute-value sets to be lists.");
+    ReadSymbol(&symbol_);
+    if (symbol_ == "line") {
+      item.lineno = ReadInteger();
+    } else if (symbol_ == "offset") {
+      item.charno = ReadInteger();
+    } else if (symbol_ == "descriptor") {
+      ReadDescriptor();
+      has_descriptor = true;
+    } else if (symbol_ == "snippet") {
+      ReadString(&snippet_);
+    } else {
+      Skip();
+    }
+    Expect(')', "Expected attribute-value set to contain only two elements.");
+  }
+
+  // If this item is not a tag, there is nothing to report.
+  if (failed() || !has_descriptor)
+    return;
+
+  item.descriptor = descriptor_.c_str();
+  item.tag = tag_.c_str();
+  item.tag_length = tag_.size();
+  item.snippet = snippet_.c_str();
+  item.snippet_length = snippet_.size();
+  handler_->Item(item);
+}
+
+void TagsReader::ReadDescriptor() {
+  Expect('(', "Expected a descriptor list.");
+  ReadSymbol(&descriptor_);
+  tag_.clear();
+
+  // References name their tag in a (to (ref ...)) attribute, and all
+  // other descriptors in a (tag ...) attribute.
+  bool is_call = (descriptor_ == "call");
+  while (!TryClose()) {
+    Expect('(', "Expected attribute-value sets to be lists.");
+    ReadSymbol(&symbol_);
+    if (is_call && symbol_ == "to")
+      ReadRef(&tag_);
+    else if (!is_call && symbol_ == "tag")
+      ReadString(&tag_);
+    else
+      Skip();
+    Expect(')', "Expected attribute-value set to contain only two elements.");
+  }
+}
+
+void TagsReader::ReadRef(string* name) {
+  Expect('(', "Expected a ref declaration.");
+  ReadSymbol(&symbol_);
+  if (symbol_ != "ref") {
+    Fail("Expected a ref declaration.");
+    return;
+  }
+
+  name->clear();
+  while (!TryClose()) {
+    Expect('(', "Expected attribute-value sets to be lists.");
+    ReadSymbol(&symbol_);
+    if (symbol_ == "name")
+      ReadString(name);
+    else
+      Skip();
+    Expect(')', "Expected attribute-value set to contain only two elements.");
+  }
+  if (!failed() && name->empty())
+    Fail("Expected name inside reference.");
+}
+
+void TagsReader::Fail(const char* error) {
+  if (failed())
+    return;
+  error_ = error;
+  error_ += " Found: ";
+  error_.append(p_, min<int>(end_ - p_, kContextSize));
+  p_ = end_;
+}
+
+bool TagsReader::SkipWhitespace() {
+  while (p_ < end_ && ascii_isspace(*p_))
+    ++p_;
+  return p_ < end_;
+}
+
+void TagsReader::Expect(char c, const char* what) {
+  if (!SkipWhitespace() || *p_ != c) {
+    Fail(what);
+    return;
+  }
+  ++p_;
+}
+
+bool TagsReader::TryClose() {
+  if (!SkipWhitespace()) {
+    Fail("Unexpected end of input inside a list.");
+    return true;
+  }
+  if (*p_ != ')')
+    return false;
+  ++p_;
+  return true;
+}
+
+void TagsReader::ReadSymbol(string* value) {
+  if (!SkipWhitespace() || *p_ == '(' || *p_ == ')' || *p_ == '"') {
+    Fail("Expected a symbol.");
+    value->clear();
+    return;
+  }
+  if (*p_ == '|') {
+    ReadDelimited('|', value);
+    return;
+  }
+
+  value->clear();
+  while (p_ < end_ && !ascii_isspace(*p_) && *p_ != ')') {
+    if (*p_ == '\\' && p_ + 1 < end_)
+      ++p_;
+    value->push_back(*p_);
+    ++p_;
+  }
+}
+
+void TagsReader::ReadString(string* value) {
+  if (!SkipWhitespace() || *p_ != '"') {
+    Fail("Expected a string.");
+    value->clear();
+    return;
+  }
+  ReadDelimited('"', value);
+}
+
+int TagsReader::ReadInteger() {
+  SkipWhitespace();
+  const char* start = p_;
+  if (p_ < end_ && (*p_ == '+' || *p_ == '-'))
+    ++p_;
+  const char* digits = p_;
+  while (p_ < end_ && isdigit(*p_))
+    ++p_;
+  if (p_ == digits || (p_ < end_ && !ascii_isspace(*p_) && *p_ != ')')) {
+    p_ = start;
+    Fail("Expected an integer.");
+    return 0;
+  }
+  return strtol(start, NULL, 10);
+}
+
+void TagsReader::Skip() {
+  if (!SkipWhitespace()) {
+    Fail("Unexpected end of input.");
+    return;
+  }
+  switch (*p_) {
+    case '(':
+      ++p_;
+      SkipRest();
+      break;
+    case '"':
+    case '|':
+      ReadDelimited(*p_, NULL);
+      break;
+    default:
+      while (p_ < end_ && !ascii_isspace(*p_) && *p_ != ')') {
+        if (*p_ == '\\' && p_ + 1 < end_)
+          ++p_;
+        ++p_;
+      }
+      break;
+  }
+}
+
+void TagsReader::SkipRest() {
+  while (!TryClose())
+    Skip();
+}
+
+void TagsReader::ReadDelimited(char delimiter, string* value) {
+  CHECK_EQ(delimiter, *p_);
+  ++p_;
+  if (value != NULL)
+    value->clear();
+
+  // Copy runs of plain characters at once.
+  const char* run = p_;
+  while (p_ < end_ && *p_ != delimiter) {
+    if (*p_ == '\\') {
+      if (value != NULL)
+        value->append(run, p_ - run);
+      ++p_;
+      if (p_ == end_) {
+        Fail("Nothing after escape character.");
+        return;
+      }
+      run = p_;
+    }
+    ++p_;
+  }
+  if (p_ == end_) {
+    Fail("Unterminated string.");
+    return;
+  }
+  if (value != NULL)
+    value->append(run, p_ - run);
+  ++p_;
+}
+
+TagsEventBuffer::~TagsEventBuffer() {
+  for (size_t i = 0; i < headers_.size(); ++i)
+    delete headers_[i];
+}
+
+void TagsEventBuffer::Header(SExpression* sexp) {
+  Event event;
+  event.type = HEADER;
+  event.lineno = headers_.size();
+  headers_.push_back(sexp);
+  events_.push_back(event);
+}
+
+void TagsEventBuffer::File(const char* path, const char* language) {
+  Event event;
+  event.type = BEGIN_FILE;
+  event.tag = AddString(path, strlen(path));
+  event.snippet = AddString(language, strlen(language));
+  events_.push_back(event);
+}
+
+void TagsEventBuffer::Item(const TagsItem& item) {
+  Event event;
+  event.type = ITEM;
+  event.lineno = item.lineno;
+  event.charno = item.charno;
+  // Most items share their descriptor with the previous one.
+  if (!events_.empty() && events_.back().type == ITEM &&
+      strcmp(strings_.data() + events_.back().descriptor,
+             item.descriptor) == 0) {
+    event.descriptor = events_.back().descriptor;
+  } else {
+    event.descriptor = AddString(item.descriptor, strlen(item.descriptor));
+  }
+  event.tag = AddString(item.tag, item.tag_length);
+  event.tag_length = item.tag_length;
+  event.snippet = AddString(item.snippet, item.snippet_length);
+  event.snippet_length = item.snippet_length;
+  events_.push_back(event);
+}
+
+void TagsEventBuffer::EndFile() {
+  Event event;
+  event.type = END_FILE;
+  events_.push_back(event);
+}
+
+void TagsEventBuffer::Deleted(const char* path) {
+  Event event;
+  event.type = DELETED;
+  event.tag = AddString(path, strlen(path));
+  events_.push_back(event);
+}
+
+void TagsEventBuffer::Replay(TagsReader::Handler* handler) {
+  const char* strings = strings_.data();
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const Event& event = events_[i];
+    switch (event.type) {
+      case HEADER:
+        handler->Header(headers_[event.lineno]);
+        headers_[event.lineno] = NULL;
+        break;
+      case BEGIN_FILE:
+        handler->File(strings + event.tag, strings + event.snippet);
+        break;
+      case ITEM: {
+        TagsItem item;
+        item.lineno = event.lineno;
+        item.charno = event.charno;
+        item.descriptor = strings + event.descriptor;
+        item.tag = strings + event.tag;
+        item.tag_length = event.tag_length;
+        item.snippet = strings + event.snippet;
+        item.snippet_length = event.snippet_length;
+        handler->Item(item);
+        break;
+      }
+      case END_FILE:
+        handler->EndFile();
+        break;
+      case DELETED:
+        handler->Deleted(strings + event.tag);
+        break;
+    }
+  }
+}
+
+int TagsEventBuffer::AddString(const char* str, int length) {
+  int offset = strings_.size();
+  strings_.append(str, length);
+  strings_.push_back('\0');
+  return offset;
+}
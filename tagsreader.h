@@ -0,0 +1,224 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// TagsReader reads the declarations of a TAGS file and reports them
+// to a Handler as a stream of events: one per header declaration,
+// the start and end of each (file ...) declaration, one per item in
+// its contents, and one per (deleted ...) declaration.
+//
+// Unlike parsing each declaration with SExpression::Parse, this
+// builds no tree: the reader walks the text directly, keeping only
+// the few attribute values it reports, in buffers that are reused
+// from one item to the next. Only header declarations, of which there
+// are a handful per file, are handed out as SExpressions.
+//
+// TagsEventBuffer records events so that they can be replayed later,
+// possibly on another thread, and TagsBatch uses it to read TAGS files
+// with a ParallelReader (see parallelreader.h).
+
+#ifndef TOOLS_TAGS_TAGSREADER_H__
+#define TOOLS_TAGS_TAGSREADER_H__
+
+#include <string>
+#include <vector>
+
+#include "tagsutil.h"
+
+class SExpression;
+
+// An (item ...) in the contents of a (file ...) declaration. The
+// strings are nul-terminated, and are only valid during the call to
+// Handler::Item.
+struct TagsItem {
+  int lineno;
+  int charno;
+  // The head of the item's descriptor, such as "generic-tag" or
+  // "call".
+  const char* descriptor;
+  // The tag attribute of the descriptor, or for a call, the name of
+  // the ref it calls. Empty if the descriptor has neither.
+  const char* tag;
+  int tag_length;
+  // The snippet attribute of the item, or empty if it has none.
+  const char* snippet;
+  int snippet_length;
+};
+
+class TagsReader {
+ public:
+  class Handler {
+   public:
+    virtual ~Handler() {}
+
+    // Called for declarations other than file and deleted, such as
+    // (tags-format-version 2). The handler takes ownership of SEXP.
+    virtual void Header(SExpression* sexp) = 0;
+
+    // Called at the start of (file (path PATH) (language LANGUAGE)
+    // (contents ...)), before the items in its contents.
+    virtual void File(const char* path, const char* language) = 0;
+
+    // Called for each item with a descriptor in the contents of the
+    // current file. Items without one are not tags and are skipped.
+    virtual void Item(const TagsItem& item) = 0;
+
+    // Called after the last item of the current file.
+    virtual void EndFile() = 0;
+
+    // Called for (deleted PATH).
+    virtual void Deleted(const char* path) = 0;
+  };
+
+  explicit TagsReader(Handler* handler) : handler_(handler) {}
+
+  // Reads the declarations in the LENGTH bytes at TEXT, which must end
+  // between two declarations. Returns false on malformed input, in
+  // which case the handler may have seen only part of it.
+  bool Read(const char* text, int length);
+
+  // Describes what was wrong with the input, once Read returned false.
+  const string& error() const {
+    return error_;
+  }
+
+ private:
+  // Reads one top-level declaration.
+  void ReadDeclaration();
+  // Reads the rest of a (file ...) declaration.
+  void ReadFile();
+  // Reads an (item ...) declaration.
+  void ReadItem();
+  // Reads an item descriptor into descriptor_ and tag_.
+  void ReadDescriptor();
+  // Reads (ref (name NAME) ...) into NAME.
+  void ReadRef(string* name);
+
+  // Records ERROR and the text at the current position, unless an
+  // error was already recorded, and moves to the end of the input so
+  // that every loop over it ends. Nothing more is reported to the
+  // handler once an error is recorded.
+  void Fail(const char* error);
+  bool failed() const {
+    return !error_.empty();
+  }
+
+  // Lexical helpers. They all skip leading whitespace. On malformed
+  // input they Fail, and return empty values.
+
+  // Moves past whitespace, and returns true if there is more input.
+  bool SkipWhitespace();
+  // Checks that the next character is C, and moves past it.
+  void Expect(char c, const char* what);
+  // Moves past a ')' and returns true if it is next, or if the input
+  // ended.
+  bool TryClose();
+  // Reads a symbol, bare or in bars, into VALUE.
+  void ReadSymbol(string* value);
+  // Reads a quoted string into VALUE.
+  void ReadString(string* value);
+  // Reads an integer.
+  int ReadInteger();
+  // Moves past one s-expression of any kind.
+  void Skip();
+  // Moves past the rest of the list we are in, including its ')'.
+  void SkipRest();
+  // Reads the characters up to DELIMITER, unescaping them into VALUE.
+  void ReadDelimited(char delimiter, string* value);
+
+  Handler* handler_;
+
+  // The text being read.
+  const char* p_;
+  const char* end_;
+
+  // Buffers for the values we report, reused across declarations.
+  string symbol_;
+  string path_;
+  string language_;
+  string descriptor_;
+  string tag_;
+  string snippet_;
+
+  // The first error in the input, or empty.
+  string error_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TagsReader);
+};
+
+// Records the events of a TagsReader in a compact form, to be passed
+// on later with Replay.
+class TagsEventBuffer : public TagsReader::Handler {
+ public:
+  TagsEventBuffer() {}
+  virtual ~TagsEventBuffer();
+
+  virtual void Header(SExpression* sexp);
+  virtual void File(const char* path, const char* language);
+  virtual void Item(const TagsItem& item);
+  virtual void EndFile();
+  virtual void Deleted(const char* path);
+
+  // Passes the recorded events to HANDLER, in order. Headers are
+  // handed over, so Replay may only be called once.
+  void Replay(TagsReader::Handler* handler);
+
+ private:
+  enum EventType { HEADER, BEGIN_FILE, ITEM, END_FILE, DELETED };
+
+  // For a HEADER, lineno indexes headers_. For a BEGIN_FILE or
+  // DELETED, tag is the path and snippet the language. Strings are
+  // offsets into strings_.
+  struct Event {
+    EventType type;
+    int lineno;
+    int charno;
+    int descriptor;
+    int tag;
+    int tag_length;
+    int snippet;
+    int snippet_length;
+  };
+
+  // Appends the LENGTH bytes at STR and a nul to strings_, and returns
+  // their offset.
+  int AddString(const char* str, int length);
+
+  vector<Event> events_;
+  vector<SExpression*> headers_;
+  string strings_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TagsEventBuffer);
+};
+
+// A batch of a TAGS file for ParallelReader, which is read on a
+// parsing thread into events.
+struct TagsBatch {
+  void Parse() {
+    TagsReader reader(&events);
+    if (!reader.Read(text.data(), text.size()))
+      error = reader.error();
+  }
+
+  string text;
+  TagsEventBuffer events;
+  // What was wrong with the batch, or empty. The events then stop
+  // before the malformed declaration.
+  string error;
+};
+
+#endif  // TOOLS_TAGS_TAGSREADER_H__
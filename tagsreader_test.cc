@@ -0,0 +1,143 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "gtagsunit.h"
+#include "tagsreader.h"
+
+#include "sexpression.h"
+#include "strutil.h"
+#include "tagsoptionparser.h"
+
+namespace {
+
+// Logs each event as a line of text.
+class LoggingHandler : public TagsReader::Handler {
+ public:
+  virtual void Header(SExpression* sexp) {
+    events.push_back("header " + sexp->Repr());
+    delete sexp;
+  }
+  virtual void File(const char* path, const char* language) {
+    events.push_back(string("file ") + path + " " + language);
+  }
+  virtual void Item(const TagsItem& item) {
+    events.push_back("item " + FastItoa(item.lineno) + " " +
+                     FastItoa(item.charno) + " " + item.descriptor + " " +
+                     string(item.tag, item.tag_length) + " " +
+                     string(item.snippet, item.snippet_length));
+  }
+  virtual void EndFile() {
+    events.push_back("end");
+  }
+  virtual void Deleted(const char* path) {
+    events.push_back(string("deleted ") + path);
+  }
+
+  vector<string> events;
+};
+
+const char kTags[] =
+    "(tags-format-version 2)\n"
+    "(tags-comment \"a \\\"comment\\\"\")\n"
+    "(file\n"
+    "  (contents ((item (line 10) (offset 100)\n"
+    "                   (descriptor (generic-tag (tag \"file_size\")))\n"
+    "                   (snippet \"int file_size;\"))\n"
+    "             (item (snippet \"no descriptor\"))\n"
+    "             (item (offset 30) (line 35)\n"
+    "                   (descriptor (function (tag \"f\") (specified-here d)\n"
+    "                                (argument-types ((ref (name \"int\"))))))\n"
+    "                   (snippet \"f(\\\\)\"))\n"
+    "             (item (line 12) (offset 150) (unknown (x \")\"))\n"
+    "                   (descriptor (call (to (ref (name \"file_size\")))))\n"
+    "                   )))\n"
+    "  (path \"tools/tags/file1.h\")\n"
+    "  (language \"c++\"))\n"
+    "(file (path \"empty.h\") (language \"c++\") (contents nil))\n"
+    "(deleted \"tools/util/file2.h\")\n";
+
+TEST(TagsReaderTest, Events) {
+  LoggingHandler handler;
+  TagsReader reader(&handler);
+  EXPECT_TRUE(reader.Read(kTags, sizeof(kTags) - 1));
+
+  ASSERT_EQ(10, handler.events.size());
+  EXPECT_EQ("header (tags-format-version 2)", handler.events[0]);
+  EXPECT_EQ("header (tags-comment \"a \\\"comment\\\"\")", handler.events[1]);
+  // Items are reported after the file, even if the contents come
+  // first.
+  EXPECT_EQ("file tools/tags/file1.h c++", handler.events[2]);
+  EXPECT_EQ("item 10 100 generic-tag file_size int file_size;",
+            handler.events[3]);
+  EXPECT_EQ("item 35 30 function f f(\\)", handler.events[4]);
+  EXPECT_EQ("item 12 150 call file_size ", handler.events[5]);
+  EXPECT_EQ("end", handler.events[6]);
+  EXPECT_EQ("file empty.h c++", handler.events[7]);
+  EXPECT_EQ("end", handler.events[8]);
+  EXPECT_EQ("deleted tools/util/file2.h", handler.events[9]);
+}
+
+TEST(TagsReaderTest, Malformed) {
+  const char* kMalformed[] = {
+    "(tags-format-version 2",
+    "(file (path \"a.h\") (contents nil))",
+    "(file (path \"a.h\") (language \"c++\") (contents ((item (line x)))))",
+    "(file (path \"a.h\") (language \"c++\") (contents ((nonitem))))",
+    "(deleted \"unterminated)",
+    "()",
+    "tags-format-version",
+  };
+  for (size_t i = 0; i < sizeof(kMalformed) / sizeof(kMalformed[0]); ++i) {
+    LoggingHandler handler;
+    TagsReader reader(&handler);
+    EXPECT_FALSE(reader.Read(kMalformed[i], strlen(kMalformed[i])));
+    EXPECT_FALSE(reader.error().empty());
+  }
+
+  // Declarations before the malformed one are reported, and nothing
+  // after it.
+  const char kTruncated[] =
+      "(tags-format-version 2)\n"
+      "(deleted \"a.h\")\n"
+      "(file (path \"b.h\") (language";
+  LoggingHandler handler;
+  TagsReader reader(&handler);
+  EXPECT_FALSE(reader.Read(kTruncated, sizeof(kTruncated) - 1));
+  ASSERT_EQ(2, handler.events.size());
+  EXPECT_EQ("deleted a.h", handler.events[1]);
+}
+
+TEST(TagsEventBufferTest, Replay) {
+  LoggingHandler expected;
+  TagsReader reader(&expected);
+  reader.Read(kTags, sizeof(kTags) - 1);
+
+  TagsEventBuffer buffer;
+  TagsReader buffered_reader(&buffer);
+  buffered_reader.Read(kTags, sizeof(kTags) - 1);
+  LoggingHandler actual;
+  buffer.Replay(&actual);
+
+  EXPECT_TRUE(expected.events == actual.events);
+}
+
+}  // namespace
@@ -25,57 +25,156 @@
 #include <set>
 #include <string>
 
+#include "responsecache.h"
 #include "tagstable.h"
+#include "tagstableholder.h"
 #include "sexpression.h"
 #include "tagsoptionparser.h"
 #include "tagsutil.h"
 #include "queryprofile.h"
 
 using gtags::MutexLock;
+using gtags::ReaderMutexLock;
+using gtags::WriterMutexLock;
 
 // If test mode flag is on, the server will answer 'nil' instead of
 // 't' to the '/' or 'ping' commands, so the clients can know that the
 // server is in testing mode.
 DEFINE_BOOL(test_mode, false, "Enable test mode");
 
-SingleTableTagsRequestHandler::SingleTableTagsRequestHandler
-    (string tags_file, bool enable_fileindex, bool enable_gunzip,
-     string corpus_root) {
-  tags_table_ = new TagsTable(enable_fileindex);
-  CHECK(tags_table_->ReloadTagFile(tags_file, enable_gunzip));
+DEFINE_INT32(response_cache_bytes, 16 << 20,
+             "Memory used to cache the responses to recent lookups "
+             "(0 disables the cache)");
+
+namespace {
+
+// Appends FIELD to KEY, prefixed with its length so that the fields
+// of different keys can't run into each other.
+void AppendKeyField(const string& field, string* key) {
+  key->append(FastItoa(field.size()));
+  key->push_back(':');
+  key->append(field);
+}
+
+}  // namespace
+
+TagsRequest::~TagsRequest() {
+  delete sexp_;
+}
+
+void TagsRequest::set_sexp(SExpression* sexp) {
+  delete sexp_;
+  sexp_ = sexp;
+}
 
-  opcode_handler_ = new OpcodeProtocolRequestHandler(enable_fileindex,
-                                                     enable_gunzip,
-                                                     corpus_root);
-  sexp_handler_ = new SexpProtocolRequestHandler(enable_fileindex,
-                                                 enable_gunzip,
-                                                 corpus_root);
+SingleTableTagsRequestHandler::SingleTableTagsRequestHandler
+    (string tags_file, bool enable_gunzip, string corpus_root) {
+  // The first load happens before we serve anything, so there is no
+  // point doing it in the background.
+  TagsTable* tags_table = new TagsTable();
+  CHECK(tags_table->ReloadTagFile(tags_file, enable_gunzip));
+  tables_ = new TagsTableHolder(tags_table);
+
+  opcode_handler_ = new OpcodeProtocolRequestHandler(enable_gunzip,
+                                                     corpus_root,
+                                                     tables_);
+  sexp_handler_ = new SexpProtocolRequestHandler(enable_gunzip,
+                                                 corpus_root,
+                                                 tables_);
 }
 
 SingleTableTagsRequestHandler::~SingleTableTagsRequestHandler() {
-  delete tags_table_;
   delete opcode_handler_;
   delete sexp_handler_;
+  delete tables_;
 }
 
 string
 SingleTableTagsRequestHandler::Execute(const char* command,
                                        clock_t* pclock_before_preparing_results,
                                        struct query_profile* log) {
+  TagsRequest request(command);
+  Prepare(&request);
+  return Execute(request, pclock_before_preparing_results, log);
+}
+
+void SingleTableTagsRequestHandler::Prepare(TagsRequest* request) const {
+  HandlerFor(request->command())->Prepare(request);
+}
+
+string
+SingleTableTagsRequestHandler::Execute(const TagsRequest& request,
+                                       clock_t* pclock_before_preparing_results,
+                                       struct query_profile* log) {
   // We work by dispatching on protocol, which can be determined by
   // looking at the first character.
-  ProtocolRequestHandler* handler
-    = (*command == '(') ? sexp_handler_ : opcode_handler_;
+  ProtocolRequestHandler* handler = HandlerFor(request.command());
 
   CHECK(pclock_before_preparing_results != NULL);
   CHECK(log != NULL);
 
-  return handler->Execute(command,
-                          tags_table_,
+  // Updates change the current table in place, so they must not run
+  // alongside queries.
+  if (request.changes_table()) {
+    WriterMutexLock lock(&mu_);
+    TagsTableHolder::Reference tags_table(tables_);
+    return handler->Execute(request,
+                            tags_table.get(),
+                            pclock_before_preparing_results,
+                            log);
+  }
+
+  ReaderMutexLock lock(&mu_);
+  // A reload started by this request, or finishing during it, doesn't
+  // affect the table the request uses.
+  TagsTableHolder::Reference tags_table(tables_);
+  return handler->Execute(request,
+                          tags_table.get(),
                           pclock_before_preparing_results,
                           log);
 }
 
+void SingleTableTagsRequestHandler::WaitForReload() {
+  tables_->WaitForReload();
+}
+
+bool ProtocolRequestHandler::ReloadTagFile(TagsTable* tags_table,
+                                           const string& filename) {
+  if (tables_ != NULL)
+    return tables_->StartReload(filename, enable_gunzip_);
+  return tags_table->ReloadTagFile(filename, enable_gunzip_);
+}
+
+bool ProtocolRequestHandler::UpdateTagFile(TagsTable* tags_table,
+                                           const string& filename) {
+  if (tables_ != NULL)
+    return tables_->Update(filename, enable_gunzip_);
+  return tags_table->UpdateTagFile(filename, enable_gunzip_);
+}
+
+void ProtocolRequestHandler::Prepare(TagsRequest* request) const {
+  TagsCommand tags_command;
+  if (!GetCommand(request, &tags_command)) {
+    request->set_class(false, false);
+    return;
+  }
+  switch (tags_command) {
+    case RELOAD_TAGS_FILE:
+    case LOAD_UPDATE_FILE:
+      request->set_class(true, true);
+      break;
+    case LOOKUP_TAG_PREFIX_REGEXP:
+    case LOOKUP_TAG_SNIPPET_REGEXP:
+    case FIND_FILE:
+    case GET_MEMORY_STATS:
+      request->set_class(false, true);
+      break;
+    default:
+      request->set_class(false, false);
+      break;
+  }
+}
+
 string ProtocolRequestHandler::StripCorpusRoot(const string& path) {
   if (corpus_root_ == "")
     return path;
@@ -87,11 +186,39 @@ string ProtocolRequestHandler::StripCorpusRoot(const string& path) {
     return path;
 }
 
+class OpcodeProtocolRequestHandler::ResultPrinter
+    : public TagsTable::ResultSink {
+ public:
+  ResultPrinter(OpcodeProtocolRequestHandler* handler, string* output)
+      : handler_(handler), output_(output) {}
+
+  // Output format:
+  // ((tag . (snippet filename filesize line offset)) ...)
+  virtual void Add(const TagsTable::TagsResult& result) {
+    output_->append("(\"");
+    output_->append(result.tag);
+    output_->append("\" . (\"");
+    output_->append(handler_->EscapeQuotes(result.linerep));
+    output_->append("\" \"");
+    output_->append(result.filename->c_str(), result.filename->length());
+    output_->append("\" 0 ");  // filesize field is obselete; fill in 0
+    output_->append(FastItoa(result.lineno));
+    output_->push_back(' ');
+    output_->append(FastItoa(result.charno));
+    output_->append(")) ");
+  }
+
+ private:
+  OpcodeProtocolRequestHandler* handler_;
+  string* output_;
+};
+
 string OpcodeProtocolRequestHandler::Execute(
-    const char* command,
+    const TagsRequest& request,
     TagsTable* tags_table,
     clock_t* pclock_before_preparing_results,
     struct query_profile* log) {
+  const char* command = request.command();
   string output;
 
   // Extract leading comment, if any
@@ -115,12 +242,14 @@ string OpcodeProtocolRequestHandler::Execute(
   log->current_file = "";
   log->client_message = "";
 
-  list<const TagsTable::TagsResult*>* tag_matches = NULL;
+  ResultPrinter printer(this, &output);
   set<string>* file_matches = NULL;
 
   bool search_callers = tags_table->SearchCallersByDefault();
 
-  // Set command based on opcode and put the tag in the right place
+  // Set command based on opcode and put the tag in the right place.
+  // Tags matches are printed as the table finds them, so for lookups
+  // the clock is read once they have been.
   switch (*command) {
     case PING:  // Ping, print 't if not in testing mode
       *pclock_before_preparing_results = clock();
@@ -128,13 +257,11 @@ string OpcodeProtocolRequestHandler::Execute(
       break;
     case RELOAD_TAGS_FILE:  // Reload tags table, print 't if success
       *pclock_before_preparing_results = clock();
-      output.append(
-          tags_table->ReloadTagFile(tag, enable_gunzip_) ? "t" : "nil");
+      output.append(ReloadTagFile(tags_table, tag) ? "t" : "nil");
       break;
     case LOAD_UPDATE_FILE:
       *pclock_before_preparing_results = clock();
-      output.append(
-          tags_table->UpdateTagFile(tag, enable_gunzip_) ? "t" : "nil");
+      output.append(UpdateTagFile(tags_table, tag) ? "t" : "nil");
       break;
     case FIND_FILE:  // Find file
       file_matches = tags_table->FindFile(tag);
@@ -143,63 +270,53 @@ string OpcodeProtocolRequestHandler::Execute(
       break;
     case LOOKUP_TAGS_IN_FILE:  // All tags in file
       *pclock_before_preparing_results = clock();
-      if (enable_fileindex_) {
-        string file = StripCorpusRoot(tag);
-        tag_matches = tags_table->FindTagsByFile(file, search_callers);
-        PrintTagsResults(tag_matches, &output);
-      } else {
-        output.append("nil");
-      }
+      output.push_back('(');
+      tags_table->FindTagsByFile(StripCorpusRoot(tag), search_callers,
+                                 &printer);
+      output.push_back(')');
       break;
     case LOOKUP_TAG_PREFIX_REGEXP:  // Prefix regexp
-      tag_matches = tags_table->FindRegexpTags(tag, "", search_callers, NULL);
+      output.push_back('(');
+      tags_table->FindRegexpTags(tag, "", search_callers, NULL, &printer);
+      output.push_back(')');
       *pclock_before_preparing_results = clock();
-      PrintTagsResults(tag_matches, &output);
       break;
     case LOOKUP_TAG_SNIPPET_REGEXP:  // Snippet regexp
-      tag_matches =
-          tags_table->FindSnippetMatches(tag, "", search_callers, NULL);
+      output.push_back('(');
+      tags_table->FindSnippetMatches(tag, "", search_callers, NULL, &printer);
+      output.push_back(')');
       *pclock_before_preparing_results = clock();
-      PrintTagsResults(tag_matches, &output);
       break;
     case LOOKUP_TAG_EXACT:  // Exact match
-      tag_matches = tags_table->FindTags(tag, "", search_callers, NULL);
+      output.push_back('(');
+      tags_table->FindTags(tag, "", search_callers, NULL, &printer);
+      output.push_back(')');
       *pclock_before_preparing_results = clock();
-      PrintTagsResults(tag_matches, &output);
       break;
     default:
       *pclock_before_preparing_results = clock();
       output.append("nil");
   }
 
-  delete tag_matches;
   delete file_matches;
 
   return output;
 }
 
-void OpcodeProtocolRequestHandler::PrintTagsResults(
-    list<const TagsTable::TagsResult*>* matches,
-    string* output) {
-  output->push_back('(');
-  // Output format:
-  // ((tag . (snippet filename filesize line offset)) ...)
-  for (list<const TagsTable::TagsResult*>::const_iterator i = matches->begin();
-       i != matches->end();
-       ++i) {
-    output->append("(\"");
-    output->append((*i)->tag);
-    output->append("\" . (\"");
-    output->append(EscapeQuotes((*i)->linerep));
-    output->append("\" \"");
-    output->append((*i)->filename->Str());
-    output->append("\" 0 ");  // filesize field is obselete; fill in 0
-    output->append(FastItoa((*i)->lineno));
-    output->push_back(' ');
-    output->append(FastItoa((*i)->charno));
-    output->append(")) ");
+bool OpcodeProtocolRequestHandler::GetCommand(TagsRequest* request,
+                                              TagsCommand* tags_command) const {
+  const char* command = request->command();
+  // Skip the leading comment, if any, as Execute does.
+  if (*command == '#') {
+    command = strchr(command + 1, '#');
+    if (command == NULL)
+      return false;
+    command++;
   }
-  output->push_back(')');
+  if (*command == '\0')
+    return false;
+  *tags_command = static_cast<TagsCommand>(*command);
+  return true;
 }
 
 void OpcodeProtocolRequestHandler::PrintFileResults(set<string>* matching_files,
@@ -227,10 +344,10 @@ string OpcodeProtocolRequestHandler::EscapeQuotes(string s)  {
   return retval;
 }
 
-SexpProtocolRequestHandler::SexpProtocolRequestHandler(bool fileindex,
-                                                       bool gunzip,
-                                                       string corpus_root)
-    : ProtocolRequestHandler(fileindex, gunzip, corpus_root) {
+SexpProtocolRequestHandler::SexpProtocolRequestHandler(bool gunzip,
+                                                       string corpus_root,
+                                                       TagsTableHolder* tables)
+    : ProtocolRequestHandler(gunzip, corpus_root, tables) {
   server_start_time_ = time(NULL);
   sequence_number_ = 0;
 
@@ -244,6 +361,9 @@ SexpProtocolRequestHandler::SexpProtocolRequestHandler(bool fileindex,
   (*tag_command_map_)["get-server-version"] = GET_SERVER_VERSION;
   (*tag_command_map_)["get-supported-protocol-versions"]
     = GET_SUPPORTED_PROTOCOL_VERSIONS;
+  (*tag_command_map_)["get-server-stats"] = GET_SERVER_STATS;
+  (*tag_command_map_)["get-reload-status"] = GET_RELOAD_STATUS;
+  (*tag_command_map_)["get-memory-stats"] = GET_MEMORY_STATS;
   (*tag_command_map_)["lookup-tag-exact"] = LOOKUP_TAG_EXACT;
   (*tag_command_map_)["lookup-tag-prefix-regexp"] = LOOKUP_TAG_PREFIX_REGEXP;
   (*tag_command_map_)["lookup-tag-snippet-regexp"] = LOOKUP_TAG_SNIPPET_REGEXP;
@@ -257,6 +377,8 @@ SexpProtocolRequestHandler::SexpProtocolRequestHandler(bool fileindex,
   (*client_code_map_)["vi"] = "vi";
   (*client_code_map_)["gnu-emacs"] = "em";
   (*client_code_map_)["xemacs"] = "em";
+
+  response_cache_ = new ResponseCache(GET_FLAG(response_cache_bytes));
 }
 
 SexpProtocolRequestHandler::~SexpProtocolRequestHandler() {
@@ -265,30 +387,76 @@ SexpProtocolRequestHandler::~SexpProtocolRequestHandler() {
 
   delete client_code_map_;
   delete tag_command_map_;
+  delete response_cache_;
 }
 
 string SexpProtocolRequestHandler::Execute(
-    const char* command_list,
+    const TagsRequest& request,
     TagsTable* tags_table,
     clock_t* pclock_before_preparing_results,
     struct query_profile* log) {
   DefaultTagsResultPredicate predicate;
-  return Execute(command_list,
+  return Execute(request,
                  tags_table,
                  pclock_before_preparing_results,
                  log,
                  &predicate);
 }
 
+class SexpProtocolRequestHandler::ResultPrinter
+    : public TagsTable::ResultSink {
+ public:
+  // Directory distances are relative to CURRENT_FILE, or 0 if it is
+  // NULL.
+  ResultPrinter(const Filename* current_file,
+                const TagsResultPredicate* predicate, string* output)
+      : current_file_(current_file), predicate_(predicate),
+        output_(output) {}
+
+  // output format:
+  // (((tag T) (snippet S) (filename F) (lineno L) (offset C)
+  //            (directory-distance D)) ...)
+  virtual void Add(const TagsTable::TagsResult& result) {
+    output_->push_back('(');
+    output_->append("(tag \"");
+    CEscapeAppend(result.tag, strlen(result.tag), output_);
+    output_->append("\") (snippet \"");
+    CEscapeAppend(result.linerep, strlen(result.linerep), output_);
+    output_->append("\") (filename \"");
+    output_->append(result.filename->escaped_c_str(),
+                    result.filename->escaped_length());
+    output_->append("\") (lineno ");
+    output_->append(FastItoa(result.lineno));
+    output_->append(") (offset ");
+    output_->append(FastItoa(result.charno));
+    output_->append(") (directory-distance ");
+    output_->append(FastItoa(
+        current_file_ == NULL
+        ? 0 : result.filename->DistanceTo(*current_file_)));
+    output_->append(")");
+
+    output_->append(") ");
+  }
+
+  virtual bool Accepts(const TagsTable::TagsResult& result) const {
+    return predicate_->Test(&result);
+  }
+
+ private:
+  const Filename* current_file_;
+  const TagsResultPredicate* predicate_;
+  string* output_;
+};
+
 string SexpProtocolRequestHandler::Execute(
-    const char* command_list,
+    const TagsRequest& request,
     TagsTable* tags_table,
     clock_t* pclock_before_preparing_results,
     struct query_profile* log,
     const TagsResultPredicate* predicate) {
-  // We first use TranslateInput to parse the query and make a
-  // TagsQuery struct.
-  TagsQuery query = TranslateInput(command_list,
+  // We first use TranslateInput to make a TagsQuery struct of the
+  // query Prepare parsed.
+  TagsQuery query = TranslateInput(request.sexp(),
                                    tags_table->SearchCallersByDefault());
 
   string output;
@@ -300,11 +468,14 @@ string SexpProtocolRequestHandler::Execute(
   output.append(" ");
   output.append(FastItoa(static_cast<int64>(server_start_time_) & 0xffff));
   output.append(")) (sequence-number ");
-  output.append(FastItoa(sequence_number_));
+  int sequence_number;
+  {
+    MutexLock lock(&sequence_mu_);
+    sequence_number = sequence_number_++;
+  }
+  output.append(FastItoa(sequence_number));
   output.append(") (value ");
 
-  sequence_number_++;
-
   // Set the comment on the basis of the client type. We don't want to
   // use client_code_map_[...] here since that would insert a
   // key/value for any key which wasn't already in there, and clients
@@ -320,7 +491,25 @@ string SexpProtocolRequestHandler::Execute(
   log->current_file = query.file;
   log->client_message = "";
 
-  list<const TagsTable::TagsResult*>* tag_matches = NULL;
+  // Lookups which were answered since the table last changed are
+  // answered again from the cache, without querying the table.
+  string cache_key;
+  bool cacheable = GetCacheKey(query, predicate, &cache_key);
+  int64 generation = tags_table->generation();
+  if (cacheable && response_cache_->Lookup(cache_key, generation, &output)) {
+    *pclock_before_preparing_results = clock();
+    output.append("))");
+    return output;
+  }
+  string::size_type value_start = output.size();
+
+  // Directory distances in the results are relative to the current
+  // file, if there is one.
+  string current_file = StripCorpusRoot(query.file);
+  Filename current_filename(current_file.empty() ? "." : current_file.c_str());
+  const Filename* distance_from =
+      current_file.empty() ? NULL : &current_filename;
+  ResultPrinter printer(distance_from, predicate, &output);
 
   // Write return-value
   switch (query.command) {
@@ -341,52 +530,67 @@ string SexpProtocolRequestHandler::Execute(
       *pclock_before_preparing_results = clock();
       output.append("(1 2)");
       break;
+    case GET_SERVER_STATS:
+      *pclock_before_preparing_results = clock();
+      PrintServerStats(tags_table, &output);
+      break;
+    case GET_RELOAD_STATUS:
+      *pclock_before_preparing_results = clock();
+      PrintReloadStatus(&output);
+      break;
+    case GET_MEMORY_STATS:
+      *pclock_before_preparing_results = clock();
+      PrintMemoryStats(tags_table, &output);
+      break;
     case RELOAD_TAGS_FILE:
       *pclock_before_preparing_results = clock();
-      output.append(
-          tags_table->ReloadTagFile(query.file, enable_gunzip_) ? "t" : "nil");
+      output.append(ReloadTagFile(tags_table, query.file) ? "t" : "nil");
       break;
     case LOAD_UPDATE_FILE:
       *pclock_before_preparing_results = clock();
-      output.append(
-          tags_table->UpdateTagFile(query.file, enable_gunzip_) ? "t" : "nil");
+      output.append(UpdateTagFile(tags_table, query.file) ? "t" : "nil");
       break;
     case LOOKUP_TAGS_IN_FILE:
       *pclock_before_preparing_results = clock();
-      if (enable_fileindex_ && query.file != "") {
-        tag_matches = tags_table->FindTagsByFile(StripCorpusRoot(query.file),
-                                                 query.callers);
-        PrintTagsResults(tag_matches, &output, predicate);
+      if (query.file != "") {
+        output.push_back('(');
+        tags_table->FindTagsByFile(current_file, query.callers, &printer);
+        output.push_back(')');
       } else {
         output.append("nil");
       }
       break;
+    // Tags matches are printed as the table finds them, so the clock
+    // is read once they have been.
     case LOOKUP_TAG_PREFIX_REGEXP:
-      tag_matches
-        = tags_table->FindRegexpTags(query.tag,
-                                     StripCorpusRoot(query.file),
-                                     query.callers,
-                                     &query.ranking);
+      output.push_back('(');
+      tags_table->FindRegexpTags(query.tag,
+                                 current_file,
+                                 query.callers,
+                                 &query.ranking,
+                                 &printer);
+      output.push_back(')');
       *pclock_before_preparing_results = clock();
-      PrintTagsResults(tag_matches, &output, predicate);
       break;
     case LOOKUP_TAG_SNIPPET_REGEXP:
-      tag_matches
-        = tags_table->FindSnippetMatches(query.tag,
-                                         StripCorpusRoot(query.file),
-                                         query.callers,
-                                         &query.ranking);
+      output.push_back('(');
+      tags_table->FindSnippetMatches(query.tag,
+                                     current_file,
+                                     query.callers,
+                                     &query.ranking,
+                                     &printer);
+      output.push_back(')');
       *pclock_before_preparing_results = clock();
-      PrintTagsResults(tag_matches, &output, predicate);
       break;
     case LOOKUP_TAG_EXACT:
-      tag_matches
-        = tags_table->FindTags(query.tag,
-                               StripCorpusRoot(query.file),
-                               query.callers,
-                               &query.ranking);
+      output.push_back('(');
+      tags_table->FindTags(query.tag,
+                           current_file,
+                           query.callers,
+                           &query.ranking,
+                           &printer);
+      output.push_back(')');
       *pclock_before_preparing_results = clock();
-      PrintTagsResults(tag_matches, &output, predicate);
       break;
     default:
       *pclock_before_preparing_results = clock();
@@ -394,53 +598,172 @@ string SexpProtocolRequestHandler::Execute(
       break;
   }
 
-  delete tag_matches;
+  if (cacheable) {
+    response_cache_->Insert(cache_key, generation,
+                            output.substr(value_start));
+  }
 
   output.append("))");
 
   return output;
 }
 
-void SexpProtocolRequestHandler::PrintTagsResults(
-    list<const TagsTable::TagsResult*>* matches,
-    string* output,
-    const TagsResultPredicate* predicate) {
-  // output format:
-  // (((tag T) (snippet S) (filename F) (lineno L) (offset C)
-  //            (directory-distance D)) ...)
-  output->push_back('(');
-  for (list<const TagsTable::TagsResult*>::const_iterator i = matches->begin();
-       i != matches->end();
+bool SexpProtocolRequestHandler::GetCacheKey(
+    const TagsQuery& query,
+    const TagsResultPredicate* predicate,
+    string* key) {
+  switch (query.command) {
+    case LOOKUP_TAGS_IN_FILE:
+    case LOOKUP_TAG_PREFIX_REGEXP:
+    case LOOKUP_TAG_SNIPPET_REGEXP:
+    case LOOKUP_TAG_EXACT:
+      break;
+    default:
+      return false;
+  }
+
+  // Everything the response depends on, besides the table.
+  key->push_back(query.command);
+  key->push_back(query.callers ? 't' : 'n');
+  AppendKeyField(query.tag, key);
+  AppendKeyField(query.file, key);
+  key->append(FastItoa(query.ranking.size()));
+  for (list<string>::const_iterator i = query.ranking.begin();
+       i != query.ranking.end();
        ++i) {
-    if (!predicate->Test(*i)) {
-      continue;
-    }
+    AppendKeyField(*i, key);
+  }
+  return predicate->AppendCacheKey(key);
+}
 
-    output->push_back('(');
-    output->append("(tag \"");
-    output->append(CEscape((*i)->tag));
-    output->append("\") (snippet \"");
-    output->append(CEscape((*i)->linerep));
-    output->append("\") (filename \"");
-    output->append(CEscape((*i)->filename->Str()));
-    output->append("\") (lineno ");
-    output->append(FastItoa((*i)->lineno));
-    output->append(") (offset ");
-    output->append(FastItoa((*i)->charno));
-    output->append(") (directory-distance ");
-    // TODO(psung): Fill in directory-distance here
-    output->append("0");
-    output->append(")");
-
-    output->append(") ");
+void SexpProtocolRequestHandler::PrintServerStats(const TagsTable* tags_table,
+                                                  string* output) {
+  // output format:
+  // ((table-generation G) (table-size N)
+  //  (response-cache (entries E) (bytes B) (hits H) (misses M)))
+  output->append("((table-generation ");
+  output->append(Int64ToString(tags_table->generation()));
+  output->append(") (table-size ");
+  output->append(FastItoa(tags_table->size()));
+  output->append(") (response-cache (entries ");
+  output->append(FastItoa(response_cache_->size()));
+  output->append(") (bytes ");
+  output->append(Int64ToString(response_cache_->bytes_used()));
+  output->append(") (hits ");
+  output->append(Int64ToString(response_cache_->hits()));
+  output->append(") (misses ");
+  output->append(Int64ToString(response_cache_->misses()));
+  output->append(")))");
+}
+
+void SexpProtocolRequestHandler::PrintMemoryStats(const TagsTable* tags_table,
+                                                  string* output) {
+  // output format:
+  // ((total-bytes B)
+  //  (bytes (strings B) (tags B) (index B) (snippet-index B) (files B)
+  //         (file-index B) (find-file B))
+  //  (snapshot-bytes B) (strings N) (files N)
+  //  (tags (call N) (generic N) (type N) (variable N) (function N)))
+  static const char* const kTagTypeNames[TagsTable::kNumTagTypes] = {
+    "call", "generic", "type", "variable", "function"
+  };
+  TagsTable::MemoryStats stats;
+  tags_table->GetMemoryStats(&stats);
+  output->append("((total-bytes ");
+  output->append(Int64ToString(stats.total_bytes));
+  output->append(") (bytes (strings ");
+  output->append(Int64ToString(stats.string_bytes));
+  output->append(") (tags ");
+  output->append(Int64ToString(stats.tag_bytes));
+  output->append(") (index ");
+  output->append(Int64ToString(stats.index_bytes));
+  output->append(") (snippet-index ");
+  output->append(Int64ToString(stats.snippet_index_bytes));
+  output->append(") (files ");
+  output->append(Int64ToString(stats.file_bytes));
+  output->append(") (file-index ");
+  output->append(Int64ToString(stats.file_index_bytes));
+  output->append(") (find-file ");
+  output->append(Int64ToString(stats.find_file_bytes));
+  output->append(")) (snapshot-bytes ");
+  output->append(Int64ToString(stats.snapshot_bytes));
+  output->append(") (strings ");
+  output->append(FastItoa(stats.strings));
+  output->append(") (files ");
+  output->append(FastItoa(stats.files));
+  output->append(") (tags");
+  for (int type = 0; type < TagsTable::kNumTagTypes; ++type) {
+    output->append(" (");
+    output->append(kTagTypeNames[type]);
+    output->push_back(' ');
+    output->append(FastItoa(stats.tags[type]));
+    output->push_back(')');
   }
-  output->push_back(')');
+  output->append("))");
+}
+
+void SexpProtocolRequestHandler::PrintReloadStatus(string* output) {
+  // output format:
+  // ((state S) (file F) (elapsed-seconds E) (tags-loaded N))
+  // where S is one of idle, loading, succeeded and failed. Only the
+  // state is given when idle. E is the time the reload has taken so
+  // far, or took.
+  if (tables_ == NULL) {
+    output->append("((state idle))");
+    return;
+  }
+
+  TagsTableHolder::ReloadStatus status;
+  tables_->GetReloadStatus(&status);
+  output->append("((state ");
+  switch (status.state) {
+    case TagsTableHolder::IDLE:
+      output->append("idle))");
+      return;
+    case TagsTableHolder::LOADING:
+      output->append("loading");
+      break;
+    case TagsTableHolder::SUCCEEDED:
+      output->append("succeeded");
+      break;
+    case TagsTableHolder::FAILED:
+      output->append("failed");
+      break;
+  }
+  time_t end_time = status.state == TagsTableHolder::LOADING
+      ? time(NULL) : status.end_time;
+  output->append(") (file \"");
+  CEscapeAppend(status.filename.data(), status.filename.size(), output);
+  output->append("\") (elapsed-seconds ");
+  output->append(FastItoa(end_time - status.start_time));
+  output->append(") (tags-loaded ");
+  output->append(FastItoa(status.tags_loaded));
+  output->append("))");
+}
+
+bool SexpProtocolRequestHandler::GetCommand(TagsRequest* request,
+                                            TagsCommand* tags_command) const {
+  SExpression* command_list = SExpression::Parse(request->command());
+  // Execute translates the parsed command, so it is kept.
+  request->set_sexp(command_list);
+  bool found = false;
+  if (command_list != NULL && command_list->IsList()) {
+    SExpression::const_iterator iter = command_list->Begin();
+    if (iter != command_list->End() && iter->IsSymbol()) {
+      map<string, TagsCommand>::const_iterator cmd_iter =
+          tag_command_map_->find(iter->Repr());
+      if (cmd_iter != tag_command_map_->end()) {
+        *tags_command = cmd_iter->second;
+        found = true;
+      }
+    }
+  }
+  return found;
 }
 
 SexpProtocolRequestHandler::TagsQuery
-SexpProtocolRequestHandler::TranslateInput(const char* command_list_string,
+SexpProtocolRequestHandler::TranslateInput(const SExpression* command_list,
                                            bool default_callers_value) {
-  SExpression* command_list = SExpression::Parse(command_list_string);
   SexpProtocolRequestHandler::TagsQuery query;
 
   query.client_type = "Unknown";
@@ -539,16 +862,13 @@ SexpProtocolRequestHandler::TranslateInput(const char* command_list_string,
     }
   }
 
-  delete command_list;
-
   return query;
 }
 
-LocalTagsRequestHandler::LocalTagsRequestHandler(bool fileindex, bool gunzip,
+LocalTagsRequestHandler::LocalTagsRequestHandler(bool gunzip,
                                                  string corpus_root) {
-  tags_table_ = new TagsTable(fileindex);
-  sexpr_handler_ = new SexpProtocolRequestHandler(fileindex, gunzip,
-                                                  corpus_root);
+  tags_table_ = new TagsTable();
+  sexpr_handler_ = new SexpProtocolRequestHandler(gunzip, corpus_root);
 }
 
 LocalTagsRequestHandler::~LocalTagsRequestHandler() {
@@ -568,17 +888,41 @@ string LocalTagsRequestHandler::Execute(const char* command,
   struct query_profile profile;
 
   LanguageClientTagsResultPredicate predicate(language, client_path);
-  MutexLock lock(&mu_);
-  return sexpr_handler_->Execute(command, tags_table_, &clock, &profile,
+  TagsRequest request(command);
+  sexpr_handler_->Prepare(&request);
+  if (request.changes_table()) {
+    WriterMutexLock lock(&mu_);
+    return sexpr_handler_->Execute(request, tags_table_, &clock, &profile,
+                                   &predicate);
+  }
+  ReaderMutexLock lock(&mu_);
+  return sexpr_handler_->Execute(request, tags_table_, &clock, &profile,
                                  &predicate);
 }
 
 void LocalTagsRequestHandler::Update(const string& filename) {
-  MutexLock lock(&mu_);
-  tags_table_->UpdateTagFile(filename, false);
+  TagsUpdate* update = TagsTable::ReadUpdate(filename, false);
+  if (update == NULL)
+    return;
+  {
+    WriterMutexLock lock(&mu_);
+    tags_table_->ApplyUpdate(update, true);
+  }
+  delete update;
+
+  // The rebuild only reads the table, so queries go on meanwhile.
+  TagsTable::Rebuild* rebuild;
+  {
+    ReaderMutexLock lock(&mu_);
+    rebuild = tags_table_->PrepareRebuild();
+  }
+  if (rebuild != NULL) {
+    WriterMutexLock lock(&mu_);
+    tags_table_->FinishRebuild(rebuild);
+  }
 }
 
 void LocalTagsRequestHandler::UnloadFilesInDir(const string& dirname) {
-  MutexLock lock(&mu_);
+  WriterMutexLock lock(&mu_);
   tags_table_->UnloadFilesInDir(dirname);
 }
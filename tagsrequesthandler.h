@@ -33,8 +33,59 @@
 
 struct query_profile;
 class ProtocolRequestHandler;
+class ResponseCache;
+class TagsTableHolder;
 
 using gtags::Mutex;
+using gtags::RWMutex;
+
+// A request, parsed and classified by TagsRequestHandler::Prepare so
+// that a server can decide where to execute it, and then execute it,
+// without the command being parsed or looked up again.
+class TagsRequest {
+ public:
+  explicit TagsRequest(const char* command)
+      : command_(command), sexp_(NULL),
+        changes_table_(false), slow_(false) {}
+
+  ~TagsRequest();
+
+  const char* command() const {
+    return command_.c_str();
+  }
+
+  // The command parsed as an s-expression, or NULL if it wasn't.
+  const SExpression* sexp() const {
+    return sexp_;
+  }
+
+  // Whether the command loads a tags file into the table it is
+  // executed on, rather than only reading from it.
+  bool changes_table() const {
+    return changes_table_;
+  }
+
+  // Whether the command may take much longer to answer than a lookup,
+  // because it scans the table or loads a file.
+  bool slow() const {
+    return slow_;
+  }
+
+  // For Prepare. The request takes ownership of SEXP.
+  void set_sexp(SExpression* sexp);
+  void set_class(bool changes_table, bool slow) {
+    changes_table_ = changes_table;
+    slow_ = slow;
+  }
+
+ private:
+  string command_;
+  SExpression* sexp_;
+  bool changes_table_;
+  bool slow_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TagsRequest);
+};
 
 class TagsRequestHandler {
  public:
@@ -52,6 +103,19 @@ class TagsRequestHandler {
   virtual string Execute(const char* command,
                          clock_t* pclock_before_preparing_results,
                          struct query_profile* log) = 0;
+
+  // Parses and classifies REQUEST, so that servers can keep slow
+  // requests from holding up others. By default requests are left
+  // unparsed, and are neither slow nor change the table.
+  virtual void Prepare(TagsRequest* request) const {}
+
+  // Executes REQUEST, which has been prepared by Prepare, as Execute
+  // does its command.
+  virtual string Execute(const TagsRequest& request,
+                         clock_t* pclock_before_preparing_results,
+                         struct query_profile* log) {
+    return Execute(request.command(), pclock_before_preparing_results, log);
+  }
 };
 
 // Stores a TAGS file and converts protocol inputs to outputs
@@ -59,7 +123,6 @@ class SingleTableTagsRequestHandler : public TagsRequestHandler {
  public:
   // New request handler initially reading from tags_file
   SingleTableTagsRequestHandler(string tags_file,
-                                bool enable_fileindex,
                                 bool enable_gunzip,
                                 string corpus_root);
 
@@ -73,23 +136,43 @@ class SingleTableTagsRequestHandler : public TagsRequestHandler {
   //    after the index is queried but before the results are
   //    formatted.
   // -- Fills *pcomment with any comment found in the command.
+  //
+  // Requests may be executed on several threads at once.
   virtual string Execute(const char* command,
                          clock_t* pclock_before_preparing_results,
                          struct query_profile* log);
 
+  virtual void Prepare(TagsRequest* request) const;
+
+  virtual string Execute(const TagsRequest& request,
+                         clock_t* pclock_before_preparing_results,
+                         struct query_profile* log);
+
+  // Waits until the table isn't being reloaded.
+  void WaitForReload();
+
  protected:
   // Only use when creating mock TagsRequestHandler in tests.
-  SingleTableTagsRequestHandler() : tags_table_(0),
+  SingleTableTagsRequestHandler() : tables_(0),
                                     opcode_handler_(0),
                                     sexp_handler_(0) {}
 
  private:
-  // Currently loaded tags table
-  TagsTable * tags_table_;
+  // Currently loaded tags table, which is reloaded in the background
+  TagsTableHolder* tables_;
+
+  // Returns the handler for the protocol COMMAND is in.
+  ProtocolRequestHandler* HandlerFor(const char* command) const {
+    return (*command == '(') ? sexp_handler_ : opcode_handler_;
+  }
 
   // Protocol-specific handlers
   ProtocolRequestHandler* opcode_handler_;
   ProtocolRequestHandler* sexp_handler_;
+
+  // Held for reading by queries and for writing by requests which
+  // change the table.
+  mutable RWMutex mu_;
 };
 
 // Superclass for protocol-specific request handlers. They satisfy
@@ -99,16 +182,18 @@ class SingleTableTagsRequestHandler : public TagsRequestHandler {
 // single tags table in memory.
 class ProtocolRequestHandler {
  public:
-  // fileindex specifies whether to create a per-file index of
-  // tags. This requires a lot more memory.
-  ProtocolRequestHandler(bool fileindex, bool gunzip, string corpus_root)
-      : enable_fileindex_(fileindex), enable_gunzip_(gunzip),
-        corpus_root_(corpus_root) { }
-
-  // Returns the correct response string for input COMMAND using the
-  // specified tags table. Update pclock and pcomment as specified by
-  // TagsRequestHandler.Execute.
-  virtual string Execute(const char* command,
+  // If tables is not NULL, it holds the tags table passed to
+  // Execute, and reloads and updates go through it; reloads then
+  // happen in the background.
+  ProtocolRequestHandler(bool gunzip, string corpus_root,
+                         TagsTableHolder* tables = NULL)
+      : enable_gunzip_(gunzip),
+        corpus_root_(corpus_root), tables_(tables) { }
+
+  // Returns the correct response string for REQUEST, which has been
+  // prepared by Prepare, using the specified tags table. Update pclock
+  // and pcomment as specified by TagsRequestHandler.Execute.
+  virtual string Execute(const TagsRequest& request,
                          TagsTable* tags_table,
                          clock_t* pclock_before_preparing_results,
                          struct query_profile* log) = 0;
@@ -116,19 +201,32 @@ class ProtocolRequestHandler {
   string StripCorpusRoot(const string& path);
 
  protected:
-  bool enable_fileindex_;
+  // Reloads TAGS_TABLE from FILENAME, or starts reloading it in the
+  // background if it belongs to tables_. Returns false on failure, or
+  // if a reload is already in progress.
+  bool ReloadTagFile(TagsTable* tags_table, const string& filename);
+
+  // Updates TAGS_TABLE from FILENAME.
+  bool UpdateTagFile(TagsTable* tags_table, const string& filename);
+
   bool enable_gunzip_;
 
   // Name of the root directory of the corpus, or the empty string to use
   // absolute paths.
   string corpus_root_;
 
+  // Holder of the tags table, or NULL if the caller owns it.
+  TagsTableHolder* tables_;
+
   // These are all the commands available.
   enum TagsCommand {
     PING = '/',
     LOG = 0,
     GET_SERVER_VERSION = 1,
     GET_SUPPORTED_PROTOCOL_VERSIONS = 2,
+    GET_SERVER_STATS = 3,
+    GET_RELOAD_STATUS = 4,
+    GET_MEMORY_STATS = 5,
     RELOAD_TAGS_FILE = '!',
     LOOKUP_TAG_EXACT = ';',
     LOOKUP_TAG_PREFIX_REGEXP = ':',
@@ -137,23 +235,41 @@ class ProtocolRequestHandler {
     FIND_FILE = '&',
     LOAD_UPDATE_FILE = '+'
   };
+
+ public:
+  // Parses REQUEST if the protocol calls for it, looks up the command
+  // it asks for, once, and records in REQUEST what executing it
+  // involves. Commands which can't be understood are neither slow nor
+  // change the table.
+  void Prepare(TagsRequest* request) const;
+
+ protected:
+  // Sets *TAGS_COMMAND to the command REQUEST asks for and returns
+  // true, or returns false if it can't be understood. Stores the
+  // parsed command in REQUEST if the protocol has one.
+  virtual bool GetCommand(TagsRequest* request,
+                          TagsCommand* tags_command) const = 0;
 };
 
 // Handles requests for the old protocol (1 character opcode + tag
 // string)
 class OpcodeProtocolRequestHandler : public ProtocolRequestHandler {
  public:
-  OpcodeProtocolRequestHandler(bool fileindex, bool gunzip, string corpus_root)
-      : ProtocolRequestHandler(fileindex, gunzip, corpus_root) { }
+  OpcodeProtocolRequestHandler(bool gunzip, string corpus_root,
+                               TagsTableHolder* tables = NULL)
+      : ProtocolRequestHandler(gunzip, corpus_root, tables) { }
 
-  virtual string Execute(const char*, TagsTable*, clock_t*,
+  virtual string Execute(const TagsRequest&, TagsTable*, clock_t*,
                          struct query_profile*);
 
+ protected:
+  virtual bool GetCommand(TagsRequest* request,
+                          TagsCommand* tags_command) const;
+
  private:
-  // Given a list of tags matches, prints them as specified by the
-  // protocol and appends to output.
-  void PrintTagsResults(list<const TagsTable::TagsResult*>* matches,
-                        string* output);
+  // Prints tags matches as specified by the protocol, appending them
+  // to an output string as the table finds them.
+  class ResultPrinter;
 
   // Given a list of find-file matches, prints them as specified by
   // the protocol and appends to output.
@@ -169,6 +285,14 @@ class OpcodeProtocolRequestHandler : public ProtocolRequestHandler {
 class TagsResultPredicate {
  public:
   virtual bool Test(const TagsTable::TagsResult* result) const = 0;
+
+  // Appends to KEY a description of the results Test accepts, and
+  // returns true, if responses filtered by this predicate may be
+  // cached; predicates which append the same description must accept
+  // the same results.
+  virtual bool AppendCacheKey(string* key) const {
+    return false;
+  }
 };
 
 // Used on remote GTags servers. No need for filtering since each server serves
@@ -178,6 +302,10 @@ class DefaultTagsResultPredicate : public TagsResultPredicate {
   virtual bool Test(const TagsTable::TagsResult* result) const {
     return true;
   }
+
+  virtual bool AppendCacheKey(string* key) const {
+    return true;
+  }
 };
 
 // Used by local GTags server to determine whether the result matches what the
@@ -193,7 +321,18 @@ class LanguageClientTagsResultPredicate : public TagsResultPredicate {
 
   virtual bool Test(const TagsTable::TagsResult* result) const {
     return (strncmp(result->language, language_.c_str(), language_.size()) == 0)
-        && HasPrefixString(result->filename->Str(), client_path_);
+        && result->filename->length()
+               >= static_cast<int>(client_path_.size())
+        && memcmp(result->filename->c_str(), client_path_.data(),
+                  client_path_.size()) == 0;
+  }
+
+  virtual bool AppendCacheKey(string* key) const {
+    key->append(FastItoa(language_.size()));
+    key->push_back(':');
+    key->append(language_);
+    key->append(client_path_);
+    return true;
   }
 
  private:
@@ -204,17 +343,22 @@ class LanguageClientTagsResultPredicate : public TagsResultPredicate {
 // Handles requests for the new s-expression based protocol.
 class SexpProtocolRequestHandler : public ProtocolRequestHandler {
  public:
-  SexpProtocolRequestHandler(bool fileindex, bool gunzip, string corpus_root);
+  SexpProtocolRequestHandler(bool gunzip, string corpus_root,
+                             TagsTableHolder* tables = NULL);
 
   ~SexpProtocolRequestHandler();
 
-  virtual string Execute(const char*, TagsTable*, clock_t*,
+  virtual string Execute(const TagsRequest&, TagsTable*, clock_t*,
                          struct query_profile*);
 
-  virtual string Execute(const char*, TagsTable*,
+  virtual string Execute(const TagsRequest&, TagsTable*,
                          clock_t*, struct query_profile*,
                          const TagsResultPredicate* predicate);
 
+ protected:
+  virtual bool GetCommand(TagsRequest* request,
+                          TagsCommand* tags_command) const;
+
  private:
   // TODO(psung): Support FIND_FILE in protocol v2
 
@@ -237,27 +381,50 @@ class SexpProtocolRequestHandler : public ProtocolRequestHandler {
     list<string> ranking; // List of field names for ordering results
   };
 
-  // Given a list of tags matches, prints them as specified by the
-  // protocol if the match passes the predicate and appends to output.
-  void PrintTagsResults(list<const TagsTable::TagsResult*>* matches,
-                        string* output, const TagsResultPredicate* predicate);
+  // Prints tags matches as specified by the protocol if they pass a
+  // predicate, appending them to an output string as the table finds
+  // them.
+  class ResultPrinter;
+
+  // If the response to QUERY, filtered by PREDICATE, may be cached,
+  // stores the key to cache it under in KEY and returns true.
+  bool GetCacheKey(const TagsQuery& query,
+                   const TagsResultPredicate* predicate,
+                   string* key);
+
+  // Prints the server statistics for get-server-stats to OUTPUT.
+  void PrintServerStats(const TagsTable* tags_table, string* output);
+
+  // Prints the status of the last reload for get-reload-status to
+  // OUTPUT.
+  void PrintReloadStatus(string* output);
+
+  // Prints where the memory of TAGS_TABLE goes for get-memory-stats
+  // to OUTPUT.
+  void PrintMemoryStats(const TagsTable* tags_table, string* output);
 
   // Converts parsed expression to standard data
   // structure. Default_callers_value is the default value to fill in
   // for query.callers if it's not set in the command.
-  TagsQuery TranslateInput(const char* sexpressionCommand,
+  TagsQuery TranslateInput(const SExpression* command_list,
                            bool default_callers_value);
 
   // Server start time, in seconds since the epoch
   time_t server_start_time_;
   // How many requests have previously been processed
   int sequence_number_;
+  // Guards sequence_number_, since requests may be executed on
+  // several threads at once.
+  Mutex sequence_mu_;
 
   // Map to facilitate converting commands from strings to enums
   map<string, TagsCommand>* tag_command_map_;
 
   // Map to convert client-type field into two-char description for log
   map<string, string>* client_code_map_;
+
+  // Responses to recent lookups
+  ResponseCache* response_cache_;
 };
 
 // A thread-safe TagsRequesHandler for all local tags queries.
@@ -265,9 +432,14 @@ class SexpProtocolRequestHandler : public ProtocolRequestHandler {
 // clients. We run a filter through all results before returning to caller.
 // Performance wise, this is OK because this operation is running in parallel
 // with remote tags query which is network IO bounded.
+//
+// Queries run concurrently with each other. Update reads the update
+// file before it locks out queries, and rebuilds the snippet index
+// and strings while they run, so they are only held up while the
+// parsed tags are applied to the table.
 class LocalTagsRequestHandler {
  public:
-  LocalTagsRequestHandler(bool fileindex, bool gunzip, string corpus_root);
+  LocalTagsRequestHandler(bool gunzip, string corpus_root);
   ~LocalTagsRequestHandler();
 
   string Execute(const char* command, const string& language,
@@ -281,7 +453,9 @@ class LocalTagsRequestHandler {
  private:
   SexpProtocolRequestHandler* sexpr_handler_;
   TagsTable* tags_table_;
-  Mutex mu_;
+  // Held for reading by queries and for writing by anything that
+  // changes tags_table_.
+  RWMutex mu_;
 
   DISALLOW_EVIL_CONSTRUCTORS(LocalTagsRequestHandler);
 };
@@ -30,7 +30,7 @@ GTAGS_FIXTURE(SingleTableTagsRequestHandlerTest) {
   GTAGS_FIXTURE_SETUP(SingleTableTagsRequestHandlerTest) {
     handler_ = new SingleTableTagsRequestHandler(
         TEST_DATA_DIR + "/test_TAGS",
-        false, false, "google3");
+        false, "google3");
   }
 
   GTAGS_FIXTURE_TEARDOWN(SingleTableTagsRequestHandlerTest) {
@@ -61,6 +61,25 @@ GTAGS_FIXTURE(SingleTableTagsRequestHandlerTest) {
     return retval;
   }
 
+  // Returns the (value ...) part of the response to COMMAND.
+  string Value(const char* command) {
+    SExpression* response =
+        SExpression::Parse(handler_->Execute(command, &clock_, &log_));
+    SExpression::const_iterator iter = response->Begin();
+    ++iter;
+    ++iter;
+    string value = iter->Repr();
+    delete response;
+    return value;
+  }
+
+  // Returns true if the handler prepares COMMAND as a slow request.
+  bool IsSlow(const char* command) {
+    TagsRequest request(command);
+    handler_->Prepare(&request);
+    return request.slow();
+  }
+
   SingleTableTagsRequestHandler* handler_;
   struct query_profile log_;
   clock_t clock_;
@@ -78,7 +97,9 @@ TEST_F(SingleTableTagsRequestHandlerTest, OpcodeReloadFile) {
   query.append(TEST_DATA_DIR);
   query.append("/test_empty_TAGS");
 
-  handler_->Execute(query.c_str(), &clock_, &log_);
+  // Reloads return at once, and happen in the background.
+  ExpectSexpEq("t", handler_->Execute(query.c_str(), &clock_, &log_));
+  handler_->WaitForReload();
   ExpectSexpEq("()",
                handler_->Execute("#comment#:file_size", &clock_, &log_));
 }
@@ -120,12 +141,6 @@ TEST_F(SingleTableTagsRequestHandlerTest, OpcodeLookupExact) {
 }
 
 TEST_F(SingleTableTagsRequestHandlerTest, OpcodeLookupFile) {
-  // Make a new handler which creates a file-index
-  delete handler_;
-  handler_ = new SingleTableTagsRequestHandler(
-      TEST_DATA_DIR + "/test_TAGS",
-      true, false, "google3");
-
   ExpectSexpEq("((\"TagsReader\" . "
                "(\"class TagsReader {\" \"tools/cpp/file3.h\" 0 25 400)))",
                handler_->Execute("#comment#@tools/cpp/file3.h",
@@ -175,6 +190,7 @@ TEST_F(SingleTableTagsRequestHandlerTest, SexpReloadFile) {
   query.append("/test_empty_TAGS\"))");
 
   handler_->Execute(query.c_str(), &clock_, &log_);
+  handler_->WaitForReload();
   SExpression* result = SExpression::Parse(
       handler_->Execute("(lookup-tag-prefix-regexp (client-type \"gnu-emacs\")"
                        "(client-version 1) "
@@ -200,6 +216,19 @@ TEST_F(SingleTableTagsRequestHandlerTest, SexpReloadFile) {
   delete result;
 }
 
+TEST_F(SingleTableTagsRequestHandlerTest, SexpReloadStatus) {
+  ExpectSexpEq("(value ((state idle)))", Value("(get-reload-status)"));
+
+  string reload = "(reload-tags-file (file \"" + TEST_DATA_DIR +
+      "/test_update_TAGS\"))";
+  ExpectSexpEq("(value t)", Value(reload.c_str()));
+  handler_->WaitForReload();
+  string status = Value("(get-reload-status)");
+  EXPECT_TRUE(status.find("(state succeeded) (file \"" + TEST_DATA_DIR +
+                          "/test_update_TAGS\")") != string::npos);
+  EXPECT_TRUE(status.find("(tags-loaded 3)") != string::npos);
+}
+
 TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupPrefix) {
   SExpression* result = SExpression::Parse(
       handler_->Execute("(lookup-tag-prefix-regexp (client-type \"gnu-emacs\") "
@@ -286,12 +315,6 @@ TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupExact) {
 }
 
 TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupFile) {
-  // Make a new handler which creates a file-index
-  delete handler_;
-  handler_ = new SingleTableTagsRequestHandler(
-      TEST_DATA_DIR + "/test_TAGS",
-      true, false, "google3");
-
   SExpression* result = SExpression::Parse(
       handler_->Execute("(lookup-tags-in-file (client-type \"gnu-emacs\") "
                        "(client-version 1) "
@@ -319,12 +342,6 @@ TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupFile) {
 }
 
 TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupFileWithStripCorpus) {
-  // Make a new handler which creates a file-index
-  delete handler_;
-  handler_ = new SingleTableTagsRequestHandler(
-      TEST_DATA_DIR + "/test_TAGS",
-      true, false, "google3");
-
   SExpression* result = SExpression::Parse(
       handler_->Execute("(lookup-tags-in-file (client-type \"gnu-emacs\") "
                        "(client-version 1) "
@@ -352,12 +369,6 @@ TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupFileWithStripCorpus) {
 }
 
 TEST_F(SingleTableTagsRequestHandlerTest, SexpLookupFileBadRequest) {
-  // Make a new handler which creates a file-index
-  delete handler_;
-  handler_ = new SingleTableTagsRequestHandler(
-      TEST_DATA_DIR + "/test_TAGS",
-      true, false, "google3");
-
   SExpression* result = SExpression::Parse(
       handler_->Execute("(lookup-tags-in-file)", &clock_, &log_)); // No (file)
 
@@ -414,6 +425,86 @@ TEST_F(SingleTableTagsRequestHandlerTest, SexpLoadUpdateFile) {
   delete result;
 }
 
+TEST_F(SingleTableTagsRequestHandlerTest, SexpDirectoryDistance) {
+  ExpectSexpEq("(value (((tag \"file_name\") (snippet \"string file_name;\") "
+               "(filename \"tools/util/file2.h\") (lineno 20) (offset 300) "
+               "(directory-distance 0)) "
+               "((tag \"file_name\") (snippet \"string file_name;\") "
+               "(filename \"tools/tags/file1.h\") (lineno 15) (offset 200) "
+               "(directory-distance 2))))",
+               Value("(lookup-tag-exact (tag \"file_name\") "
+                     "(current-file \"/home/user/google3/tools/util/a.cc\") "
+                     "(ranking-methods (include-distance) "
+                     "(directory-distance)))"));
+}
+
+TEST_F(SingleTableTagsRequestHandlerTest, SexpResponseCache) {
+  const char* lookup = "(lookup-tag-exact (tag \"file_name\"))";
+  string before_update = Value(lookup);
+  EXPECT_EQ(before_update, Value(lookup));
+  // Callers are another query.
+  Value("(lookup-tag-exact (tag \"file_name\") (callers t))");
+  string stats = Value("(get-server-stats)");
+  EXPECT_TRUE(stats.find("(response-cache (entries 2)") != string::npos);
+  EXPECT_TRUE(stats.find("(hits 1) (misses 2)") != string::npos);
+
+  // Updating the table invalidates the cache.
+  string update = "(load-update-file (file \"" + TEST_DATA_DIR +
+      "/test_update_TAGS\"))";
+  Value(update.c_str());
+  ExpectSexpEq("(value (((tag \"file_name\") (snippet \"string file_name;\") "
+               "(filename \"tools/tags/file1.h\") (lineno 15) (offset 200) "
+               "(directory-distance 0))))", Value(lookup));
+  EXPECT_TRUE(Value(lookup) != before_update);
+  stats = Value("(get-server-stats)");
+  EXPECT_TRUE(stats.find("(response-cache (entries 1)") != string::npos);
+  EXPECT_TRUE(stats.find("(hits 2) (misses 3)") != string::npos);
+}
+
+TEST_F(SingleTableTagsRequestHandlerTest, SexpMemoryStats) {
+  string stats = Value("(get-memory-stats)");
+  EXPECT_TRUE(stats.find("(snapshot-bytes 0)") != string::npos);
+  EXPECT_TRUE(stats.find("(files 4) (tags (call 0) (generic 5) (type 0) "
+                         "(variable 0) (function 1))") != string::npos);
+}
+
+TEST_F(SingleTableTagsRequestHandlerTest, IsSlow) {
+  EXPECT_FALSE(IsSlow(";foo"));
+  EXPECT_FALSE(IsSlow("#comment#;foo"));
+  EXPECT_FALSE(IsSlow("/"));
+  EXPECT_FALSE(IsSlow("@tools/tags/file.cc"));
+  EXPECT_TRUE(IsSlow("$snippet"));
+  EXPECT_TRUE(IsSlow("#comment#:prefix"));
+  EXPECT_TRUE(IsSlow("+update_TAGS"));
+  EXPECT_FALSE(IsSlow("#unterminated comment"));
+  EXPECT_FALSE(IsSlow(""));
+
+  EXPECT_FALSE(IsSlow("(lookup-tag-exact (tag \"foo\"))"));
+  EXPECT_FALSE(IsSlow("(get-server-version)"));
+  EXPECT_TRUE(IsSlow("(lookup-tag-snippet-regexp (tag \"f.o\"))"));
+  EXPECT_TRUE(IsSlow("(reload-tags-file (file \"TAGS\"))"));
+  EXPECT_FALSE(IsSlow("(no-such-command)"));
+  EXPECT_FALSE(IsSlow("malformed ("));
+}
+
+TEST_F(SingleTableTagsRequestHandlerTest, ExecutePreparedRequest) {
+  // S-expression requests are parsed once, by Prepare.
+  TagsRequest request("(lookup-tag-exact (tag \"TagsReader\"))");
+  handler_->Prepare(&request);
+  ASSERT_TRUE(request.sexp() != NULL);
+  EXPECT_EQ("lookup-tag-exact", request.sexp()->Begin()->Repr());
+  EXPECT_FALSE(request.slow());
+  string response = handler_->Execute(request, &clock_, &log_);
+  EXPECT_TRUE(response.find("(tag \"TagsReader\")") != string::npos);
+
+  TagsRequest opcode_request(";TagsReader");
+  handler_->Prepare(&opcode_request);
+  EXPECT_TRUE(opcode_request.sexp() == NULL);
+  ExpectSexpEq("((\"TagsReader\" . "
+               "(\"class TagsReader {\" \"tools/cpp/file3.h\" 0 25 400)))",
+               handler_->Execute(opcode_request, &clock_, &log_));
+}
+
 TEST(LanguageClientTagsResultPredicateTest, Test) {
   // NOTE: Checks in this test behave very unexpectedly in this function
   //   when executed under boost.
@@ -448,9 +539,64 @@ TEST(LanguageClientTagsResultPredicateTest, Test) {
   EXPECT_TRUE(predicate1.Test(&result));
 }
 
+// Ranked lookups return the best results of those the local
+// handler's language filter accepts, however many others there are.
+TEST(LocalTagsRequestHandlerTest, FiltersBeforeRanking) {
+  // 150 c++ files and then 3 python files each define Run.
+  LocalTagsRequestHandler handler(false, "");
+  handler.Update(TEST_DATA_DIR + "/test_run_TAGS");
+
+  SExpression* response = SExpression::Parse(handler.Execute(
+      "(lookup-tag-exact (tag \"Run\") (current-file \"cc/main.h\") "
+      "(ranking-methods (directory-distance)))", "python", ""));
+  ASSERT_TRUE(response != NULL);
+  string value = response->Repr();
+  delete response;
+  EXPECT_TRUE(value.find("py/run150.py") != string::npos);
+  EXPECT_TRUE(value.find("py/run151.py") != string::npos);
+  EXPECT_TRUE(value.find("py/run152.py") != string::npos);
+  EXPECT_TRUE(value.find("cc/") == string::npos);
+}
+
+// Returns "changes" and/or "slow" for what HANDLER says executing
+// COMMAND involves, or "" if neither.
+string Classify(const ProtocolRequestHandler& handler, const char* command) {
+  TagsRequest request(command);
+  handler.Prepare(&request);
+  string result;
+  if (request.changes_table())
+    result += "changes ";
+  if (request.slow())
+    result += "slow";
+  return result;
+}
+
+TEST(SexpProtocolRequestHandlerTest, Classify) {
+  SexpProtocolRequestHandler handler(false, "");
+  EXPECT_EQ("changes slow",
+            Classify(handler, "(reload-tags-file (file \"TAGS\"))"));
+  EXPECT_EQ("changes slow",
+            Classify(handler, "(load-update-file (file \"TAGS\"))"));
+  EXPECT_EQ("slow",
+            Classify(handler, "(lookup-tag-snippet-regexp (tag \"f.o\"))"));
+  EXPECT_EQ("", Classify(handler, "(lookup-tag-exact (tag \"foo\"))"));
+  EXPECT_EQ("", Classify(handler, "(get-reload-status)"));
+  EXPECT_EQ("", Classify(handler, "(no-such-command)"));
+  EXPECT_EQ("", Classify(handler, "malformed ("));
+}
+
+TEST(OpcodeProtocolRequestHandlerTest, Classify) {
+  OpcodeProtocolRequestHandler handler(false, "");
+  EXPECT_EQ("changes slow", Classify(handler, "!TAGS"));
+  EXPECT_EQ("changes slow", Classify(handler, "#comment#+TAGS"));
+  EXPECT_EQ("slow", Classify(handler, "$snippet"));
+  EXPECT_EQ("", Classify(handler, ";foo"));
+  EXPECT_EQ("", Classify(handler, "#+TAGS"));
+}
+
 TEST(ProtocolRequestHandlerTest, StripCorpusRoot) {
   ProtocolRequestHandler* handler = new SexpProtocolRequestHandler(
-        false, false, "google3");
+        false, "google3");
   EXPECT_EQ("/path/without/corpus/root",
             handler->StripCorpusRoot("/path/without/corpus/root"));
   EXPECT_EQ("tools/tags/test.cc",
@@ -466,7 +612,7 @@ TEST(ProtocolRequestHandlerTest, StripCorpusRoot) {
 
 TEST(ProtocolRequestHandlerTest, StripCorpusRootNoRoot) {
   ProtocolRequestHandler* handler = new SexpProtocolRequestHandler(
-        false, false, "");
+        false, "");
   EXPECT_EQ("/path/without/corpus/root",
             handler->StripCorpusRoot("/path/without/corpus/root"));
   delete handler;
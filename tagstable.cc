@@ -24,84 +24,165 @@
 //
 // strings_: string table to efficiently store the strings used inside
 //     all the other data structures. We guarantee that each unique
-//     tag, snippet, or filename is only stored once in memory.
-// fileset_: set of Filename objects representing loaded/referenced
-//     files.
-// map_: multimap from tag name to TagsResult*'s for all tags with
-//     that name.
-// filemap_: map from filename to a vector of TagsResult*'s for all tags
-//     in that file. Creation of the filemap can be enabled or disabled
-//     in the constructor.
-// findfilemap_: multimap which maps BASE to all filenames which have
-//     basename BASE.
+//     tag, snippet, or filename is only stored once in memory, and
+//     refer to it by its 32-bit id. Strings are never removed one
+//     by one; once enough tags have been unloaded, CompactStrings
+//     copies the ones still in use to a new table, and drops the
+//     files which are no longer loaded.
+// files_, file_ids_: Filename objects representing loaded/referenced
+//     files, and the map from Filename to its index (file id) in
+//     files_.
+// columns_: every tag, stored as one row across parallel arrays of
+//     type, charno, lineno and tag/snippet/file/language ids. This
+//     takes about 25 bytes per tag, where a heap-allocated
+//     TagsResult with four pointers took over 60. Query results are
+//     materialized into TagsResult objects.
+// index_: arrays of row numbers, sorted by tag name. There is one
+//     array for definitions and one for callers,
+//     so a query never has to skip over entries of the other kind.
+//     They are frozen (rebuilt into single contiguous sorted arrays)
+//     at the end of every load, update or unload, so lookups are
+//     binary searches over adjacent memory rather than walks over
+//     scattered tree nodes.
+// pending_index_: entries for tags loaded since the indexes were last
+//     frozen. FreezeIndex sorts them and merges them into index_.
+// snippet_index_: optionally, a trigram index (see trigramindex.h)
+//     of the snippets of each index_, rebuilt whenever index_ is
+//     frozen. The rebuild only reads the table, so updates may leave
+//     it to PrepareRebuild, which can run alongside queries.
+//     Snippet searches only run their regular expression on the
+//     entries containing the trigrams a match must contain, rather
+//     than on every entry, or on every entry while there is no index.
+// file_rows_: the first row and number of rows of each file. A file's
+//     rows are appended together when it is loaded and deleted
+//     together when it is unloaded, and CompactRows keeps rows in
+//     order, so they always form one range of columns_.
+// file_suffix_index_: ids of the loaded files, sorted by their
+//     components from the basename back. The files with a given
+//     basename or path suffix form a range, which FindFile finds by
+//     binary search.
 //
-// We load files by reading s-expressions sequentially from the
-// file. Each item descriptor (see file format spec) generally is
-// translated into a single TagsResult and is indexed in map_ and
-// filemap_.
+// We load files with a TagsReader (see tagsreader.h), which reports
+// headers, files and items as events without building s-expression
+// trees. Batches of the file are read into events on several threads
+// and then replayed, in file order, into a Loader. Each item
+// descriptor (see file format spec) generally is translated into a
+// single row of columns_ and is indexed in pending_index_ and
+// file_rows_. Unloading a file only marks its rows as deleted;
+// FreezeIndex then compacts the columns, renumbers the indexes and
+// merges in the pending rows. ReadUpdate keeps the events of an
+// update file instead of replaying them, so that the parsing can be
+// done while the table is in use and only ApplyUpdate changes it.
 //
-// We do quite a bit of s-exp processing as we load the file. Here is
-// some idiomatic processing code for parsing an expression SEXP which
-// is of the form (HEAD (KEY1 VALUE1) (KEY2 VALUE2) ...). We first use
-// IsDeclarationWithAlist to check that the s-expression is of the
-// form above. Then, on each loop iteration, we assign KEY* and VALUE*
-// to attr_name and attr_value, and do something specific by
-// dispatching based on the key.
+// Queries which ask for ranking collect up to max_ranking_candidates
+// rows that their ResultSink accepts, score each of them with every
+// RankingMethod they ask for, and partially sort them to keep only the
+// best max_ranked_results. Rows are only materialized into TagsResults
+// once they have been picked.
 //
-// CHECK(IsDeclarationWithAlist(sexp, "HEAD"));
-// for (SExpression::const_iterator sexp_iter = GetAttributes(sexp);
-//      sexp_iter != sexp->End();
-//      ++sexp_iter) {
-//   SExpression::const_iterator attr_iter = sexp_iter->Begin();
-//   const SExpression* attr_name = &*attr_iter;
-//   ++attr_iter;
-//   const SExpression* attr_value = &*attr_iter;
-//   if (attr_name->Repr() == "path") {
-//     CHECK(attr_value->IsString());
-//     processPath(attr_value);
-//   } else if ...
+// Regexp and snippet searches which can't use the sorted index scan
+// it in chunks on several threads (see parallelscan.h), with the
+// threads of scan_pool_ helping the querying thread. The results are
+// those of a sequential scan: chunks are merged in index order, and
+// no chunk is started once the ones before it have max_results
+// matches.
+//
+// A table can also be loaded from a snapshot (see snapshot.h), in
+// which case strings_, columns_ and index_ are views of the mapped
+// file and are only copied into memory if they are modified. The
+// snippet index isn't stored in snapshots; it is rebuilt once the
+// snapshot is mapped.
 
 #include "tagstable.h"
 
+#include <ctype.h>
+#include <fnmatch.h>
+#include <unistd.h>
 #include <ext/hash_map>
 #include <ext/hash_set>
+#include <algorithm>
 #include <deque>
 #include <list>
 #include <map>
 #include <set>
 #include <vector>
 
+#include "automaton.h"
+#include "mutex.h"
+#include "parallelreader.h"
+#include "parallelscan.h"
 #include "regexp.h"
+#include "snapshot.h"
+#include "stl_util.h"
+#include "strutil.h"
+#include "tagsreader.h"
 #include "tagsutil.h"
 #include "tagsoptionparser.h"
+#include "trigramindex.h"
 
 DEFINE_INT32(max_results, 2000,
              "Maximum number of results to return to clients");
-DEFINE_BOOL(findfile, false, "Enable file location");
+DEFINE_INT32(max_ranked_results, 100,
+             "Maximum number of results to return to clients for queries "
+             "which ask for ranking");
+DEFINE_INT32(max_ranking_candidates, 100000,
+             "Maximum number of results ranked to find the best ones");
 
 DEFINE_INT32(max_snippet_size, 200,
              "Maximum snippet size (larger size snippets are truncated");
 DEFINE_INT32(max_error_line,  280,
              "Maximum error line size");
+DEFINE_INT32(load_threads, 0,
+             "Number of threads parsing TAGS files while loading "
+             "(0 means one per processor)");
+DEFINE_INT32(scan_threads, 0,
+             "Number of threads scanning the table for a regexp or "
+             "snippet search (0 means one per processor)");
+DEFINE_INT32(regexp_cache_size, 64,
+             "Number of compiled regexps kept for reuse by later queries");
+DEFINE_INT32(string_compaction_percent, 50,
+             "Rebuild the string table, dropping strings no longer in "
+             "use, once this many tags as a percentage of the table have "
+             "been unloaded since it was last rebuilt (0 never rebuilds)");
+DEFINE_BOOL(snippet_index, false,
+            "Index snippets by trigram, which makes snippet searches much "
+            "faster but uses more memory and makes loading slower");
+
+const int TagsTable::kNumTagTypes;
+const uint32 TagsTable::kNoFile;
+const uint32 TagsTable::kScanChunkSize;
 
 TagsTable::~TagsTable() {
   FreeData();
-  delete findfilemap_;
-  delete filemap_;
-  delete map_;
-  delete fileset_;
+  delete pending_files_;
+  delete file_suffix_index_;
+  delete file_rows_;
+  for (int i = 0; i < NUM_INDEX_FAMILIES; ++i) {
+    delete snippet_index_[i];
+    delete pending_index_[i];
+    delete index_[i];
+  }
+  delete columns_;
+  delete file_ids_;
+  delete files_;
   delete strings_;
   delete loaded_files_;
+  delete file_languages_;
 }
 
 // Parses tags information from FILENAME, overwriting anything that
-// was previously in the table. If enable_gunzip is true then filters
-// the input through gunzip.
+// was previously in the table. If enable_gunzip is true then the
+// input is decompressed with zlib.
 bool TagsTable::ReloadTagFile(const string& filename,
                               bool enable_gunzip) {
   LOG(INFO) << "Loading " << filename;
   FreeData();
-  return LoadTagFile(filename, enable_gunzip);
+  tags_loaded_ = 0;
+  if (Snapshot::IsSnapshot(filename))
+    return LoadSnapshot(filename);
+  bool loaded = LoadTagFile(filename, enable_gunzip);
+  TrimStorage();
+  return loaded;
 }
 
 bool TagsTable::UpdateTagFile(const string& filename,
@@ -110,10 +191,291 @@ bool TagsTable::UpdateTagFile(const string& filename,
   return LoadTagFile(filename, enable_gunzip);
 }
 
-bool TagsTable::LoadTagFile(const string& filename,
-                              bool enable_gunzip) {
-  FileReader<SExpression> filereader(filename, enable_gunzip);
+int TagsTable::num_strings() const {
+  return strings_->size();
+}
+
+namespace {
+
+// Estimates of the memory used by containers, not counting anything
+// their elements point to.
+
+template<class T>
+int64 VectorBytes(const vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+int64 VectorBytes(const vector<bool>& v) {
+  return v.capacity() / 8;
+}
+
+// Hash tables have an array of buckets, and a node per element with
+// the value and a pointer to the next node.
+template<class HashTable>
+int64 HashTableBytes(const HashTable& table) {
+  return table.bucket_count() * sizeof(void*) +
+      table.size() * (sizeof(typename HashTable::value_type) + sizeof(void*));
+}
+
+}  // namespace
+
+void TagsTable::GetMemoryStats(MemoryStats* stats) const {
+  stats->string_bytes = strings_->bytes_allocated() +
+      strings_->overhead_bytes();
+  stats->tag_bytes = columns_->bytes_owned();
+
+  stats->index_bytes = 0;
+  stats->snippet_index_bytes = 0;
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family) {
+    stats->index_bytes += index_[family]->bytes_owned() +
+        VectorBytes(*pending_index_[family]);
+    if (snippet_index_[family] != NULL)
+      stats->snippet_index_bytes += snippet_index_[family]->bytes_used();
+  }
+
+  stats->file_bytes = VectorBytes(*files_) + HashTableBytes(*file_ids_) +
+      VectorBytes(*loaded_files_) + VectorBytes(*file_languages_);
+  for (vector<const Filename*>::const_iterator i = files_->begin();
+       i != files_->end(); ++i) {
+    stats->file_bytes += (*i)->bytes_used();
+  }
+
+  stats->file_index_bytes = VectorBytes(*file_rows_);
+  stats->find_file_bytes = VectorBytes(*file_suffix_index_) +
+      VectorBytes(*pending_files_);
+
+  stats->total_bytes = stats->string_bytes + stats->tag_bytes +
+      stats->index_bytes + stats->snippet_index_bytes + stats->file_bytes +
+      stats->file_index_bytes + stats->find_file_bytes;
+  stats->snapshot_bytes = snapshot_ != NULL ? snapshot_->size() : 0;
+
+  stats->strings = strings_->size();
+  stats->files = files_->size();
+  for (int type = 0; type < kNumTagTypes; ++type)
+    stats->tags[type] = 0;
+  const Column<unsigned char>& types = columns_->type;
+  for (uint32 row = 0; row < types.size(); ++row)
+    ++stats->tags[types[row]];
+}
+
+int TagsTable::size() const {
+  return size(false) + size(true);
+}
+
+int TagsTable::size(bool callers) const {
+  return index_[FamilyOf(callers)]->size();
+}
+
+class TagsTable::Loader : public TagsReader::Handler {
+ public:
+  explicit Loader(TagsTable* table)
+      : table_(table), version_seen_(false), files_loaded_(false),
+        file_(kNoFile), language_(0) {}
+
+  virtual void Header(SExpression* sexp) {
+    if (failed()) {
+      // Nothing to do.
+    } else if (!version_seen_) {
+      // First expression should be the tags-format-version
+      int tags_format_version = table_->GetTagsFormatVersion(sexp);
+      if (tags_format_version == -1) {
+        Fail("Expected tags-format-version declaration at file start.");
+      } else if (tags_format_version != 2) {
+        Fail("Sorry, I don't know how to read version " +
+             FastItoa(tags_format_version) + " of the TAGS format.");
+      }
+      version_seen_ = true;
+    } else if (files_loaded_) {
+      // Give up if any headers are found after the first file
+      // declaration.
+      Fail("Header declarations must precede all file declarations.");
+    } else if (!table_->ParseHeaderDeclaration(sexp)) {
+      Fail("Malformed header declaration: " + sexp->Repr());
+    }
+    delete sexp;
+  }
+
+  virtual void File(const char* path, const char* language) {
+    if (!CheckVersionSeen())
+      return;
+    files_loaded_ = true;
+
+    file_ = table_->FileGet(path);
+    language_ = table_->strings_->GetId(language);
+    (*table_->file_languages_)[file_] = language_;
+    filename_ = (*table_->files_)[file_];
+    LOG(INFO) << "Processing " << filename_->Str();
+
+    table_->UnloadFile(file_);
+
+    // Mark as loaded
+    (*table_->loaded_files_)[file_] = true;
+    table_->pending_files_->push_back(file_);
+    FileRows* rows = &(*table_->file_rows_)[file_];
+    rows->first_row = table_->columns_->size();
+    rows->num_rows = 0;
+  }
+
+  virtual void Item(const TagsItem& item) {
+    if (failed())
+      return;
+    TagRow tag;
+    if (!table_->ParseItem(item, &tag)) {
+      Fail(string("Malformed ") + item.descriptor + " item in " +
+           filename_->Str());
+      return;
+    }
+    tag.file = file_;
+    tag.language = language_;
+
+    uint32 row = table_->AppendRow(tag);
+    ++table_->tags_loaded_;
+    table_->pending_index_[FamilyOf(tag.type)]->push_back(row);
+    ++(*table_->file_rows_)[file_].num_rows;
+
+    if (tag.type != CALL)
+      table_->callers_on_by_default_ = false;
+
+    LOG_EVERY_N(INFO, 100000) << "Tag: " << item.tag << "\n"
+                              << "Snippet: " << item.snippet << "\n"
+                              << "Filename: " << filename_->Str() << "\n"
+                              << "Lineno: " << tag.lineno << "\n"
+                              << "Charno: " << tag.charno;
+  }
+
+  virtual void EndFile() {}
+
+  virtual void Deleted(const char* path) {
+    if (!CheckVersionSeen())
+      return;
+    files_loaded_ = true;
+    table_->UnloadFile(table_->FileGet(path));
+  }
+
+  // Checks that the file started with a tags-format-version, and
+  // returns false if it didn't or if loading already failed.
+  bool CheckVersionSeen() {
+    if (!failed() && !version_seen_)
+      Fail("Expected tags-format-version declaration at file start.");
+    return !failed();
+  }
+
+  // Records ERROR, unless an error was already recorded. Nothing more
+  // is loaded once one is.
+  void Fail(const string& error) {
+    if (!failed())
+      error_ = error;
+  }
+
+  bool failed() const {
+    return !error_.empty();
+  }
+
+  // The first error, or empty.
+  const string& error() const {
+    return error_;
+  }
+
+ private:
+  TagsTable* table_;
+  // Whether the tags-format-version declaration has been read.
+  bool version_seen_;
+  // Whether any (file ...) or (deleted ...) declarations have been
+  // read.
+  bool files_loaded_;
+
+  // The file being loaded.
+  uint32 file_;
+  uint32 language_;
+  const Filename* filename_;
+
+  string error_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Loader);
+};
+
+namespace {
+
+// Returns the number of threads to parse tags files on.
+int LoadThreads() {
+  int num_threads = GET_FLAG(load_threads);
+  if (num_threads <= 0)
+    num_threads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  return num_threads;
+}
 
+// A batch of a tags file for ReadUpdate, which keeps the events once
+// the batch is done with.
+struct TagsUpdateBatch {
+  TagsUpdateBatch() : events(new TagsEventBuffer) {}
+  ~TagsUpdateBatch() {
+    delete events;
+  }
+
+  void Parse() {
+    TagsReader reader(events);
+    if (!reader.Read(text.data(), text.size()))
+      error = reader.error();
+  }
+
+  string text;
+  TagsEventBuffer* events;
+  string error;
+};
+
+}  // namespace
+
+TagsUpdate::~TagsUpdate() {
+  STLDeleteElementContainer(&batches_);
+}
+
+TagsUpdate* TagsTable::ReadUpdate(const string& filename,
+                                  bool enable_gunzip) {
+  LOG(INFO) << "Reading update " << filename;
+  TagsUpdate* update = new TagsUpdate;
+  ParallelReader<TagsUpdateBatch> reader(filename, enable_gunzip,
+                                         LoadThreads());
+  while (TagsUpdateBatch* batch = reader.NextBatch()) {
+    if (!batch->error.empty()) {
+      LOG(WARNING) << "Unable to read update " << filename << ": "
+                   << batch->error;
+      delete update;
+      return NULL;
+    }
+    update->batches_.push_back(batch->events);
+    batch->events = NULL;
+  }
+  if (reader.error()) {
+    LOG(WARNING) << "Unable to read update " << filename;
+    delete update;
+    return NULL;
+  }
+  return update;
+}
+
+bool TagsTable::ApplyUpdate(TagsUpdate* update, bool defer_rebuild) {
+  ResetHeaderData();
+
+  Loader loader(this);
+  for (size_t i = 0; i < update->batches_.size() && !loader.failed(); ++i)
+    update->batches_[i]->Replay(&loader);
+  loader.CheckVersionSeen();
+
+  if (defer_rebuild)
+    FreezeRows();
+  else
+    FreezeIndex();
+
+  if (loader.failed()) {
+    LOG(WARNING) << "Unable to apply update: " << loader.error();
+    return false;
+  }
+  LOG(INFO) << "Successfully applied update.";
+
+  return true;
+}
+
+void TagsTable::ResetHeaderData() {
   tags_comment_ = "";
   tagfile_creation_time_ = static_cast<time_t>(0);
   corpus_name_ = "";
@@ -123,60 +485,277 @@ bool TagsTable::LoadTagFile(const string& filename,
     i->second = false;
   }
   callers_on_by_default_ = true;
+}
 
-  // First expression should be the tags-format-version
-  SExpression* sexp = filereader.GetNext();
-  int tags_format_version = GetTagsFormatVersion(sexp);
-  CHECK_EQ(tags_format_version, 2)
-    << "Sorry, I don't know how to read version "
-    << tags_format_version
-    << " of the TAGS format.";
-  delete sexp;
-
-  // Keep track of whether any (file ...) declarations have been
-  // loaded, and exit if any headers are found after the first file
-  // declaration.
-  bool files_loaded = false;
-
-  while (!filereader.IsDone()) {
-    sexp = filereader.GetNext();
-
-    CHECK_NE(sexp, static_cast<SExpression*>(NULL))
-      << "Expected a valid s-expression in input file.";
-    CHECK(sexp->IsList()) << "Expected a declaration list at the top-level.";
-
-    // Iterate over all elements of a single declaration.
-    SExpression::const_iterator sexp_iter = sexp->Begin();
-
-    // Read declaration type
-    CHECK(sexp_iter != sexp->End())
-      << "Expected a non-empty declaration at top-level.";
-    CHECK(sexp_iter->IsSymbol())
-      << "Expected a symbol at head of declaration.";
-
-    if (sexp_iter->Repr() == "file") {
-      // Handle file declarations
-      files_loaded = true;
-      ParseFileDeclaration(sexp);
-    } else if (sexp_iter->Repr() == "deleted") {
-      // Handle "deleted" entries, which can occur in update files
-      files_loaded = true;
-      ParseDeletedDeclaration(sexp);
-    } else {
-      // Handle header declarations (everything except 'file')
-      CHECK(!files_loaded) << "Header declarations must precede "
-                           << "all file declarations.";
-      ParseHeaderDeclaration(sexp);
-    }
-
-    delete sexp;
+bool TagsTable::LoadTagFile(const string& filename,
+                              bool enable_gunzip) {
+  ResetHeaderData();
+
+  // Declarations are read into events in parallel but handed to the
+  // loader in file order, so the table ends up exactly as if they
+  // were read one by one: string ids, rows and the index all come out
+  // the same.
+  ParallelReader<TagsBatch> reader(filename, enable_gunzip, LoadThreads());
+  Loader loader(this);
+  TagsBatch* batch;
+  while (!loader.failed() && (batch = reader.NextBatch()) != NULL) {
+    if (!batch->error.empty())
+      loader.Fail(batch->error);
+    else
+      batch->events.Replay(&loader);
   }
+  if (!loader.failed() && reader.error())
+    loader.Fail("Unable to read the file.");
+  loader.CheckVersionSeen();
+
+  // Whatever was loaded is indexed, so that the table stays usable
+  // even if the file was cut short.
+  FreezeIndex();
 
+  if (loader.failed()) {
+    LOG(WARNING) << "Unable to load " << filename << ": " << loader.error();
+    return false;
+  }
   LOG(INFO) << "Successfully loaded TAGS file.";
+  MemoryStats stats;
+  GetMemoryStats(&stats);
+  LOG(INFO) << "Table uses " << stats.total_bytes << " bytes: "
+            << stats.string_bytes << " for " << stats.strings << " strings, "
+            << stats.tag_bytes << " for " << size() << " tags, "
+            << stats.index_bytes << " for the index, "
+            << stats.snippet_index_bytes << " for the snippet index, "
+            << stats.file_bytes << " for " << stats.files << " files, "
+            << stats.file_index_bytes << " for the file index and "
+            << stats.find_file_bytes << " for the find-file index.";
+
+  return true;
+}
+
+namespace {
+
+// Contents of the SNAPSHOT_TABLE_INFO section.
+struct SnapshotTableInfo {
+  int64 creation_time;
+  uint32 flags;
+  uint32 reserved;
+};
+
+// Bits of SnapshotTableInfo::flags.
+const uint32 kSnapshotCallersOnByDefault = 1;
+
+// Appends STR and its terminating nul to the current section.
+void AppendString(SnapshotWriter* writer, const string& str) {
+  writer->Append(str.c_str(), str.size() + 1);
+}
+
+// Splits SECTION, a sequence of nul-terminated strings, into STRINGS.
+// Returns false if SECTION is not nul-terminated.
+bool ReadStrings(const Snapshot& snapshot, SnapshotSection section,
+                 vector<const char*>* strings) {
+  const char* p = snapshot.section(section);
+  const char* end = p + snapshot.section_size(section);
+  if (p != end && end[-1] != '\0')
+    return false;
+  for (; p < end; p += strlen(p) + 1) {
+    strings->push_back(p);
+  }
+  return true;
+}
+
+// Writes COLUMN as SECTION.
+template<class T>
+void WriteColumn(const Column<T>& column, SnapshotSection section,
+                 SnapshotWriter* writer) {
+  writer->BeginSection(section);
+  writer->AppendArray(column.data(), column.size());
+}
+
+// Makes COLUMN a view of SECTION. Returns false if SECTION doesn't
+// have SIZE elements.
+template<class T>
+bool AttachColumn(const Snapshot& snapshot, SnapshotSection section,
+                  int64 size, Column<T>* column) {
+  int64 count;
+  const T* data = snapshot.Array<T>(section, &count);
+  if (data == NULL || count != size)
+    return false;
+  column->Attach(data, count);
+  return true;
+}
+
+}  // namespace
+
+bool TagsTable::WriteSnapshot(const string& filename) const {
+  // FreezeIndex always leaves the columns compacted.
+  CHECK_EQ(deleted_rows_, 0);
 
+  SnapshotWriter writer(filename);
+  strings_->WriteSnapshot(&writer);
+
+  SnapshotTableInfo info;
+  info.creation_time = tagfile_creation_time_;
+  info.flags = callers_on_by_default_ ? kSnapshotCallersOnByDefault : 0;
+  info.reserved = 0;
+  writer.BeginSection(SNAPSHOT_TABLE_INFO);
+  writer.AppendArray(&info, 1);
+
+  writer.BeginSection(SNAPSHOT_TABLE_STRINGS);
+  AppendString(&writer, tags_comment_);
+  AppendString(&writer, corpus_name_);
+  for (hash_map<string, bool>::const_iterator i = features_.begin();
+       i != features_.end(); ++i) {
+    if (i->second)
+      AppendString(&writer, i->first);
+  }
+
+  // Filenames are stored as paths and rebuilt on load, in file id
+  // order so that the file column stays valid.
+  writer.BeginSection(SNAPSHOT_FILE_PATHS);
+  for (vector<const Filename*>::const_iterator i = files_->begin();
+       i != files_->end(); ++i) {
+    AppendString(&writer, (*i)->Str());
+  }
+  vector<unsigned char> loaded(loaded_files_->begin(), loaded_files_->end());
+  writer.BeginSection(SNAPSHOT_FILE_LOADED);
+  writer.AppendArray(loaded.empty() ? NULL : &loaded[0], loaded.size());
+
+  WriteColumn(columns_->type, SNAPSHOT_COLUMN_TYPE, &writer);
+  WriteColumn(columns_->charno, SNAPSHOT_COLUMN_CHARNO, &writer);
+  WriteColumn(columns_->lineno, SNAPSHOT_COLUMN_LINENO, &writer);
+  WriteColumn(columns_->tag, SNAPSHOT_COLUMN_TAG, &writer);
+  WriteColumn(columns_->linerep, SNAPSHOT_COLUMN_LINEREP, &writer);
+  WriteColumn(columns_->file, SNAPSHOT_COLUMN_FILE, &writer);
+  WriteColumn(columns_->language, SNAPSHOT_COLUMN_LANGUAGE, &writer);
+  WriteColumn(*index_[DEFINITIONS], SNAPSHOT_DEFINITIONS_INDEX, &writer);
+  WriteColumn(*index_[CALLERS], SNAPSHOT_CALLERS_INDEX, &writer);
+
+  if (!writer.Finish()) {
+    LOG(WARNING) << "Unable to write snapshot " << filename;
+    return false;
+  }
   return true;
 }
 
+bool TagsTable::LoadSnapshot(const string& filename) {
+  Snapshot* snapshot = new Snapshot();
+  if (!snapshot->Open(filename)) {
+    delete snapshot;
+    return false;
+  }
+  snapshot_ = snapshot;
+
+  const char* error = AttachSnapshot(*snapshot);
+  if (error != NULL) {
+    LOG(WARNING) << "Snapshot " << filename << " " << error;
+    FreeData();
+    return false;
+  }
+  FinishRebuild(PrepareRebuild());
+
+  tags_loaded_ = columns_->size();
+  LOG(INFO) << "Successfully mapped snapshot with " << tags_loaded_
+            << " tags.";
+  return true;
+}
+
+const char* TagsTable::AttachSnapshot(const Snapshot& snapshot) {
+  // Snapshots are written by WriteSnapshot, but may have been
+  // truncated or corrupted since. Everything that is used as an index
+  // is checked, so that a bad snapshot fails the reload instead of
+  // taking the server down. String ids in the columns are not.
+  if (!strings_->AttachSnapshot(snapshot))
+    return "has invalid strings";
+
+  int64 count;
+  const SnapshotTableInfo* info
+      = snapshot.Array<SnapshotTableInfo>(SNAPSHOT_TABLE_INFO, &count);
+  if (info == NULL || count != 1)
+    return "has no table information";
+  tagfile_creation_time_ = static_cast<time_t>(info->creation_time);
+  callers_on_by_default_ = (info->flags & kSnapshotCallersOnByDefault) != 0;
+
+  vector<const char*> strings;
+  if (!ReadStrings(snapshot, SNAPSHOT_TABLE_STRINGS, &strings)
+      || strings.size() < 2)
+    return "has no comment or corpus name";
+  tags_comment_ = strings[0];
+  corpus_name_ = strings[1];
+  for (hash_map<string, bool>::iterator i = features_.begin();
+       i != features_.end(); ++i) {
+    i->second = false;
+  }
+  for (size_t i = 2; i < strings.size(); ++i) {
+    hash_map<string, bool>::iterator feature = features_.find(strings[i]);
+    if (feature != features_.end())
+      feature->second = true;
+  }
+
+  vector<const char*> paths;
+  if (!ReadStrings(snapshot, SNAPSHOT_FILE_PATHS, &paths))
+    return "has invalid file paths";
+  for (uint32 i = 0; i < paths.size(); ++i) {
+    if (FileGet(paths[i]) != i)
+      return "has a duplicate file path";
+  }
+  const unsigned char* loaded
+      = snapshot.Array<unsigned char>(SNAPSHOT_FILE_LOADED, &count);
+  if (loaded == NULL || count != static_cast<int64>(files_->size()))
+    return "has the wrong number of loaded flags";
+  for (uint32 i = 0; i < count; ++i) {
+    (*loaded_files_)[i] = loaded[i];
+    if (loaded[i])
+      pending_files_->push_back(i);
+  }
+  FreezeFileIndex();
+
+  int64 num_rows = snapshot.section_size(SNAPSHOT_COLUMN_FILE)
+      / sizeof(uint32);
+  if (!AttachColumn(snapshot, SNAPSHOT_COLUMN_TYPE, num_rows,
+                    &columns_->type) ||
+      !AttachColumn(snapshot, SNAPSHOT_COLUMN_CHARNO, num_rows,
+                    &columns_->charno) ||
+      !AttachColumn(snapshot, SNAPSHOT_COLUMN_LINENO, num_rows,
+                    &columns_->lineno) ||
+      !AttachColumn(snapshot, SNAPSHOT_COLUMN_TAG, num_rows,
+                    &columns_->tag) ||
+      !AttachColumn(snapshot, SNAPSHOT_COLUMN_LINEREP, num_rows,
+                    &columns_->linerep) ||
+      !AttachColumn(snapshot, SNAPSHOT_COLUMN_FILE, num_rows,
+                    &columns_->file) ||
+      !AttachColumn(snapshot, SNAPSHOT_COLUMN_LANGUAGE, num_rows,
+                    &columns_->language))
+    return "has columns with different numbers of rows";
+
+  SnapshotSection index_sections[NUM_INDEX_FAMILIES];
+  index_sections[DEFINITIONS] = SNAPSHOT_DEFINITIONS_INDEX;
+  index_sections[CALLERS] = SNAPSHOT_CALLERS_INDEX;
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family) {
+    const uint32* rows
+        = snapshot.Array<uint32>(index_sections[family], &count);
+    if (rows == NULL)
+      return "has an invalid index";
+    for (int64 i = 0; i < count; ++i) {
+      if (rows[i] >= num_rows)
+        return "has an index entry out of bounds";
+    }
+    index_[family]->Attach(rows, count);
+  }
+
+  for (uint32 row = 0; row < num_rows; ++row) {
+    if (columns_->file[row] >= files_->size())
+      return "has a row with an unknown file";
+    (*file_languages_)[columns_->file[row]] = columns_->language[row];
+  }
+  // Snapshots are written compacted, so each file's rows are still
+  // contiguous.
+  for (uint32 row = 0; row < num_rows; ++row) {
+    FileRows* rows = &(*file_rows_)[columns_->file[row]];
+    if (rows->num_rows++ == 0)
+      rows->first_row = row;
+  }
+  return NULL;
+}
+
 const string& TagsTable::GetCommentString() const {
   return tags_comment_;
 }
@@ -193,288 +772,1172 @@ bool TagsTable::SearchCallersByDefault() const {
   return callers_on_by_default_;
 }
 
-list<const TagsTable::TagsResult*>* TagsTable::FindSnippetMatches(
-    const string& match, const string& current_file, bool callers,
-    const list<string>* ranking) const {
-  list<const TagsResult*>* retval = new list<const TagsResult*>();
-  int resultcount = 0;
-  multimap<const char*, const TagsResult*>::const_iterator pos;
-  RegExp snippetmatch(match);
-
-  for (pos = map_->begin();
-       pos != map_->end() && resultcount < GET_FLAG(max_results);
-       pos++) {
-    const TagsResult* tag = pos->second;
-    if (snippetmatch.PartialMatch(tag->linerep)) {
-      // TODO(psung): In this function and friends, we should actually
-      // filter the results based on whether they were in callers or
-      // not. The current code only works as long as callers and
-      // definitions are always in separate files.
-      retval->push_back(tag);
-      resultcount++;
+// Runs a regexp on a range of an index for ParallelScan, either on
+// the snippets (with PartialMatch) or on the tags (with FullMatch).
+class TagsTable::RegexpScanner {
+ public:
+  struct Query {
+    const TagsTable* table;
+    const TagIndex* index;
+    // Positions in INDEX to scan, or NULL to scan all of INDEX.
+    const vector<uint32>* positions;
+    string regexp;
+    bool snippets;
+    // Matches which SINK doesn't accept are skipped.
+    const ResultSink* sink;
+  };
+
+  // Each scanner has a RegExp of its own, since they can't be
+  // shared between threads.
+  explicit RegexpScanner(const Query& query)
+      : query_(query), regexp_(query.table->regexps_, query.regexp) {}
+
+  void Scan(uint32 begin, uint32 end, size_t max_matches,
+            vector<uint32>* rows) {
+    const TagsTable* table = query_.table;
+    for (uint32 i = begin; i < end && rows->size() < max_matches; ++i) {
+      uint32 row = (*query_.index)[query_.positions != NULL
+                                   ? (*query_.positions)[i] : i];
+      bool match = query_.snippets
+          ? regexp_->PartialMatch(
+              table->strings_->Lookup(table->columns_->linerep[row]))
+          : regexp_->FullMatch(table->TagOf(row));
+      if (match && table->Accepts(query_.sink, row))
+        rows->push_back(row);
     }
   }
 
-  return retval;
+ private:
+  const Query& query_;
+  CachedRegExp regexp_;
+};
+
+// Runs a RegexpAutomaton on the tags in a range of an index for
+// ParallelScan, skipping the runs of tags with a prefix that no match
+// can start with.
+class TagsTable::AutomatonScanner {
+ public:
+  struct Query {
+    const TagsTable* table;
+    const TagIndex* index;
+    const RegexpAutomaton* automaton;
+    // Matches which SINK doesn't accept are skipped.
+    const ResultSink* sink;
+  };
+
+  explicit AutomatonScanner(const Query& query) : query_(query) {
+    query.automaton->Start(&start_);
+  }
+
+  void Scan(uint32 begin, uint32 end, size_t max_matches,
+            vector<uint32>* rows) {
+    const TagsTable* table = query_.table;
+    const RegexpAutomaton& automaton = *query_.automaton;
+    TagIndex::const_iterator pos = query_.index->begin() + begin;
+    TagIndex::const_iterator last = query_.index->begin() + end;
+
+    // states[i] holds the states reached after reading the first i
+    // characters of the last tag looked at. The next tag can start
+    // from the states after the prefix it shares with that one.
+    vector<RegexpAutomaton::StateSet> states(1, start_);
+    const char* previous = "";
+
+    while (pos != last && rows->size() < max_matches) {
+      const char* tag = table->TagOf(*pos);
+      size_t depth = 0;
+      while (depth + 1 < states.size() && tag[depth] != '\0' &&
+             tag[depth] == previous[depth]) {
+        ++depth;
+      }
+      states.resize(depth + 1);
+      while (tag[depth] != '\0' && !states[depth].empty()) {
+        states.push_back(RegexpAutomaton::StateSet());
+        automaton.Step(states[depth], tag[depth], &states.back());
+        ++depth;
+      }
+      previous = tag;
+
+      if (states[depth].empty()) {
+        // No tag starting with the first DEPTH characters of this one
+        // can match. Skip to the first tag after all of them, which
+        // starts with the prefix with its last character incremented.
+        string next(tag, depth);
+        while (!next.empty() &&
+               static_cast<unsigned char>(*next.rbegin()) == 0xff) {
+          next.erase(next.size() - 1);
+        }
+        if (next.empty())
+          break;
+        ++*next.rbegin();
+        pos = lower_bound(pos, last, next.c_str(), IndexEntryLess(table));
+        continue;
+      }
+
+      // All entries for this tag match, or none do.
+      bool match = automaton.IsMatch(states[depth]);
+      uint32 tag_id = table->columns_->tag[*pos];
+      for (; pos != last && table->columns_->tag[*pos] == tag_id; ++pos) {
+        if (match && rows->size() < max_matches &&
+            table->Accepts(query_.sink, *pos)) {
+          rows->push_back(*pos);
+        }
+      }
+    }
+  }
+
+ private:
+  const Query& query_;
+  RegexpAutomaton::StateSet start_;
+};
+
+class TagsTable::RankingMethod {
+ public:
+  virtual ~RankingMethod() {}
+
+  // Returns the score of row ROW. Rows with lower scores rank first.
+  virtual int Score(uint32 row) const = 0;
+};
+
+class TagsTable::DirectoryDistanceRanking : public TagsTable::RankingMethod {
+ public:
+  DirectoryDistanceRanking(const TagsTable* table, const string& current_file)
+      : table_(table), current_file_(current_file.c_str()) {}
+
+  virtual int Score(uint32 row) const {
+    const Filename* file = (*table_->files_)[table_->columns_->file[row]];
+    return file->DistanceTo(current_file_);
+  }
+
+ private:
+  const TagsTable* table_;
+  Filename current_file_;
+};
+
+class TagsTable::TagTypeRanking : public TagsTable::RankingMethod {
+ public:
+  explicit TagTypeRanking(const TagsTable* table) : table_(table) {}
+
+  virtual int Score(uint32 row) const {
+    switch (table_->columns_->type[row]) {
+      case TYPE_DEFN:
+        return 0;
+      case FUNCTION_DEFN:
+        return 1;
+      case VARIABLE_DEFN:
+        return 2;
+      default:
+        return 3;
+    }
+  }
+
+ private:
+  const TagsTable* table_;
+};
+
+class TagsTable::LanguageRanking : public TagsTable::RankingMethod {
+ public:
+  LanguageRanking(const TagsTable* table, uint32 language)
+      : table_(table), language_(language) {}
+
+  virtual int Score(uint32 row) const {
+    return table_->columns_->language[row] == language_ ? 0 : 1;
+  }
+
+ private:
+  const TagsTable* table_;
+  uint32 language_;
+};
+
+// Ranks rows by a list of ranking methods: by the first method, then
+// among rows it scores equally by the second, and so on.
+class TagsTable::Ranker {
+ public:
+  Ranker(const TagsTable* table, const string& current_file,
+         const list<string>* ranking) {
+    if (ranking == NULL)
+      return;
+
+    for (list<string>::const_iterator i = ranking->begin();
+         i != ranking->end();
+         ++i) {
+      // Methods that need a current file are skipped without one.
+      if (*i == "tag-type") {
+        methods_.push_back(new TagTypeRanking(table));
+      } else if (current_file.empty()) {
+        continue;
+      } else if (*i == "directory-distance") {
+        methods_.push_back(new DirectoryDistanceRanking(table, current_file));
+      } else if (*i == "language") {
+        Filename file(current_file.c_str());
+        FileIdMap::const_iterator id = table->file_ids_->find(&file);
+        if (id != table->file_ids_->end() &&
+            (*table->loaded_files_)[id->second]) {
+          methods_.push_back(new LanguageRanking(
+              table, (*table->file_languages_)[id->second]));
+        }
+      }
+    }
+  }
+
+  ~Ranker() {
+    STLDeleteElementContainer(&methods_);
+  }
+
+  // Returns the number of rows a query should find: the results
+  // themselves if there is nothing to rank them by, or otherwise the
+  // candidates to pick the best results from.
+  size_t candidate_limit() const {
+    return methods_.empty()
+        ? GET_FLAG(max_results) : GET_FLAG(max_ranking_candidates);
+  }
+
+  // Orders ROWS best first and keeps only the best results. Rows which
+  // rank equally stay in the order they were found. Does nothing if
+  // there is nothing to rank by.
+  void Rank(vector<uint32>* rows) const {
+    if (methods_.empty())
+      return;
+
+    int num_methods = methods_.size();
+    vector<int> scores(rows->size() * num_methods);
+    for (uint32 i = 0; i < rows->size(); ++i) {
+      for (int method = 0; method < num_methods; ++method)
+        scores[i * num_methods + method] = methods_[method]->Score((*rows)[i]);
+    }
+
+    // Only the best results need to be sorted.
+    uint32 num_results = min(GET_FLAG(max_results),
+                             GET_FLAG(max_ranked_results));
+    num_results = min(num_results, static_cast<uint32>(rows->size()));
+    vector<uint32> order(rows->size());
+    for (uint32 i = 0; i < order.size(); ++i)
+      order[i] = i;
+    partial_sort(order.begin(), order.begin() + num_results, order.end(),
+                 ScoreLess(scores, num_methods));
+
+    vector<uint32> ranked(num_results);
+    for (uint32 i = 0; i < num_results; ++i)
+      ranked[i] = (*rows)[order[i]];
+    rows->swap(ranked);
+  }
+
+ private:
+  // Orders positions in the rows by their scores, and then by
+  // position.
+  class ScoreLess {
+   public:
+    ScoreLess(const vector<int>& scores, int num_methods)
+        : scores_(scores), num_methods_(num_methods) {}
+
+    bool operator()(uint32 i, uint32 j) const {
+      const int* score1 = &scores_[i * num_methods_];
+      const int* score2 = &scores_[j * num_methods_];
+      for (int method = 0; method < num_methods_; ++method) {
+        if (score1[method] != score2[method])
+          return score1[method] < score2[method];
+      }
+      return i < j;
+    }
+
+   private:
+    const vector<int>& scores_;
+    int num_methods_;
+  };
+
+  vector<RankingMethod*> methods_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Ranker);
+};
+
+namespace {
+
+// Collects results for the Find methods which return a list.
+class ListSink : public TagsTable::ResultSink {
+ public:
+  ListSink() : results_(new list<TagsTable::TagsResult>()) {}
+
+  virtual void Add(const TagsTable::TagsResult& result) {
+    results_->push_back(result);
+  }
+
+  list<TagsTable::TagsResult>* results() const {
+    return results_;
+  }
+
+ private:
+  list<TagsTable::TagsResult>* results_;
+};
+
+}  // namespace
+
+list<TagsTable::TagsResult>* TagsTable::FindSnippetMatches(
+    const string& match, const string& current_file, bool callers,
+    const list<string>* ranking) const {
+  ListSink sink;
+  FindSnippetMatches(match, current_file, callers, ranking, &sink);
+  return sink.results();
 }
 
-list<const TagsTable::TagsResult*>* TagsTable::FindRegexpTags(
+list<TagsTable::TagsResult>* TagsTable::FindRegexpTags(
     const string& tag, const string& current_file, bool callers,
     const list<string>* ranking) const {
-  list<const TagsResult*>* retval = new list<const TagsResult*>();
-  int resultcount = 0;
-  multimap<const char*, const TagsResult*>::const_iterator pos;
+  ListSink sink;
+  FindRegexpTags(tag, current_file, callers, ranking, &sink);
+  return sink.results();
+}
+
+list<TagsTable::TagsResult>* TagsTable::FindTags(
+    const string& tag, const string& current_file, bool callers,
+    const list<string>* ranking) const {
+  ListSink sink;
+  FindTags(tag, current_file, callers, ranking, &sink);
+  return sink.results();
+}
+
+list<TagsTable::TagsResult>* TagsTable::FindTagsByFile(
+    const string& filename, bool callers) const {
+  ListSink sink;
+  FindTagsByFile(filename, callers, &sink);
+  return sink.results();
+}
+
+void TagsTable::FindSnippetMatches(
+    const string& match, const string& current_file, bool callers,
+    const list<string>* ranking, ResultSink* sink) const {
+  if (CachedRegExp(regexps_, match)->error())
+    return;
+
+  RegexpScanner::Query query;
+  query.table = this;
+  query.index = index_[FamilyOf(callers)];
+  query.positions = NULL;
+  query.regexp = match;
+  query.snippets = true;
+  query.sink = sink;
+  uint32 size = query.index->size();
+
+  // With a snippet index, only the entries which contain every
+  // trigram that a match must contain need to be checked.
+  const TrigramIndex* snippets = snippet_index_[FamilyOf(callers)];
+  vector<uint32> candidates;
+  if (snippets != NULL &&
+      snippets->Candidates(TrigramQuery::FromRegexp(match), &candidates)) {
+    query.positions = &candidates;
+    size = candidates.size();
+  }
+
+  Ranker ranker(this, current_file, ranking);
+  vector<uint32> rows;
+  ParallelScan<RegexpScanner>(query, size, ranker.candidate_limit(),
+                              kScanChunkSize).Run(scan_pool_, &rows);
+  ranker.Rank(&rows);
+  AddResults(rows, sink);
+}
+
+void TagsTable::FindRegexpTags(
+    const string& tag, const string& current_file, bool callers,
+    const list<string>* ranking, ResultSink* sink) const {
+  const TagIndex* index = index_[FamilyOf(callers)];
+  Ranker ranker(this, current_file, ranking);
+  vector<uint32> rows;
 
   if (ContainsRegexpChar(tag)) {
     // Return all entries matching regexp TAG
-    RegExp retag(tag);
-    if (!retag.error()) {
-      for (pos = map_->begin();
-           pos != map_->end() && resultcount < GET_FLAG(max_results);
-           pos++) {
-        if (retag.FullMatch(pos->first)) {
-          retval->push_back(pos->second);
-          resultcount++;
-        }
-      }
+    CachedRegExp retag(regexps_, tag);
+    if (retag->error())
+      return;
+
+    if (retag->automaton() != NULL) {
+      AutomatonScanner::Query query;
+      query.table = this;
+      query.index = index;
+      query.automaton = retag->automaton();
+      query.sink = sink;
+      ParallelScan<AutomatonScanner>(query, index->size(),
+                                     ranker.candidate_limit(),
+                                     kScanChunkSize).Run(scan_pool_, &rows);
+    } else {
+      RegexpScanner::Query query;
+      query.table = this;
+      query.index = index;
+      query.positions = NULL;
+      query.regexp = tag;
+      query.snippets = false;
+      query.sink = sink;
+      ParallelScan<RegexpScanner>(query, index->size(),
+                                  ranker.candidate_limit(),
+                                  kScanChunkSize).Run(scan_pool_, &rows);
     }
   } else {
     // Return all entries with TAG as a prefix
-    for (pos = map_->lower_bound(tag.c_str());
-         pos != map_->end() && resultcount < GET_FLAG(max_results)
-               && IsPrefix(tag, pos->first);
-         pos++) {
-      retval->push_back(pos->second);
-      resultcount++;
+    for (TagIndex::const_iterator pos
+             = lower_bound(index->begin(), index->end(), tag.c_str(),
+                           IndexEntryLess(this));
+         pos != index->end() && rows.size() < ranker.candidate_limit()
+               && IsPrefix(tag, TagOf(*pos));
+         ++pos) {
+      if (Accepts(sink, *pos))
+        rows.push_back(*pos);
     }
   }
 
-  return retval;
+  ranker.Rank(&rows);
+  AddResults(rows, sink);
 }
 
-list<const TagsTable::TagsResult*>* TagsTable::FindTags(
+void TagsTable::FindTags(
     const string& tag, const string& current_file, bool callers,
-    const list<string>* ranking) const {
-  list<const TagsResult*>* retval = new list<const TagsResult*>();
+    const list<string>* ranking, ResultSink* sink) const {
+  const TagIndex* index = index_[FamilyOf(callers)];
+  Ranker ranker(this, current_file, ranking);
+
+  pair<TagIndex::const_iterator, TagIndex::const_iterator> limits
+    = equal_range(index->begin(), index->end(), tag.c_str(),
+                  IndexEntryLess(this));
+  vector<uint32> rows;
+  for (TagIndex::const_iterator pos = limits.first;
+       pos != limits.second && rows.size() < ranker.candidate_limit();
+       ++pos) {
+    if (Accepts(sink, *pos))
+      rows.push_back(*pos);
+  }
+
+  ranker.Rank(&rows);
+  AddResults(rows, sink);
+}
+
+void TagsTable::FindTagsByFile(const string& filename, bool callers,
+                               ResultSink* sink) const {
   int resultcount = 0;
+  Filename query_file(filename.c_str());
 
-  pair<multimap<const char*, const TagsResult*>::const_iterator,
-    multimap<const char*, const TagsResult*>::const_iterator> limits
-    = map_->equal_range(tag.c_str());
+  FileIdMap::const_iterator file = file_ids_->find(&query_file);
+  if (file == file_ids_->end())
+    return;
 
-  for (multimap<const char*, const TagsResult*>::const_iterator pos
-         = limits.first;
-       pos != limits.second && resultcount < GET_FLAG(max_results);
-       ++pos) {
-    retval->push_back(pos->second);
+  const FileRows& rows = (*file_rows_)[file->second];
+  uint32 end = rows.first_row + rows.num_rows;
+  TagsResult result;
+  for (uint32 row = rows.first_row;
+       row < end && resultcount < GET_FLAG(max_results);
+       ++row) {
+    TagType type = static_cast<TagType>(columns_->type[row]);
+    if (FamilyOf(type) != FamilyOf(callers))
+      continue;
+    GetResult(row, &result);
+    if (!sink->Accepts(result))
+      continue;
+    sink->Add(result);
     resultcount++;
   }
+}
 
-  return retval;
+namespace {
+
+// Returns whether a path component contains glob metacharacters.
+bool HasWildcards(const char* component) {
+  return strpbrk(component, "*?[\\") != NULL;
 }
 
-list<const TagsTable::TagsResult*>* TagsTable::FindTagsByFile(
-    const string& filename, bool callers) const {
-  list<const TagsResult*>* retval = new list<const TagsResult*>();
-  int resultcount = 0;
-  Filename query_file(filename.c_str());
+// Compares the path suffix of FILE to the path suffix SUFFIX (whose
+// components are given last first) followed, in the component before
+// it, by PREFIX. Returns a value less than, equal to or greater than
+// zero as the file sorts before, within or after the files that end
+// with that suffix, in the order of FileSuffixLess.
+int CompareSuffix(const Filename* file, const vector<const char*>& suffix,
+                  const string& prefix) {
+  int last = file->num_components() - 1;
+  for (int i = 0; i < static_cast<int>(suffix.size()); ++i) {
+    if (last - i < 0)
+      return -1;
+    int compare = strcmp(file->component(last - i), suffix[i]);
+    if (compare != 0)
+      return compare;
+  }
+  if (prefix.empty())
+    return 0;
+  if (last - static_cast<int>(suffix.size()) < 0)
+    return -1;
+  return strncmp(file->component(last - suffix.size()), prefix.c_str(),
+                 prefix.size());
+}
 
-  FileMap::const_iterator pos = filemap_->find(&query_file);
-  if (pos != filemap_->end()) {
-    const std::vector<const TagsResult*>& results = pos->second;
-    for (vector<const TagsResult*>::const_iterator i = results.begin();
-         i != results.end() && resultcount < GET_FLAG(max_results);
-         ++i) {
-      retval->push_back(*i);
-      resultcount++;
-    }
+// Binary search predicate for the files that end with a suffix. The
+// suffix is held by the predicate rather than passed as the key, so
+// lower_bound is only a partition-point search: it passes a dummy key,
+// and returns the first file that doesn't sort before the suffix.
+class SuffixLess {
+ public:
+  SuffixLess(const vector<const Filename*>* files,
+             const vector<const char*>* suffix, const string* prefix)
+      : files_(files), suffix_(suffix), prefix_(prefix) { }
+
+  bool operator()(uint32 file, uint32) const {
+    return CompareSuffix((*files_)[file], *suffix_, *prefix_) < 0;
   }
-  return retval;
+
+ private:
+  const vector<const Filename*>* files_;
+  const vector<const char*>* suffix_;
+  const string* prefix_;
+};
+
+}  // namespace
+
+bool TagsTable::FileSuffixLess::operator()(uint32 file1, uint32 file2) const {
+  const Filename* filename1 = (*table_->files_)[file1];
+  const Filename* filename2 = (*table_->files_)[file2];
+  int i1 = filename1->num_components() - 1;
+  int i2 = filename2->num_components() - 1;
+  for (; i1 >= 0 && i2 >= 0; --i1, --i2) {
+    int compare = strcmp(filename1->component(i1), filename2->component(i2));
+    if (compare != 0)
+      return compare < 0;
+  }
+  return i1 < i2;
 }
 
 set<string>* TagsTable::FindFile(const string& filename) const {
   set<string>* retval = new set<string>();
-  int resultcount = 0;
-
-  pair<hash_multimap<const char*, const Filename*, hash<const char*>, StrEq>
-    ::const_iterator,
-    hash_multimap<const char*, const Filename*, hash<const char*>, StrEq>
-    ::const_iterator> limits = findfilemap_->equal_range(filename.c_str());
+  if (filename.empty())
+    return retval;
+
+  // The trailing components without wildcards pick out a range of
+  // file_suffix_index_, as does the literal start of the component
+  // before them. Whatever else the pattern has is matched against
+  // each file in that range.
+  Filename pattern(filename.c_str());
+  int last = pattern.num_components() - 1;
+  vector<const char*> suffix;
+  while (last >= 0 && !HasWildcards(pattern.component(last))) {
+    suffix.push_back(pattern.component(last));
+    --last;
+  }
+  string prefix;
+  if (last >= 0) {
+    const char* component = pattern.component(last);
+    prefix.assign(component, strcspn(component, "*?[\\"));
+  }
 
-  for (hash_multimap<const char*, const Filename*, hash<const char*>, StrEq>
-         ::const_iterator pos = limits.first;
-       pos != limits.second && resultcount < GET_FLAG(max_results);
-       pos++, resultcount++) {
-    retval->insert(pos->second->Str());
+  int resultcount = 0;
+  for (vector<uint32>::const_iterator i =
+           lower_bound(file_suffix_index_->begin(), file_suffix_index_->end(),
+                       0 /* unused */, SuffixLess(files_, &suffix, &prefix));
+       i != file_suffix_index_->end() &&
+           resultcount < GET_FLAG(max_results);
+       ++i) {
+    const Filename* file = (*files_)[*i];
+    if (CompareSuffix(file, suffix, prefix) != 0)
+      break;
+
+    // Match the remaining components of the pattern, which line up
+    // with the components before the suffix.
+    int offset = file->num_components() - pattern.num_components();
+    if (offset < 0)
+      continue;
+    bool matches = true;
+    for (int component = last; matches && component >= 0; --component) {
+      matches = fnmatch(pattern.component(component),
+                        file->component(offset + component), 0) == 0;
+    }
+    if (matches) {
+      retval->insert(file->Str());
+      resultcount++;
+    }
   }
 
   return retval;
 }
 
-void TagsTable::Initialize() {
+void TagsTable::Initialize(WorkerPool* scan_pool, RegExpCache* regexps) {
   strings_ = new SymbolTable();
-  fileset_ = new FileSet();
-  loaded_files_ = new FileSet();
-  map_ = new TagMap();
-  filemap_ = new FileMap();
-  findfilemap_ = new FindFileMap();
+  files_ = new vector<const Filename*>();
+  file_ids_ = new FileIdMap();
+  loaded_files_ = new vector<bool>();
+  file_languages_ = new vector<uint32>();
+  columns_ = new TagColumns();
+  deleted_rows_ = 0;
+  removed_rows_ = 0;
+  generation_ = NewGeneration();
+  tags_loaded_ = 0;
+  for (int i = 0; i < NUM_INDEX_FAMILIES; ++i) {
+    index_[i] = new TagIndex();
+    pending_index_[i] = new vector<uint32>();
+    snippet_index_[i] = NULL;
+  }
+  file_rows_ = new vector<FileRows>();
+  snapshot_ = NULL;
+  file_suffix_index_ = new vector<uint32>();
+  pending_files_ = new vector<uint32>();
+  files_unloaded_ = false;
+  scan_pool_ = scan_pool != NULL ? scan_pool : SharedScanPool();
+  regexps_ = regexps != NULL ? regexps : SharedRegExpCache();
   // Register known features
   features_["callers"] = false;
 }
 
+// The shared pool and cache are created on first use and live as long
+// as the process.
+WorkerPool* TagsTable::SharedScanPool() {
+  static gtags::Mutex mu;
+  static bool created = false;
+  static WorkerPool* pool = NULL;
+  gtags::MutexLock lock(&mu);
+  if (!created) {
+    // The querying thread does its share of every scan.
+    int scan_threads = GET_FLAG(scan_threads) > 0
+        ? GET_FLAG(scan_threads) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (scan_threads > 1)
+      pool = new WorkerPool(scan_threads - 1);
+    created = true;
+  }
+  return pool;
+}
+
+RegExpCache* TagsTable::SharedRegExpCache() {
+  static gtags::Mutex mu;
+  static RegExpCache* cache = NULL;
+  gtags::MutexLock lock(&mu);
+  if (cache == NULL)
+    cache = new RegExpCache(GET_FLAG(regexp_cache_size));
+  return cache;
+}
+
+int64 TagsTable::NewGeneration() {
+  static gtags::Mutex mu;
+  static int64 last_generation = 0;
+  gtags::MutexLock lock(&mu);
+  return ++last_generation;
+}
+
 void TagsTable::FreeData() {
-  // Each TagResult appears as a value in map_ exactly once, so delete
-  // all TagsResults here.
-  TagMap::iterator i;
-  for (i = map_->begin(); i != map_->end(); ++i) {
-    delete i->second;
+  // Swapping with empty vectors releases the storage, which clear()
+  // would not.
+  columns_->Clear();
+  deleted_rows_ = 0;
+  removed_rows_ = 0;
+  generation_ = NewGeneration();
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family) {
+    index_[family]->Clear();
+    vector<uint32>().swap(*pending_index_[family]);
+    delete snippet_index_[family];
+    snippet_index_[family] = NULL;
   }
-  map_->clear();
 
-  // The keys (strings) will be deallocated below, and the values
-  // (TagsResults) have already been deleted, so just clear the map.
-  filemap_->clear();
+  vector<FileRows>().swap(*file_rows_);
 
-  // The keys and values are both strings and will be deallocated
-  // below.
-  findfilemap_->clear();
+  vector<uint32>().swap(*file_suffix_index_);
+  vector<uint32>().swap(*pending_files_);
+  files_unloaded_ = false;
 
   // Deleted list of loaded files
-  loaded_files_->clear();
+  vector<bool>().swap(*loaded_files_);
+  vector<uint32>().swap(*file_languages_);
 
-  // Each Filename appears exactly once in this set; delete them all
+  // Each Filename appears exactly once in files_; delete them all
   // here.
-  FileSet::iterator j;
-  for (j = fileset_->begin(); j != fileset_->end();) {
-    // advance the iterator before we delete the element
-    FileSet::iterator temp = j;
-    j++;
-    delete *temp;
+  file_ids_->clear();
+  for (vector<const Filename*>::iterator i = files_->begin();
+       i != files_->end(); ++i) {
+    delete *i;
   }
-  fileset_->clear();
+  vector<const Filename*>().swap(*files_);
 
-  // Delete the stored strings. Every string stored as a map key or
-  // inside a TagsResult ought to be stored here.
+  // Delete the stored strings. Every string referred to by a row or
+  // Filename ought to be stored here.
   strings_->Clear();
+
+  // Nothing refers to the snapshot any more.
+  delete snapshot_;
+  snapshot_ = NULL;
 }
 
 void TagsTable::UnloadFilesInDir(const string& dirname) {
-  FileSet::const_iterator iter;
-  for (iter = fileset_->begin(); iter != fileset_->end();) {
-    const Filename* filename = *iter;
-    ++iter;  // Move iter before UnloadFile deletes filename from the set.
-    if (HasPrefixString(filename->Str(), dirname)) {
-      UnloadFile(filename);
+  for (uint32 file = 0; file < files_->size(); ++file) {
+    const Filename* filename = (*files_)[file];
+    if (filename->length() >= static_cast<int>(dirname.size()) &&
+        memcmp(filename->c_str(), dirname.data(), dirname.size()) == 0) {
+      UnloadFile(file);
     }
   }
+  FreezeIndex();
 }
 
-void TagsTable::UnloadFile(const Filename* filename) {
+void TagsTable::UnloadFile(uint32 file) {
   // No such file loaded. We are done.
-  if (loaded_files_->find(filename) == loaded_files_->end()) {
+  if (!(*loaded_files_)[file]) {
     return;
   }
 
+  const Filename* filename = (*files_)[file];
   LOG(INFO) << "Unloading " << filename->Str();
 
-  // Delete from findfilemap_.
-  pair<FindFileMap::iterator, FindFileMap::iterator> iter_ffm =
-      findfilemap_->equal_range(filename->Basename());
+  files_unloaded_ = true;
+
+  // Mark the file's rows as deleted. Their index entries are dropped
+  // by the next FreezeIndex.
+  FileRows* rows = &(*file_rows_)[file];
+  for (uint32 row = rows->first_row;
+       row < rows->first_row + rows->num_rows; ++row) {
+    DeleteRow(row);
+  }
+  rows->num_rows = 0;
+
+  (*loaded_files_)[file] = false;
+}
+
+namespace {
+
+// New row number of rows removed by CompactRows.
+const uint32 kNoRow = ~0U;
+
+// Replaces each row number in ROWS by its new number NEW_ROW[row],
+// dropping rows which were removed.
+void RenumberRows(const vector<uint32>& new_row, vector<uint32>* rows) {
+  vector<uint32>::iterator out = rows->begin();
+  for (vector<uint32>::const_iterator i = rows->begin();
+       i != rows->end(); ++i) {
+    if (new_row[*i] != kNoRow)
+      *out++ = new_row[*i];
+  }
+  rows->erase(out, rows->end());
+}
+
+}  // namespace
+
+namespace {
+
+// Copies element FROM of COLUMN over element TO.
+template<class T>
+void MoveElement(Column<T>* column, uint32 from, uint32 to) {
+  vector<T>* v = column->Mutable();
+  (*v)[to] = (*v)[from];
+}
+
+}  // namespace
+
+void TagsTable::TagColumns::Move(uint32 from, uint32 to) {
+  MoveElement(&type, from, to);
+  MoveElement(&charno, from, to);
+  MoveElement(&lineno, from, to);
+  MoveElement(&tag, from, to);
+  MoveElement(&linerep, from, to);
+  MoveElement(&file, from, to);
+  MoveElement(&language, from, to);
+}
+
+void TagsTable::TagColumns::Resize(uint32 n) {
+  type.Mutable()->resize(n);
+  charno.Mutable()->resize(n);
+  lineno.Mutable()->resize(n);
+  tag.Mutable()->resize(n);
+  linerep.Mutable()->resize(n);
+  file.Mutable()->resize(n);
+  language.Mutable()->resize(n);
+}
+
+void TagsTable::TagColumns::Trim() {
+  type.Trim();
+  charno.Trim();
+  lineno.Trim();
+  tag.Trim();
+  linerep.Trim();
+  file.Trim();
+  language.Trim();
+}
+
+void TagsTable::TagColumns::Clear() {
+  type.Clear();
+  charno.Clear();
+  lineno.Clear();
+  tag.Clear();
+  linerep.Clear();
+  file.Clear();
+  language.Clear();
+}
+
+int64 TagsTable::TagColumns::bytes_owned() const {
+  return type.bytes_owned() + charno.bytes_owned() + lineno.bytes_owned() +
+      tag.bytes_owned() + linerep.bytes_owned() + file.bytes_owned() +
+      language.bytes_owned();
+}
+
+uint32 TagsTable::AppendRow(const TagRow& row) {
+  columns_->type.Mutable()->push_back(row.type);
+  columns_->charno.Mutable()->push_back(row.charno);
+  columns_->lineno.Mutable()->push_back(row.lineno);
+  columns_->tag.Mutable()->push_back(row.tag);
+  columns_->linerep.Mutable()->push_back(row.linerep);
+  columns_->file.Mutable()->push_back(row.file);
+  columns_->language.Mutable()->push_back(row.language);
+  return columns_->size() - 1;
+}
+
+void TagsTable::GetResult(uint32 row, TagsResult* result) const {
+  result->type = static_cast<TagType>(columns_->type[row]);
+  result->charno = columns_->charno[row];
+  result->lineno = columns_->lineno[row];
+  result->tag = strings_->Lookup(columns_->tag[row]);
+  result->linerep = strings_->Lookup(columns_->linerep[row]);
+  result->filename = (*files_)[columns_->file[row]];
+  result->language = strings_->Lookup(columns_->language[row]);
+}
+
+void TagsTable::AddResults(const vector<uint32>& rows,
+                           ResultSink* sink) const {
+  TagsResult result;
+  for (vector<uint32>::const_iterator i = rows.begin(); i != rows.end(); ++i) {
+    GetResult(*i, &result);
+    sink->Add(result);
+  }
+}
+
+bool TagsTable::Accepts(const ResultSink* sink, uint32 row) const {
+  TagsResult result;
+  GetResult(row, &result);
+  return sink->Accepts(result);
+}
+
+void TagsTable::CompactRows() {
+  // Slide the live rows down over the deleted ones. Rows keep their
+  // relative order, so every index stays sorted once renumbered.
+  uint32 num_rows = columns_->size();
+  vector<uint32> new_row(num_rows, kNoRow);
+  uint32 live_rows = 0;
+  for (uint32 row = 0; row < num_rows; ++row) {
+    if (columns_->file[row] == kNoFile)
+      continue;
+    if (row != live_rows)
+      columns_->Move(row, live_rows);
+    new_row[row] = live_rows++;
+  }
+  columns_->Resize(live_rows);
+
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family) {
+    RenumberRows(new_row, index_[family]->Mutable());
+    RenumberRows(new_row, pending_index_[family]);
+  }
+  // Only whole files are deleted, so the first row of a file with
+  // rows is never removed.
+  for (vector<FileRows>::iterator i = file_rows_->begin();
+       i != file_rows_->end(); ++i) {
+    if (i->num_rows > 0)
+      i->first_row = new_row[i->first_row];
+  }
+  removed_rows_ += deleted_rows_;
+  deleted_rows_ = 0;
+}
+
+// What PrepareRebuild builds for FinishRebuild to swap into the
+// table. Once swapped in, it holds what it replaced, which it deletes.
+class TagsTable::Rebuild {
+ public:
+  explicit Rebuild(int64 generation)
+      : generation(generation), snippets(false), strings(NULL),
+        files(NULL), file_ids(NULL), loaded_files(NULL),
+        file_languages(NULL), file_rows(NULL) {
+    for (int family = 0; family < NUM_INDEX_FAMILIES; ++family)
+      snippet_index[family] = NULL;
+  }
+
+  ~Rebuild() {
+    for (int family = 0; family < NUM_INDEX_FAMILIES; ++family)
+      delete snippet_index[family];
+    if (files != NULL)
+      STLDeleteElementContainer(files);
+    delete files;
+    delete file_ids;
+    delete loaded_files;
+    delete file_languages;
+    delete file_rows;
+    delete strings;
+  }
+
+  // Generation of the table it was prepared from
+  int64 generation;
+
+  // Whether snippet_index was built
+  bool snippets;
+  TrigramIndex* snippet_index[NUM_INDEX_FAMILIES];
+
+  // The compacted strings and files, or NULL if the strings weren't
+  // compacted, and the ids of each row and loaded file with them.
+  SymbolTable* strings;
+  vector<const Filename*>* files;
+  FileIdMap* file_ids;
+  vector<bool>* loaded_files;
+  vector<uint32>* file_languages;
+  vector<FileRows>* file_rows;
+  vector<uint32> file_suffix_index;
+  vector<uint32> tag;
+  vector<uint32> linerep;
+  vector<uint32> language;
+  vector<uint32> file;
+
+ private:
+  DISALLOW_EVIL_CONSTRUCTORS(Rebuild);
+};
+
+void TagsTable::CompactStrings(Rebuild* rebuild) const {
+  SymbolTable* strings = new SymbolTable();
+
+  // Give the files that are still loaded new ids, in the same order.
+  vector<uint32> new_file(files_->size(), kNoFile);
+  vector<const Filename*>* files = new vector<const Filename*>();
+  FileIdMap* file_ids = new FileIdMap();
+  vector<bool>* loaded_files = new vector<bool>();
+  vector<uint32>* file_languages = new vector<uint32>();
+  vector<FileRows>* file_rows = new vector<FileRows>();
+  for (uint32 file = 0; file < files_->size(); ++file) {
+    if (!(*loaded_files_)[file])
+      continue;
+    uint32 language = (*file_languages_)[file];
+    Filename* filename =
+        new Filename((*files_)[file]->c_str(), strings);
+    new_file[file] = files->size();
+    file_ids->insert(make_pair(filename, files->size()));
+    files->push_back(filename);
+    loaded_files->push_back(true);
+    file_languages->push_back(
+        strings->GetId(strings_->Lookup(language), strings_->Length(language)));
+    file_rows->push_back((*file_rows_)[file]);
+  }
+
+  // Only loaded files have rows, and only loaded files are in
+  // file_suffix_index_, which keeps its order since the paths do not
+  // change.
+  rebuild->file_suffix_index.reserve(file_suffix_index_->size());
+  for (vector<uint32>::const_iterator i = file_suffix_index_->begin();
+       i != file_suffix_index_->end(); ++i) {
+    rebuild->file_suffix_index.push_back(new_file[*i]);
+  }
+
+  // Intern the strings of every row again, in row order.
+  const int kNumStringColumns = 3;
+  const Column<uint32>* string_columns[kNumStringColumns] = {
+    &columns_->tag, &columns_->linerep, &columns_->language
+  };
+  vector<uint32>* new_columns[kNumStringColumns] = {
+    &rebuild->tag, &rebuild->linerep, &rebuild->language
+  };
+  for (int column = 0; column < kNumStringColumns; ++column) {
+    const Column<uint32>& ids = *string_columns[column];
+    vector<uint32>* new_ids = new_columns[column];
+    new_ids->reserve(ids.size());
+    for (Column<uint32>::const_iterator i = ids.begin(); i != ids.end(); ++i)
+      new_ids->push_back(strings->GetId(strings_->Lookup(*i),
+                                        strings_->Length(*i)));
+  }
+  rebuild->file.reserve(columns_->size());
+  for (Column<uint32>::const_iterator i = columns_->file.begin();
+       i != columns_->file.end(); ++i) {
+    rebuild->file.push_back(new_file[*i]);
+  }
+
+  LOG(INFO) << "Compacted strings from " << strings_->size() << " to "
+            << strings->size() << " and files from " << files_->size()
+            << " to " << files->size() << ".";
+
+  rebuild->strings = strings;
+  rebuild->files = files;
+  rebuild->file_ids = file_ids;
+  rebuild->loaded_files = loaded_files;
+  rebuild->file_languages = file_languages;
+  rebuild->file_rows = file_rows;
+}
+
+void TagsTable::FreezeIndex() {
+  FreezeRows();
+  FinishRebuild(PrepareRebuild());
+}
 
-  for (FindFileMap::iterator i = iter_ffm.first;
-       i != iter_ffm.second;) {
-    FindFileMap::iterator tmp = i;
-    ++i;
-    if (*(tmp->second) == *(filename)) {
-      findfilemap_->erase(tmp);
+void TagsTable::FreezeRows() {
+  generation_ = NewGeneration();
+  if (deleted_rows_ > 0)
+    CompactRows();
+
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family) {
+    TagIndex* index = index_[family];
+    vector<uint32>* pending = pending_index_[family];
+
+    if (!pending->empty()) {
+      // Both the sort and the merge are stable, so entries with equal
+      // tags stay in the order in which they were loaded.
+      stable_sort(pending->begin(), pending->end(), IndexEntryLess(this));
+      vector<uint32>* rows = index->Mutable();
+      vector<uint32>::size_type old_size = rows->size();
+      rows->reserve(old_size + pending->size());
+      rows->insert(rows->end(), pending->begin(), pending->end());
+      inplace_merge(rows->begin(), rows->begin() + old_size, rows->end(),
+                    IndexEntryLess(this));
     }
+    vector<uint32>().swap(*pending);
+
+    // The positions in the snippet index are those of the old index.
+    delete snippet_index_[family];
+    snippet_index_[family] = NULL;
   }
+  FreezeFileIndex();
+}
 
-  // Delete from map_.
-  if (enable_fileindex_) {
-    // Find and delete the right TagResults using filemap_.
-    FileMap::iterator pos = filemap_->find(filename);
-    CHECK(pos != filemap_->end());
-    for (vector<const TagsResult*>::const_iterator i = pos->second.begin();
-        i != pos->second.end(); ++i) {
-      pair<TagMap::iterator, TagMap::iterator> iter_tag =
-          map_->equal_range((*i)->tag);
-      for (TagMap::iterator j = iter_tag.first;
-           j != iter_tag.second;) {
-        TagMap::iterator tmp = j;
-        ++j;
-        if (tmp->second == *i) {
-          map_->erase(tmp);
-          break;
-        }
-      }
-      delete *i;
+void TagsTable::TrimStorage() {
+  columns_->Trim();
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family)
+    index_[family]->Trim();
+}
+
+TagsTable::Rebuild* TagsTable::PrepareRebuild() const {
+  bool snippets =
+      GET_FLAG(snippet_index) && snippet_index_[DEFINITIONS] == NULL;
+
+  // Unloaded tags leave their strings and file names behind. Once
+  // enough have been unloaded, copying what is still in use costs
+  // less than keeping the rest around.
+  int compaction_percent = GET_FLAG(string_compaction_percent);
+  bool compact = compaction_percent > 0 && removed_rows_ > 0 &&
+      removed_rows_ * 100 >=
+          static_cast<int64>(columns_->size()) * compaction_percent;
+
+  if (!snippets && !compact)
+    return NULL;
+  Rebuild* rebuild = new Rebuild(generation_);
+  if (snippets) {
+    BuildSnippetIndex(rebuild->snippet_index);
+    rebuild->snippets = true;
+  }
+  if (compact)
+    CompactStrings(rebuild);
+  return rebuild;
+}
+
+void TagsTable::FinishRebuild(Rebuild* rebuild) {
+  if (rebuild == NULL)
+    return;
+  if (rebuild->generation != generation_) {
+    LOG(INFO) << "Dropped a rebuild of a table which has changed since.";
+    delete rebuild;
+    return;
+  }
+
+  // Compacted strings have new ids, so whatever was prepared from the
+  // old ones is stale.
+  generation_ = NewGeneration();
+  if (rebuild->snippets) {
+    for (int family = 0; family < NUM_INDEX_FAMILIES; ++family)
+      swap(snippet_index_[family], rebuild->snippet_index[family]);
+  }
+  if (rebuild->strings != NULL) {
+    swap(strings_, rebuild->strings);
+    swap(files_, rebuild->files);
+    swap(file_ids_, rebuild->file_ids);
+    swap(loaded_files_, rebuild->loaded_files);
+    swap(file_languages_, rebuild->file_languages);
+    swap(file_rows_, rebuild->file_rows);
+    file_suffix_index_->swap(rebuild->file_suffix_index);
+    columns_->tag.Swap(&rebuild->tag);
+    columns_->linerep.Swap(&rebuild->linerep);
+    columns_->language.Swap(&rebuild->language);
+    columns_->file.Swap(&rebuild->file);
+    removed_rows_ = 0;
+  }
+  delete rebuild;
+}
+
+void TagsTable::FreezeFileIndex() {
+  if (pending_files_->empty() && !files_unloaded_)
+    return;
+
+  // Drop the files that have been unloaded, and those that were
+  // loaded again, which are also in pending_files_.
+  vector<bool> indexed(files_->size(), false);
+  vector<uint32>::iterator end = file_suffix_index_->begin();
+  for (vector<uint32>::const_iterator i = file_suffix_index_->begin();
+       i != file_suffix_index_->end(); ++i) {
+    if ((*loaded_files_)[*i]) {
+      indexed[*i] = true;
+      *end++ = *i;
     }
-    filemap_->erase(pos);
-  } else {
-    // If the file index is not enabled, we might still want to unload
-    // files when doing an incremental update for example. To do this,
-    // we need to scan through the entire table. This is fairly slow,
-    // but it saves memory over maintaining the file index.
-    // TODO: It might be nice to have an UnloadFiles function that unloads
-    // a list of files and only scans the index once (sort the list).
-    for (TagMap::iterator i = map_->begin(); i != map_->end();) {
-      TagMap::iterator tmp = i;
-      ++i;
-      if (*(tmp->second->filename) == *(filename)) {
-        delete tmp->second;
-        map_->erase(tmp);
-      }
+  }
+  file_suffix_index_->erase(end, file_suffix_index_->end());
+
+  vector<uint32> added;
+  for (vector<uint32>::const_iterator i = pending_files_->begin();
+       i != pending_files_->end(); ++i) {
+    if ((*loaded_files_)[*i] && !indexed[*i]) {
+      indexed[*i] = true;
+      added.push_back(*i);
     }
   }
+  sort(added.begin(), added.end(), FileSuffixLess(this));
+  vector<uint32>::size_type old_size = file_suffix_index_->size();
+  file_suffix_index_->insert(file_suffix_index_->end(),
+                             added.begin(), added.end());
+  inplace_merge(file_suffix_index_->begin(),
+                file_suffix_index_->begin() + old_size,
+                file_suffix_index_->end(), FileSuffixLess(this));
+  vector<uint32>(*file_suffix_index_).swap(*file_suffix_index_);
+
+  vector<uint32>().swap(*pending_files_);
+  files_unloaded_ = false;
+}
 
-  loaded_files_->erase(filename);
+void TagsTable::BuildSnippetIndex(TrigramIndex* snippet_index[]) const {
+  int64 bytes_used = 0;
+  for (int family = 0; family < NUM_INDEX_FAMILIES; ++family) {
+    const TagIndex& index = *index_[family];
+    TrigramIndex* snippets = new TrigramIndex();
+    for (uint32 i = 0; i < index.size(); ++i) {
+      uint32 linerep = columns_->linerep[index[i]];
+      snippets->Add(i, strings_->Lookup(linerep), strings_->Length(linerep));
+    }
+    snippets->Freeze();
+    bytes_used += snippets->bytes_used();
+    snippet_index[family] = snippets;
+  }
+  LOG(INFO) << "Indexed snippets by trigram in " << bytes_used << " bytes.";
 }
 
 int TagsTable::GetTagsFormatVersion(const SExpression* sexp) {
-  // Check that a valid s-expression was parsed. If we get NULL back
-  // it was probably an invalid s-expression in the file.
-  CHECK_NE(sexp, static_cast<SExpression*>(NULL))
-    << "Expected a valid s-expression in input file.";
   // Each top-level expression found in the file must be a list.
-  CHECK(sexp->IsList()) << "Expected a declaration list at the top-level.";
+  if (!sexp->IsList())
+    return -1;
   // Iterate over all elements of a single declaration.
   SExpression::const_iterator sexp_iter = sexp->Begin();
-  CHECK(sexp_iter != sexp->End())
-    << "Expected tags-format-version declaration at file start.";
-  CHECK(sexp_iter->IsSymbol())
-    << "Expected tags-format-version declaration at file start.";
-  CHECK_EQ(sexp_iter->Repr(), "tags-format-version")
-    << "Expected tags-format-version declaration at file start.";
+  if (sexp_iter == sexp->End() || !sexp_iter->IsSymbol() ||
+      sexp_iter->Repr() != "tags-format-version")
+    return -1;
   ++sexp_iter;
-  CHECK(sexp_iter != sexp->End())
-    << "Expected a format version to follow tags-format-version.";
-  CHECK(sexp_iter->IsInteger())
-    << "Expected a format version to follow tags-format-version.";
+  // Expect a format version to follow tags-format-version.
+  if (sexp_iter == sexp->End() || !sexp_iter->IsInteger())
+    return -1;
 
   return down_cast<const SExpressionInteger*>(&*sexp_iter)->value();
 }
 
-void TagsTable::ParseHeaderDeclaration(const SExpression* sexp) {
-  CHECK(sexp->IsList());
+bool TagsTable::ParseHeaderDeclaration(const SExpression* sexp) {
+  if (!sexp->IsList())
+    return false;
   SExpression::const_iterator sexp_iter = sexp->Begin();
+  if (sexp_iter == sexp->End())
+    return false;
 
   const SExpression* declaration_type = &*sexp_iter;
   ++sexp_iter;
-  CHECK(sexp_iter != sexp->End())
-    << "Expected parameter(s) to follow declaration type.";
+  // Expect parameter(s) to follow the declaration type.
+  if (sexp_iter == sexp->End())
+    return false;
   const SExpression* declaration_value = &*sexp_iter;
 
   // In general, just read the value and stick it into the
   // appropriate member variable.
   if (declaration_type->Repr() == "tags-comment") {
-    CHECK(declaration_value->IsString())
-      << "Expected string after tags-comment.";
+    if (!declaration_value->IsString())
+      return false;
     tags_comment_ =
       down_cast<const SExpressionString*>(declaration_value)->value();
   } else if (declaration_type->Repr() == "tags-corpus-name") {
-    CHECK(declaration_value->IsString())
-      << "Expected string after tags-corpus-name.";
+    if (!declaration_value->IsString())
+      return false;
     corpus_name_ =
       down_cast<const SExpressionString*>(declaration_value)->value();
   } else if (declaration_type->Repr() == "timestamp") {
@@ -482,14 +1945,15 @@ void TagsTable::ParseHeaderDeclaration(const SExpression* sexp) {
     // we don't allocate enough space to do this.  (SExpression ints
     // are capped at 2^31-1 on 32-bit machines.)
   } else if (declaration_type->Repr() == "features") {
-    CHECK(declaration_value->IsList()) << "Expected a list after features.";
+    if (!declaration_value->IsList())
+      return false;
 
     for (SExpression::const_iterator features_iter
            = declaration_value->Begin();
          features_iter != declaration_value->End();
          ++features_iter) {
-      CHECK(features_iter->IsSymbol())
-        << "Expected symbol in feature list.";
+      if (!features_iter->IsSymbol())
+        return false;
 
       hash_map<string, bool>::iterator find_iter =
         features_.find(features_iter->Repr());
@@ -503,337 +1967,63 @@ void TagsTable::ParseHeaderDeclaration(const SExpression* sexp) {
     LOG(INFO) << "File header contained unrecognized declaration type: "
               << declaration_type->Repr();
   }
+  return true;
 }
 
-void TagsTable::ParseDeletedDeclaration(const SExpression* sexp) {
-  CHECK(sexp->IsList());
-  SExpression::const_iterator sexp_iter = sexp->Begin();
-  const SExpression* declaration_type = &*sexp_iter;
-  ++sexp_iter;
-  CHECK_EQ(declaration_type->Repr(), "deleted");
-  CHECK(sexp_iter != sexp->End())
-    << "Expected parameter(s) to follow declaration type.";
-  const SExpression* declaration_value = &*sexp_iter;
-  CHECK(declaration_value->IsString())
-    << "Expected string after deleted declaration.";
-  const Filename* filename = NULL;
-  filename = FileGet(
-    down_cast<const SExpressionString*>(declaration_value)->value());
-  CHECK_NE(filename, static_cast<Filename*>(NULL))
-    << "Expected a file path inside deleted declaration.";
-  UnloadFile(filename);
-}
-
-void TagsTable::ParseFileDeclaration(const SExpression* sexp) {
-  const Filename* filename = NULL;
-  const char* language = "";
-  const SExpression* contents_list = NULL;
-
-  CHECK(IsDeclarationWithAlist(sexp, "file"));
-
-  // Extract attributes from file declaration
-  for (SExpression::const_iterator file_iter = GetAttributes(sexp);
-       file_iter != sexp->End();
-       ++file_iter) {
-    SExpression::const_iterator attr_iter = file_iter->Begin();
-    const SExpression* attr_name = &*attr_iter;
-    ++attr_iter;
-    const SExpression* attr_value = &*attr_iter;
-
-    if (attr_name->Repr() == "path") {
-      CHECK(attr_value->IsString());
-      filename = FileGet(
-          down_cast<const SExpressionString*>(attr_value)->value());
-    } else if (attr_name->Repr() == "language") {
-      CHECK(attr_value->IsString());
-      language = strings_->Get(
-          down_cast<const SExpressionString*>(attr_value)->value().c_str());
-    } else if (attr_name->Repr() == "contents") {
-      CHECK(attr_value->IsList());
-      contents_list = &*attr_value;
-    } else {
-      LOG(INFO) << "file declaration contained unrecognized attribute name: "
-                << attr_name->Repr();
-    }
-  }
-
-  // Check that all fields were assigned
-  CHECK_NE(filename, static_cast<Filename*>(NULL))
-    << "Expected a file path inside the file declaration.";
-  CHECK_STRNE(language, "")
-    << "Expected a file language inside the file declaration.";
-  CHECK_NE(contents_list, static_cast<SExpression*>(NULL))
-    << "Expected a contents list inside the file declaration.";
-
-  LOG(INFO) << "Processing " << filename->Str();
-
-  UnloadFile(filename);
-
-  // Add into loaded_files_
-  loaded_files_->insert(filename);
-
-  vector<const TagsResult*> tags_vector;
-
-  // Iterate through contents
-  for (SExpression::const_iterator lineitem_iter = contents_list->Begin();
-       lineitem_iter != contents_list->End();
-       ++lineitem_iter) {
-    TagsResult* tag = ParseItemDeclaration(&*lineitem_iter, filename);
-
-    // If we got tag == NULL and no further work is
-    // needed.
-    if (tag == NULL)
-      continue;
-
-    tag->filename = filename;
-    tag->language = language;
-
-    map_->insert(make_pair(tag->tag, tag));
-    if (enable_fileindex_)
-      tags_vector.push_back(tag);
-    if (GET_FLAG(findfile))
-      findfilemap_->insert(make_pair(tag->filename->Basename(), tag->filename));
-
-    if (tag->type != CALL)
-      callers_on_by_default_ = false;
-
-    LOG_EVERY_N(INFO, 100000) << "Tag: " << tag->tag << "\n"
-                              << "Snippet: " << tag->linerep << "\n"
-                              << "Filename: " << tag->filename->Str() << "\n"
-                              << "Lineno: " << tag->lineno << "\n"
-                              << "Charno: " << tag->charno;
-  }
-
-  if (enable_fileindex_) {
-    tags_vector.resize(tags_vector.size());
-    filemap_->insert(make_pair(filename, tags_vector));
-  }
-}
-
-TagsTable::TagsResult* TagsTable::ParseItemDeclaration(
-    const SExpression* sexp, const Filename* filename) {
-  CHECK(IsDeclarationWithAlist(sexp, "item"));
-
-  TagsResult* retval = NULL;
-
-  int lineno = 0;
-  int charno = 0;
-  const char* snippet = NULL;
-
-  // Extract attributes from item declaration
-  for (SExpression::const_iterator item_iter = GetAttributes(sexp);
-       item_iter != sexp->End();
-       ++item_iter) {
-    SExpression::const_iterator attr_iter = item_iter->Begin();
-    const SExpression* attr_name = &*attr_iter;
-    ++attr_iter;
-    const SExpression* attr_value = &*attr_iter;
-
-    if (attr_name->Repr() == "line") {
-      CHECK(attr_value->IsInteger());
-      lineno = down_cast<const SExpressionInteger*>(attr_value)->value();
-    } else if (attr_name->Repr() == "offset") {
-      CHECK(attr_value->IsInteger());
-      charno = down_cast<const SExpressionInteger*>(attr_value)->value();
-    } else if (attr_name->Repr() == "descriptor") {
-      retval = ParseDescriptorDeclaration(attr_value, filename);
-    } else if (attr_name->Repr() == "snippet") {
-      CHECK(attr_value->IsString());
-      string snippet_str
-        = down_cast<const SExpressionString*>(attr_value)->value();
-      if (snippet_str.size() > GET_FLAG(max_snippet_size))
-        snippet_str.resize(GET_FLAG(max_snippet_size));
-      snippet = strings_->Get(snippet_str.c_str());
-    }
-  }
-
-  // Assign values to TagsResult struct
-  if (retval != NULL) {
-    retval->lineno = lineno;
-    retval->charno = charno;
-    // If snippet wasn't specified, we should set it to an empty string.
-    if (snippet == NULL)
-      retval->linerep = strings_->Get("");
-    else
-      retval->linerep = snippet;
-  }
-
-  return retval;
-}
-
-TagsTable::TagsResult* TagsTable::ParseDescriptorDeclaration(
-    const SExpression* sexp, const Filename* filename) {
-
-  const SExpression* descriptor_head = &*(sexp->Begin());
-  TagsResult* retval = new TagsResult;
-
-  if (descriptor_head->Repr() == "call") {
-    // Handle references
-    CHECK(IsDeclarationWithAlist(sexp, "call"));
-    // Extract values from call declaration
-    for (SExpression::const_iterator descriptor_iter = GetAttributes(sexp);
-         descriptor_iter != sexp->End();
-         ++descriptor_iter) {
-      SExpression::const_iterator attr_iter = descriptor_iter->Begin();
-      const SExpression* attr_name = &*attr_iter;
-      ++attr_iter;
-      const SExpression* attr_value = &*attr_iter;
-
-      if (attr_name->Repr() == "to")
-        retval->tag = strings_->Get(GetTagNameFromRef(attr_value).c_str());
-    }
-  } else {
-    // All other tag definition types
-    if (descriptor_head->Repr() == "type")
-      retval->type = TYPE_DEFN;
-    else if (descriptor_head->Repr() == "function")
-      retval->type = FUNCTION_DEFN;
-    else if (descriptor_head->Repr() == "variable")
-      retval->type = VARIABLE_DEFN;
-    else if (descriptor_head->Repr() == "generic-tag")
-      retval->type = GENERIC_DEFN;
-    else
-      LOG(FATAL) << "Unexpected descriptor type encountered."
-                 << descriptor_head->Repr();
-
-    // TODO(psung): At present we don't know how to do special
-    // handling for types, functions, and variables. We just read the
-    // 'tag' field as if they were generic tags.
-    CHECK(IsDeclarationWithAlist(sexp, descriptor_head->Repr()));
-
-    for (SExpression::const_iterator descriptor_iter = GetAttributes(sexp);
-         descriptor_iter != sexp->End();
-         ++descriptor_iter) {
-      SExpression::const_iterator attr_iter = descriptor_iter->Begin();
-      const SExpression* attr_name = &*attr_iter;
-      ++attr_iter;
-      const SExpression* attr_value = &*attr_iter;
-
-      if (attr_name->Repr() == "tag") {
-        CHECK(attr_value->IsString());
-        retval->tag = strings_->Get(
-            down_cast<const SExpressionString*>(attr_value)->value().c_str());
-      }
-    }
-  }
-
-  CHECK_NE("", retval->tag) << "Expected non-empty tag name.";
-
-  return retval;
-}
-
-const string& TagsTable::GetTagNameFromRef(const SExpression* sexp) const {
-  CHECK(IsDeclarationWithAlist(sexp, "ref"));
-
-  const string* p_return = NULL;
-
-  for (SExpression::const_iterator ref_iter = GetAttributes(sexp);
-       ref_iter != sexp->End();
-       ++ref_iter) {
-    SExpression::const_iterator attr_iter = ref_iter->Begin();
-    const SExpression* attr_name = &*attr_iter;
-    ++attr_iter;
-    const SExpression* attr_value = &*attr_iter;
-
-    if (attr_name->Repr() == "name") {
-      CHECK(attr_value->IsString());
-      p_return = &(down_cast<const SExpressionString*>(attr_value)->value());
-    }
-  }
-
-  CHECK_NE(p_return, static_cast<string*>(NULL))
-    << "Expected name inside reference";
-  CHECK_NE(*p_return, "")
-    << "Expected name inside reference";
-  return *p_return;
-}
-
-bool TagsTable::IsDeclarationWithAlist(const SExpression* sexp,
-                                       const string& decltype) const {
-  if (!sexp->IsList()) {
-    LOG(WARNING) << "Expected expression to be a list.";
+bool TagsTable::ParseItem(const TagsItem& item, TagRow* row) {
+  if (strcmp(item.descriptor, "call") == 0)
+    row->type = CALL;
+  else if (strcmp(item.descriptor, "type") == 0)
+    row->type = TYPE_DEFN;
+  else if (strcmp(item.descriptor, "function") == 0)
+    row->type = FUNCTION_DEFN;
+  else if (strcmp(item.descriptor, "variable") == 0)
+    row->type = VARIABLE_DEFN;
+  else if (strcmp(item.descriptor, "generic-tag") == 0)
+    row->type = GENERIC_DEFN;
+  else
     return false;
-  }
 
-  SExpression::const_iterator sexp_iter = sexp->Begin();
-
-  // Check that the first element is a symbol
-  if (sexp_iter == sexp->End()) {
-    LOG(WARNING) << "Expected expression to be a non-empty list.";
-    return false;
-  }
-  if (!sexp_iter->IsSymbol()) {
-    LOG(WARNING) << "Expected expresssion to begin with a symbol.";
+  // TODO(psung): At present we don't know how to do special
+  // handling for types, functions, and variables. We just read the
+  // 'tag' field as if they were generic tags.
+  if (item.tag_length == 0)
     return false;
-  }
-  if (down_cast<const SExpressionSymbol*>(&*sexp_iter)->name() != decltype) {
-    LOG(WARNING) << "Expected expression to begin with symbol: "
-                 << decltype;
-    return false;
-  }
-
-  ++sexp_iter;
-
-  // Check the attributes
-  for (; sexp_iter != sexp->End(); ++sexp_iter) {
-    if (!sexp_iter->IsList()) {
-      LOG(WARNING) << "Expected attribute-value sets to be lists.";
-      return false;
-    }
-
-    // TODO(psung): Maybe reject the s-expression if there are
-    // duplicate names in the attribute list
-
-    SExpression::const_iterator attr_iter = sexp_iter->Begin();
-    // Check that each attribute has two elements, first of which is a
-    // symbol
-    if (attr_iter == sexp_iter->End() || !attr_iter->IsSymbol()) {
-      LOG(WARNING) << "Expected first element of attribute-value set to be "
-                   << "a symbol.";
-      return false;
-    }
-    ++attr_iter;
-    if (attr_iter == sexp_iter->End()) {
-      LOG(WARNING) << "Expected attribute-value set to contain second element.";
-      return false;
-    }
-    ++attr_iter;
-    if (attr_iter != sexp_iter->End()) {
-      LOG(WARNING) << "Expected attribute-value set to contain only "
-                   << "two elements.";
-      return false;
-    }
-  }
+  row->tag = strings_->GetId(item.tag, item.tag_length);
 
+  int snippet_length = min(item.snippet_length, GET_FLAG(max_snippet_size));
+  row->linerep = strings_->GetId(item.snippet, snippet_length);
+  row->lineno = item.lineno;
+  row->charno = item.charno;
   return true;
 }
 
-SExpression::const_iterator TagsTable::GetAttributes(
-    const SExpression* sexp) const {
-  // All this really does is return an iterator starting from the
-  // second element
-  SExpression::const_iterator sexp_iter = sexp->Begin();
-  ++sexp_iter;
-  return sexp_iter;
-}
-
 bool TagsTable::IsPrefix(const string& a, const string& b) const {
   return (a.size() <= b.size()) && !(b.compare(0, a.size(), a));
 }
 
 bool TagsTable::ContainsRegexpChar(const string& tag) const {
-  static RegExp rechars("[^a-zA-Z0-9\\-_]");
-  return rechars.PartialMatch(tag);
+  for (string::const_iterator i = tag.begin(); i != tag.end(); ++i) {
+    if (!isalnum(static_cast<unsigned char>(*i)) && *i != '-' && *i != '_')
+      return true;
+  }
+  return false;
 }
 
-const Filename* TagsTable::FileGet(const string& file_str) {
+uint32 TagsTable::FileGet(const string& file_str) {
   Filename file(file_str.c_str(), strings_);
-  FileSet::const_iterator iter = fileset_->find(&file);
+  FileIdMap::const_iterator iter = file_ids_->find(&file);
 
-  if (iter != fileset_->end())
-    return *iter;
+  if (iter != file_ids_->end())
+    return iter->second;
 
   Filename* f = new Filename(file);
-  fileset_->insert(f);
-  return f;
+  uint32 id = files_->size();
+  files_->push_back(f);
+  loaded_files_->push_back(false);
+  file_languages_->push_back(0);
+  FileRows rows = { 0, 0 };
+  file_rows_->push_back(rows);
+  file_ids_->insert(make_pair(f, id));
+  return id;
 }
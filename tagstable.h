@@ -30,24 +30,58 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 #include <ext/hash_map>
 
+#include "column.h"
 #include "filename.h"
 #include "symboltable.h"
 #include "sexpression.h"
+#include "tagsreader.h"
+
+class RegExpCache;
+class RegexpAutomaton;
+class Snapshot;
+class TrigramIndex;
+class WorkerPool;
+
+// The declarations of a tags file, read by TagsTable::ReadUpdate but
+// not yet applied to a table.
+class TagsUpdate {
+ public:
+  TagsUpdate() {}
+  ~TagsUpdate();
+
+ private:
+  friend class TagsTable;
+
+  // The file's declarations, in file order.
+  vector<TagsEventBuffer*> batches_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TagsUpdate);
+};
 
 class TagsTable {
  public:
-  // Default constructor disables file-index.
-  TagsTable() : enable_fileindex_(false) {
-    Initialize();
+  // Creates an empty table. Scans are helped by the threads of
+  // SCAN_POOL, and compiled regexps are kept in REGEXPS; the table
+  // owns neither. If either is NULL, the table uses the one shared by
+  // all tables in the process, so that reloads and the tables of
+  // different handlers don't each start threads and compile regexps
+  // of their own.
+  explicit TagsTable(WorkerPool* scan_pool = NULL,
+                     RegExpCache* regexps = NULL) {
+    Initialize(scan_pool, regexps);
   }
 
-  // Conditionally enables file-index based on argument.
-  explicit TagsTable(bool enable_fileindex)
-      : enable_fileindex_(enable_fileindex) {
-    Initialize();
-  }
+  // Returns the pool shared by tables created without one, with
+  // --scan_threads threads counting the querying thread, or NULL if
+  // that is just one.
+  static WorkerPool* SharedScanPool();
+
+  // Returns the regexp cache shared by tables created without one,
+  // keeping --regexp_cache_size regexps.
+  static RegExpCache* SharedRegExpCache();
 
   virtual ~TagsTable();
 
@@ -60,9 +94,13 @@ class TagsTable {
     VARIABLE_DEFN,
     FUNCTION_DEFN
   };
+  static const int kNumTagTypes = FUNCTION_DEFN + 1;
 
   // Stores data associated with a single instance of a tag. Each item
-  // descriptor in a file has an associated TagsResult object.
+  // descriptor in a file has an associated tag in the table. Tags are
+  // stored in compact columnar form, and queries materialize them into
+  // TagsResult objects. The strings and Filename pointed to remain
+  // valid until the table is next changed.
   struct TagsResult {
     TagType type : 16;         // type of tag
     int charno;                // char offset of beginning of line
@@ -73,14 +111,61 @@ class TagsTable {
     const char* language;      // file language
   };
 
+  // Receives the results of a query one at a time, in order, so that
+  // they can be used as they are found rather than collected in a
+  // list first. RESULT is only valid during the call to Add.
+  //
+  // A sink may also leave results out. Queries ask Accepts about each
+  // match before they limit and rank the matches, so that the limits
+  // only count results the sink keeps. Accepts may be called on
+  // several threads at once.
+  class ResultSink {
+   public:
+    virtual ~ResultSink() {}
+    virtual void Add(const TagsResult& result) = 0;
+    virtual bool Accepts(const TagsResult& result) const {
+      return true;
+    }
+  };
+
   // Load the tag file from FILENAME. The file format is described at
-  // wiki/Nonconf/GTagsTagsFormat.
+  // wiki/Nonconf/GTagsTagsFormat. FILENAME may also be a snapshot
+  // written by WriteSnapshot, which is mapped instead of parsed.
+  // Returns false if FILENAME can't be read or is malformed, in which
+  // case the table may hold only part of it.
   bool ReloadTagFile(const string& filename, bool enable_gunzip);
 
   // Update the tag file from FILENAME. Only effects entries from files
-  // listed in the input file.
+  // listed in the input file. Returns false if FILENAME can't be read
+  // or is malformed, in which case only part of it may be applied.
   bool UpdateTagFile(const string& filename, bool enable_gunzip);
 
+  // UpdateTagFile in two steps. ReadUpdate reads and parses FILENAME,
+  // which is most of the work, into a new TagsUpdate without touching
+  // any table, so other threads may go on querying the table in the
+  // meantime, and returns NULL if FILENAME can't be read or is
+  // malformed. ApplyUpdate then applies UPDATE to the table; an update
+  // can only be applied once.
+  //
+  // If DEFER_REBUILD is set, ApplyUpdate only changes the rows and
+  // their indexes, and leaves the snippet index and the compaction of
+  // the strings to PrepareRebuild and FinishRebuild. Snippet searches
+  // scan every entry until then.
+  static TagsUpdate* ReadUpdate(const string& filename, bool enable_gunzip);
+  bool ApplyUpdate(TagsUpdate* update, bool defer_rebuild = false);
+
+  // The work left after a change which takes time in proportion to
+  // the whole table but only reads it: rebuilding the snippet index
+  // and compacting the strings. PrepareRebuild does it into a new
+  // Rebuild, or returns NULL if there is nothing to do, and may run
+  // alongside queries but not alongside changes. FinishRebuild then
+  // swaps REBUILD into the table, which is quick, and deletes it. If
+  // the table has changed since REBUILD was prepared, REBUILD is only
+  // deleted: the change has a rebuild of its own.
+  class Rebuild;
+  Rebuild* PrepareRebuild() const;
+  void FinishRebuild(Rebuild* rebuild);
+
   // Accessors to retrieve metadata for the tagsfile.
   const string& GetCommentString() const;
   time_t GetTagfileCreationTime() const;
@@ -88,37 +173,130 @@ class TagsTable {
 
   bool SearchCallersByDefault() const;
 
+  // Returns a number which changes whenever the contents of the table
+  // do, so that callers can tell whether results they kept are stale.
+  // No two tables ever have the same generation.
+  int64 generation() const {
+    return generation_;
+  }
+
+  // Returns the number of tags read since the table was last
+  // reloaded. May be called from other threads while the table is
+  // loading, to follow its progress.
+  int tags_loaded() const {
+    return tags_loaded_;
+  }
+
   // These functions are used to query the TagsTable. CURRENT_FILE, if
-  // not "", is used to rank the results. Each returns a newly
-  // allocated data structure.
+  // not "", is used to rank the results. If CALLERS is true only
+  // references (CALL entries) are searched, otherwise only
+  // definitions are. Each returns a newly allocated data structure,
+  // or passes the results to a ResultSink instead, which allocates
+  // nothing per result.
+  //
+  // RANKING, if not NULL, names the methods to rank results by, most
+  // important first:
+  //   directory-distance: results closer to CURRENT_FILE first
+  //   tag-type: type, then function, then variable definitions, and
+  //       generic ones last
+  //   language: results in the language of CURRENT_FILE first
+  // Other methods are ignored. Ranked queries return the best
+  // --max_ranked_results results; others return the first
+  // --max_results in tag order.
 
   // Return snippet matches
-  virtual list<const TagsResult*>* FindSnippetMatches(
+  virtual list<TagsResult>* FindSnippetMatches(
       const string& match, const string& current_file, bool callers,
       const list<string>* ranking) const;
+  void FindSnippetMatches(
+      const string& match, const string& current_file, bool callers,
+      const list<string>* ranking, ResultSink* sink) const;
   // Return regexp matches
-  virtual list<const TagsResult*>* FindRegexpTags(
+  virtual list<TagsResult>* FindRegexpTags(
       const string& tag, const string& current_file, bool callers,
       const list<string>* ranking) const;
+  void FindRegexpTags(
+      const string& tag, const string& current_file, bool callers,
+      const list<string>* ranking, ResultSink* sink) const;
   // Return matching tags
-  virtual list<const TagsResult*>* FindTags(
+  virtual list<TagsResult>* FindTags(
       const string& tag, const string& current_file, bool callers,
       const list<string>* ranking) const;
+  void FindTags(
+      const string& tag, const string& current_file, bool callers,
+      const list<string>* ranking, ResultSink* sink) const;
 
   // Return all tags in a particular file
-  list<const TagsResult*>* FindTagsByFile(const string& filename,
-                                          bool callers) const;
-  // Return all files that have the correct base name
+  list<TagsResult>* FindTagsByFile(const string& filename,
+                                   bool callers) const;
+  void FindTagsByFile(const string& filename, bool callers,
+                      ResultSink* sink) const;
+  // Return all files whose path ends with FILENAME: FILENAME is a
+  // basename such as "gtags.cc" or a path suffix such as
+  // "tags/gtags.cc". Its components may be glob patterns, as in
+  // "*.cc" or "tags/gtags*", each matching one component of the path.
   set<string>* FindFile(const string& filename) const;
 
   // Unload all files contained in dir.
   void UnloadFilesInDir(const string& dirname);
+
+  // Writes the table to FILENAME as a snapshot (see snapshot.h), which
+  // ReloadTagFile can map. Returns false if the file can't be written.
+  bool WriteSnapshot(const string& filename) const;
+
+  // Returns the number of distinct strings stored for tags, snippets,
+  // languages and file names.
+  int num_strings() const;
+
+  // Estimated memory used by each of the table's data structures, in
+  // bytes, and counts of what they hold. The mapped snapshot, if the
+  // table was loaded from one, is shared with any other process
+  // mapping it and is not part of the total.
+  struct MemoryStats {
+    int64 string_bytes;         // Tags, snippets, languages and paths
+    int64 tag_bytes;            // One row per tag
+    int64 index_bytes;          // Tags sorted by name
+    int64 snippet_index_bytes;  // Snippets by trigram (--snippet_index)
+    int64 file_bytes;           // File names and ids
+    int64 file_index_bytes;     // Tags by file
+    int64 find_file_bytes;      // Files by path suffix
+    int64 total_bytes;
+    int64 snapshot_bytes;
+
+    int strings;
+    int files;
+    int tags[kNumTagTypes];     // Tags of each TagType
+  };
+
+  // Fills in STATS. Takes time proportional to the number of tags.
+  void GetMemoryStats(MemoryStats* stats) const;
+
+  // Returns the number of tags currently indexed.
+  int size() const;
+  // Returns the number of callers (if CALLERS is true) or definitions
+  // currently indexed.
+  int size(bool callers) const;
  private:
   // Instantiates all needed members. Should be called only once, from
   // the constructor.
-  void Initialize();
+  void Initialize(WorkerPool* scan_pool, RegExpCache* regexps);
+
+  // Returns a generation no table has had yet.
+  static int64 NewGeneration();
 
  protected:
+  // A single tag, as it is stored in the columns of the table.
+  // Strings are ids in strings_ and FILE is an index into files_.
+  struct TagRow {
+    TagType type;
+    int charno;
+    int lineno;
+    uint32 tag;
+    uint32 linerep;
+    uint32 file;
+    uint32 language;
+  };
+
   // Clears all data structures and deallocates stored strings, in
   // preparation for destructor or loading a new TAGS file.
   virtual void FreeData();
@@ -127,75 +305,194 @@ class TagsTable {
   // wiki/Nonconf/GTagsTagsFormat.
   bool LoadTagFile(const string& filename, bool enable_gunzip);
 
-  // Unload all tags from the specified file.
-  virtual void UnloadFile(const Filename* filename);
+  // Clears the header data, which each tags file loaded sets anew.
+  void ResetHeaderData();
+
+  // Maps the snapshot FILENAME into the table, which must be empty.
+  // The columns and indexes are used in place until they are next
+  // modified; only the file indexes and file names are rebuilt.
+  // Returns false, leaving the table empty, if the snapshot can't be
+  // mapped or is inconsistent.
+  bool LoadSnapshot(const string& filename);
+
+  // Attaches the table to the contents of SNAPSHOT, for LoadSnapshot.
+  // Returns NULL, or what is wrong with SNAPSHOT if it is
+  // inconsistent.
+  const char* AttachSnapshot(const Snapshot& snapshot);
+
+  // Unload all tags from the file with id FILE. The file's rows are
+  // only marked as deleted; FreezeIndex must be called before the
+  // table is queried again.
+  virtual void UnloadFile(uint32 file);
+
+  // Drops deleted rows, merges each pending_index_ into the
+  // corresponding index_ and then does the rebuild (see
+  // PrepareRebuild). Called at the end of every operation that
+  // modifies the table.
+  void FreezeIndex();
+
+  // FreezeIndex without the rebuild. The snippet index is dropped
+  // until the next FinishRebuild.
+  void FreezeRows();
+
+  // Releases the memory that loading leaves unused at the end of the
+  // columns and indexes, which copies each of them.
+  void TrimStorage();
+
+  // Brings file_suffix_index_ up to date with the files loaded and
+  // unloaded since it was last frozen.
+  void FreezeFileIndex();
+
+  // Copies the strings and file names still in use into REBUILD,
+  // dropping those only used by tags and files which were unloaded.
+  // Files which aren't loaded lose their ids, so the file ids of rows
+  // change.
+  void CompactStrings(Rebuild* rebuild) const;
+
+  // Removes deleted rows from the columns, renumbering the remaining
+  // rows in every index and in file_rows_.
+  void CompactRows();
+
+  // Builds a snippet index of each index_ into SNIPPET_INDEX.
+  void BuildSnippetIndex(TrigramIndex* snippet_index[]) const;
+
+  // Appends ROW to the columns and returns its row number.
+  uint32 AppendRow(const TagRow& row);
+
+  // Materializes row ROW of the columns into RESULT.
+  void GetResult(uint32 row, TagsResult* result) const;
+
+  // Passes the materialized ROWS to SINK, in order.
+  void AddResults(const vector<uint32>& rows, ResultSink* sink) const;
+
+  // Returns whether SINK accepts the result in ROW.
+  bool Accepts(const ResultSink* sink, uint32 row) const;
+
+  // Scan ranges of an index for regexp and snippet searches, which
+  // run on several threads (see parallelscan.h).
+  friend class Rebuild;
+  class RegexpScanner;
+  friend class RegexpScanner;
+  class AutomatonScanner;
+  friend class AutomatonScanner;
+
+  // Rank the rows found by a query (see FindTags).
+  class RankingMethod;
+  class DirectoryDistanceRanking;
+  friend class DirectoryDistanceRanking;
+  class TagTypeRanking;
+  friend class TagTypeRanking;
+  class LanguageRanking;
+  friend class LanguageRanking;
+  class Ranker;
+  friend class Ranker;
+
+  // Number of index entries each thread scans at a time.
+  static const uint32 kScanChunkSize = 1 << 14;
+
+  // Returns the tag name of row ROW.
+  const char* TagOf(uint32 row) const {
+    return strings_->Lookup(columns_->tag[row]);
+  }
+
+  // Helpers for loading TAGS files:
 
-  // Helpers for parsing s-expression input from file:
+  // Receives the events of a TagsReader, in file order, and loads
+  // them into the table.
+  class Loader;
+  friend class Loader;
 
-  // CHECKs that SEXP is a valid (tags-format-version ...)
-  // declaration, and returns the version given.
+  // Returns the version given by SEXP if it is a valid
+  // (tags-format-version ...) declaration, or -1 if it isn't.
   int GetTagsFormatVersion(const SExpression* sexp);
   // If SEXP is a valid header declaration other than
-  // tags-format-version, parses it and updates the TagsTable.
-  void ParseHeaderDeclaration(const SExpression* sexp);
-  // If SEXP is a valid (file ...) declaration, parses it and updates
-  // the TagsTable.
-  void ParseFileDeclaration(const SExpression* sexp);
-  // Parses SEXP, which must be a valid (item ...) declaration. Returns
-  // a newly allocated TagsResult with the type, tag, snippet, lineno,
-  // and charno fields filled in. FILENAME should be the path to the file
-  // containing the item declaration. If SEXP does not represent a tag,
-  // returns NULL.
-  virtual TagsResult* ParseItemDeclaration(const SExpression* sexp,
-                                           const Filename* filename);
-  // Parses SEXP, which must be a valid item descriptor. Rreturns a newly
-  // allocated TagsResult with the type and tag fields filled in. FILENAME
-  // should be the path to the file containing the descriptor. If SEXP does
-  // not represent a tag, returns NULL.
-  virtual TagsResult* ParseDescriptorDeclaration(const SExpression* sexp,
-                                                 const Filename* filename);
-  // If SEXP is a valid (deleted ...) declaration, parses it and updates
-  // the TagsTable.
-  void ParseDeletedDeclaration(const SExpression* sexp);
-  // If sexp is of the form (ref (name "TAGNAME") (id ...)), returns
-  // the value of its NAME attribute as a string.
-  const string& GetTagNameFromRef(const SExpression* sexp) const;
-  // Returns true if SEXP is of the form (DECLTYPE (name value) ...).
-  //
-  // We frequently use s-expressions of this form to store
-  // attribute-value pairs attached to an entity (file, line, etc.)
-  bool IsDeclarationWithAlist(const SExpression* sexp,
-                              const string& decltype) const;
-  // Returns an iterator over the attributes of SEXP (everything
-  // except the first item). Returns a suffix of SEXP, so that the end
-  // of the list of attributes is still given by sexp->End().
-  SExpression::const_iterator GetAttributes(const SExpression* sexp) const;
+  // tags-format-version, parses it and updates the TagsTable. Returns
+  // false if it is malformed.
+  bool ParseHeaderDeclaration(const SExpression* sexp);
+  // Fills in the type, tag, linerep, lineno, and charno fields of ROW
+  // from ITEM. Returns false if ITEM has an unknown descriptor or no
+  // tag.
+  virtual bool ParseItem(const TagsItem& item, TagRow* row);
 
   // Returns true if a is a prefix of b
   bool IsPrefix(const string& a, const string& b) const;
 
   bool ContainsRegexpChar(const string& tag) const;
 
-  // Analagous to SymbolTable::Get; ensures that we only store each
-  // unique Filename once. Given a path FILE_STR, returns a pointer to
-  // a Filename inside fileset_ which represents the same
-  // path. Allocates a new Filename if necessary.
-  const Filename* FileGet(const string& file_str);
+  // Analagous to SymbolTable::GetId; ensures that we only store each
+  // unique Filename once. Given a path FILE_STR, returns the id of the
+  // Filename inside files_ which represents the same path. Allocates a
+  // new Filename if necessary.
+  uint32 FileGet(const string& file_str);
 
-  // Provide a string operator< for sorted string containers
-  class StrCompare {
-   public:
-    bool operator()(const char* s1, const char* s2) const {
-      return strcmp(s1, s2) < 0;
+  // Marks row ROW as deleted.
+  void DeleteRow(uint32 row) {
+    (*columns_->file.Mutable())[row] = kNoFile;
+    ++deleted_rows_;
+  }
+
+  // File id of rows which have been deleted.
+  static const uint32 kNoFile = ~0U;
+
+  // All tags, stored column-wise: row R of the table is made of
+  // element R of each array.
+  struct TagColumns {
+    Column<unsigned char> type;
+    Column<int> charno;
+    Column<int> lineno;
+    Column<uint32> tag;
+    Column<uint32> linerep;
+    Column<uint32> file;
+    Column<uint32> language;
+
+    uint32 size() const {
+      return file.size();
     }
+    // Copies row FROM over row TO.
+    void Move(uint32 from, uint32 to);
+    // Truncates the columns to N rows.
+    void Resize(uint32 n);
+    // Releases unused capacity.
+    void Trim();
+    // Empties the columns and releases their storage.
+    void Clear();
+    // Returns the number of bytes of memory the columns own.
+    int64 bytes_owned() const;
   };
 
-  // Provide a string operator== for hashed string containers
-  class StrEq {
+  // Orders rows (and tag names, for lookups) by tag name. Since all
+  // tags are interned in strings_, equal tags can be detected by id
+  // comparison before falling back to strcmp.
+  class IndexEntryLess {
    public:
-    bool operator()(const char* s1, const char* s2) const {
-      return !strcmp(s1, s2);
+    explicit IndexEntryLess(const TagsTable* table) : table_(table) { }
+
+    bool operator()(uint32 row1, uint32 row2) const {
+      const Column<uint32>& tags = table_->columns_->tag;
+      return tags[row1] != tags[row2]
+          && strcmp(table_->TagOf(row1), table_->TagOf(row2)) < 0;
     }
+    bool operator()(uint32 row, const char* tag) const {
+      return strcmp(table_->TagOf(row), tag) < 0;
+    }
+    bool operator()(const char* tag, uint32 row) const {
+      return strcmp(tag, table_->TagOf(row)) < 0;
+    }
+
+   private:
+    const TagsTable* table_;
+  };
+
+  // Orders files by their path components from the basename back,
+  // shorter paths first, for file_suffix_index_.
+  class FileSuffixLess {
+   public:
+    explicit FileSuffixLess(const TagsTable* table) : table_(table) { }
+
+    bool operator()(uint32 file1, uint32 file2) const;
+
+   private:
+    const TagsTable* table_;
   };
 
   // Provide Filename* operator== and hasher for hashed Filename*
@@ -204,10 +501,8 @@ class TagsTable {
   class FileHash {
    public:
     size_t operator()(const Filename* s1) const {
-      return hasher_(s1->Str().c_str());
+      return s1->hash();
     }
-   private:
-    hash<const char*> hasher_;
   };
 
   class FileEq {
@@ -218,32 +513,80 @@ class TagsTable {
   };
 
   // Map and set types for our data structures.
-  typedef hash_set<const Filename*, FileHash, FileEq> FileSet;
-  typedef multimap<const char*, const TagsResult*, StrCompare> TagMap;
-  typedef hash_map<const Filename*, vector<const TagsResult*>, FileHash, FileEq>
-    FileMap;
-  typedef hash_multimap<const char*, const Filename*, hash<const char*>, StrEq>
-    FindFileMap;
+  typedef hash_map<const Filename*, uint32, FileHash, FileEq> FileIdMap;
+  typedef Column<uint32> TagIndex;
+
+  // Definitions and callers are kept in separate indexes, since a
+  // query only ever asks for one of them.
+  enum IndexFamily {
+    DEFINITIONS,
+    CALLERS,
+    NUM_INDEX_FAMILIES
+  };
+
+  static IndexFamily FamilyOf(TagType type) {
+    return type == CALL ? CALLERS : DEFINITIONS;
+  }
 
-  // TODO(psung): Storing callers and non-callers in separate data
-  // structures might make lookups faster, since we never search for
-  // both and always have to filter one of them out.
+  static IndexFamily FamilyOf(bool callers) {
+    return callers ? CALLERS : DEFINITIONS;
+  }
+
+  // The rows of a file, which are always contiguous: a file's rows
+  // are appended together when it is loaded, and only ever deleted
+  // together.
+  struct FileRows {
+    uint32 first_row;
+    uint32 num_rows;
+  };
 
   // Store all the strings that we use here
   SymbolTable* strings_;
-  // Set of all filenames
-  FileSet* fileset_;
-  // Set of all currently indexed filenames
-  FileSet* loaded_files_;
-  // Index all tagged lines by tagname. This needs to be not hashed so
-  // we can do range queries when we're looking for prefixes.
-  TagMap* map_;
-  // Index all tagged lines by filename
-  FileMap* filemap_;
-  // Index all files by their basename
-  FindFileMap* findfilemap_;
-  // Allow searching for tags by filename. This can be a big space hit.
-  bool enable_fileindex_;
+  // All filenames, indexed by file id
+  vector<const Filename*>* files_;
+  // Map from filename to file id
+  FileIdMap* file_ids_;
+  // Whether each file id is currently indexed
+  vector<bool>* loaded_files_;
+  // Language id of each file id, as of when it was last loaded
+  vector<uint32>* file_languages_;
+  // All tagged lines
+  TagColumns* columns_;
+  // Number of rows in columns_ marked as deleted
+  int deleted_rows_;
+  // Number of rows removed since strings_ was last compacted
+  int64 removed_rows_;
+  // Set to a new value by every change to the contents of the table
+  int64 generation_;
+  // Number of tags read since the last reload
+  volatile int tags_loaded_;
+  // Index all tagged lines by tagname, one index per IndexFamily.
+  // Each is a contiguous array of rows sorted by tag (and by insertion
+  // order among equal tags) so we can binary search it and do range
+  // queries when we're looking for prefixes.
+  TagIndex* index_[NUM_INDEX_FAMILIES];
+  // Rows added since the last FreezeIndex, in insertion order.
+  vector<uint32>* pending_index_[NUM_INDEX_FAMILIES];
+  // Index of the snippets of each index_ by trigram, whose documents
+  // are positions in index_, or NULL if snippets aren't indexed.
+  TrigramIndex* snippet_index_[NUM_INDEX_FAMILIES];
+  // The rows of each file id. Files which are not loaded have none.
+  vector<FileRows>* file_rows_;
+  // Threads helping the querying thread scan the indexes, or NULL to
+  // scan on the querying thread only. Not owned.
+  WorkerPool* scan_pool_;
+  // Compiled regexps of recent queries. Not owned.
+  RegExpCache* regexps_;
+  // Snapshot the table was loaded from, or NULL
+  Snapshot* snapshot_;
+  // Ids of the loaded files, sorted by path from the last component
+  // back, so files with a common path suffix are adjacent.
+  vector<uint32>* file_suffix_index_;
+  // Files loaded since the last FreezeIndex, some of which may
+  // already be in file_suffix_index_.
+  vector<uint32>* pending_files_;
+  // Whether files were unloaded since the last FreezeIndex.
+  bool files_unloaded_;
 
   // Tagsfile metadata
   string tags_comment_;
@@ -16,24 +16,58 @@
 //
 // Author: psung@google.com (Phil Sung)
 
+#include <stdio.h>
+#include <unistd.h>
 #include <list>
 
 #include "gtagsunit.h"
 #include "tagstable.h"
 
+#include "snapshot.h"
+#include "strutil.h"
+
 #include "tagsoptionparser.h"
+#include "workerpool.h"
 
-DECLARE_BOOL(findfile);
+DECLARE_INT32(load_threads);
+DECLARE_INT32(max_ranked_results);
+DECLARE_INT32(max_results);
+DECLARE_BOOL(snippet_index);
+DECLARE_INT32(string_compaction_percent);
 
 namespace {
 
+// Returns the contents of FILENAME.
+string ReadFile(const string& filename) {
+  string contents;
+  FILE* file = fopen(filename.c_str(), "r");
+  CHECK(file != NULL) << "Could not open file " << filename;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, length);
+  fclose(file);
+  return contents;
+}
+
+// Deletes RESULTS and returns the files they are in, separated by
+// spaces.
+string FilesOf(list<TagsTable::TagsResult>* results) {
+  string files;
+  for (list<TagsTable::TagsResult>::const_iterator i = results->begin();
+       i != results->end(); ++i) {
+    if (!files.empty())
+      files.push_back(' ');
+    files.append(i->filename->Str());
+  }
+  delete results;
+  return files;
+}
+
 GTAGS_FIXTURE(TagsTableTest) {
  protected:
   GTAGS_FIXTURE_SETUP(TagsTableTest) {
-    // Turn findfile on so we can test it
-    GET_FLAG(findfile) = true;
-
-    tags_table = new TagsTable(true);
+    tags_table = new TagsTable();
 
     tags_table->ReloadTagFile(
         TEST_DATA_DIR + "/test_TAGS",
@@ -53,14 +87,14 @@ TEST_F(TagsTableTest, CallersByDefault) {
 
 TEST_F(TagsTableTest, UnloadFilesInDir) {
   // from tools/cpp/file3.h
-  list<const TagsTable::TagsResult*> * results1 =
+  list<TagsTable::TagsResult> * results1 =
       tags_table->FindTags("TagsReader", "", false, NULL);
   EXPECT_EQ(1, results1->size());
   // from tools/cpp/file4.h
-  list<const TagsTable::TagsResult*> * results2 =
+  list<TagsTable::TagsResult> * results2 =
       tags_table->FindTags("BetterTagsReader", "", false, NULL);
   EXPECT_EQ(1, results2->size());
-  list<const TagsTable::TagsResult*> * results3 =
+  list<TagsTable::TagsResult> * results3 =
       tags_table->FindTags("file_name", "", false, NULL);
   EXPECT_EQ(2, results3->size());
 
@@ -68,15 +102,15 @@ TEST_F(TagsTableTest, UnloadFilesInDir) {
   tags_table->UnloadFilesInDir("tools/cpp");
 
   // file_name is uneffected.
-  list<const TagsTable::TagsResult*> * results4 =
+  list<TagsTable::TagsResult> * results4 =
       tags_table->FindTags("file_name", "", false, NULL);
   EXPECT_EQ(2, results4->size());
 
   // tags from tools/cpp are gone.
-  list<const TagsTable::TagsResult*> * results5 =
+  list<TagsTable::TagsResult> * results5 =
       tags_table->FindTags("TagsReader", "", false, NULL);
   EXPECT_EQ(0, results5->size());
-  list<const TagsTable::TagsResult*> * results6 =
+  list<TagsTable::TagsResult> * results6 =
       tags_table->FindTags("BetterTagsReader", "", false, NULL);
   EXPECT_EQ(0, results6->size());
 
@@ -93,15 +127,15 @@ TEST_F(TagsTableTest, UpdateTagfile) {
   // Should have two file_name tag.
   // Should have one TagsReader tag.
   // Should have no file_test tag.
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results1 = tags_table->FindTags("TagsReader", "", false, NULL);
   EXPECT_EQ(1, results1->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results2 = tags_table->FindTags("file_name", "", false, NULL);
   EXPECT_EQ(2, results2->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results3 = tags_table->FindTags("file_test", "", false, NULL);
 
   EXPECT_EQ(0, results3->size());
@@ -114,16 +148,16 @@ TEST_F(TagsTableTest, UpdateTagfile) {
   // Should have only one file_name tag.
   // should have one TagsReader tag.
   // Should have one file_test tag.
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results4 = tags_table->FindTags("file_name", "", false, NULL);
   EXPECT_EQ(1, results4->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results5 = tags_table->FindTags("file_test", "", false, NULL);
 
   EXPECT_EQ(1, results5->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results6 = tags_table->FindTags("TagsReader", "", false, NULL);
   EXPECT_EQ(1, results6->size());
 
@@ -135,19 +169,508 @@ TEST_F(TagsTableTest, UpdateTagfile) {
   delete results6;
 }
 
+TEST_F(TagsTableTest, IndexOrderAfterUpdate) {
+  EXPECT_EQ(6, tags_table->size());
+
+  tags_table->UpdateTagFile(
+      TEST_DATA_DIR + "/test_update_TAGS",
+      false);
+
+  // file_size was dropped from file1.h, file2.h's file_name was
+  // replaced by file_name_1 and file_test is new.
+  EXPECT_EQ(6, tags_table->size());
+
+  // Results from the update must be merged into the index in tag
+  // order.
+  list<TagsTable::TagsResult> *
+    results = tags_table->FindRegexpTags("file", "", false, NULL);
+  ASSERT_EQ(3, results->size());
+
+  list<TagsTable::TagsResult>::const_iterator iter = results->begin();
+  EXPECT_STREQ("file_name", iter->tag);
+  EXPECT_EQ("tools/tags/file1.h", iter->filename->Str());
+  ++iter;
+  EXPECT_STREQ("file_name_1", iter->tag);
+  EXPECT_EQ("tools/util/file2.h", iter->filename->Str());
+  ++iter;
+  EXPECT_STREQ("file_test", iter->tag);
+  EXPECT_EQ("tools/util/file6.h", iter->filename->Str());
+
+  delete results;
+}
+
+// An update read ahead of time changes the table only once it is
+// applied, and then just as UpdateTagFile would.
+TEST_F(TagsTableTest, ReadAndApplyUpdate) {
+  TagsUpdate* update =
+      TagsTable::ReadUpdate(TEST_DATA_DIR + "/test_update_TAGS", false);
+
+  list<TagsTable::TagsResult> *
+      results = tags_table->FindTags("file_test", "", false, NULL);
+  EXPECT_EQ(0, results->size());
+  delete results;
+
+  EXPECT_TRUE(tags_table->ApplyUpdate(update));
+  delete update;
+
+  TagsTable updated_table;
+  updated_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  updated_table.UpdateTagFile(TEST_DATA_DIR + "/test_update_TAGS", false);
+
+  EXPECT_EQ(updated_table.size(), tags_table->size());
+  results = tags_table->FindTags("file_test", "", false, NULL);
+  EXPECT_EQ(1, results->size());
+  delete results;
+
+  list<TagsTable::TagsResult>* expected =
+      updated_table.FindRegexpTags("", "", false, NULL);
+  results = tags_table->FindRegexpTags("", "", false, NULL);
+  ASSERT_EQ(expected->size(), results->size());
+  list<TagsTable::TagsResult>::const_iterator i = results->begin();
+  list<TagsTable::TagsResult>::const_iterator j = expected->begin();
+  for (; i != results->end(); ++i, ++j) {
+    EXPECT_STREQ(j->tag, i->tag);
+    EXPECT_EQ(j->filename->Str(), i->filename->Str());
+  }
+  delete results;
+  delete expected;
+}
+
+// Files unloaded by an update lose their old tags, including files
+// loaded and deleted again by the same update, and the tags of the
+// files that are left can still be found by file.
+TEST(TagsTableUpdateTest, UnloadsFiles) {
+  TagsTable tags_table;
+  tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  tags_table.UpdateTagFile(TEST_DATA_DIR + "/test_deleting_update_TAGS",
+                           false);
+  EXPECT_EQ(4, tags_table.size());
+
+  EXPECT_EQ("tools/tags/file1.h",
+            FilesOf(tags_table.FindTags("file_name", "", false, NULL)));
+  EXPECT_EQ("", FilesOf(tags_table.FindTags("file_size", "", false, NULL)));
+  EXPECT_EQ("", FilesOf(tags_table.FindTags("file_test", "", false, NULL)));
+
+  list<TagsTable::TagsResult>* results =
+      tags_table.FindTags("TagsReader", "", false, NULL);
+  ASSERT_EQ(1, results->size());
+  EXPECT_EQ(26, results->front().lineno);
+  delete results;
+
+  results = tags_table.FindTagsByFile("tools/cpp/file3.h", false);
+  ASSERT_EQ(1, results->size());
+  EXPECT_STREQ("TagsReader", results->front().tag);
+  delete results;
+  EXPECT_EQ("tools/tags/file1.h",
+            FilesOf(tags_table.FindTagsByFile("tools/tags/file1.h", false)));
+
+  tags_table.UnloadFilesInDir("tools/cpp");
+  EXPECT_EQ(1, tags_table.size());
+  EXPECT_EQ("", FilesOf(tags_table.FindTagsByFile("tools/cpp/file3.h",
+                                                  false)));
+  EXPECT_EQ("tools/tags/file1.h",
+            FilesOf(tags_table.FindTagsByFile("tools/tags/file1.h", false)));
+}
+
+// Strings of unloaded tags are dropped once enough tags have been
+// unloaded, so a table updated over and over stays the same size.
+TEST(TagsTableUpdateTest, CompactsStrings) {
+  int old_compaction_percent = GET_FLAG(string_compaction_percent);
+  string update_file = GET_FLAG(test_tmpdir) + "/test_changing_TAGS";
+  for (int compact = 0; compact < 2; ++compact) {
+    GET_FLAG(string_compaction_percent) = compact ? 50 : 0;
+    TagsTable tags_table;
+    tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+    int initial_strings = tags_table.num_strings();
+
+    // Each update replaces file2.h with a new snippet, and deletes
+    // file3.h and loads it again.
+    for (int i = 0; i < 20; ++i) {
+      string snippet = "int changing_" + Int64ToString(i) + ";";
+      FILE* file = fopen(update_file.c_str(), "w");
+      ASSERT_TRUE(file != NULL);
+      fprintf(file,
+              "(tags-format-version 2)\n"
+              "(file (path \"tools/util/file2.h\") (language \"c++\")\n"
+              " (contents ((item (line 20) (offset 300)\n"
+              "  (descriptor (generic-tag (tag \"changing\")))\n"
+              "  (snippet \"%s\")))))\n"
+              "(deleted \"tools/cpp/file3.h\")\n"
+              "(deleted \"tools/cpp/file%d.h\")\n",
+              snippet.c_str(), 10 + i);
+      fclose(file);
+      tags_table.UpdateTagFile(update_file, false);
+
+      list<TagsTable::TagsResult>* results =
+          tags_table.FindTags("changing", "", false, NULL);
+      ASSERT_EQ(1, results->size());
+      EXPECT_EQ(snippet, results->front().linerep);
+      EXPECT_EQ("tools/util/file2.h", results->front().filename->Str());
+      delete results;
+    }
+
+    EXPECT_EQ(5, tags_table.size());
+    EXPECT_EQ("tools/tags/file1.h",
+              FilesOf(tags_table.FindTags("file_size", "", false, NULL)));
+    set<string>* files = tags_table.FindFile("file4.h");
+    EXPECT_EQ(1, files->size());
+    delete files;
+    files = tags_table.FindFile("file3.h");
+    EXPECT_EQ(0, files->size());
+    delete files;
+    list<TagsTable::TagsResult>* results =
+        tags_table.FindTagsByFile("tools/tags/file1.h", false);
+    EXPECT_EQ(2, results->size());
+    delete results;
+
+    if (compact)
+      EXPECT_TRUE(tags_table.num_strings() <= initial_strings + 2);
+    else
+      EXPECT_TRUE(tags_table.num_strings() >= initial_strings + 20);
+  }
+  GET_FLAG(string_compaction_percent) = old_compaction_percent;
+}
+
+// An update applied with a deferred rebuild is searchable at once,
+// and a rebuild prepared before a later change is dropped.
+TEST(TagsTableUpdateTest, DeferredRebuild) {
+  int old_compaction_percent = GET_FLAG(string_compaction_percent);
+  GET_FLAG(string_compaction_percent) = 1;
+  GET_FLAG(snippet_index) = true;
+  TagsTable tags_table;
+  tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  GET_FLAG(snippet_index) = false;
+  int initial_strings = tags_table.num_strings();
+
+  TagsUpdate* update =
+      TagsTable::ReadUpdate(TEST_DATA_DIR + "/test_update_TAGS", false);
+  EXPECT_TRUE(tags_table.ApplyUpdate(update, true));
+  delete update;
+  EXPECT_EQ("tools/util/file6.h",
+            FilesOf(tags_table.FindSnippetMatches("file_test", "", false,
+                                                  NULL)));
+
+  // The rebuild is stale once the table changes again.
+  TagsTable::Rebuild* rebuild = tags_table.PrepareRebuild();
+  ASSERT_TRUE(rebuild != NULL);
+  tags_table.UnloadFilesInDir("tools/cpp");
+  tags_table.FinishRebuild(rebuild);
+  EXPECT_EQ("tools/util/file6.h",
+            FilesOf(tags_table.FindSnippetMatches("file_test", "", false,
+                                                  NULL)));
+
+  GET_FLAG(snippet_index) = true;
+  update = TagsTable::ReadUpdate(TEST_DATA_DIR + "/test_update_TAGS", false);
+  EXPECT_TRUE(tags_table.ApplyUpdate(update, true));
+  delete update;
+  rebuild = tags_table.PrepareRebuild();
+  ASSERT_TRUE(rebuild != NULL);
+  tags_table.FinishRebuild(rebuild);
+  GET_FLAG(snippet_index) = false;
+  EXPECT_TRUE(tags_table.PrepareRebuild() == NULL);
+  EXPECT_TRUE(tags_table.num_strings() < initial_strings);
+
+  TagsTable expected_table;
+  expected_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  expected_table.UpdateTagFile(TEST_DATA_DIR + "/test_update_TAGS", false);
+  expected_table.UnloadFilesInDir("tools/cpp");
+  EXPECT_EQ(expected_table.size(), tags_table.size());
+  const char* snippets[] = { "file_(test|name)", "string", "." };
+  for (size_t i = 0; i < sizeof(snippets) / sizeof(snippets[0]); ++i) {
+    EXPECT_EQ(FilesOf(expected_table.FindSnippetMatches(snippets[i], "",
+                                                        false, NULL)),
+              FilesOf(tags_table.FindSnippetMatches(snippets[i], "", false,
+                                                    NULL)));
+  }
+  GET_FLAG(string_compaction_percent) = old_compaction_percent;
+}
+
+// Every structure is accounted for, and the file index costs a few
+// bytes per file.
+TEST(TagsTableMemoryTest, MemoryStats) {
+  TagsTable tags_table;
+  tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_mixed_TAGS", false);
+  TagsTable::MemoryStats stats;
+  tags_table.GetMemoryStats(&stats);
+
+  EXPECT_EQ(stats.string_bytes + stats.tag_bytes +
+            stats.index_bytes + stats.snippet_index_bytes +
+            stats.file_bytes + stats.file_index_bytes +
+            stats.find_file_bytes,
+            stats.total_bytes);
+  EXPECT_TRUE(stats.file_index_bytes > 0);
+  EXPECT_TRUE(stats.file_index_bytes < stats.file_bytes);
+
+  EXPECT_TRUE(stats.string_bytes > 0);
+  EXPECT_TRUE(stats.tag_bytes > 0);
+  EXPECT_TRUE(stats.index_bytes > 0);
+  EXPECT_TRUE(stats.file_bytes > 0);
+  EXPECT_TRUE(stats.find_file_bytes > 0);
+  EXPECT_EQ(0, stats.snapshot_bytes);
+  EXPECT_EQ(3, stats.tags[TagsTable::CALL]);
+  EXPECT_EQ(2, stats.tags[TagsTable::GENERIC_DEFN] +
+            stats.tags[TagsTable::TYPE_DEFN] +
+            stats.tags[TagsTable::VARIABLE_DEFN] +
+            stats.tags[TagsTable::FUNCTION_DEFN]);
+}
+
+// Definitions and callers loaded from the same file are kept apart.
+TEST(TagsTableMixedTest, DefinitionsAndCallers) {
+  TagsTable tags_table;
+  tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_mixed_TAGS", false);
+  EXPECT_FALSE(tags_table.SearchCallersByDefault());
+  EXPECT_EQ(2, tags_table.size(false));
+  EXPECT_EQ(3, tags_table.size(true));
+
+  list<TagsTable::TagsResult> * results =
+      tags_table.FindTags("file_size", "", false, NULL);
+  EXPECT_EQ(1, results->size());
+  EXPECT_STREQ("int file_size;", results->front().linerep);
+  delete results;
+
+  results = tags_table.FindTags("file_size", "", true, NULL);
+  EXPECT_EQ(2, results->size());
+  for (list<TagsTable::TagsResult>::const_iterator i =
+           results->begin(); i != results->end(); ++i) {
+    EXPECT_EQ(TagsTable::CALL, i->type);
+  }
+  delete results;
+
+  results = tags_table.FindSnippetMatches("file_", "", true, NULL);
+  EXPECT_EQ(3, results->size());
+  delete results;
+
+  results = tags_table.FindTagsByFile("tools/tags/file1.h", false);
+  EXPECT_EQ(2, results->size());
+  delete results;
+
+  results = tags_table.FindTagsByFile("tools/tags/file1.h", true);
+  EXPECT_EQ(1, results->size());
+  EXPECT_STREQ("return file_size;", results->front().linerep);
+  delete results;
+
+  tags_table.UnloadFilesInDir("tools/tags");
+  EXPECT_EQ(0, tags_table.size(false));
+  EXPECT_EQ(2, tags_table.size(true));
+}
+
+// Loading on several threads builds exactly the table a single
+// thread would, down to the string ids.
+TEST(TagsTableLoadTest, ThreadsAreDeterministic) {
+  int old_load_threads = GET_FLAG(load_threads);
+  string snapshot_file[2];
+  int threads[2] = { 1, 4 };
+  for (int i = 0; i < 2; ++i) {
+    GET_FLAG(load_threads) = threads[i];
+    TagsTable tags_table;
+    tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+    tags_table.UpdateTagFile(TEST_DATA_DIR + "/test_update_TAGS", false);
+    EXPECT_EQ(6, tags_table.size());
+
+    snapshot_file[i] = GET_FLAG(test_tmpdir) + "/test_TAGS.threads" +
+        static_cast<char>('0' + threads[i]);
+    ASSERT_TRUE(tags_table.WriteSnapshot(snapshot_file[i]));
+  }
+  GET_FLAG(load_threads) = old_load_threads;
+
+  EXPECT_TRUE(ReadFile(snapshot_file[0]) == ReadFile(snapshot_file[1]));
+}
+
+// A table mapped from a snapshot answers queries like the table that
+// wrote it, and can still be updated.
+TEST_F(TagsTableTest, Snapshot) {
+  string snapshot_file = GET_FLAG(test_tmpdir) + "/test_TAGS.snapshot";
+  ASSERT_TRUE(tags_table->WriteSnapshot(snapshot_file));
+
+  TagsTable snapshot_table;
+  ASSERT_TRUE(snapshot_table.ReloadTagFile(snapshot_file, false));
+  EXPECT_EQ(tags_table->size(false), snapshot_table.size(false));
+  EXPECT_EQ(tags_table->size(true), snapshot_table.size(true));
+  EXPECT_EQ(tags_table->SearchCallersByDefault(),
+            snapshot_table.SearchCallersByDefault());
+  EXPECT_EQ(tags_table->GetCorpusName(), snapshot_table.GetCorpusName());
+
+  list<TagsTable::TagsResult> * results =
+      snapshot_table.FindRegexpTags("file", "", false, NULL);
+  ASSERT_EQ(3, results->size());
+  EXPECT_STREQ("file_name", results->front().tag);
+  EXPECT_STREQ("string file_name;", results->front().linerep);
+  EXPECT_EQ("tools/tags/file1.h", results->front().filename->Str());
+  EXPECT_EQ(15, results->front().lineno);
+  EXPECT_EQ(200, results->front().charno);
+  EXPECT_STREQ("c++", results->front().language);
+  delete results;
+
+  results = snapshot_table.FindTagsByFile("tools/tags/file1.h", false);
+  EXPECT_EQ(2, results->size());
+  delete results;
+
+  set<string> * files = snapshot_table.FindFile("file2.h");
+  EXPECT_EQ(1, files->size());
+  delete files;
+
+  snapshot_table.UpdateTagFile(TEST_DATA_DIR + "/test_update_TAGS", false);
+  EXPECT_EQ(6, snapshot_table.size());
+  results = snapshot_table.FindRegexpTags("file", "", false, NULL);
+  ASSERT_EQ(3, results->size());
+  EXPECT_STREQ("file_test", results->back().tag);
+  EXPECT_EQ("tools/util/file6.h", results->back().filename->Str());
+  delete results;
+
+  // Snapshots are recognized by their contents only.
+  EXPECT_FALSE(Snapshot::IsSnapshot(TEST_DATA_DIR + "/test_TAGS"));
+  EXPECT_TRUE(Snapshot::IsSnapshot(snapshot_file));
+  remove(snapshot_file.c_str());
+}
+
+// Rewriting a snapshot replaces the file rather than writing over
+// it, so a table which has the old one mapped is unaffected.
+TEST_F(TagsTableTest, SnapshotRewrittenWhileMapped) {
+  string snapshot_file = GET_FLAG(test_tmpdir) + "/test_rewrite.snapshot";
+  ASSERT_TRUE(tags_table->WriteSnapshot(snapshot_file));
+  TagsTable snapshot_table;
+  ASSERT_TRUE(snapshot_table.ReloadTagFile(snapshot_file, false));
+
+  TagsTable ranking_table;
+  ranking_table.ReloadTagFile(TEST_DATA_DIR + "/test_ranking_TAGS", false);
+  ASSERT_TRUE(ranking_table.WriteSnapshot(snapshot_file));
+  EXPECT_NE(0, access((snapshot_file + ".tmp").c_str(), F_OK));
+
+  EXPECT_EQ("tools/tags/file1.h tools/util/file2.h",
+            FilesOf(snapshot_table.FindTags("file_name", "", false, NULL)));
+  TagsTable rewritten_table;
+  ASSERT_TRUE(rewritten_table.ReloadTagFile(snapshot_file, false));
+  EXPECT_EQ(5, rewritten_table.size());
+  remove(snapshot_file.c_str());
+}
+
+// Writes CONTENTS to FILENAME.
+void WriteFile(const string& filename, const string& contents) {
+  FILE* file = fopen(filename.c_str(), "w");
+  CHECK(file != NULL) << "Could not create file " << filename;
+  fwrite(contents.data(), 1, contents.size(), file);
+  fclose(file);
+}
+
+// Returns the header of the snapshot in CONTENTS, which can be
+// modified in place.
+SnapshotHeader* HeaderOf(string* contents) {
+  return reinterpret_cast<SnapshotHeader*>(&(*contents)[0]);
+}
+
+// Returns the first element of SECTION of the snapshot in CONTENTS.
+uint32* FirstOf(string* contents, SnapshotSection section) {
+  return reinterpret_cast<uint32*>(
+      &(*contents)[HeaderOf(contents)->sections[section].offset]);
+}
+
+// A corrupt snapshot fails the reload, whichever section is broken,
+// and leaves the table empty and usable.
+TEST_F(TagsTableTest, CorruptSnapshot) {
+  string snapshot_file = GET_FLAG(test_tmpdir) + "/test_corrupt.snapshot";
+  ASSERT_TRUE(tags_table->WriteSnapshot(snapshot_file));
+  const string good = ReadFile(snapshot_file);
+
+  for (int corruption = 0; corruption < 5; ++corruption) {
+    LOG(INFO) << "Corruption " << corruption;
+    string bad = good;
+    SnapshotHeader* header = HeaderOf(&bad);
+    switch (corruption) {
+      case 0:  // A column with fewer rows than the others
+        header->sections[SNAPSHOT_COLUMN_LINENO].size -= sizeof(uint32);
+        break;
+      case 1:  // A column which isn't a whole number of rows
+        header->sections[SNAPSHOT_COLUMN_TAG].size -= 1;
+        break;
+      case 2:  // A row in a file that doesn't exist
+        *FirstOf(&bad, SNAPSHOT_COLUMN_FILE) = 1000;
+        break;
+      case 3:  // An index entry past the last row
+        *FirstOf(&bad, SNAPSHOT_DEFINITIONS_INDEX) = 1000;
+        break;
+      case 4:  // A string page past the end of the pages
+        *FirstOf(&bad, SNAPSHOT_SYMBOL_PAGE_SIZES) = 1 << 30;
+        break;
+    }
+    WriteFile(snapshot_file, bad);
+
+    TagsTable snapshot_table;
+    EXPECT_FALSE(snapshot_table.ReloadTagFile(snapshot_file, false));
+    EXPECT_EQ(0, snapshot_table.size());
+    EXPECT_TRUE(snapshot_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS",
+                                             false));
+    EXPECT_EQ(tags_table->size(), snapshot_table.size());
+  }
+  remove(snapshot_file.c_str());
+}
+
+TEST(TagsTableRankingTest, Ranking) {
+  TagsTable tags_table;
+  tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_ranking_TAGS", false);
+  const string current_file = "app/server/main.cc";
+  list<string> ranking;
+
+  // Without ranking, results come in index order.
+  EXPECT_EQ("base/run.h app/server/run.py app/server/util.h "
+            "app/client/run.h app/server/main.cc",
+            FilesOf(tags_table.FindTags("Run", current_file, false, NULL)));
+
+  ranking.push_back("include-distance");
+  ranking.push_back("directory-distance");
+  EXPECT_EQ("app/server/run.py app/server/util.h app/server/main.cc "
+            "app/client/run.h base/run.h",
+            FilesOf(tags_table.FindTags("Run", current_file, false,
+                                        &ranking)));
+  // Distances need a current file.
+  EXPECT_EQ("base/run.h app/server/run.py app/server/util.h "
+            "app/client/run.h app/server/main.cc",
+            FilesOf(tags_table.FindTags("Run", "", false, &ranking)));
+
+  ranking.clear();
+  ranking.push_back("tag-type");
+  EXPECT_EQ("app/client/run.h app/server/run.py app/server/main.cc "
+            "app/server/util.h base/run.h",
+            FilesOf(tags_table.FindRegexpTags("Ru", "", false, &ranking)));
+
+  ranking.clear();
+  ranking.push_back("language");
+  ranking.push_back("directory-distance");
+  const string ranked = "app/server/util.h app/server/main.cc "
+      "app/client/run.h base/run.h app/server/run.py";
+  EXPECT_EQ(ranked, FilesOf(tags_table.FindSnippetMatches(
+      "Run", current_file, false, &ranking)));
+
+  // Snapshots know the languages of their files too.
+  string snapshot_file = GET_FLAG(test_tmpdir) + "/test_ranking_TAGS.snapshot";
+  ASSERT_TRUE(tags_table.WriteSnapshot(snapshot_file));
+  TagsTable snapshot_table;
+  ASSERT_TRUE(snapshot_table.ReloadTagFile(snapshot_file, false));
+  EXPECT_EQ(ranked, FilesOf(snapshot_table.FindRegexpTags(
+      "R.n", current_file, false, &ranking)));
+  remove(snapshot_file.c_str());
+
+  // Only the best results are returned.
+  int old_max_ranked_results = GET_FLAG(max_ranked_results);
+  GET_FLAG(max_ranked_results) = 2;
+  EXPECT_EQ("app/server/util.h app/server/main.cc",
+            FilesOf(tags_table.FindTags("Run", current_file, false,
+                                        &ranking)));
+  GET_FLAG(max_ranked_results) = old_max_ranked_results;
+}
+
 TEST_F(TagsTableTest, Regexp) {
   // We use static_cast<string>(...).c_str() throughout to force the
   // allocation of new strings, to make sure that we're doing string
   // comparison (not pointer comparison) in lookups.
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
     results1 = tags_table->FindRegexpTags(
         static_cast<string>("Tags").c_str(), "", false, NULL);
   // Should contain:
   //   file3.h : class TagsReader {
   EXPECT_EQ(1, results1->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
     results2 = tags_table->FindRegexpTags(
         static_cast<string>("file").c_str(), "", false, NULL);
   // Should contain:
@@ -156,12 +679,27 @@ TEST_F(TagsTableTest, Regexp) {
   //   file2.h : string file_name;
   EXPECT_EQ(3, results2->size());
 
+  // Patterns with a literal prefix, which skip most of the index, and
+  // without one.
+  list<TagsTable::TagsResult> *
+    results3 = tags_table->FindRegexpTags("file_.*", "", false, NULL);
+  EXPECT_EQ(3, results3->size());
+  list<TagsTable::TagsResult> *
+    results4 = tags_table->FindRegexpTags(".*_name", "", false, NULL);
+  EXPECT_EQ(2, results4->size());
+  list<TagsTable::TagsResult> *
+    results5 = tags_table->FindRegexpTags("file_x.*", "", false, NULL);
+  EXPECT_EQ(0, results5->size());
+
   delete results1;
   delete results2;
+  delete results3;
+  delete results4;
+  delete results5;
 }
 
 TEST_F(TagsTableTest, Snippet) {
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
     results1 = tags_table->FindSnippetMatches(
         static_cast<string>("Tags").c_str(), "", false, NULL);
   // Should contain:
@@ -169,7 +707,7 @@ TEST_F(TagsTableTest, Snippet) {
   //   file3.h : class BetterTagsReader : public TagsReader {
   EXPECT_EQ(2, results1->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
     results2 = tags_table->FindSnippetMatches(
         static_cast<string>(";").c_str(), "", false, NULL);
   // Should contain:
@@ -182,14 +720,54 @@ TEST_F(TagsTableTest, Snippet) {
   delete results2;
 }
 
+TEST_F(TagsTableTest, SnippetIndex) {
+  const char* matches[] = { "Tags", ";", "file_(size|name)", "^class", "." };
+  int expected[] = { 2, 3, 3, 2, 0 };
+  expected[4] = tags_table->size(false);
+
+  GET_FLAG(snippet_index) = true;
+  tags_table->ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  GET_FLAG(snippet_index) = false;
+
+  for (size_t i = 0; i < sizeof(matches) / sizeof(matches[0]); ++i) {
+    list<TagsTable::TagsResult>* results =
+        tags_table->FindSnippetMatches(matches[i], "", false, NULL);
+    EXPECT_EQ(expected[i], results->size());
+    delete results;
+  }
+}
+
+TEST_F(TagsTableTest, ParallelScans) {
+  WorkerPool scan_pool(3);
+  TagsTable parallel_table(&scan_pool);
+  parallel_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+
+  const char* regexps[] = { "file_.*", ".*_name", "(f|T).*", "\\(" };
+  for (size_t i = 0; i < sizeof(regexps) / sizeof(regexps[0]); ++i) {
+    list<TagsTable::TagsResult>* expected =
+        tags_table->FindRegexpTags(regexps[i], "", false, NULL);
+    list<TagsTable::TagsResult>* results =
+        parallel_table.FindRegexpTags(regexps[i], "", false, NULL);
+    EXPECT_EQ(expected->size(), results->size());
+    delete expected;
+    delete results;
+
+    expected = tags_table->FindSnippetMatches(regexps[i], "", false, NULL);
+    results = parallel_table.FindSnippetMatches(regexps[i], "", false, NULL);
+    EXPECT_EQ(expected->size(), results->size());
+    delete expected;
+    delete results;
+  }
+}
+
 TEST_F(TagsTableTest, Matching) {
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results1 = tags_table->FindTags("TagsReader", "", false, NULL);
   // Should contain:
   //   file3.h : class TagsReader {
   EXPECT_EQ(1, results1->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results2 = tags_table->FindTags(
           static_cast<string>("file_name").c_str(), "", false, NULL);
   // Should contain:
@@ -197,12 +775,12 @@ TEST_F(TagsTableTest, Matching) {
   //   file2.h : string file_name;
   EXPECT_EQ(2, results2->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results3 = tags_table->FindTags("file", "", false, NULL);
   // Should contain nothing
   EXPECT_EQ(0, results3->size());
 
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
       results4 = tags_table->FindTags("doSomething", "", false, NULL);
   // Should contain:
   //   file4.h : vector<int> doSomething(int q, string z) {
@@ -215,7 +793,7 @@ TEST_F(TagsTableTest, Matching) {
 }
 
 TEST_F(TagsTableTest, TagsInFile) {
-  list<const TagsTable::TagsResult*> *
+  list<TagsTable::TagsResult> *
     results = tags_table->FindTagsByFile(
         static_cast<string>("tools/tags/file1.h").c_str(),
         false);
@@ -233,10 +811,197 @@ TEST_F(TagsTableTest, FindFile) {
   EXPECT_EQ(1, results->size());
   EXPECT_EQ(*(results->begin()), "tools/util/file2.h");
   delete results;
+
+  results = tags_table->FindFile("nonexistent.h");
+  EXPECT_EQ(0, results->size());
+  delete results;
+  results = tags_table->FindFile("");
+  EXPECT_EQ(0, results->size());
+  delete results;
+}
+
+TEST_F(TagsTableTest, FindFileBySuffix) {
+  set<string>* results = tags_table->FindFile("util/file2.h");
+  EXPECT_EQ(1, results->size());
+  EXPECT_EQ("tools/util/file2.h", *results->begin());
+  delete results;
+
+  results = tags_table->FindFile("tools/util/file2.h");
+  EXPECT_EQ(1, results->size());
+  delete results;
+
+  // Suffixes match whole components only.
+  results = tags_table->FindFile("til/file2.h");
+  EXPECT_EQ(0, results->size());
+  delete results;
+  results = tags_table->FindFile("cpp/file2.h");
+  EXPECT_EQ(0, results->size());
+  delete results;
+  results = tags_table->FindFile("src/tools/util/file2.h");
+  EXPECT_EQ(0, results->size());
+  delete results;
+}
+
+TEST_F(TagsTableTest, FindFileByGlob) {
+  set<string>* results = tags_table->FindFile("*.h");
+  EXPECT_EQ(4, results->size());
+  delete results;
+
+  results = tags_table->FindFile("cpp/file?.h");
+  EXPECT_EQ(2, results->size());
+  EXPECT_EQ("tools/cpp/file3.h", *results->begin());
+  EXPECT_EQ("tools/cpp/file4.h", *results->rbegin());
+  delete results;
+
+  results = tags_table->FindFile("tools/*/file1.h");
+  EXPECT_EQ(1, results->size());
+  EXPECT_EQ("tools/tags/file1.h", *results->begin());
+  delete results;
+
+  results = tags_table->FindFile("file[12].h");
+  EXPECT_EQ(2, results->size());
+  delete results;
+
+  results = tags_table->FindFile("*/*/*/file1.h");
+  EXPECT_EQ(0, results->size());
+  delete results;
+}
+
+// Files leave the find-file index when they are unloaded, and a file
+// that is loaded again only appears once.
+TEST(TagsTableUpdateTest, FindFileAfterUpdate) {
+  TagsTable tags_table;
+  tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  TagsTable::MemoryStats before;
+  tags_table.GetMemoryStats(&before);
+  tags_table.UpdateTagFile(TEST_DATA_DIR + "/test_TAGS", false);
+  TagsTable::MemoryStats after;
+  tags_table.GetMemoryStats(&after);
+  EXPECT_EQ(before.find_file_bytes, after.find_file_bytes);
+
+  set<string>* results = tags_table.FindFile("*.h");
+  EXPECT_EQ(4, results->size());
+  delete results;
+
+  tags_table.UnloadFilesInDir("tools/cpp/");
+  results = tags_table.FindFile("*.h");
+  EXPECT_EQ(2, results->size());
+  delete results;
+  results = tags_table.FindFile("file3.h");
+  EXPECT_EQ(0, results->size());
+  delete results;
+}
+
+// Records the tags and files of the results it is given.
+class RecordingSink : public TagsTable::ResultSink {
+ public:
+  virtual void Add(const TagsTable::TagsResult& result) {
+    if (!results.empty())
+      results.push_back(' ');
+    results.append(result.tag);
+    results.push_back(':');
+    results.append(result.filename->Str());
+  }
+
+  string results;
+};
+
+// Returns the tags and files of RESULTS as RecordingSink would, and
+// deletes them.
+string Record(list<TagsTable::TagsResult>* results) {
+  RecordingSink sink;
+  for (list<TagsTable::TagsResult>::const_iterator i = results->begin();
+       i != results->end(); ++i) {
+    sink.Add(*i);
+  }
+  delete results;
+  return sink.results;
+}
+
+// A sink gets the same results, in the same order, as the list.
+TEST_F(TagsTableTest, ResultSink) {
+  RecordingSink exact;
+  tags_table->FindTags("file_name", "", false, NULL, &exact);
+  EXPECT_EQ("file_name:tools/tags/file1.h file_name:tools/util/file2.h",
+            exact.results);
+  EXPECT_EQ(exact.results,
+            Record(tags_table->FindTags("file_name", "", false, NULL)));
+
+  RecordingSink regexp;
+  tags_table->FindRegexpTags("file", "", false, NULL, &regexp);
+  EXPECT_EQ(Record(tags_table->FindRegexpTags("file", "", false, NULL)),
+            regexp.results);
+
+  RecordingSink snippets;
+  tags_table->FindSnippetMatches("TagsReader", "", false, NULL, &snippets);
+  EXPECT_EQ(Record(tags_table->FindSnippetMatches("TagsReader", "", false,
+                                                  NULL)),
+            snippets.results);
+
+  RecordingSink by_file;
+  tags_table->FindTagsByFile("tools/cpp/file3.h", false, &by_file);
+  EXPECT_EQ("TagsReader:tools/cpp/file3.h", by_file.results);
+
+  RecordingSink none;
+  tags_table->FindTags("no_such_tag", "", false, NULL, &none);
+  tags_table->FindTagsByFile("no/such/file.h", false, &none);
+  EXPECT_EQ("", none.results);
+}
+
+// Records only the results in one language.
+class LanguageSink : public RecordingSink {
+ public:
+  explicit LanguageSink(const string& language) : language_(language) {}
+
+  virtual bool Accepts(const TagsTable::TagsResult& result) const {
+    return language_ == result.language;
+  }
+
+ private:
+  string language_;
+};
+
+// Results the sink leaves out don't count towards the limits, so
+// they can't crowd out those it keeps.
+TEST(TagsTableFilterTest, SinkFiltersBeforeLimits) {
+  // 150 c++ files and then 3 python files each define Run.
+  TagsTable tags_table;
+  ASSERT_TRUE(tags_table.ReloadTagFile(TEST_DATA_DIR + "/test_run_TAGS",
+                                       false));
+
+  const string python = "Run:py/run150.py Run:py/run151.py Run:py/run152.py";
+  list<string> ranking;
+  ranking.push_back("tag-type");
+  ranking.push_back("directory-distance");
+
+  LanguageSink exact("python");
+  tags_table.FindTags("Run", "cc/main.h", false, &ranking, &exact);
+  EXPECT_EQ(python, exact.results);
+
+  LanguageSink prefix("python");
+  tags_table.FindRegexpTags("Ru", "cc/main.h", false, &ranking, &prefix);
+  EXPECT_EQ(python, prefix.results);
+
+  LanguageSink regexp("python");
+  tags_table.FindRegexpTags("R.n", "cc/main.h", false, &ranking, &regexp);
+  EXPECT_EQ(python, regexp.results);
+
+  LanguageSink snippets("python");
+  tags_table.FindSnippetMatches("Ru", "cc/main.h", false, &ranking,
+                                &snippets);
+  EXPECT_EQ(python, snippets.results);
+
+  // The first --max_results rows of unranked queries are all c++.
+  int old_max_results = GET_FLAG(max_results);
+  GET_FLAG(max_results) = 100;
+  LanguageSink unranked("python");
+  tags_table.FindTags("Run", "", false, NULL, &unranked);
+  EXPECT_EQ(python, unranked.results);
+  GET_FLAG(max_results) = old_max_results;
 }
 
 TEST_F(TagsTableTest, TagsResult) {
-  list<const TagsTable::TagsResult*> * results =
+  list<TagsTable::TagsResult> * results =
       tags_table->FindSnippetMatches(static_cast<string>("TagsReader").c_str(),
                                      "tools/cpp/file4.h", false, NULL);
   // Should contain:
@@ -244,12 +1009,12 @@ TEST_F(TagsTableTest, TagsResult) {
   //   file4.h : class BetterTagsReader : public TagsReader {
   EXPECT_EQ(2, results->size());
 
-  list<const TagsTable::TagsResult*>::const_iterator iter
+  list<TagsTable::TagsResult>::const_iterator iter
     = results->begin();
 
-  TagsTable::TagsResult result1 = **iter;
+  TagsTable::TagsResult result1 = *iter;
   ++iter;
-  TagsTable::TagsResult result2 = **iter;
+  TagsTable::TagsResult result2 = *iter;
 
   // current_file is file4.h so we should rank file4.h first
 
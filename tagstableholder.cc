@@ -0,0 +1,177 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include "tagstableholder.h"
+
+#include "tagstable.h"
+
+using gtags::MutexLock;
+
+TagsTableHolder::TagsTableHolder(TagsTable* table)
+    : loading_(NULL),
+      reload_gunzip_(false), reload_thread_(NULL) {
+  current_ = new SharedTable;
+  current_->table = table;
+  current_->references = 1;
+
+  status_.state = IDLE;
+  status_.start_time = 0;
+  status_.end_time = 0;
+  status_.tags_loaded = 0;
+}
+
+TagsTableHolder::~TagsTableHolder() {
+  WaitForReload();
+  CHECK_EQ(current_->references, 1) << "Table deleted while in use";
+  delete current_->table;
+  delete current_;
+}
+
+bool TagsTableHolder::StartReload(const string& filename,
+                                  bool enable_gunzip) {
+  gtags::Thread* finished_thread;
+  {
+    MutexLock lock(&mu_);
+    if (status_.state == LOADING)
+      return false;
+
+    status_.state = LOADING;
+    status_.filename = filename;
+    status_.start_time = time(NULL);
+    status_.end_time = 0;
+    status_.tags_loaded = 0;
+    reload_filename_ = filename;
+    reload_gunzip_ = enable_gunzip;
+
+    finished_thread = reload_thread_;
+    reload_thread_ = new gtags::ClosureThread(
+        gtags::CallbackFactory::CreatePermanent(
+            this, &TagsTableHolder::Reload));
+    reload_thread_->SetJoinable(true);
+    reload_thread_->Start();
+  }
+
+  // The thread of the previous reload is done with mu_, so it can be
+  // joined without holding it.
+  if (finished_thread != NULL) {
+    finished_thread->Join();
+    delete finished_thread;
+  }
+  return true;
+}
+
+bool TagsTableHolder::Update(const string& filename, bool enable_gunzip) {
+  SharedTable* table;
+  {
+    MutexLock lock(&mu_);
+    // The update will also be applied to the table being reloaded
+    // before it is swapped in.
+    if (status_.state == LOADING)
+      pending_updates_.push_back(make_pair(filename, enable_gunzip));
+    table = current_;
+    ++table->references;
+  }
+  bool updated = table->table->UpdateTagFile(filename, enable_gunzip);
+  Release(table);
+  return updated;
+}
+
+void TagsTableHolder::WaitForReload() {
+  gtags::Thread* thread;
+  {
+    MutexLock lock(&mu_);
+    thread = reload_thread_;
+    reload_thread_ = NULL;
+  }
+  if (thread != NULL) {
+    thread->Join();
+    delete thread;
+  }
+}
+
+void TagsTableHolder::GetReloadStatus(ReloadStatus* status) {
+  MutexLock lock(&mu_);
+  *status = status_;
+  if (loading_ != NULL)
+    status->tags_loaded = loading_->tags_loaded();
+}
+
+void TagsTableHolder::Reload() {
+  TagsTable* table = new TagsTable();
+  string filename;
+  bool enable_gunzip;
+  {
+    MutexLock lock(&mu_);
+    loading_ = table;
+    filename = reload_filename_;
+    enable_gunzip = reload_gunzip_;
+  }
+  bool loaded = table->ReloadTagFile(filename, enable_gunzip);
+
+  // Apply the updates that arrived during the load, until there are
+  // none left when we get the lock to swap the new table in.
+  SharedTable* replaced = NULL;
+  while (true) {
+    list<pair<string, bool> > updates;
+    {
+      MutexLock lock(&mu_);
+      if (pending_updates_.empty()) {
+        loading_ = NULL;
+        status_.state = loaded ? SUCCEEDED : FAILED;
+        status_.end_time = time(NULL);
+        status_.tags_loaded = table->tags_loaded();
+        if (loaded) {
+          replaced = current_;
+          current_ = new SharedTable;
+          current_->table = table;
+          current_->references = 1;
+          table = NULL;
+        }
+        break;
+      }
+      updates.swap(pending_updates_);
+    }
+    for (list<pair<string, bool> >::const_iterator i = updates.begin();
+         loaded && i != updates.end();
+         ++i) {
+      table->UpdateTagFile(i->first, i->second);
+    }
+  }
+
+  // Only set if the load failed.
+  delete table;
+  // Drop the holder's reference to the replaced table, which is
+  // deleted here unless queries are still using it.
+  if (replaced != NULL)
+    Release(replaced);
+}
+
+TagsTableHolder::SharedTable* TagsTableHolder::Acquire() {
+  MutexLock lock(&mu_);
+  ++current_->references;
+  return current_;
+}
+
+void TagsTableHolder::Release(SharedTable* table) {
+  {
+    MutexLock lock(&mu_);
+    if (--table->references > 0)
+      return;
+  }
+  delete table->table;
+  delete table;
+}
@@ -0,0 +1,165 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//
+// TagsTableHolder owns the TagsTable a server answers queries from,
+// and reloads it without interrupting them.
+//
+// A reload builds a new table on a thread of its own while queries
+// keep using the current one, then replaces the current table with it
+// in one step. Queries hold a Reference to the table they use, which
+// is counted, so a replaced table is only deleted once the last query
+// using it is done with it. Updates that arrive while a reload is in
+// progress are applied to both tables, so none is lost by the swap.
+//
+// Sample usage:
+//
+// TagsTableHolder holder(new TagsTable());
+// holder.StartReload("/path/to/TAGS", false);
+// ...
+// {
+//   TagsTableHolder::Reference table(&holder);
+//   MyResultSink sink;  // a TagsTable::ResultSink
+//   table->FindTags(tag, current_file, false, NULL, &sink);
+//   ...
+// }
+
+#ifndef TOOLS_TAGS_TAGSTABLEHOLDER_H__
+#define TOOLS_TAGS_TAGSTABLEHOLDER_H__
+
+#include <time.h>
+#include <list>
+#include <string>
+
+#include "mutex.h"
+#include "tagsutil.h"
+#include "thread.h"
+
+class TagsTable;
+
+class TagsTableHolder {
+ public:
+  // Serves TABLE, which the holder takes ownership of, until it is
+  // reloaded.
+  explicit TagsTableHolder(TagsTable* table);
+
+  // Waits for any reload in progress to finish. There must be no
+  // Reference left.
+  ~TagsTableHolder();
+
+ private:
+  // A table and the number of references to it.
+  struct SharedTable {
+    TagsTable* table;
+    int references;
+  };
+
+ public:
+  // Holds the current table for the lifetime of the object.
+  class Reference {
+   public:
+    explicit Reference(TagsTableHolder* holder)
+        : holder_(holder), table_(holder->Acquire()) {}
+
+    ~Reference() {
+      holder_->Release(table_);
+    }
+
+    TagsTable* get() const {
+      return table_->table;
+    }
+
+    TagsTable* operator->() const {
+      return table_->table;
+    }
+
+   private:
+    TagsTableHolder* holder_;
+    SharedTable* table_;
+
+    DISALLOW_EVIL_CONSTRUCTORS(Reference);
+  };
+
+  // Starts loading FILENAME, gunzipping it if ENABLE_GUNZIP is set,
+  // into a new table which replaces the current one once it is
+  // loaded. Returns false if a reload is already in progress.
+  bool StartReload(const string& filename, bool enable_gunzip);
+
+  // Updates the current table from FILENAME (see
+  // TagsTable::UpdateTagFile), and the table being reloaded if there
+  // is one.
+  bool Update(const string& filename, bool enable_gunzip);
+
+  // Waits until no reload is in progress.
+  void WaitForReload();
+
+  // What the last reload is doing or did.
+  enum ReloadState {
+    IDLE,       // No reload was started
+    LOADING,
+    SUCCEEDED,
+    FAILED
+  };
+
+  struct ReloadStatus {
+    ReloadState state;
+    string filename;
+    // When the reload started, and when it ended unless it is LOADING.
+    time_t start_time;
+    time_t end_time;
+    // Number of tags read so far.
+    int tags_loaded;
+  };
+
+  // Fills STATUS with the status of the last reload.
+  void GetReloadStatus(ReloadStatus* status);
+
+ private:
+  friend class Reference;
+
+  // Loads reload_filename_ into loading_ and swaps it in. Runs on the
+  // reload thread.
+  void Reload();
+
+  // Returns the current table with one more reference.
+  SharedTable* Acquire();
+
+  // Drops a reference to TABLE, deleting it if it isn't current and
+  // this was the last one.
+  void Release(SharedTable* table);
+
+  // Protects the members below.
+  gtags::Mutex mu_;
+  // The table queries are answered from. The holder holds a
+  // reference to it.
+  SharedTable* current_;
+  // The table being reloaded, or NULL.
+  TagsTable* loading_;
+  // Updates to apply to loading_ before it is swapped in, as (file,
+  // enable_gunzip) pairs.
+  list<pair<string, bool> > pending_updates_;
+  // The last reload, and its status.
+  string reload_filename_;
+  bool reload_gunzip_;
+  ReloadStatus status_;
+
+  // Runs Reload, or NULL if no reload was ever started.
+  gtags::Thread* reload_thread_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TagsTableHolder);
+};
+
+#endif  // TOOLS_TAGS_TAGSTABLEHOLDER_H__
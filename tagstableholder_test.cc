@@ -0,0 +1,119 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <stdio.h>
+
+#include "gtagsunit.h"
+#include "tagstableholder.h"
+
+#include "tagsoptionparser.h"
+#include "tagstable.h"
+
+namespace {
+
+TagsTable* LoadTable(const string& filename) {
+  TagsTable* table = new TagsTable();
+  CHECK(table->ReloadTagFile(filename, false));
+  return table;
+}
+
+TEST(TagsTableHolderTest, ReloadSwapsTables) {
+  TagsTableHolder holder(LoadTable(TEST_DATA_DIR + "/test_TAGS"));
+  TagsTableHolder::ReloadStatus status;
+  holder.GetReloadStatus(&status);
+  EXPECT_EQ(TagsTableHolder::IDLE, status.state);
+
+  TagsTableHolder::Reference old_table(&holder);
+  EXPECT_EQ(6, old_table->size());
+  EXPECT_TRUE(holder.StartReload(TEST_DATA_DIR + "/test_empty_TAGS", false));
+  holder.WaitForReload();
+
+  // The old table stays alive for as long as it is referenced.
+  TagsTableHolder::Reference new_table(&holder);
+  EXPECT_TRUE(old_table.get() != new_table.get());
+  EXPECT_EQ(6, old_table->size());
+  EXPECT_EQ(0, new_table->size());
+  EXPECT_TRUE(old_table->generation() != new_table->generation());
+
+  holder.GetReloadStatus(&status);
+  EXPECT_EQ(TagsTableHolder::SUCCEEDED, status.state);
+  EXPECT_EQ(TEST_DATA_DIR + "/test_empty_TAGS", status.filename);
+  EXPECT_EQ(0, status.tags_loaded);
+  EXPECT_TRUE(status.end_time >= status.start_time);
+}
+
+TEST(TagsTableHolderTest, FailedReloadKeepsTable) {
+  TagsTableHolder holder(LoadTable(TEST_DATA_DIR + "/test_TAGS"));
+  string missing = GET_FLAG(test_tmpdir) + "/no_such_TAGS";
+  EXPECT_TRUE(holder.StartReload(missing, false));
+  holder.WaitForReload();
+
+  TagsTableHolder::ReloadStatus status;
+  holder.GetReloadStatus(&status);
+  EXPECT_EQ(TagsTableHolder::FAILED, status.state);
+  EXPECT_EQ(missing, status.filename);
+  TagsTableHolder::Reference table(&holder);
+  EXPECT_EQ(6, table->size());
+}
+
+TEST(TagsTableHolderTest, MalformedReloadFails) {
+  TagsTableHolder holder(LoadTable(TEST_DATA_DIR + "/test_TAGS"));
+  string malformed = GET_FLAG(test_tmpdir) + "/malformed_TAGS";
+  FILE* file = fopen(malformed.c_str(), "w");
+  CHECK(file != NULL);
+  fputs("(tags-format-version 2)\n(file (path \"a.h\") (contents", file);
+  fclose(file);
+  EXPECT_TRUE(holder.StartReload(malformed, false));
+  holder.WaitForReload();
+
+  TagsTableHolder::ReloadStatus status;
+  holder.GetReloadStatus(&status);
+  EXPECT_EQ(TagsTableHolder::FAILED, status.state);
+  TagsTableHolder::Reference table(&holder);
+  EXPECT_EQ(6, table->size());
+}
+
+TEST(TagsTableHolderTest, UpdatesCurrentTable) {
+  TagsTableHolder holder(LoadTable(TEST_DATA_DIR + "/test_TAGS"));
+  EXPECT_TRUE(holder.StartReload(TEST_DATA_DIR + "/test_TAGS", false));
+  // Whether the update reaches the old table, the new one or both, it
+  // must end up in the table that is served.
+  EXPECT_TRUE(holder.Update(TEST_DATA_DIR + "/test_update_TAGS", false));
+  holder.WaitForReload();
+
+  TagsTableHolder::Reference table(&holder);
+  EXPECT_EQ(6, table->size());
+  list<TagsTable::TagsResult>* results =
+      table->FindTags("file_test", "", false, NULL);
+  EXPECT_EQ(1, results->size());
+  delete results;
+}
+
+TEST(TagsTableHolderTest, OneReloadAtATime) {
+  TagsTableHolder holder(LoadTable(TEST_DATA_DIR + "/test_TAGS"));
+  for (int i = 0; i < 3; ++i) {
+    if (holder.StartReload(TEST_DATA_DIR + "/test_TAGS", false)) {
+      TagsTableHolder::ReloadStatus status;
+      holder.GetReloadStatus(&status);
+      EXPECT_TRUE(status.state != TagsTableHolder::IDLE);
+    }
+  }
+  holder.WaitForReload();
+  EXPECT_TRUE(holder.StartReload(TEST_DATA_DIR + "/test_TAGS", false));
+}
+
+}  // namespace
@@ -65,6 +65,7 @@ CHECK ((a) >= (b))
 CHECK(strcmp(s1, s2) != 0)
 
 typedef long long int64;
+typedef unsigned int uint32;
 
 template<typename To, typename From>
 To down_cast(From * from) {
@@ -0,0 +1,516 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "trigramindex.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// Packs the three bytes at P into a trigram.
+inline uint32 Trigram(const char* p) {
+  return (static_cast<unsigned char>(p[0]) << 16)
+      | (static_cast<unsigned char>(p[1]) << 8)
+      | static_cast<unsigned char>(p[2]);
+}
+
+// Parses a POSIX extended regular expression just far enough to
+// find the literal strings that its matches must contain. Anything
+// it doesn't understand makes the whole query ALL, which is always
+// safe.
+class RegexpPlanner {
+ public:
+  explicit RegexpPlanner(const string& regexp)
+      : p_(regexp.data()), end_(regexp.data() + regexp.size()), ok_(true) {}
+
+  TrigramQuery Plan() {
+    TrigramQuery query = ParseAlternation();
+    if (!ok_ || p_ != end_)
+      return TrigramQuery();
+    return query;
+  }
+
+ private:
+  // alternation: branch ('|' branch)*
+  TrigramQuery ParseAlternation() {
+    TrigramQuery query = ParseBranch();
+    while (ok_ && p_ < end_ && *p_ == '|') {
+      ++p_;
+      query = TrigramQuery::Or(query, ParseBranch());
+    }
+    return query;
+  }
+
+  // branch: piece*
+  // RUN holds the literal characters matched by the pieces since the
+  // last one which wasn't a single literal character.
+  TrigramQuery ParseBranch() {
+    TrigramQuery query;
+    string run;
+    while (ok_ && p_ < end_ && *p_ != '|' && *p_ != ')')
+      ParsePiece(&query, &run);
+    return TrigramQuery::And(query, TrigramQuery::FromLiteral(run));
+  }
+
+  // piece: atom repetition*
+  void ParsePiece(TrigramQuery* query, string* run) {
+    char c = *p_++;
+    bool literal = false;
+    bool is_group = false;
+    TrigramQuery group;
+    switch (c) {
+      case '(':
+        group = ParseAlternation();
+        if (!ok_ || p_ == end_ || *p_ != ')') {
+          ok_ = false;
+          return;
+        }
+        ++p_;
+        is_group = true;
+        break;
+      case '[':
+        SkipBracketExpression();
+        break;
+      case '\\':
+        if (p_ == end_) {
+          ok_ = false;
+          return;
+        }
+        c = *p_++;
+        // An escaped letter or digit is a GNU extension such as \w, or
+        // a back-reference, and so are the word anchors \< \> \` \'.
+        literal = !isalnum(static_cast<unsigned char>(c)) &&
+                  strchr("<>`'", c) == NULL;
+        break;
+      case '.':
+      case '^':
+      case '$':
+        break;
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        // A repetition of nothing.
+        ok_ = false;
+        return;
+      default:
+        literal = true;
+        break;
+    }
+
+    bool required, once;
+    ParseRepetitions(&required, &once);
+    if (!ok_)
+      return;
+
+    if (literal && required) {
+      run->push_back(c);
+      if (once)
+        return;
+      // More copies of C may follow, so the run can't go on past
+      // them, but the last one starts the next run.
+      *query = TrigramQuery::And(*query, TrigramQuery::FromLiteral(*run));
+      run->assign(1, c);
+      return;
+    }
+
+    *query = TrigramQuery::And(*query, TrigramQuery::FromLiteral(*run));
+    run->clear();
+    if (is_group && required)
+      *query = TrigramQuery::And(*query, group);
+  }
+
+  // Reads the repetition operators after an atom. Sets REQUIRED if
+  // the atom must be matched at least once, and ONCE if it must be
+  // matched exactly once.
+  void ParseRepetitions(bool* required, bool* once) {
+    *required = true;
+    *once = true;
+    while (ok_ && p_ < end_) {
+      switch (*p_) {
+        case '*':
+        case '?':
+          *required = false;
+          *once = false;
+          break;
+        case '+':
+          *once = false;
+          break;
+        case '{': {
+          ++p_;
+          int min = ParseNumber();
+          int max = min;
+          if (ok_ && p_ < end_ && *p_ == ',') {
+            ++p_;
+            max = (p_ < end_ && isdigit(static_cast<unsigned char>(*p_)))
+                ? ParseNumber() : -1;
+          }
+          if (!ok_ || p_ == end_ || *p_ != '}') {
+            ok_ = false;
+            return;
+          }
+          if (min == 0)
+            *required = false;
+          if (min != 1 || max != 1)
+            *once = false;
+          break;
+        }
+        default:
+          return;
+      }
+      ++p_;
+    }
+  }
+
+  // Reads a decimal number, or clears ok_ if there is none.
+  int ParseNumber() {
+    if (p_ == end_ || !isdigit(static_cast<unsigned char>(*p_))) {
+      ok_ = false;
+      return 0;
+    }
+    int value = 0;
+    while (p_ < end_ && isdigit(static_cast<unsigned char>(*p_)) &&
+           value < 1000) {
+      value = value * 10 + (*p_++ - '0');
+    }
+    return value;
+  }
+
+  // Moves past a bracket expression, whose '[' has been read. A ']'
+  // right after the '[' or '[^' is a member, as is any ']' inside a
+  // [:class:], [=equivalence=] or [.collating.] element.
+  void SkipBracketExpression() {
+    if (p_ < end_ && *p_ == '^')
+      ++p_;
+    if (p_ < end_ && *p_ == ']')
+      ++p_;
+    while (p_ < end_ && *p_ != ']') {
+      if (*p_ == '[' && p_ + 1 < end_ &&
+          (p_[1] == ':' || p_[1] == '=' || p_[1] == '.')) {
+        char delimiter = p_[1];
+        p_ += 2;
+        while (p_ + 1 < end_ && !(p_[0] == delimiter && p_[1] == ']'))
+          ++p_;
+        if (p_ + 1 >= end_) {
+          ok_ = false;
+          return;
+        }
+        p_ += 2;
+      } else {
+        ++p_;
+      }
+    }
+    if (p_ == end_) {
+      ok_ = false;
+      return;
+    }
+    ++p_;
+  }
+
+  const char* p_;
+  const char* end_;
+  // Cleared when the expression can't be analyzed.
+  bool ok_;
+};
+
+// Appends the elements of QUERY to SUBQUERIES if QUERY is an OP
+// query, or QUERY itself otherwise.
+void Flatten(const TrigramQuery& query, TrigramQuery::Op op,
+             vector<TrigramQuery>* subqueries) {
+  if (query.op() == op) {
+    subqueries->insert(subqueries->end(), query.subqueries().begin(),
+                       query.subqueries().end());
+  } else {
+    subqueries->push_back(query);
+  }
+}
+
+// Appends VALUE to OUT as a varint: seven bits per byte, least
+// significant first, with the high bit set on all but the last.
+void AppendVarint(uint32 value, string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+}  // namespace
+
+// ***** TrigramQuery
+
+TrigramQuery TrigramQuery::FromRegexp(const string& regexp) {
+  return RegexpPlanner(regexp).Plan();
+}
+
+TrigramQuery TrigramQuery::FromLiteral(const string& literal) {
+  TrigramQuery query;
+  if (literal.size() < 3)
+    return query;
+
+  vector<uint32> trigrams;
+  for (string::size_type i = 0; i + 3 <= literal.size(); ++i)
+    trigrams.push_back(Trigram(literal.data() + i));
+  sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+  for (vector<uint32>::const_iterator i = trigrams.begin();
+       i != trigrams.end(); ++i) {
+    TrigramQuery trigram;
+    trigram.op_ = TRIGRAM;
+    trigram.trigram_ = *i;
+    query = And(query, trigram);
+  }
+  return query;
+}
+
+TrigramQuery TrigramQuery::And(const TrigramQuery& a, const TrigramQuery& b) {
+  if (a.op_ == ALL)
+    return b;
+  if (b.op_ == ALL)
+    return a;
+  TrigramQuery query;
+  query.op_ = AND;
+  Flatten(a, AND, &query.subqueries_);
+  Flatten(b, AND, &query.subqueries_);
+  return query;
+}
+
+TrigramQuery TrigramQuery::Or(const TrigramQuery& a, const TrigramQuery& b) {
+  if (a.op_ == ALL || b.op_ == ALL)
+    return TrigramQuery();
+  TrigramQuery query;
+  query.op_ = OR;
+  Flatten(a, OR, &query.subqueries_);
+  Flatten(b, OR, &query.subqueries_);
+  return query;
+}
+
+string TrigramQuery::ToString() const {
+  switch (op_) {
+    case ALL:
+      return "t";
+    case TRIGRAM: {
+      string str = "\"";
+      for (int shift = 16; shift >= 0; shift -= 8) {
+        char c = static_cast<char>((trigram_ >> shift) & 0xff);
+        if (c == '"' || c == '\\')
+          str.push_back('\\');
+        str.push_back(c);
+      }
+      return str + "\"";
+    }
+    case AND:
+    case OR: {
+      string str = op_ == AND ? "(and" : "(or";
+      for (vector<TrigramQuery>::const_iterator i = subqueries_.begin();
+           i != subqueries_.end(); ++i) {
+        str += " " + i->ToString();
+      }
+      return str + ")";
+    }
+  }
+  return "";
+}
+
+// ***** TrigramIndex
+
+TrigramIndex::TrigramIndex() : frozen_(false) {}
+
+void TrigramIndex::Add(uint32 doc, const char* text, int length) {
+  CHECK(!frozen_) << "Can't add to a frozen TrigramIndex";
+  if (length < 3)
+    return;
+
+  vector<uint32> trigrams;
+  trigrams.reserve(length - 2);
+  for (int i = 0; i + 3 <= length; ++i)
+    trigrams.push_back(Trigram(text + i));
+  sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+  for (vector<uint32>::const_iterator i = trigrams.begin();
+       i != trigrams.end(); ++i) {
+    pair<hash_map<uint32, int>::iterator, bool> slot =
+        slots_.insert(make_pair(*i, static_cast<int>(lists_.size())));
+    if (slot.second) {
+      lists_.push_back(string());
+      last_doc_.push_back(0);
+    }
+    int s = slot.first->second;
+    AppendVarint(doc - last_doc_[s], &lists_[s]);
+    last_doc_[s] = doc;
+  }
+}
+
+void TrigramIndex::Freeze() {
+  vector<pair<uint32, int> > order(slots_.begin(), slots_.end());
+  sort(order.begin(), order.end());
+
+  string::size_type total = 0;
+  for (vector<string>::const_iterator i = lists_.begin();
+       i != lists_.end(); ++i) {
+    total += i->size();
+  }
+  keys_.reserve(order.size());
+  starts_.reserve(order.size() + 1);
+  postings_.reserve(total);
+  for (vector<pair<uint32, int> >::const_iterator i = order.begin();
+       i != order.end(); ++i) {
+    keys_.push_back(i->first);
+    starts_.push_back(postings_.size());
+    postings_.append(lists_[i->second]);
+    // Release each list as soon as it is copied.
+    string().swap(lists_[i->second]);
+  }
+  starts_.push_back(postings_.size());
+
+  hash_map<uint32, int>().swap(slots_);
+  vector<string>().swap(lists_);
+  vector<uint32>().swap(last_doc_);
+  frozen_ = true;
+}
+
+void TrigramIndex::Clear() {
+  vector<uint32>().swap(keys_);
+  vector<uint32>().swap(starts_);
+  string().swap(postings_);
+  hash_map<uint32, int>().swap(slots_);
+  vector<string>().swap(lists_);
+  vector<uint32>().swap(last_doc_);
+  frozen_ = false;
+}
+
+bool TrigramIndex::Candidates(const TrigramQuery& query,
+                              vector<uint32>* docs) const {
+  CHECK(frozen_) << "TrigramIndex queried before Freeze";
+  docs->clear();
+  if (query.op() == TrigramQuery::ALL)
+    return false;
+  Evaluate(query, docs);
+  return true;
+}
+
+int64 TrigramIndex::bytes_used() const {
+  return (keys_.capacity() + starts_.capacity()) * sizeof(uint32)
+      + postings_.capacity();
+}
+
+void TrigramIndex::Lookup(uint32 trigram, vector<uint32>* docs) const {
+  docs->clear();
+  vector<uint32>::const_iterator key =
+      lower_bound(keys_.begin(), keys_.end(), trigram);
+  if (key == keys_.end() || *key != trigram)
+    return;
+
+  int i = key - keys_.begin();
+  const unsigned char* p =
+      reinterpret_cast<const unsigned char*>(postings_.data()) + starts_[i];
+  const unsigned char* end =
+      reinterpret_cast<const unsigned char*>(postings_.data()) + starts_[i + 1];
+  uint32 doc = 0;
+  while (p < end) {
+    uint32 delta = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+      delta |= (*p++ & 0x7f) << shift;
+      shift += 7;
+    }
+    delta |= *p++ << shift;
+    doc += delta;
+    docs->push_back(doc);
+  }
+}
+
+int TrigramIndex::PostingSize(uint32 trigram) const {
+  vector<uint32>::const_iterator key =
+      lower_bound(keys_.begin(), keys_.end(), trigram);
+  if (key == keys_.end() || *key != trigram)
+    return 0;
+  int i = key - keys_.begin();
+  return starts_[i + 1] - starts_[i];
+}
+
+namespace {
+
+// Orders the subqueries of an AND so that the cheapest come first:
+// trigrams by the size of their posting lists, then compound
+// queries.
+class CheaperFirst {
+ public:
+  explicit CheaperFirst(const vector<int>& costs) : costs_(costs) {}
+
+  bool operator()(int a, int b) const {
+    return costs_[a] < costs_[b];
+  }
+
+ private:
+  const vector<int>& costs_;
+};
+
+}  // namespace
+
+void TrigramIndex::Evaluate(const TrigramQuery& query,
+                            vector<uint32>* docs) const {
+  const vector<TrigramQuery>& subqueries = query.subqueries();
+  vector<uint32> subdocs, merged;
+  switch (query.op()) {
+    case TrigramQuery::ALL:
+      LOG(FATAL) << "Can't evaluate ALL";
+      break;
+    case TrigramQuery::TRIGRAM:
+      Lookup(query.trigram(), docs);
+      break;
+    case TrigramQuery::AND: {
+      // Start from the rarest trigram, so that the intersection is
+      // small from the start, and stop as soon as it is empty.
+      vector<int> costs, order;
+      for (size_t i = 0; i < subqueries.size(); ++i) {
+        costs.push_back(subqueries[i].op() == TrigramQuery::TRIGRAM
+                        ? PostingSize(subqueries[i].trigram()) : INT_MAX);
+        order.push_back(i);
+      }
+      stable_sort(order.begin(), order.end(), CheaperFirst(costs));
+      Evaluate(subqueries[order[0]], docs);
+      for (size_t i = 1; i < order.size() && !docs->empty(); ++i) {
+        Evaluate(subqueries[order[i]], &subdocs);
+        merged.clear();
+        set_intersection(docs->begin(), docs->end(),
+                         subdocs.begin(), subdocs.end(),
+                         back_inserter(merged));
+        docs->swap(merged);
+      }
+      break;
+    }
+    case TrigramQuery::OR:
+      docs->clear();
+      for (size_t i = 0; i < subqueries.size(); ++i) {
+        Evaluate(subqueries[i], &subdocs);
+        merged.clear();
+        set_union(docs->begin(), docs->end(),
+                  subdocs.begin(), subdocs.end(),
+                  back_inserter(merged));
+        docs->swap(merged);
+      }
+      break;
+  }
+}
@@ -0,0 +1,162 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// TrigramIndex maps each trigram (sequence of three bytes) to the
+// documents containing it, so that a regular expression search need
+// only run the regular expression on documents which contain the
+// trigrams every match must contain.
+//
+// TrigramQuery describes which trigrams a match must contain. It is
+// computed from a POSIX extended regular expression by looking for
+// the literal strings that any match must include; when there are
+// none, or the expression is too unusual to analyze, the query
+// matches every document and the caller must scan them all.
+//
+// Posting lists are stored as delta-encoded varints, back to back in
+// a single array, so an index costs a few bytes per trigram of each
+// document.
+//
+// Sample usage:
+//
+// TrigramIndex index;
+// for (uint32 doc = 0; doc < num_docs; ++doc)
+//   index.Add(doc, text[doc], strlen(text[doc]));
+// index.Freeze();
+//
+// vector<uint32> docs;
+// if (index.Candidates(TrigramQuery::FromRegexp("foo_?bar"), &docs)) {
+//   ... run the regular expression on each of DOCS ...
+// } else {
+//   ... run the regular expression on every document ...
+// }
+
+#ifndef TOOLS_TAGS_TRIGRAMINDEX_H__
+#define TOOLS_TAGS_TRIGRAMINDEX_H__
+
+#include <string>
+#include <vector>
+#include <ext/hash_map>
+
+#include "tagsutil.h"
+
+class TrigramQuery {
+ public:
+  enum Op {
+    ALL,      // Matches every document
+    TRIGRAM,  // Matches documents containing trigram
+    AND,      // Matches documents matching all subqueries
+    OR        // Matches documents matching any subquery
+  };
+
+  // Creates a query matching every document.
+  TrigramQuery() : op_(ALL), trigram_(0) {}
+
+  // Returns a query matching the documents which may contain a match
+  // of the POSIX extended regular expression REGEXP.
+  static TrigramQuery FromRegexp(const string& regexp);
+
+  // Returns a query matching the documents which contain every
+  // trigram of LITERAL.
+  static TrigramQuery FromLiteral(const string& literal);
+
+  // Returns the conjunction or disjunction of A and B, simplified so
+  // that ALL only ever appears alone.
+  static TrigramQuery And(const TrigramQuery& a, const TrigramQuery& b);
+  static TrigramQuery Or(const TrigramQuery& a, const TrigramQuery& b);
+
+  Op op() const {
+    return op_;
+  }
+
+  // For TRIGRAM queries, the three bytes packed big-endian.
+  uint32 trigram() const {
+    return trigram_;
+  }
+
+  // For AND and OR queries.
+  const vector<TrigramQuery>& subqueries() const {
+    return subqueries_;
+  }
+
+  // Returns the query as an s-expression, such as
+  // (and "foo" (or "bar" "baz")), or t for ALL.
+  string ToString() const;
+
+ private:
+  Op op_;
+  uint32 trigram_;
+  vector<TrigramQuery> subqueries_;
+};
+
+class TrigramIndex {
+ public:
+  TrigramIndex();
+
+  // Adds document DOC, made of the LENGTH bytes at TEXT. Documents
+  // must be added in increasing order.
+  void Add(uint32 doc, const char* text, int length);
+
+  // Packs the posting lists once all documents have been added. The
+  // index can only be queried once frozen, and can't be added to.
+  void Freeze();
+
+  // Empties the index and releases its storage.
+  void Clear();
+
+  // Stores the documents matching QUERY in DOCS, in increasing
+  // order, and returns true. Returns false without looking at the
+  // index if QUERY matches every document.
+  bool Candidates(const TrigramQuery& query, vector<uint32>* docs) const;
+
+  // Returns the number of distinct trigrams indexed.
+  int size() const {
+    return keys_.size();
+  }
+
+  // Returns the number of bytes used by the frozen index.
+  int64 bytes_used() const;
+
+ private:
+  // Stores the documents containing TRIGRAM in DOCS.
+  void Lookup(uint32 trigram, vector<uint32>* docs) const;
+
+  // Stores the documents matching QUERY, which is not ALL, in DOCS.
+  void Evaluate(const TrigramQuery& query, vector<uint32>* docs) const;
+
+  // Returns the number of bytes in the posting list of TRIGRAM, which
+  // is a cheap estimate of its length.
+  int PostingSize(uint32 trigram) const;
+
+  // Trigrams in increasing order, and where each one's posting list
+  // starts in postings_. The list of keys_[i] ends where that of
+  // keys_[i+1] starts.
+  vector<uint32> keys_;
+  vector<uint32> starts_;
+  string postings_;
+
+  // Posting lists under construction, and the last document added to
+  // each, indexed by slot.
+  hash_map<uint32, int> slots_;
+  vector<string> lists_;
+  vector<uint32> last_doc_;
+  bool frozen_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TrigramIndex);
+};
+
+#endif  // TOOLS_TAGS_TRIGRAMINDEX_H__
@@ -0,0 +1,165 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include <string.h>
+
+#include "gtagsunit.h"
+#include "trigramindex.h"
+
+#include "regexp.h"
+
+namespace {
+
+string Plan(const string& regexp) {
+  return TrigramQuery::FromRegexp(regexp).ToString();
+}
+
+TEST(TrigramQueryTest, Literals) {
+  EXPECT_EQ("t", Plan(""));
+  EXPECT_EQ("t", Plan("ab"));
+  EXPECT_EQ("\"abc\"", Plan("abc"));
+  EXPECT_EQ("(and \"abc\" \"bcd\")", Plan("abcd"));
+  // Each trigram is only required once.
+  EXPECT_EQ("(and \"aaa\" \"aab\")", Plan("aaaab"));
+  EXPECT_EQ("\"a.c\"", Plan("a\\.c"));
+  EXPECT_EQ("\"\\\"\\\\x\"", Plan("\"\\\\x"));
+}
+
+TEST(TrigramQueryTest, Operators) {
+  // Wildcards, classes and anchors split the literal.
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("^abc.def$"));
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abc[]x-z]def"));
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abc[[:alpha:]]def"));
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abc\\wdef"));
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abc\\<def"));
+  // Optional characters are left out.
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abcx?def"));
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abcx*def"));
+  EXPECT_EQ("(and \"abc\" \"def\")", Plan("abcx{0,2}def"));
+  // Repeated characters end one literal and start the next.
+  EXPECT_EQ("(and \"abx\" \"xcd\")", Plan("abx+cd"));
+  EXPECT_EQ("(and \"abx\" \"xcd\")", Plan("abx{2}cd"));
+  EXPECT_EQ("(and \"abx\" \"bxc\" \"xcd\")", Plan("abx{1}cd"));
+}
+
+TEST(TrigramQueryTest, Groups) {
+  EXPECT_EQ("(or \"foo\" \"bar\")", Plan("foo|bar"));
+  EXPECT_EQ("t", Plan("foo|ba"));
+  EXPECT_EQ("(and \"int\" \"nt \" (or \"foo\" \"bar\"))",
+            Plan("int (foo|bar)"));
+  EXPECT_EQ("(and \"foo\" \"bar\")", Plan("(foo)+bar"));
+  EXPECT_EQ("\"bar\"", Plan("(foo)?bar"));
+  EXPECT_EQ("\"bar\"", Plan("(foo|)bar"));
+}
+
+TEST(TrigramQueryTest, Unanalyzable) {
+  EXPECT_EQ("t", Plan("(foo"));
+  EXPECT_EQ("t", Plan("foo)"));
+  EXPECT_EQ("t", Plan("*foo"));
+  EXPECT_EQ("t", Plan("foo{2"));
+  EXPECT_EQ("t", Plan("foo[bar"));
+  EXPECT_EQ("t", Plan("foo\\"));
+}
+
+const char* kDocs[] = {
+  "int file_size;",
+  "string file_name;",
+  "class TagsReader {",
+  "class BetterTagsReader : public TagsReader {",
+  "  return TagsReader::Read(file_name);",
+  "x",
+  "",
+  "int foo(int bar);",
+};
+const int kNumDocs = sizeof(kDocs) / sizeof(kDocs[0]);
+
+GTAGS_FIXTURE(TrigramIndexTest) {
+ protected:
+  GTAGS_FIXTURE_SETUP(TrigramIndexTest) {
+    for (int i = 0; i < kNumDocs; ++i)
+      index.Add(i, kDocs[i], strlen(kDocs[i]));
+    index.Freeze();
+  }
+
+  // Returns the candidates for REGEXP, after checking that they
+  // include every document which matches it.
+  vector<uint32> Candidates(const string& regexp) {
+    vector<uint32> docs;
+    if (!index.Candidates(TrigramQuery::FromRegexp(regexp), &docs)) {
+      for (int i = 0; i < kNumDocs; ++i)
+        docs.push_back(i);
+    }
+    RegExp re(regexp);
+    for (int i = 0; i < kNumDocs; ++i) {
+      if (re.PartialMatch(kDocs[i]))
+        EXPECT_TRUE(find(docs.begin(), docs.end(), i) != docs.end());
+    }
+    return docs;
+  }
+
+  TrigramIndex index;
+};
+
+TEST_F(TrigramIndexTest, Candidates) {
+  vector<uint32> docs = Candidates("TagsReader");
+  ASSERT_EQ(3, docs.size());
+  EXPECT_EQ(2, docs[0]);
+  EXPECT_EQ(3, docs[1]);
+  EXPECT_EQ(4, docs[2]);
+
+  docs = Candidates("file_(size|name)");
+  ASSERT_EQ(3, docs.size());
+  EXPECT_EQ(0, docs[0]);
+  EXPECT_EQ(1, docs[1]);
+  EXPECT_EQ(4, docs[2]);
+
+  EXPECT_EQ(0, Candidates("nothing").size());
+  EXPECT_EQ(kNumDocs, Candidates("^x").size());
+}
+
+TEST_F(TrigramIndexTest, CandidatesIncludeMatches) {
+  const char* regexps[] = {
+    "int", "^int .*;$", "Tags?Reader", "(Better)?Tags", "file_[a-z]+;",
+    "class|return", "a{2,}", "Read(er)*", "\\(file", "[[:space:]]{2}",
+  };
+  for (size_t i = 0; i < sizeof(regexps) / sizeof(regexps[0]); ++i)
+    Candidates(regexps[i]);
+}
+
+TEST(TrigramIndexClearTest, Clear) {
+  TrigramIndex index;
+  index.Add(0, "abcd", 4);
+  index.Add(7, "xabc", 4);
+  index.Freeze();
+  EXPECT_EQ(3, index.size());
+
+  vector<uint32> docs;
+  ASSERT_TRUE(index.Candidates(TrigramQuery::FromLiteral("abc"), &docs));
+  ASSERT_EQ(2, docs.size());
+  EXPECT_EQ(7, docs[1]);
+
+  index.Clear();
+  EXPECT_EQ(0, index.size());
+  index.Add(300, "abc", 3);
+  index.Freeze();
+  ASSERT_TRUE(index.Candidates(TrigramQuery::FromLiteral("abc"), &docs));
+  ASSERT_EQ(1, docs.size());
+  EXPECT_EQ(300, docs[0]);
+}
+
+}  // namespace
@@ -0,0 +1,56 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "workerpool.h"
+
+namespace {
+
+// Closures which may be queued before Add blocks.
+const int kQueueCapacity = 1024;
+
+}  // namespace
+
+WorkerPool::WorkerPool(int num_threads) : queue_(kQueueCapacity) {
+  CHECK_GE(num_threads, 1);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.push_back(new gtags::ClosureThread(
+        gtags::CallbackFactory::CreatePermanent(this, &WorkerPool::Work)));
+    threads_.back()->SetJoinable(true);
+    threads_.back()->Start();
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  for (size_t i = 0; i < threads_.size(); ++i)
+    queue_.Put(NULL);
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i]->Join();
+    delete threads_[i];
+  }
+}
+
+void WorkerPool::Add(gtags::Closure* closure) {
+  CHECK(!closure->IsRepeatable()) << "WorkerPool closures run only once";
+  queue_.Put(closure);
+}
+
+void WorkerPool::Work() {
+  gtags::Closure* closure;
+  while ((closure = queue_.Get()) != NULL)
+    closure->Run();
+}
@@ -0,0 +1,66 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+//
+// WorkerPool runs closures on a fixed set of threads. Closures are
+// run in the order they are added, as soon as a thread is free.
+//
+// Sample usage:
+//
+// WorkerPool pool(4);
+// pool.Add(gtags::CallbackFactory::Create(&worker, &Worker::Work));
+// ...
+// // The destructor waits for the closures already added to finish.
+
+#ifndef TOOLS_TAGS_WORKERPOOL_H__
+#define TOOLS_TAGS_WORKERPOOL_H__
+
+#include <vector>
+
+#include "callback.h"
+#include "pcqueue.h"
+#include "tagsutil.h"
+#include "thread.h"
+
+class WorkerPool {
+ public:
+  // Starts NUM_THREADS threads.
+  explicit WorkerPool(int num_threads);
+
+  // Runs the closures already added, then stops the threads.
+  ~WorkerPool();
+
+  // Queues CLOSURE to be run once on one of the threads. CLOSURE must
+  // not be permanent: it is deleted once it has run.
+  void Add(gtags::Closure* closure);
+
+  // Returns the number of threads.
+  int size() const {
+    return threads_.size();
+  }
+
+ private:
+  // Runs queued closures until it gets NULL. Runs on each thread.
+  void Work();
+
+  gtags::ProducerConsumerQueue<gtags::Closure*> queue_;
+  vector<gtags::Thread*> threads_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(WorkerPool);
+};
+
+#endif  // TOOLS_TAGS_WORKERPOOL_H__
@@ -0,0 +1,56 @@
+// Copyright 2007 Google Inc. All Rights Reserved.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// Author: piaw@google.com (Piaw Na)
+
+#include "gtagsunit.h"
+#include "workerpool.h"
+
+#include "mutex.h"
+
+namespace {
+
+class Counter {
+ public:
+  Counter() : count_(0) {}
+
+  void Increment() {
+    gtags::MutexLock lock(&mu_);
+    ++count_;
+  }
+
+  int count() {
+    gtags::MutexLock lock(&mu_);
+    return count_;
+  }
+
+ private:
+  gtags::Mutex mu_;
+  int count_;
+};
+
+TEST(WorkerPoolTest, RunsEveryClosure) {
+  Counter counter;
+  {
+    WorkerPool pool(3);
+    EXPECT_EQ(3, pool.size());
+    for (int i = 0; i < 2000; ++i)
+      pool.Add(gtags::CallbackFactory::Create(&counter, &Counter::Increment));
+  }
+  EXPECT_EQ(2000, counter.count());
+}
+
+}  // namespace